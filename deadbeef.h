@@ -596,6 +596,46 @@ typedef struct ddb_file_found_data_s {
     const char *filename;
     int is_dir;
 } ddb_file_found_data_t;
+
+// playlist lock contention statistics, see pl_get_lock_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_lock_stats_t)
+    uint64_t lock_count; // number of times pl_lock was called, not counting nested calls
+    uint64_t contended_count; // number of times pl_lock had to wait for another thread
+    uint64_t wait_time_us; // total time spent waiting, in microseconds
+    uint64_t max_wait_time_us; // longest single wait, in microseconds
+    uint64_t read_lock_count; // number of times pl_lock_read was called, not counting nested calls
+    uint64_t read_contended_count; // number of times pl_lock_read had to wait for a writer
+} ddb_lock_stats_t;
+
+// one key of a multi-key sort, see plt_sort_v3
+typedef struct {
+    const char *format; // title formatting v2 script
+    int order; // DDB_SORT_ASCENDING or DDB_SORT_DESCENDING
+    int numeric; // compare the values as integers, instead of as text
+} ddb_sort_key_t;
+
+// compiled search query, see query_compile
+typedef struct ddb_query_s ddb_query_t;
+
+// read-ahead buffer state, see streamer_get_buffer_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_buffer_stats_t)
+    int fill_bytes; // decoded data waiting to be played
+    int fill_ms; // same, in milliseconds of the streaming track
+    int capacity_bytes; // current size of the read-ahead buffer
+    int target_ms; // read-ahead duration, grows after underruns
+    uint64_t underrun_count; // number of times the output ran out of data during playback
+} ddb_buffer_stats_t;
+
+// metadata string cache statistics, see metacache_get_stats
+typedef struct {
+    int _size; // must be set to sizeof(ddb_metacache_stats_t)
+    int n_strings; // number of unique strings in the cache
+    int n_buckets; // number of non-empty hash buckets
+    int hash_size; // total number of hash buckets
+    uint64_t slab_bytes; // memory allocated for small strings
+} ddb_metacache_stats_t;
 #endif
 
 // context for title formatting interpreter
@@ -975,6 +1015,8 @@ typedef struct {
 
     // direct access to metadata structures
     // not thread-safe, make sure to wrap with pl_lock/pl_unlock
+    // the list stays valid until a new field is added to the track;
+    // deleting a field with pl_delete_metadata doesn't affect the other nodes
     DB_metaInfo_t * (*pl_get_metadata_head) (DB_playItem_t *it); // returns head of metadata linked list
     void (*pl_delete_metadata) (DB_playItem_t *it, DB_metaInfo_t *meta);
 
@@ -1309,7 +1351,8 @@ typedef struct {
     // try loading external and embedded cuesheet, using the configured order (cue.prefer_embedded, default=0)
     DB_playItem_t * (*plt_process_cue) (ddb_playlist_t *plt, DB_playItem_t *after, DB_playItem_t *it, uint64_t numsamples, int samplerate);
 
-    // return direct-access metadata structure for the given track and key
+    // return direct-access metadata structure for the given track and key,
+    // the node of the pl_get_metadata_head list
     DB_metaInfo_t * (*pl_meta_for_key) (DB_playItem_t *it, const char *key);
 
     ////////////  Logging  ///////////
@@ -1412,6 +1455,60 @@ typedef struct {
 
     // get total playback time of selected tracks
     float (*plt_get_selection_playback_time) (ddb_playlist_t *plt);
+
+    // get pl_lock contention statistics, and reset the counters if `reset` is non-zero
+    // stats can be NULL, to only reset the counters;
+    // only the fields which fit in stats->_size bytes are filled
+    void (*pl_get_lock_stats) (ddb_lock_stats_t *stats, int reset);
+
+    // Sort the playlist by several keys at once, e.g. by album, then disc, then track.
+    // Tracks are ordered by the first key, tracks with equal first keys by the second, and so on;
+    // tracks which are equal by all keys keep their relative order.
+    // Text values are compared case-insensitively, numbers at the start of the text by value.
+    // Numeric keys are compared as integers, values which aren't numbers are less than any number.
+    // If the order of the first key is DDB_SORT_RANDOM, the playlist is shuffled.
+    // Returns -1 without sorting if a key format is NULL or fails to compile, 0 otherwise.
+    int (*plt_sort_v3) (ddb_playlist_t *plt, int iter, const ddb_sort_key_t *keys, int num_keys);
+
+    // same as plt_search_process2, but can be aborted from another thread by setting *pabort to non-zero;
+    // returns -1 if aborted, in which case the previous search results are kept, 0 otherwise.
+    // When the text extends the text of the previous search, only the previous results are rescanned.
+    // The playlist lock is released from time to time during the search, so other threads aren't blocked.
+    int (*plt_search_process3) (ddb_playlist_t *plt, const char *text, int select_results, int *pabort);
+
+    // Compile a search query, e.g. `artist HAS beatles AND date GREATER 1989 AND %length_seconds% > 300`.
+    // Conditions are `field op value`, where field is a metadata key or a title formatting script,
+    // and op is HAS, IS, EQUAL, GREATER, LESS, =, >, <, >=, <=, PRESENT or MISSING;
+    // they can be combined with AND, OR, NOT and parentheses. ALL matches every track.
+    // The search functions use queries automatically, and search the text as is when the query
+    // matches nothing; text without any condition, e.g. "NOT AFRAID", is not a query, and is compiled
+    // to match a substring of any field, the same way as the plain search does.
+    // The query must be freed with query_free.
+    ddb_query_t *(*query_compile) (const char *text);
+
+    // returns 1 if the track matches the query; plt can be NULL, it's only used by
+    // title formatting scripts, e.g. %list_index%
+    int (*query_match) (ddb_query_t *query, ddb_playlist_t *plt, DB_playItem_t *it);
+
+    void (*query_free) (ddb_query_t *query);
+
+    // Get the state of the read-ahead buffer, and reset the underrun counter if `reset` is non-zero.
+    // stats can be NULL, to only reset the counter; only the fields which fit in stats->_size bytes are filled.
+    // The read-ahead duration is set by the streamer.readahead_ms and streamer.readahead_ms_remote
+    // config options, for local files and network streams.
+    void (*streamer_get_buffer_stats) (ddb_buffer_stats_t *stats, int reset);
+
+    // Shared playlist lock, for code which only reads playlists, tracks and metadata,
+    // e.g. to draw a playlist. It can be held by several threads at once, while pl_lock
+    // waits until all of them release it. Calls can be nested; inside pl_lock, it's the same as pl_lock.
+    // Calling pl_lock while holding the shared lock releases the shared lock until the
+    // matching pl_unlock, so the pointers obtained before it must not be used afterwards.
+    void (*pl_lock_read) (void);
+    void (*pl_unlock_read) (void);
+
+    // Get the metadata string cache statistics; only the fields which fit in stats->_size bytes are filled.
+    // The average chain length of the hash table is n_strings / n_buckets.
+    void (*metacache_get_stats) (ddb_metacache_stats_t *stats);
 #endif
 } DB_functions_t;
 
@@ -139,13 +139,16 @@ dsp_clone (ddb_dsp_context_t *from) {
 
 void
 streamer_set_dsp_chain_real (ddb_dsp_context_t *chain) {
+    // the chain is used by the DSP thread under the streamer lock
+    streamer_lock ();
     dsp_chain_free (dsp_chain);
     dsp_chain = chain;
     eq = NULL;
     streamer_dsp_postinit ();
+    streamer_dsp_flush ();
+    streamer_unlock ();
 
     streamer_dsp_chain_save();
-    streamer_reset (1);
 
     messagepump_push (DB_EV_DSPCHAINCHANGED, 0, 0, 0);
 }
@@ -47,6 +47,7 @@ typedef struct handler_s {
     message_t *mqtail;
     uintptr_t mutex;
     uintptr_t cond;
+    int notified; // set by handler_notify, cleared by handler_wait
     message_t pool[1];
 } handler_t;
 
@@ -113,9 +114,21 @@ handler_push (handler_t *h, uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2
     return 0;
 }
 
+void
+handler_notify (handler_t *h) {
+    mutex_lock (h->mutex);
+    h->notified = 1;
+    mutex_unlock (h->mutex);
+    cond_signal (h->cond);
+}
+
 void
 handler_wait (handler_t *h) {
-    cond_wait (h->cond, h->mutex);
+    mutex_lock (h->mutex);
+    while (!h->mqueue && !h->notified) {
+        cond_wait_locked (h->cond, h->mutex);
+    }
+    h->notified = 0;
     mutex_unlock (h->mutex);
 }
 
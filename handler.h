@@ -44,6 +44,11 @@ handler_push (struct handler_s *h, uint32_t id, uintptr_t ctx, uint32_t p1, uint
 int
 handler_pop (struct handler_s *h, uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2);
 
+// Wakes up handler_wait without a message
+void
+handler_notify (struct handler_s *h);
+
+// Blocks until there's a message in the queue, or handler_notify was called since the last wait
 void
 handler_wait (struct handler_s *h);
 
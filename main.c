@@ -71,6 +71,7 @@
 #include "playqueue.h"
 #include "tf.h"
 #include "logger.h"
+#include "metacache.h"
 
 #ifndef PREFIX
 #error PREFIX must be defined
@@ -115,6 +116,8 @@ print_help (void) {
     fprintf (stdout, _("   --random           Random song in playlist\n"));
     fprintf (stdout, _("   --queue            Append file(s) to existing playlist\n"));
     fprintf (stdout, _("   --gui PLUGIN       Tells which GUI plugin to use, default is \"GTK2\"\n"));
+    fprintf (stdout, _("   --search QUERY     Select the tracks matching the text or query in the current playlist\n"));
+    fprintf (stdout, _("                      example: --search \"artist HAS beatles AND date GREATER 1989\"\n"));
     fprintf (stdout, _("   --nowplaying FMT   Print formatted track name to stdout\n"));
     fprintf (stdout, _("                      FMT %%-syntax: [a]rtist, [t]itle, al[b]um,\n"
                 "                      [l]ength, track[n]umber, [y]ear, [c]omment,\n"
@@ -274,6 +277,28 @@ server_exec_command_line (const char *cmdline, int len, char *sendback, int sbsi
                 return 1; // exit
             }
         }
+        else if (!strcmp (parg, "--search")) {
+            parg += strlen (parg);
+            parg++;
+            if (parg >= pend) {
+                const char *errtext = "--search expects query argument";
+                if (sendback) {
+                    snprintf (sendback, sbsize, "error %s\n", errtext);
+                    return 0;
+                }
+                else {
+                    trace_err ("%s\n", errtext);
+                    return -1;
+                }
+            }
+            playlist_t *plt = plt_get_curr ();
+            if (plt) {
+                plt_search_process2 (plt, parg, 1);
+                plt_unref (plt);
+                messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SELECTION, 0);
+            }
+            return 0;
+        }
         else if (!strcmp (parg, "--next")) {
             messagepump_push (DB_EV_NEXT, 0, 0, 0);
             return 0;
@@ -730,6 +755,10 @@ restore_resume_state (void) {
         int paused = conf_get_int ("resume.paused", 0);
         trace ("resume: track %d pos %f playlist %d\n", track, pos, plt);
         if (plt >= 0 && track >= 0 && pos >= 0) {
+            if (plt != conf_get_int ("playlist.current", 0)) {
+                // only the current playlist is guaranteed to be loaded
+                pl_load_all_wait ();
+            }
             streamer_set_current_playlist (plt);
             streamer_yield ();
             streamer_set_nextsong (track);
@@ -772,6 +801,7 @@ main_cleanup_and_quit (void) {
     }
 
     // save config
+    pl_load_all_wait ();
     pl_save_all ();
     conf_save ();
 
@@ -800,6 +830,8 @@ main_cleanup_and_quit (void) {
     messagepump_free ();
     trace ("plug_cleanup\n");
     plug_cleanup ();
+    trace ("metacache_free\n");
+    metacache_free ();
     trace ("logger_free\n");
 
     trace ("hej-hej!\n");
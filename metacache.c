@@ -26,48 +26,196 @@
 */
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "threading.h"
 #include "metacache.h"
 
+// NOTE: refcount and cmpidx must immediately precede str,
+// since plt_search_process2 accesses cmpidx as str[-1]
 typedef struct metacache_str_s {
     struct metacache_str_s *next;
     size_t value_length;
+    uint32_t hash;
     uint32_t refcount;
     char cmpidx; // positive means "equals", negative means "notequals"
     char str[1];
 } metacache_str_t;
 
+// The cache is split into independent stripes, selected by the top bits of the hash.
+// Each stripe has its own lock, hash table and string allocator,
+// so that threads adding metadata in parallel rarely wait for each other.
+#define STRIPE_BITS 4
+#define NUM_STRIPES (1<<STRIPE_BITS)
+#define INITIAL_HASH_SIZE 256
+
+// strings up to SLAB_CLASS_SIZE*NUM_SLAB_CLASSES bytes (including the header)
+// are allocated from slabs, bigger ones are malloc'd individually
+#define SLAB_SIZE 65536
+#define SLAB_CLASS_SIZE 16
+#define NUM_SLAB_CLASSES 16
+
+typedef struct metacache_slab_s {
+    struct metacache_slab_s *next;
+    size_t pad; // keeps data 16-byte aligned
+    char data[];
+} metacache_slab_t;
+
 typedef struct {
-//    uint32_t hash;
-    metacache_str_t *chain;
-} metacache_hash_t;
+    uintptr_t mutex;
+    metacache_str_t **hash;
+    uint32_t hash_size; // power of 2
+    int n_strings;
+    int n_buckets; // non-empty buckets
+    metacache_str_t *free_nodes[NUM_SLAB_CLASSES];
+    metacache_slab_t *slabs;
+    size_t slab_used;
+    size_t slab_bytes;
+} metacache_stripe_t;
 
-#define HASH_SIZE 4096
+static metacache_stripe_t stripes[NUM_STRIPES];
 
-static metacache_hash_t hash[HASH_SIZE];
+static inline uint32_t
+rotl32 (uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
 
+// MurmurHash3 x86_32 (public domain)
 static uint32_t
-metacache_get_hash_sdbm (const char *str, size_t len) {
-    uint32_t hash = 0;
-    int c;
+metacache_get_hash (const char *str, size_t len) {
+    const uint8_t *data = (const uint8_t *)str;
+    const size_t nblocks = len / 4;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
+    uint32_t h = 0x9747b28c;
 
-    const char *end = str+len;
+    for (size_t i = 0; i < nblocks; i++) {
+        uint32_t k;
+        memcpy (&k, data + i * 4, 4);
+        k *= c1;
+        k = rotl32 (k, 15);
+        k *= c2;
+        h ^= k;
+        h = rotl32 (h, 13);
+        h = h * 5 + 0xe6546b64;
+    }
 
-    while (str < end) {
-        c = *str++;
-        hash = c + (hash << 6) + (hash << 16) - hash;
+    const uint8_t *tail = data + nblocks * 4;
+    uint32_t k = 0;
+    switch (len & 3) {
+    case 3:
+        k ^= (uint32_t)tail[2] << 16;
+    case 2:
+        k ^= (uint32_t)tail[1] << 8;
+    case 1:
+        k ^= tail[0];
+        k *= c1;
+        k = rotl32 (k, 15);
+        k *= c2;
+        h ^= k;
     }
 
-    return hash;
+    h ^= (uint32_t)len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline metacache_stripe_t *
+metacache_stripe_for_hash (uint32_t h) {
+    return &stripes[h >> (32 - STRIPE_BITS)];
+}
+
+static inline metacache_str_t *
+metacache_str_for_value (const char *str) {
+    return (metacache_str_t *)(str - offsetof (metacache_str_t, str));
+}
+
+static inline int
+metacache_slab_class (size_t len) {
+    size_t size = offsetof (metacache_str_t, str) + len;
+    return (int)((size + SLAB_CLASS_SIZE - 1) / SLAB_CLASS_SIZE) - 1;
 }
 
 static metacache_str_t *
-metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
-    metacache_hash_t *bucket = &hash[h];
-    metacache_str_t *chain = bucket->chain;
+metacache_alloc_str (metacache_stripe_t *s, size_t len) {
+    size_t size = offsetof (metacache_str_t, str) + len;
+    int cls = metacache_slab_class (len);
+    if (cls >= NUM_SLAB_CLASSES) {
+        return malloc (size);
+    }
+
+    metacache_str_t *data = s->free_nodes[cls];
+    if (data) {
+        s->free_nodes[cls] = data->next;
+        return data;
+    }
+
+    size = (cls + 1) * SLAB_CLASS_SIZE;
+    if (!s->slabs || s->slab_used + size > SLAB_SIZE) {
+        metacache_slab_t *slab = malloc (sizeof (metacache_slab_t) + SLAB_SIZE);
+        if (!slab) {
+            return NULL;
+        }
+        slab->next = s->slabs;
+        s->slabs = slab;
+        s->slab_used = 0;
+        s->slab_bytes += SLAB_SIZE;
+    }
+    data = (metacache_str_t *)(s->slabs->data + s->slab_used);
+    s->slab_used += size;
+    return data;
+}
+
+static void
+metacache_free_str (metacache_stripe_t *s, metacache_str_t *data) {
+    int cls = metacache_slab_class (data->value_length);
+    if (cls >= NUM_SLAB_CLASSES) {
+        free (data);
+        return;
+    }
+    data->next = s->free_nodes[cls];
+    s->free_nodes[cls] = data;
+}
+
+static void
+metacache_grow (metacache_stripe_t *s) {
+    uint32_t size = s->hash_size ? s->hash_size * 2 : INITIAL_HASH_SIZE;
+    metacache_str_t **hash = calloc (size, sizeof (metacache_str_t *));
+    if (!hash) {
+        return; // keep using the old table, with longer chains
+    }
+    int n_buckets = 0;
+    for (uint32_t i = 0; i < s->hash_size; i++) {
+        metacache_str_t *next;
+        for (metacache_str_t *data = s->hash[i]; data; data = next) {
+            next = data->next;
+            metacache_str_t **bucket = &hash[data->hash & (size-1)];
+            if (!*bucket) {
+                n_buckets++;
+            }
+            data->next = *bucket;
+            *bucket = data;
+        }
+    }
+    free (s->hash);
+    s->hash = hash;
+    s->hash_size = size;
+    s->n_buckets = n_buckets;
+}
+
+static metacache_str_t *
+metacache_find_in_bucket (metacache_stripe_t *s, uint32_t h, const char *value, size_t len) {
+    if (!s->hash_size) {
+        return NULL;
+    }
+    metacache_str_t *chain = s->hash[h & (s->hash_size-1)];
     while (chain) {
-        if (chain->value_length == len && !memcmp (chain->str, value, len)) {
+        if (chain->hash == h && chain->value_length == len && !memcmp (chain->str, value, len)) {
             return chain;
         }
         chain = chain->next;
@@ -75,32 +223,73 @@ metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
     return NULL;
 }
 
-static int n_strings = 0;
-static int n_inserts = 0;
-static int n_buckets = 0;
+void
+metacache_init (void) {
+    for (int i = 0; i < NUM_STRIPES; i++) {
+        if (!stripes[i].mutex) {
+            stripes[i].mutex = mutex_create_nonrecursive ();
+        }
+    }
+}
+
+void
+metacache_free (void) {
+    for (int i = 0; i < NUM_STRIPES; i++) {
+        metacache_stripe_t *s = &stripes[i];
+        for (uint32_t b = 0; b < s->hash_size; b++) {
+            metacache_str_t *next;
+            for (metacache_str_t *data = s->hash[b]; data; data = next) {
+                next = data->next;
+                if (metacache_slab_class (data->value_length) >= NUM_SLAB_CLASSES) {
+                    free (data);
+                }
+            }
+        }
+        free (s->hash);
+        while (s->slabs) {
+            metacache_slab_t *next = s->slabs->next;
+            free (s->slabs);
+            s->slabs = next;
+        }
+        if (s->mutex) {
+            mutex_free (s->mutex);
+        }
+        memset (s, 0, sizeof (metacache_stripe_t));
+    }
+}
 
 const char *
 metacache_add_value (const char *value, size_t len) {
-    //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
-    n_inserts++;
+    uint32_t h = metacache_get_hash (value, len);
+    metacache_stripe_t *s = metacache_stripe_for_hash (h);
+    mutex_lock (s->mutex);
+    metacache_str_t *data = metacache_find_in_bucket (s, h, value, len);
     if (data) {
-        data->refcount++;
+        __atomic_add_fetch (&data->refcount, 1, __ATOMIC_RELAXED);
+        mutex_unlock (s->mutex);
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    if (!bucket->chain) {
-        n_buckets++;
+    if (s->n_strings >= s->hash_size) {
+        metacache_grow (s);
+    }
+    data = metacache_alloc_str (s, len);
+    if (!data) {
+        mutex_unlock (s->mutex);
+        return NULL;
+    }
+    metacache_str_t **bucket = &s->hash[h & (s->hash_size-1)];
+    if (!*bucket) {
+        s->n_buckets++;
     }
-    data = malloc (sizeof (metacache_str_t) + len);
-    memset (data, 0, sizeof (metacache_str_t) + len);
+    data->hash = h;
     data->refcount = 1;
+    data->cmpidx = 0;
     memcpy (data->str, value, len);
     data->value_length = len;
-    data->next = bucket->chain;
-    bucket->chain = data;
-    n_strings++;
+    data->next = *bucket;
+    *bucket = data;
+    s->n_strings++;
+    mutex_unlock (s->mutex);
     return data->str;
 }
 
@@ -111,27 +300,37 @@ metacache_add_string (const char *str) {
 
 void
 metacache_remove_value (const char *value, size_t valuesize) {
-    uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
-    metacache_str_t *chain = bucket->chain;
+    uint32_t h = metacache_get_hash (value, valuesize);
+    metacache_stripe_t *s = metacache_stripe_for_hash (h);
+    mutex_lock (s->mutex);
+    if (!s->hash_size) {
+        mutex_unlock (s->mutex);
+        return;
+    }
+    metacache_str_t **bucket = &s->hash[h & (s->hash_size-1)];
+    metacache_str_t *chain = *bucket;
     metacache_str_t *prev = NULL;
     while (chain) {
-        if (chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
-            chain->refcount--;
-            if (chain->refcount == 0) {
+        if (chain->hash == h && chain->value_length == valuesize && !memcmp (chain->str, value, valuesize)) {
+            if (__atomic_sub_fetch (&chain->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
                 if (prev) {
                     prev->next = chain->next;
                 }
                 else {
-                    bucket->chain = chain->next;
+                    *bucket = chain->next;
+                    if (!*bucket) {
+                        s->n_buckets--;
+                    }
                 }
-                free (chain);
+                s->n_strings--;
+                metacache_free_str (s, chain);
             }
             break;
         }
         prev = chain;
         chain = chain->next;
     }
+    mutex_unlock (s->mutex);
 }
 
 void
@@ -139,16 +338,22 @@ metacache_remove_string (const char *str) {
     return metacache_remove_value (str, strlen (str) + 1);
 }
 
+// the caller holds a reference, so the string can't be removed meanwhile, and no lock is needed
 void
 metacache_ref (const char *str) {
-    uint32_t *refc = (uint32_t *)(str-5);
-    (*refc)++;
+    metacache_str_t *data = metacache_str_for_value (str);
+    __atomic_add_fetch (&data->refcount, 1, __ATOMIC_RELAXED);
 }
 
 void
 metacache_unref (const char *str) {
-    uint32_t *refc = (uint32_t *)(str-5);
-    (*refc)--;
+    metacache_str_t *data = metacache_str_for_value (str);
+    __atomic_sub_fetch (&data->refcount, 1, __ATOMIC_ACQ_REL);
+}
+
+size_t
+metacache_get_value_size (const char *str) {
+    return metacache_str_for_value (str)->value_length;
 }
 
 const char *
@@ -158,13 +363,36 @@ metacache_get_string (const char *str) {
 
 const char *
 metacache_get_value (const char *value, size_t len) {
-    uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
-    n_inserts++;
+    uint32_t h = metacache_get_hash (value, len);
+    metacache_stripe_t *s = metacache_stripe_for_hash (h);
+    mutex_lock (s->mutex);
+    metacache_str_t *data = metacache_find_in_bucket (s, h, value, len);
     if (data) {
-        data->refcount++;
+        __atomic_add_fetch (&data->refcount, 1, __ATOMIC_RELAXED);
+        mutex_unlock (s->mutex);
         return data->str;
     }
-
+    mutex_unlock (s->mutex);
     return NULL;
 }
+
+void
+metacache_get_stats (ddb_metacache_stats_t *stats) {
+    if (stats->_size <= (int)sizeof (stats->_size)) {
+        return;
+    }
+    ddb_metacache_stats_t st = {
+        ._size = stats->_size,
+    };
+    for (int i = 0; i < NUM_STRIPES; i++) {
+        metacache_stripe_t *s = &stripes[i];
+        mutex_lock (s->mutex);
+        st.n_strings += s->n_strings;
+        st.n_buckets += s->n_buckets;
+        st.hash_size += s->hash_size;
+        st.slab_bytes += s->slab_bytes;
+        mutex_unlock (s->mutex);
+    }
+    // only fill the fields known to the caller
+    memcpy (stats, &st, stats->_size < (int)sizeof (st) ? stats->_size : sizeof (st));
+}
@@ -27,6 +27,16 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include <stddef.h>
+#include "deadbeef.h"
+
+// Must be called before any other metacache function
+void
+metacache_init (void);
+
+void
+metacache_free (void);
+
 // Adds a new NULL-terminated string, or finds an existing one
 const char *
 metacache_add_string (const char *str);
@@ -47,6 +57,10 @@ metacache_add_value (const char *value, size_t valuesize);
 const char *
 metacache_get_value (const char *value, size_t valuesize);
 
+// Returns the size of a string returned by metacache_add_value or metacache_add_string
+size_t
+metacache_get_value_size (const char *str);
+
 // Removes an existing value of specified size, ignoring refcount
 void
 metacache_remove_value (const char *value, size_t valuesize);
@@ -59,4 +73,8 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// Fills the statistics, summed over all stripes
+void
+metacache_get_stats (ddb_metacache_stats_t *stats);
+
 #endif
@@ -0,0 +1,160 @@
+#import <XCTest/XCTest.h>
+#include "playlist.h"
+#include "plquery.h"
+#include "conf.h"
+
+@interface Search : XCTestCase {
+    playItem_t *it;
+}
+@end
+
+@implementation Search
+
+- (void)setUp {
+    [super setUp];
+
+    conf_init ();
+    conf_enable_saving (0);
+
+    pl_init ();
+
+    it = pl_item_alloc_init ("testfile.flac", "stdflac");
+    pl_add_meta (it, "artist", "The Beatles");
+    pl_add_meta (it, "title", "Help!");
+    pl_add_meta (it, "year", "1965");
+}
+
+- (void)tearDown {
+    pl_item_unref (it);
+    pl_free ();
+    conf_free ();
+
+    [super tearDown];
+}
+
+// returns 1 if the track matches the query, 0 if it doesn't, -1 if the text is not a query
+- (int)match:(const char *)text {
+    pl_query_t *query = pl_query_compile (text, 0);
+    if (!query) {
+        return -1;
+    }
+    int res = pl_query_match (query, NULL, it);
+    pl_query_free (query);
+    return res;
+}
+
+- (void)test_Has_MatchesSubstringCaseInsensitively {
+    int res = [self match:"artist HAS beatles"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_Is_MatchesWholeValueOnly {
+    int res = [self match:"artist IS beatles"];
+    XCTAssert(res == 0, @"The actual result is: %d", res);
+    res = [self match:"artist IS \"the beatles\""];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_NumericOperators_CompareNumbers {
+    int res = [self match:"date GREATER 1960 AND date LESS 1970"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+    res = [self match:"year >= 1966"];
+    XCTAssert(res == 0, @"The actual result is: %d", res);
+}
+
+- (void)test_EqualWithText_FallsBackToIs {
+    int res = [self match:"title = help!"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_AndBindsTighterThanOr {
+    // true OR (false AND false)
+    int res = [self match:"artist HAS beatles OR title HAS yesterday AND year IS 1900"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+    // (true OR false) AND false
+    res = [self match:"(artist HAS beatles OR title HAS yesterday) AND year IS 1900"];
+    XCTAssert(res == 0, @"The actual result is: %d", res);
+}
+
+- (void)test_Not_NegatesCondition {
+    int res = [self match:"NOT artist HAS stones"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+    res = [self match:"NOT (artist HAS beatles OR year IS 1900)"];
+    XCTAssert(res == 0, @"The actual result is: %d", res);
+}
+
+- (void)test_PresentMissing_CheckField {
+    int res = [self match:"year PRESENT AND genre MISSING"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_QuotedField_AllowsSpaces {
+    pl_add_meta (it, "album artist", "Various");
+    int res = [self match:"\"album artist\" IS various"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_QuotedValue_KeepsKeywords {
+    pl_add_meta (it, "album", "Rock AND Roll");
+    int res = [self match:"album IS \"rock AND roll\""];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_TitleFormattingField_IsEvaluated {
+    int res = [self match:"$left(%artist%,3) IS the"];
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_NotWithPlainText_IsNotAQuery {
+    int res = [self match:"NOT AFRAID"];
+    XCTAssert(res == -1, @"The actual result is: %d", res);
+}
+
+- (void)test_PlainTextWithKeywords_IsNotAQuery {
+    int res = [self match:"rock AND roll"];
+    XCTAssert(res == -1, @"The actual result is: %d", res);
+    res = [self match:"ALL"];
+    XCTAssert(res == -1, @"The actual result is: %d", res);
+}
+
+- (void)test_AllWithCondition_IsAQuery {
+    int res = [self match:"ALL AND NOT year IS 1965"];
+    XCTAssert(res == 0, @"The actual result is: %d", res);
+}
+
+- (void)test_IncompleteQuery_IsNotAQuery {
+    int res = [self match:"artist HAS beatles AND"];
+    XCTAssert(res == -1, @"The actual result is: %d", res);
+    res = [self match:"year GREATER nineteen"];
+    XCTAssert(res == -1, @"The actual result is: %d", res);
+}
+
+- (void)test_PlainFallback_MatchesSubstringOfAnyField {
+    pl_add_meta (it, "album", "Not Afraid Of Help");
+    pl_query_t *query = pl_query_compile ("NOT AFRAID", 1);
+    int res = pl_query_match (query, NULL, it);
+    pl_query_free (query);
+    XCTAssert(res == 1, @"The actual result is: %d", res);
+}
+
+- (void)test_SearchProcess_SearchesTextWhichIsNotAQuery {
+    playlist_t *plt = plt_alloc ("test");
+    pl_add_meta (it, "album", "Not Afraid");
+    plt_insert_item (plt, NULL, it);
+    playItem_t *other = pl_item_alloc_init ("other.flac", "stdflac");
+    pl_add_meta (other, "title", "Afraid");
+    plt_insert_item (plt, it, other);
+    pl_item_unref (other);
+
+    plt_search_process3 (plt, "NOT AFRAID", 0, NULL);
+    int count = plt->count[PL_SEARCH];
+    XCTAssert(count == 1, @"The actual count is: %d", count);
+
+    plt_search_process3 (plt, "NOT title IS afraid", 0, NULL);
+    count = plt->count[PL_SEARCH];
+    XCTAssert(count == 1, @"The actual count is: %d", count);
+
+    plt_unref (plt);
+}
+
+@end
@@ -0,0 +1,139 @@
+#import <XCTest/XCTest.h>
+#include "playlist.h"
+#include "sort.h"
+
+@interface Sorting : XCTestCase {
+    playlist_t *plt;
+    char order[1000];
+}
+@end
+
+@implementation Sorting
+
+- (void)setUp {
+    [super setUp];
+
+    pl_init ();
+
+    plt = plt_alloc ("test");
+}
+
+- (void)tearDown {
+    plt_unref (plt);
+    pl_free ();
+
+    [super tearDown];
+}
+
+- (void)addTrack:(const char *)title album:(const char *)album track:(const char *)track {
+    playItem_t *it = pl_item_alloc_init ("testfile.flac", "stdflac");
+    pl_add_meta (it, "title", title);
+    pl_add_meta (it, "album", album);
+    if (track) {
+        pl_add_meta (it, "track", track);
+    }
+    plt_insert_item (plt, plt->tail[PL_MAIN], it);
+    pl_item_unref (it);
+}
+
+// the titles of the tracks in playlist order, separated by spaces
+- (const char *)titles {
+    order[0] = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (order[0]) {
+            strcat (order, " ");
+        }
+        strcat (order, pl_find_meta (it, "title"));
+    }
+    return order;
+}
+
+- (void)test_SortByAlbumThenTrack_OrdersByBothKeys {
+    [self addTrack:"b2" album:"B" track:"2"];
+    [self addTrack:"a10" album:"A" track:"10"];
+    [self addTrack:"b1" album:"B" track:"1"];
+    [self addTrack:"a2" album:"A" track:"2"];
+
+    ddb_sort_key_t keys[] = {
+        { .format = "%album%", .order = DDB_SORT_ASCENDING },
+        { .format = "%tracknumber%", .order = DDB_SORT_ASCENDING, .numeric = 1 },
+    };
+    int res = plt_sort_v3 (plt, PL_MAIN, keys, 2);
+
+    XCTAssert(res == 0, @"The actual result is: %d", res);
+    XCTAssert(!strcmp ([self titles], "a2 a10 b1 b2"), @"The actual order is: %s", order);
+}
+
+- (void)test_SortByAlbumThenTrack_KeepsOrderOfEqualTracks {
+    [self addTrack:"x" album:"B" track:"1"];
+    [self addTrack:"y" album:"A" track:"1"];
+    [self addTrack:"z" album:"B" track:"1"];
+    [self addTrack:"w" album:"A" track:"1"];
+    [self addTrack:"v" album:"B" track:"1"];
+
+    ddb_sort_key_t keys[] = {
+        { .format = "%album%", .order = DDB_SORT_ASCENDING },
+        { .format = "%tracknumber%", .order = DDB_SORT_ASCENDING, .numeric = 1 },
+    };
+    plt_sort_v3 (plt, PL_MAIN, keys, 2);
+
+    XCTAssert(!strcmp ([self titles], "y w x z v"), @"The actual order is: %s", order);
+}
+
+- (void)test_SortAlbumAscendingTrackDescending_AppliesDirectionPerKey {
+    [self addTrack:"a1" album:"A" track:"1"];
+    [self addTrack:"b1" album:"B" track:"1"];
+    [self addTrack:"a3" album:"A" track:"3"];
+    [self addTrack:"b2" album:"B" track:"2"];
+    [self addTrack:"a2" album:"A" track:"2"];
+
+    ddb_sort_key_t keys[] = {
+        { .format = "%album%", .order = DDB_SORT_ASCENDING },
+        { .format = "%tracknumber%", .order = DDB_SORT_DESCENDING, .numeric = 1 },
+    };
+    plt_sort_v3 (plt, PL_MAIN, keys, 2);
+
+    XCTAssert(!strcmp ([self titles], "a3 a2 a1 b2 b1"), @"The actual order is: %s", order);
+}
+
+- (void)test_SortDescending_KeepsOrderOfEqualTracks {
+    [self addTrack:"x" album:"A" track:"1"];
+    [self addTrack:"y" album:"B" track:"1"];
+    [self addTrack:"z" album:"A" track:"1"];
+
+    ddb_sort_key_t keys[] = {
+        { .format = "%album%", .order = DDB_SORT_DESCENDING },
+    };
+    plt_sort_v3 (plt, PL_MAIN, keys, 1);
+
+    XCTAssert(!strcmp ([self titles], "y x z"), @"The actual order is: %s", order);
+}
+
+- (void)test_NumericKey_NonNumbersBeforeNumbers {
+    [self addTrack:"t10" album:"A" track:"10"];
+    [self addTrack:"none" album:"A" track:NULL];
+    [self addTrack:"t9" album:"A" track:"9"];
+
+    ddb_sort_key_t keys[] = {
+        { .format = "%tracknumber%", .order = DDB_SORT_ASCENDING, .numeric = 1 },
+    };
+    plt_sort_v3 (plt, PL_MAIN, keys, 1);
+
+    XCTAssert(!strcmp ([self titles], "none t9 t10"), @"The actual order is: %s", order);
+}
+
+- (void)test_InvalidKeyFormat_ReturnsErrorAndKeepsOrder {
+    [self addTrack:"b" album:"B" track:"1"];
+    [self addTrack:"a" album:"A" track:"1"];
+
+    ddb_sort_key_t keys[] = {
+        { .format = "%album%", .order = DDB_SORT_ASCENDING },
+        { .format = "$if(", .order = DDB_SORT_ASCENDING },
+    };
+    int res = plt_sort_v3 (plt, PL_MAIN, keys, 2);
+
+    XCTAssert(res == -1, @"The actual result is: %d", res);
+    XCTAssert(!strcmp ([self titles], "b a"), @"The actual order is: %s", order);
+}
+
+@end
@@ -151,6 +151,78 @@ static DB_output_t fake_out = {
     tf_free (bc);
 }
 
+static const char *column_script = "$if2(%album artist%,%artist%) - [%album% - ][$num(%discnumber%,2).]%tracknumber%. %title% [%length%]";
+
+- (void)setUpColumnScriptTrack {
+    pl_add_meta (it, "artist", "Artist");
+    pl_add_meta (it, "album", "Album");
+    pl_add_meta (it, "title", "Title");
+    pl_add_meta (it, "track", "3");
+    pl_add_meta (it, "disc", "1");
+    plt_set_item_duration (NULL, it, 215);
+}
+
+- (void)test_ColumnScript_SpecializedMatchesInterpreted {
+    [self setUpColumnScriptTrack];
+    char interpreted[1000];
+    char *bc = tf_compile(column_script);
+    tf_eval_interpreted (&ctx, bc, interpreted, sizeof (interpreted));
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Artist - Album - 01.03. Title 3:35"), @"The actual output is: %s", buffer);
+    XCTAssert(!strcmp (buffer, interpreted), @"The interpreted output is: %s", interpreted);
+}
+
+- (void)test_ColumnScriptCached_UpdatedAfterMetaChange {
+    [self setUpColumnScriptTrack];
+    char *bc = tf_compile(column_script);
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    pl_replace_meta (it, "title", "New Title");
+    pl_delete_meta (it, "album");
+    plt_set_item_duration (NULL, it, 216);
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Artist - 01.03. New Title 3:36"), @"The actual output is: %s", buffer);
+}
+
+- (void)test_ListIndexCached_UpdatedAfterIndexChange {
+    pl_add_meta (it, "title", "Title");
+    ctx.flags = DDB_TF_CONTEXT_HAS_INDEX;
+    char *bc = tf_compile("%title% %list_index%");
+    ctx.idx = 0;
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    ctx.idx = 1;
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    tf_free (bc);
+    XCTAssert(!strcmp (buffer, "Title 2"), @"The actual output is: %s", buffer);
+}
+
+- (void)test_ColumnScriptSpecialized_Performance {
+    [self setUpColumnScriptTrack];
+    char *bc = tf_compile(column_script);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; i++) {
+            tf_eval (&ctx, bc, buffer, sizeof (buffer));
+        }
+    }];
+
+    tf_free (bc);
+}
+
+- (void)test_ColumnScriptInterpreted_Performance {
+    [self setUpColumnScriptTrack];
+    char *bc = tf_compile(column_script);
+
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; i++) {
+            tf_eval_interpreted (&ctx, bc, buffer, sizeof (buffer));
+        }
+    }];
+
+    tf_free (bc);
+}
+
 - (void)test_LongCommentOverflowBuffer_DoesntCrash {
     char longcomment[2048];
     for (int i = 0; i < sizeof (longcomment) - 1; i++) {
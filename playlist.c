@@ -39,6 +39,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <assert.h>
 #include <time.h>
 #include <sys/time.h>
@@ -66,6 +68,7 @@
 #include "strdupa.h"
 #include "tf.h"
 #include "playqueue.h"
+#include "plquery.h"
 
 // disable custom title function, until we have new title formatting (0.7)
 #define DISABLE_CUSTOM_TITLE
@@ -85,12 +88,12 @@
 //    removed legacy data used for compat with 0.4.4
 //    note: ddb-0.5.0 should keep using 1.2 playlist format
 //    1.3 support is designed for transition to ddb-0.6.0
-#define PLAYLIST_MAJOR_VER 1
-#define PLAYLIST_MINOR_VER 2
-
-#if (PLAYLIST_MINOR_VER<2)
-#error writing playlists in format <1.2 is not supported
-#endif
+// 1.2->2.0 changelog:
+//    new layout with a shared string table and fixed size track records,
+//    which is loaded from a memory mapped file, see dbpl2_header_t
+//    1.x files can still be loaded, but are no longer written
+#define PLAYLIST_MAJOR_VER 2
+#define PLAYLIST_MINOR_VER 0
 
 #define SKIP_BLANK_CUE_TRACKS 0
 #define MAX_CUE_TRACKS 99
@@ -103,11 +106,34 @@ static playlist_t *playlist = NULL; // current playlist
 static int plt_loading = 0; // disable sending event about playlist switch, config regen, etc
 
 #if !DISABLE_LOCKING
+// pl_lock is a reader-writer lock: pl_lock takes it exclusively,
+// pl_lock_read shares it with other readers; the state is protected by `mutex`
 static uintptr_t mutex;
+static uintptr_t lock_cond;
+static int lock_readers; // threads holding the shared lock
+static int lock_has_writer;
+static int lock_writers_waiting;
+static int lock_readers_waiting;
+static __thread int lock_depth; // pl_lock nesting in the current thread
+static __thread int lock_read_depth; // pl_lock_read nesting in the current thread
+static __thread int lock_upgraded_read_depth; // lock_read_depth given up by pl_lock, see pl_lock_read
 #endif
 
+// contention statistics, updated under `mutex`; nested locking isn't counted
+static uint64_t lock_count;
+static uint64_t lock_contended_count;
+static uint64_t lock_wait_time_us;
+static uint64_t lock_max_wait_time_us;
+static uint64_t lock_read_count;
+static uint64_t lock_read_contended_count;
+
+// the readers extend the playlist indexes under this mutex, see plt_index_extend
+static uintptr_t index_mutex;
+
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
+#define READ_LOCK {pl_lock_read();}
+#define READ_UNLOCK {pl_unlock_read();}
 
 // used at startup to prevent crashes
 static playlist_t dummy_playlist = {
@@ -187,15 +213,19 @@ pl_init (void) {
     if (playlist) {
         return 0; // avoid double init
     }
+    metacache_init ();
     playlist = &dummy_playlist;
 #if !DISABLE_LOCKING
-    mutex = mutex_create ();
+    mutex = mutex_create_nonrecursive ();
+    lock_cond = cond_create ();
 #endif
+    index_mutex = mutex_create_nonrecursive ();
     return 0;
 }
 
 void
 pl_free (void) {
+    pl_load_all_wait ();
     LOCK;
     playqueue_clear ();
     plt_loading = 1;
@@ -212,13 +242,22 @@ pl_free (void) {
         plt_remove (0);
     }
     plt_loading = 0;
+    //trace ("pl_lock: %lld locks, %lld read locks, %lld contended, %lld contended reads, %lld us total wait, %lld us max wait\n", (long long)lock_count, (long long)lock_read_count, (long long)lock_contended_count, (long long)lock_read_contended_count, (long long)lock_wait_time_us, (long long)lock_max_wait_time_us);
     UNLOCK;
 #if !DISABLE_LOCKING
     if (mutex) {
         mutex_free (mutex);
         mutex = 0;
     }
+    if (lock_cond) {
+        cond_free (lock_cond);
+        lock_cond = 0;
+    }
 #endif
+    if (index_mutex) {
+        mutex_free (index_mutex);
+        index_mutex = 0;
+    }
     playlist = NULL;
 }
 
@@ -230,10 +269,77 @@ static pthread_t tids[1000];
 static int ntids = 0;
 pthread_t pl_lock_tid = 0;
 #endif
+
+#if !DISABLE_LOCKING
+// must be called with `mutex` held
+static void
+pl_lock_wait (int *waiting, int exclusive) {
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+    (*waiting)++;
+    while (lock_has_writer || (exclusive ? lock_readers > 0 : lock_writers_waiting > 0)) {
+        cond_wait_locked (lock_cond, mutex);
+    }
+    (*waiting)--;
+    gettimeofday (&tm2, NULL);
+    int64_t us = (int64_t)(tm2.tv_sec - tm1.tv_sec) * 1000000 + (tm2.tv_usec - tm1.tv_usec);
+    if (us < 0) {
+        us = 0;
+    }
+    if (exclusive) {
+        lock_contended_count++;
+    }
+    else {
+        lock_read_contended_count++;
+    }
+    lock_wait_time_us += us;
+    if (us > lock_max_wait_time_us) {
+        lock_max_wait_time_us = us;
+    }
+}
+
+static void
+pl_lock_shared (void) {
+    mutex_lock (mutex);
+    // waiting writers go first, so that a stream of readers can't starve them
+    if (lock_has_writer || lock_writers_waiting > 0) {
+        pl_lock_wait (&lock_readers_waiting, 0);
+    }
+    lock_readers++;
+    lock_read_count++;
+    mutex_unlock (mutex);
+}
+
+static void
+pl_unlock_shared (void) {
+    mutex_lock (mutex);
+    lock_readers--;
+    if (!lock_readers && lock_writers_waiting) {
+        cond_broadcast (lock_cond);
+    }
+    mutex_unlock (mutex);
+}
+#endif
+
 void
 pl_lock (void) {
 #if !DISABLE_LOCKING
-    mutex_lock (mutex);
+    if (lock_depth++ == 0) {
+        if (lock_read_depth) {
+            // the other readers can't be waited for while holding the shared lock,
+            // so it's given up until the matching pl_unlock
+            lock_upgraded_read_depth = lock_read_depth;
+            lock_read_depth = 0;
+            pl_unlock_shared ();
+        }
+        mutex_lock (mutex);
+        if (lock_has_writer || lock_readers > 0) {
+            pl_lock_wait (&lock_writers_waiting, 1);
+        }
+        lock_has_writer = 1;
+        lock_count++;
+        mutex_unlock (mutex);
+    }
 #if DETECT_PL_LOCK_RC
     pl_lock_tid = pthread_self ();
     tids[ntids++] = pl_lock_tid;
@@ -260,7 +366,19 @@ pl_unlock (void) {
         pl_lock_tid = 0;
     }
 #endif
-    mutex_unlock (mutex);
+    if (--lock_depth == 0) {
+        mutex_lock (mutex);
+        lock_has_writer = 0;
+        if (lock_writers_waiting || lock_readers_waiting) {
+            cond_broadcast (lock_cond);
+        }
+        mutex_unlock (mutex);
+        if (lock_upgraded_read_depth) {
+            pl_lock_shared ();
+            lock_read_depth = lock_upgraded_read_depth;
+            lock_upgraded_read_depth = 0;
+        }
+    }
 #if DEBUG_LOCKING
     pl_lock_cnt--;
     printf ("pcnt: %d\n", pl_lock_cnt);
@@ -268,9 +386,75 @@ pl_unlock (void) {
 #endif
 }
 
+void
+pl_lock_read (void) {
+#if !DISABLE_LOCKING
+    if (lock_depth) {
+        // already exclusive
+        lock_depth++;
+        return;
+    }
+    // nested shared locks don't wait, even if a writer is waiting for this thread
+    if (lock_read_depth++ == 0) {
+        pl_lock_shared ();
+    }
+#endif
+}
+
+void
+pl_unlock_read (void) {
+#if !DISABLE_LOCKING
+    if (lock_depth) {
+        // nested in pl_lock
+        lock_depth--;
+        return;
+    }
+    if (--lock_read_depth == 0) {
+        pl_unlock_shared ();
+    }
+#endif
+}
+
+void
+pl_get_lock_stats (ddb_lock_stats_t *stats, int reset) {
+#if !DISABLE_LOCKING
+    mutex_lock (mutex);
+#endif
+    if (stats && stats->_size > (int)sizeof (stats->_size)) {
+        // only fill the fields known to the caller
+        ddb_lock_stats_t st = {
+            ._size = stats->_size,
+            .lock_count = lock_count,
+            .contended_count = lock_contended_count,
+            .wait_time_us = lock_wait_time_us,
+            .max_wait_time_us = lock_max_wait_time_us,
+            .read_lock_count = lock_read_count,
+            .read_contended_count = lock_read_contended_count,
+        };
+        memcpy (stats, &st, min (stats->_size, (int)sizeof (st)));
+    }
+    if (reset) {
+        lock_count = 0;
+        lock_contended_count = 0;
+        lock_wait_time_us = 0;
+        lock_max_wait_time_us = 0;
+        lock_read_count = 0;
+        lock_read_contended_count = 0;
+    }
+#if !DISABLE_LOCKING
+    mutex_unlock (mutex);
+#endif
+}
+
 static void
 pl_item_free (playItem_t *it);
 
+static void
+plt_index_free (playlist_t *plt);
+
+static int
+plt_index_contains (playlist_t *plt, int iter, playItem_t *it);
+
 static void
 plt_gen_conf (void) {
     if (plt_loading) {
@@ -301,50 +485,48 @@ plt_get_list (void) {
 
 playlist_t *
 plt_get_curr (void) {
-    LOCK;
+    READ_LOCK;
     playlist_t *plt = playlist;
     if (plt) {
         plt_ref (plt);
         assert (plt->refc > 1);
     }
-    UNLOCK;
+    READ_UNLOCK;
     return plt;
 }
 
 playlist_t *
 plt_get_for_idx (int idx) {
-    LOCK;
+    READ_LOCK;
     playlist_t *p = playlists_head;
     for (int i = 0; p && i <= idx; i++, p = p->next) {
         if (i == idx) {
             plt_ref (p);
-            UNLOCK;
+            READ_UNLOCK;
             return p;
         }
     }
-    UNLOCK;
+    READ_UNLOCK;
     return NULL;
 }
 
+// refcounts are atomic, so that holding a reference doesn't require taking pl_lock;
+// the caller must either own a reference already, or be in a pl_lock block
 void
 plt_ref (playlist_t *plt) {
-    LOCK;
-    plt->refc++;
-    UNLOCK;
+    __atomic_add_fetch (&plt->refc, 1, __ATOMIC_RELAXED);
 }
 
 void
 plt_unref (playlist_t *plt) {
-    LOCK;
-    assert (plt->refc > 0);
-    plt->refc--;
-    if (plt->refc < 0) {
+    int refc = __atomic_sub_fetch (&plt->refc, 1, __ATOMIC_ACQ_REL);
+    assert (refc >= 0);
+    if (refc < 0) {
         trace ("\033[0;31mplaylist: bad refcount on playlist %p (%s)\033[37;0m\n", plt, plt->title);
     }
-    if (plt->refc <= 0) {
+    if (refc <= 0) {
         plt_free (plt);
     }
-    UNLOCK;
 }
 
 int
@@ -617,15 +799,15 @@ plt_get_idx_of (playlist_t *plt) {
 int
 plt_get_title (playlist_t *p, char *buffer, int bufsize) {
     int i;
-    LOCK;
+    READ_LOCK;
     if (!buffer) {
         int l = strlen (p->title);
-        UNLOCK;
+        READ_UNLOCK;
         return l;
     }
     strncpy (buffer, p->title, bufsize);
     buffer[bufsize-1] = 0;
-    UNLOCK;
+    READ_UNLOCK;
     return 0;
 }
 
@@ -655,16 +837,33 @@ plt_modified (playlist_t *plt) {
 
 int
 plt_get_modification_idx (playlist_t *plt) {
-    pl_lock ();
+    pl_lock_read ();
     int idx = plt->modification_idx;
-    pl_unlock ();
+    pl_unlock_read ();
     return idx;
 }
 
+static void
+pl_search_index_free (struct pl_search_index_s *idx);
+
+static void
+pl_search_index_insert (playlist_t *playlist, playItem_t *it);
+
+static void
+pl_search_index_remove (playlist_t *playlist, playItem_t *it);
+
+static void
+pl_search_index_prebuild (playlist_t *playlist, int shared, int *pabort);
+
 void
 plt_free (playlist_t *plt) {
     LOCK;
     plt_clear (plt);
+    plt_index_free (plt);
+    if (plt->search_index) {
+        pl_search_index_free (plt->search_index);
+    }
+    free (plt->search_text);
     free (plt->title);
 
     while (plt->meta) {
@@ -1352,6 +1551,92 @@ fileadd_filter_test (ddb_file_found_data_t *data) {
     return 0;
 }
 
+static const char *
+plt_file_basename (const char *fname) {
+    const char *fn = strrchr (fname, '/');
+    return fn ? fn+1 : fname;
+}
+
+static int
+plt_decoder_matches (DB_decoder_t *dec, const char *fname) {
+    const char *eol = strrchr (fname, '.');
+    if (!eol || !dec->insert) {
+        return 0;
+    }
+    eol++;
+    if (dec->exts) {
+        for (int e = 0; dec->exts[e]; e++) {
+            if (!strcasecmp (dec->exts[e], eol) || !strcmp (dec->exts[e], "*")) {
+                return 1;
+            }
+        }
+    }
+    if (dec->prefixes) {
+        const char *fn = plt_file_basename (fname);
+        for (int e = 0; dec->prefixes[e]; e++) {
+            size_t l = strlen (dec->prefixes[e]);
+            if (!strncasecmp (dec->prefixes[e], fn, l) && fn[l] == '.') {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// returns non-zero if any decoder claims the file by extension or name prefix
+static int
+plt_file_has_decoder (const char *fname) {
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (plt_decoder_matches (decoders[i], fname)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// tries all matching decoders in order, until one of them inserts the file;
+// doesn't run the fileadd filters and listeners, so it's safe to call
+// from worker threads on a private playlist
+static playItem_t *
+plt_insert_file_decoders (playlist_t *playlist, playItem_t *after, const char *fname) {
+    int file_recognized = 0;
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    for (int i = 0; decoders[i]; i++) {
+        if (plt_decoder_matches (decoders[i], fname)) {
+            file_recognized = 1;
+            playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+            if (inserted != NULL) {
+                return inserted;
+            }
+        }
+    }
+    if (file_recognized) {
+        trace_err ("ERROR: could not load: %s\n", fname);
+    }
+    return NULL;
+}
+
+static void
+plt_file_inserted_notify (int visibility, playlist_t *playlist, playItem_t *inserted, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (cb && cb (inserted, user_data) < 0) {
+        *pabort = 1;
+    }
+    if (file_add_listeners) {
+        ddb_fileadd_data_t d;
+        memset (&d, 0, sizeof (d));
+        d.visibility = visibility;
+        d.plt = (ddb_playlist_t *)playlist;
+        d.track = (ddb_playItem_t *)inserted;
+        for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
+            if (l->callback (&d, l->user_data) < 0) {
+                *pabort = 1;
+                break;
+            }
+        }
+    }
+}
+
 static playItem_t *
 plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     if (!fname || !(*fname)) {
@@ -1373,14 +1658,6 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
         }
     }
 
-    const char *fn = strrchr (fname, '/');
-    if (!fn) {
-        fn = fname;
-    }
-    else {
-        fn++;
-    }
-
     // add all posible streams as special-case:
     // set decoder to NULL, and filetype to "content"
     // streamer is responsible to determine content type on 1st access and
@@ -1450,102 +1727,23 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
     }
 
     // detect decoder
-    const char *eol = strrchr (fname, '.');
-    if (!eol) {
+    if (!plt_file_has_decoder (fname)) {
         return NULL;
     }
-    eol++;
-
-    int filter_done = 0;
-    int file_recognized = 0;
-
-    DB_decoder_t **decoders = plug_get_decoder_list ();
-    // match by decoder
-    for (int i = 0; decoders[i]; i++) {
-        if (decoders[i]->exts && decoders[i]->insert) {
-            const char **exts = decoders[i]->exts;
-            for (int e = 0; exts[e]; e++) {
-                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
-                    if (!filter_done) {
-                        ddb_file_found_data_t dt;
-                        dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
-                        dt.is_dir = 0;
-                        if (fileadd_filter_test (&dt) < 0) {
-                            return NULL;
-                        }
-                        filter_done = 1;
-                    }
-
-                    file_recognized = 1;
-
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
-        }
-        if (decoders[i]->prefixes && decoders[i]->insert) {
-            const char **prefixes = decoders[i]->prefixes;
-            for (int e = 0; prefixes[e]; e++) {
-                if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
-                    if (!filter_done) {
-                        ddb_file_found_data_t dt;
-                        dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
-                        dt.is_dir = 0;
-                        if (fileadd_filter_test (&dt) < 0) {
-                            return NULL;
-                        }
-                        filter_done = 1;
-                    }
 
-                    file_recognized = 1;
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
-        }
+    ddb_file_found_data_t dt;
+    dt.filename = fname;
+    dt.plt = (ddb_playlist_t *)playlist;
+    dt.is_dir = 0;
+    if (fileadd_filter_test (&dt) < 0) {
+        return NULL;
     }
-    if (file_recognized) {
-        trace_err ("ERROR: could not load: %s\n", fname);
+
+    playItem_t *inserted = plt_insert_file_decoders (playlist, after, fname);
+    if (inserted) {
+        plt_file_inserted_notify (visibility, playlist, inserted, pabort, cb, user_data);
     }
-    return NULL;
+    return inserted;
 }
 
 playItem_t *
@@ -1639,73 +1837,356 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
     return after;
 }
 
-playItem_t *
-plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
-    ignore_archives = conf_get_int ("ignore_archives", 1);
+#define PL_IMPORT_QUEUE_SIZE 256
+#define PL_IMPORT_MAX_THREADS 16
+#define PL_IMPORT_DEFAULT_THREADS 4
+
+typedef struct {
+    char *fname;
+    playlist_t *plt; // private playlist receiving the decoder output
+    playItem_t *inserted;
+    int done;
+} pl_import_job_t;
+
+// parallel directory import:
+// the calling thread walks the directory tree and runs the fileadd filters,
+// worker threads run the decoders into private playlists, and the results are
+// merged back by the calling thread in the order the files were found,
+// which is also where the callback and the fileadd listeners are called
+typedef struct {
+    int visibility;
+    playlist_t *playlist;
+    playItem_t *after;
+    int *pabort;
+    int (*cb)(playItem_t *it, void *data);
+    void *user_data;
 
-    playItem_t *ret = plt_insert_dir_int (0, playlist, NULL, after, dirname, pabort, cb, user_data);
+    pl_import_job_t jobs[PL_IMPORT_QUEUE_SIZE];
+    int head; // next job to be merged
+    int next; // next job to be picked up by a worker
+    int tail; // next free slot
+    int quit;
+    uintptr_t mutex;
+    uintptr_t cond; // new jobs or quit
+    uintptr_t done_cond; // finished jobs
+} pl_import_t;
 
-    ignore_archives = 0;
+static void
+pl_import_worker (void *ctx) {
+    pl_import_t *im = ctx;
+    mutex_lock (im->mutex);
+    for (;;) {
+        while (!im->quit && im->next == im->tail) {
+            cond_wait_locked (im->cond, im->mutex);
+        }
+        if (im->next == im->tail) {
+            break;
+        }
+        pl_import_job_t *job = &im->jobs[im->next++ % PL_IMPORT_QUEUE_SIZE];
+        mutex_unlock (im->mutex);
 
-    return ret;
-}
+        if (!*im->pabort) {
+            job->plt = plt_alloc ("");
+            job->inserted = plt_insert_file_decoders (job->plt, NULL, job->fname);
+        }
 
-static int
-plt_add_file_int (int visibility, playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    int abort = 0;
-    playItem_t *it = plt_insert_file_int (visibility, plt, plt->tail[PL_MAIN], fname, &abort, cb, user_data);
-    if (it) {
-        // pl_insert_file doesn't hold reference, don't unref here
-        return 0;
+        mutex_lock (im->mutex);
+        job->done = 1;
+        cond_signal (im->done_cond);
     }
-    return -1;
+    mutex_unlock (im->mutex);
 }
 
-int
-plt_add_file (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    return plt_add_file_int (0, plt, fname, cb, user_data);
+static void
+pl_import_finish_job (pl_import_t *im, pl_import_job_t *job) {
+    if (job->inserted && !*im->pabort) {
+        // move the tracks from the private playlist to the target one
+        playItem_t *it = job->plt->head[PL_MAIN];
+        job->plt->head[PL_MAIN] = job->plt->tail[PL_MAIN] = NULL;
+        job->plt->count[PL_MAIN] = 0;
+        plt_index_invalidate (job->plt, PL_MAIN);
+        while (it) {
+            playItem_t *next = it->next[PL_MAIN];
+            it->next[PL_MAIN] = it->prev[PL_MAIN] = NULL;
+            im->after = plt_insert_item (im->playlist, im->after, it);
+            pl_item_unref (it);
+            it = next;
+        }
+        plt_file_inserted_notify (im->visibility, im->playlist, im->after, im->pabort, im->cb, im->user_data);
+    }
+    if (job->plt) {
+        plt_unref (job->plt);
+    }
+    free (job->fname);
+    memset (job, 0, sizeof (pl_import_job_t));
 }
 
-int
-plt_add_dir (playlist_t *plt, const char *dirname, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    int abort = 0;
-    playItem_t *it = plt_insert_dir (plt, plt->tail[PL_MAIN], dirname, &abort, cb, user_data);
-    if (it) {
-        // pl_insert_file doesn't hold reference, don't unref here
-        return 0;
+// merges the finished jobs in order;
+// waits for the oldest job if the queue is full, or for all jobs if wait_all is set
+static void
+pl_import_merge (pl_import_t *im, int wait_all) {
+    mutex_lock (im->mutex);
+    while (im->head != im->tail) {
+        pl_import_job_t *job = &im->jobs[im->head % PL_IMPORT_QUEUE_SIZE];
+        if (!job->done) {
+            if (!wait_all && im->tail - im->head < PL_IMPORT_QUEUE_SIZE) {
+                break;
+            }
+            cond_wait_locked (im->done_cond, im->mutex);
+            continue;
+        }
+        im->head++;
+        mutex_unlock (im->mutex);
+        pl_import_finish_job (im, job);
+        mutex_lock (im->mutex);
     }
-    return -1;
+    mutex_unlock (im->mutex);
 }
 
-int
-pl_add_files_begin (playlist_t *plt) {
-    return plt_add_files_begin (plt, 0);
-}
+static void
+pl_import_file (pl_import_t *im, const char *fname) {
+    int is_container = 0;
+    if (!ignore_archives) {
+        DB_vfs_t **vfsplugs = plug_get_vfs_list ();
+        for (int i = 0; vfsplugs[i]; i++) {
+            if (vfsplugs[i]->is_container && vfsplugs[i]->is_container (fname)) {
+                is_container = 1;
+                break;
+            }
+        }
+    }
+    if (is_container || fname[0] != '/') {
+        // archives and anything that doesn't look like a local file take the
+        // regular path, after everything found before is merged
+        pl_import_merge (im, 1);
+        playItem_t *inserted = plt_insert_file_int (im->visibility, im->playlist, im->after, fname, im->pabort, im->cb, im->user_data);
+        if (inserted) {
+            im->after = inserted;
+        }
+        return;
+    }
 
-void
-pl_add_files_end (void) {
-    return plt_add_files_end (addfiles_playlist, 0);
-}
+    if (!plt_file_has_decoder (fname)) {
+        return;
+    }
+    ddb_file_found_data_t dt;
+    dt.filename = fname;
+    dt.plt = (ddb_playlist_t *)im->playlist;
+    dt.is_dir = 0;
+    if (fileadd_filter_test (&dt) < 0) {
+        return;
+    }
 
-int
-plt_remove_item (playlist_t *playlist, playItem_t *it) {
-    if (!it)
-        return -1;
+    // make room in the queue
+    pl_import_merge (im, 0);
 
-    if (!no_remove_notify) {
-        streamer_song_removed_notify (it);
-        playqueue_remove (it);
-    }
+    mutex_lock (im->mutex);
+    pl_import_job_t *job = &im->jobs[im->tail % PL_IMPORT_QUEUE_SIZE];
+    job->fname = strdup (fname);
+    im->tail++;
+    cond_signal (im->cond);
+    mutex_unlock (im->mutex);
+}
 
-    // remove from both lists
-    LOCK;
-    for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
-        if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
-            playlist->count[iter]--;
+// returns -1 if dirname is not a directory, 0 otherwise
+static int
+pl_import_dir (pl_import_t *im, const char *dirname) {
+    if (!follow_symlinks) {
+        struct stat buf;
+        lstat (dirname, &buf);
+        if (S_ISLNK(buf.st_mode)) {
+            return -1;
         }
+    }
 
-        playItem_t *next = it->next[iter];
+    ddb_file_found_data_t dt;
+    dt.filename = dirname;
+    dt.plt = (ddb_playlist_t *)im->playlist;
+    dt.is_dir = 1;
+    if (fileadd_filter_test (&dt) < 0) {
+        return -1;
+    }
+
+    struct dirent **namelist = NULL;
+    int n = scandir (dirname, &namelist, NULL, dirent_alphasort);
+    if (n < 0) {
+        if (namelist) {
+            free (namelist);
+        }
+        return -1; // not a dir or no read access
+    }
+
+    int i;
+    for (i = 0; i < n; i++) {
+        // no hidden files
+        if (namelist[i]->d_name[0] != '.' && !*im->pabort) {
+            char fullname[PATH_MAX];
+            snprintf (fullname, sizeof (fullname), "%s/%s", dirname, namelist[i]->d_name);
+            if (pl_import_dir (im, fullname) < 0) {
+                pl_import_file (im, fullname);
+            }
+        }
+        free (namelist[i]);
+    }
+    free (namelist);
+    return 0;
+}
+
+static playItem_t *
+plt_insert_dir_parallel (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data, int nthreads) {
+    if (!strncmp (dirname, "file://", 7)) {
+        dirname += 7;
+    }
+
+    pl_import_t *im = calloc (1, sizeof (pl_import_t));
+    if (!im) {
+        return NULL;
+    }
+    im->visibility = visibility;
+    im->playlist = playlist;
+    im->after = after;
+    im->pabort = pabort;
+    im->cb = cb;
+    im->user_data = user_data;
+    im->mutex = mutex_create_nonrecursive ();
+    im->cond = cond_create ();
+    im->done_cond = cond_create ();
+
+    intptr_t tids[PL_IMPORT_MAX_THREADS];
+    int nstarted = 0;
+    for (int i = 0; i < nthreads; i++) {
+        tids[nstarted] = thread_start (pl_import_worker, im);
+        if (tids[nstarted]) {
+            nstarted++;
+        }
+    }
+
+    playItem_t *ret = NULL;
+    if (nstarted) {
+        int is_dir = !pl_import_dir (im, dirname);
+        mutex_lock (im->mutex);
+        im->quit = 1;
+        cond_broadcast (im->cond);
+        mutex_unlock (im->mutex);
+        pl_import_merge (im, 1);
+        for (int i = 0; i < nstarted; i++) {
+            thread_join (tids[i]);
+        }
+        ret = is_dir ? im->after : NULL;
+    }
+    else {
+        ret = plt_insert_dir_int (visibility, playlist, NULL, after, dirname, pabort, cb, user_data);
+    }
+
+    cond_free (im->cond);
+    cond_free (im->done_cond);
+    mutex_free (im->mutex);
+    free (im);
+    return ret;
+}
+
+static playItem_t *
+plt_insert_dir_toplevel (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
+    ignore_archives = conf_get_int ("ignore_archives", 1);
+
+    // -1 (default) uses one thread per cpu, up to PL_IMPORT_DEFAULT_THREADS;
+    // 0 means one thread per cpu, 1 imports serially
+    int nthreads = conf_get_int ("add_folders_threads", -1);
+    if (nthreads <= 0) {
+        int ncpu = (int)sysconf (_SC_NPROCESSORS_ONLN);
+        if (nthreads < 0 && ncpu > PL_IMPORT_DEFAULT_THREADS) {
+            ncpu = PL_IMPORT_DEFAULT_THREADS;
+        }
+        nthreads = ncpu;
+    }
+    if (nthreads > PL_IMPORT_MAX_THREADS) {
+        nthreads = PL_IMPORT_MAX_THREADS;
+    }
+
+    playItem_t *ret;
+    if (nthreads > 1) {
+        ret = plt_insert_dir_parallel (visibility, playlist, after, dirname, pabort, cb, user_data, nthreads);
+    }
+    else {
+        ret = plt_insert_dir_int (visibility, playlist, NULL, after, dirname, pabort, cb, user_data);
+    }
+
+    ignore_archives = 0;
+    return ret;
+}
+
+playItem_t *
+plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    return plt_insert_dir_toplevel (0, playlist, after, dirname, pabort, cb, user_data);
+}
+
+static int
+plt_add_file_int (int visibility, playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int abort = 0;
+    playItem_t *it = plt_insert_file_int (visibility, plt, plt->tail[PL_MAIN], fname, &abort, cb, user_data);
+    if (it) {
+        // pl_insert_file doesn't hold reference, don't unref here
+        return 0;
+    }
+    return -1;
+}
+
+int
+plt_add_file (playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    return plt_add_file_int (0, plt, fname, cb, user_data);
+}
+
+int
+plt_add_dir (playlist_t *plt, const char *dirname, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int abort = 0;
+    playItem_t *it = plt_insert_dir (plt, plt->tail[PL_MAIN], dirname, &abort, cb, user_data);
+    if (it) {
+        // pl_insert_file doesn't hold reference, don't unref here
+        return 0;
+    }
+    return -1;
+}
+
+int
+pl_add_files_begin (playlist_t *plt) {
+    return plt_add_files_begin (plt, 0);
+}
+
+void
+pl_add_files_end (void) {
+    return plt_add_files_end (addfiles_playlist, 0);
+}
+
+int
+plt_remove_item (playlist_t *playlist, playItem_t *it) {
+    if (!it)
+        return -1;
+
+    if (!no_remove_notify) {
+        streamer_song_removed_notify (it);
+        playqueue_remove (it);
+    }
+
+    // remove from both lists
+    LOCK;
+    playlist->main_version++;
+    for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
+        if (!it->prev[iter] && !it->next[iter] && playlist->head[iter] != it && playlist->tail[iter] != it) {
+            // not in this list, e.g. not a search result
+            continue;
+        }
+        playlist->count[iter]--;
+        if (iter == PL_MAIN) {
+            pl_search_index_remove (playlist, it);
+        }
+
+        // the positions before the removed item stay valid
+        if (plt_index_contains (playlist, iter, it)) {
+            playlist->index_count[iter] = it->_index[iter];
+        }
+
+        playItem_t *next = it->next[iter];
         playItem_t *prev = it->prev[iter];
 
         if (prev) {
@@ -1755,14 +2236,14 @@ plt_get_item_count (playlist_t *plt, int iter) {
 
 int
 pl_getcount (int iter) {
-    LOCK;
+    READ_LOCK;
     if (!playlist) {
-        UNLOCK;
+        READ_UNLOCK;
         return 0;
     }
 
     int cnt = playlist->count[iter];
-    UNLOCK;
+    READ_UNLOCK;
     return cnt;
 }
 
@@ -1786,29 +2267,123 @@ pl_getselcount (void) {
     return cnt;
 }
 
+void
+plt_index_invalidate (playlist_t *plt, int iter) {
+    plt->index_count[iter] = 0;
+    if (iter == PL_MAIN) {
+        plt->main_version++;
+    }
+}
+
+// the readers look up the valid part of the index without locking index_mutex,
+// so index_count and _index are accessed atomically
+static int
+plt_index_contains (playlist_t *plt, int iter, playItem_t *it) {
+    int idx = __atomic_load_n (&it->_index[iter], __ATOMIC_RELAXED);
+    return idx >= 0 && idx < __atomic_load_n (&plt->index_count[iter], __ATOMIC_ACQUIRE) && plt->index[iter][idx] == it;
+}
+
+// makes room for `count` items; only called with pl_lock held,
+// so that the index never moves while the readers use it
+static int
+plt_index_reserve (playlist_t *plt, int iter, int count) {
+    if (count <= plt->index_size[iter]) {
+        return 0;
+    }
+    int size = plt->index_size[iter] ? plt->index_size[iter] : 256;
+    while (size < count) {
+        size *= 2;
+    }
+    playItem_t **index = realloc (plt->index[iter], size * sizeof (playItem_t *));
+    if (!index) {
+        return -1;
+    }
+    plt->index[iter] = index;
+    plt->index_size[iter] = size;
+    return 0;
+}
+
+static int
+plt_index_append (playlist_t *plt, int iter, playItem_t *it) {
+    int count = plt->index_count[iter];
+    if (count >= plt->index_size[iter]) {
+        return -1;
+    }
+    __atomic_store_n (&it->_index[iter], count, __ATOMIC_RELAXED);
+    plt->index[iter][count] = it;
+    __atomic_store_n (&plt->index_count[iter], count + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// extends the valid part of the index until it covers position idx, or the item
+// `find` (either can be -1/NULL), or the end of the list;
+// only the part of the list after the last change is walked.
+// Must be called with index_mutex held, the lookups extend the index under the shared lock
+static int
+plt_index_extend (playlist_t *plt, int iter, int idx, playItem_t *find) {
+    int count = plt->index_count[iter];
+    playItem_t *it = count ? plt->index[iter][count-1]->next[iter] : plt->head[iter];
+    while (it && (idx < 0 || plt->index_count[iter] <= idx)) {
+        if (plt_index_append (plt, iter, it) < 0) {
+            return -1;
+        }
+        if (it == find) {
+            break;
+        }
+        it = it->next[iter];
+    }
+    return 0;
+}
+
+static void
+plt_index_free (playlist_t *plt) {
+    for (int iter = 0; iter < PL_MAX_ITERATORS; iter++) {
+        free (plt->index[iter]);
+        plt->index[iter] = NULL;
+        plt->index_count[iter] = 0;
+        plt->index_size[iter] = 0;
+    }
+}
+
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
-    LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
+    READ_LOCK;
+    playItem_t *it = NULL;
+    if (idx < 0) {
+        READ_UNLOCK;
+        return NULL;
+    }
+    if (idx < __atomic_load_n (&playlist->index_count[iter], __ATOMIC_ACQUIRE)) {
+        it = playlist->index[iter][idx];
+    }
+    else {
+        mutex_lock (index_mutex);
+        if (!plt_index_extend (playlist, iter, idx, NULL)) {
+            if (idx < playlist->index_count[iter]) {
+                it = playlist->index[iter][idx];
+            }
         }
-        it = it->next[iter];
+        else {
+            // out of memory, fall back to walking the list
+            it = playlist->head[iter];
+            while (it && idx--) {
+                it = it->next[iter];
+            }
+        }
+        mutex_unlock (index_mutex);
     }
     if (it) {
         pl_item_ref (it);
     }
-    UNLOCK;
+    READ_UNLOCK;
     return it;
 }
 
 playItem_t *
 pl_get_for_idx_and_iter (int idx, int iter) {
-    LOCK;
+    READ_LOCK;
     playItem_t *it = plt_get_item_for_idx (playlist, idx, iter);
-    UNLOCK;
+    READ_UNLOCK;
     return it;
 }
 
@@ -1819,7 +2394,21 @@ pl_get_for_idx (int idx) {
 
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
-    LOCK;
+    READ_LOCK;
+    if (plt_index_contains (playlist, iter, it)) {
+        int idx = __atomic_load_n (&it->_index[iter], __ATOMIC_RELAXED);
+        READ_UNLOCK;
+        return idx;
+    }
+    mutex_lock (index_mutex);
+    if (!plt_index_extend (playlist, iter, -1, it)) {
+        int idx = plt_index_contains (playlist, iter, it) ? it->_index[iter] : -1;
+        mutex_unlock (index_mutex);
+        READ_UNLOCK;
+        return idx;
+    }
+    mutex_unlock (index_mutex);
+    // out of memory, fall back to walking the list
     playItem_t *c = playlist->head[iter];
     int idx = 0;
     while (c && c != it) {
@@ -1827,10 +2416,10 @@ plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
         idx++;
     }
     if (!c) {
-        UNLOCK;
+        READ_UNLOCK;
         return -1;
     }
-    UNLOCK;
+    READ_UNLOCK;
     return idx;
 }
 
@@ -1841,16 +2430,29 @@ pl_get_idx_of (playItem_t *it) {
 
 int
 pl_get_idx_of_iter (playItem_t *it, int iter) {
-    LOCK;
+    READ_LOCK;
     int idx = plt_get_item_idx (playlist, it, iter);
-    UNLOCK;
+    READ_UNLOCK;
     return idx;
 }
 
-playItem_t *
-plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
-    LOCK;
+// the caller must hold pl_lock, or own the playlist exclusively
+static void
+plt_insert_item_int (playlist_t *playlist, playItem_t *after, playItem_t *it) {
     pl_item_ref (it);
+    playlist->main_version++;
+
+    // the positions up to the new item stay valid, the rest is indexed again on demand
+    plt_index_reserve (playlist, PL_MAIN, playlist->count[PL_MAIN] + 1);
+    if (!after) {
+        playlist->index_count[PL_MAIN] = 0;
+        plt_index_append (playlist, PL_MAIN, it);
+    }
+    else if (plt_index_contains (playlist, PL_MAIN, after)) {
+        playlist->index_count[PL_MAIN] = after->_index[PL_MAIN] + 1;
+        plt_index_append (playlist, PL_MAIN, it);
+    }
+
     if (!after) {
         it->next[PL_MAIN] = playlist->head[PL_MAIN];
         it->prev[PL_MAIN] = NULL;
@@ -1910,8 +2512,14 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
         playlist->totaltime += dur;
     }
 
-    plt_modified (playlist);
+    pl_search_index_insert (playlist, it);
+}
 
+playItem_t *
+plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
+    LOCK;
+    plt_insert_item_int (playlist, after, it);
+    plt_modified (playlist);
     UNLOCK;
     return it;
 }
@@ -1936,8 +2544,9 @@ pl_item_copy (playItem_t *out, playItem_t *it) {
     out->prev[PL_SEARCH] = it->prev[PL_SEARCH];
     out->_refc = 1;
 
-    for (DB_metaInfo_t *meta = it->meta; meta; meta = meta->next) {
-        pl_add_meta_copy (out, meta);
+    pl_meta_reserve (out, it->_meta_count);
+    for (int i = 0; i < it->_meta_count; i++) {
+        pl_add_meta_copy (out, &it->_meta[i]);
     }
     UNLOCK;
 }
@@ -1948,6 +2557,7 @@ pl_item_alloc (void) {
     memset (it, 0, sizeof (playItem_t));
     it->_duration = -1;
     it->_refc = 1;
+    pl_item_meta_changed (it);
     return it;
 }
 
@@ -1961,23 +2571,15 @@ pl_item_alloc_init (const char *fname, const char *decoder_id) {
 
 void
 pl_item_ref (playItem_t *it) {
-    LOCK;
-    it->_refc++;
+    __atomic_add_fetch (&it->_refc, 1, __ATOMIC_RELAXED);
     //fprintf (stderr, "\033[0;34m+it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    UNLOCK;
 }
 
 static void
 pl_item_free (playItem_t *it) {
     LOCK;
     if (it) {
-        while (it->meta) {
-            pl_meta_free_values (it->meta);
-            DB_metaInfo_t *m = it->meta;
-            it->meta = m->next;
-            free (m);
-        }
-
+        pl_meta_free_all (it);
         free (it);
     }
     UNLOCK;
@@ -1985,17 +2587,15 @@ pl_item_free (playItem_t *it) {
 
 void
 pl_item_unref (playItem_t *it) {
-    LOCK;
-    it->_refc--;
-    //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    if (it->_refc < 0) {
+    int refc = __atomic_sub_fetch (&it->_refc, 1, __ATOMIC_ACQ_REL);
+    //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, refc, pl_find_meta_raw (it, ":URI"));
+    if (refc < 0) {
         trace ("\033[0;31mplaylist: bad refcount on item %p\033[37;0m\n", it);
     }
-    if (it->_refc <= 0) {
+    if (refc <= 0) {
         //printf ("\033[0;31mdeleted %s\033[37;0m\n", pl_find_meta_raw (it, ":URI"));
         pl_item_free (it);
     }
-    UNLOCK;
 }
 
 int
@@ -2051,203 +2651,458 @@ pl_crop_selected (void) {
     UNLOCK;
 }
 
-int
-plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    LOCK;
-    plt->last_save_modification_idx = plt->last_save_modification_idx;
-    const char *ext = strrchr (fname, '.');
-    if (ext) {
-        DB_playlist_t **plug = deadbeef->plug_get_playlist_list ();
-        for (int i = 0; plug[i]; i++) {
-            if (plug[i]->extensions && plug[i]->load) {
-                const char **exts = plug[i]->extensions;
-                if (exts && plug[i]->save) {
-                    for (int e = 0; exts[e]; e++) {
-                        if (!strcasecmp (exts[e], ext+1)) {
-                            int res = plug[i]->save ((ddb_playlist_t *)plt, fname, (DB_playItem_t *)playlist->head[PL_MAIN], NULL);
-                            UNLOCK;
-                            return res;
-                        }
-                    }
-                }
-            }
-        }
+// DBPL 2.0 layout, all values are in native byte order:
+//   dbpl2_header_t
+//   uint32_t string_offsets[nstrings] -- offsets into the string data
+//   string data: {uint32_t size; char data[size];} padded to 4 bytes,
+//     size includes the terminating 0, multivalue strings are kept intact
+//   dbpl2_track_t tracks[ntracks]
+//   dbpl2_meta_t meta[nmeta] -- track metadata, see meta_first/meta_count
+//   dbpl2_meta_t plt_meta[npltmeta] -- playlist metadata
+// Every string is stored once, and is interned once when loading.
+typedef struct {
+    char magic[4];
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t reserved;
+    uint32_t nstrings;
+    uint32_t strdata_size;
+    uint32_t ntracks;
+    uint32_t nmeta;
+    uint32_t npltmeta;
+    uint32_t reserved2;
+} dbpl2_header_t;
+
+#define DBPL2_HAS_STARTSAMPLE 1
+#define DBPL2_HAS_ENDSAMPLE 2
+
+typedef struct {
+    int64_t startsample;
+    int64_t endsample;
+    float duration;
+    uint32_t flags; // DDB_IS_SUBTRACK, tag flags, etc
+    uint32_t meta_first;
+    uint16_t meta_count;
+    uint16_t bits; // DBPL2_HAS_*
+} dbpl2_track_t;
+
+typedef struct {
+    uint32_t key;
+    uint32_t value;
+} dbpl2_meta_t;
+
+// maps string pointers to string table indexes;
+// metadata strings are interned, so comparing pointers is enough to deduplicate them
+typedef struct {
+    const char **values;
+    uint32_t *sizes;
+    uint32_t count;
+    uint32_t alloc;
+    uint32_t *hash; // index+1, 0 means empty slot
+    uint32_t hash_size;
+    uint32_t data_size;
+} dbpl2_strtab_t;
+
+static inline uint32_t
+dbpl2_ptr_hash (const char *value) {
+    return (uint32_t)(((uintptr_t)value >> 3) * 2654435761u);
+}
+
+static int
+dbpl2_strtab_grow (dbpl2_strtab_t *t) {
+    uint32_t alloc = t->alloc ? t->alloc * 2 : 1024;
+    const char **values = realloc (t->values, alloc * sizeof (const char *));
+    if (!values) {
+        return -1;
+    }
+    t->values = values;
+    uint32_t *sizes = realloc (t->sizes, alloc * sizeof (uint32_t));
+    if (!sizes) {
+        return -1;
     }
+    t->sizes = sizes;
+    t->alloc = alloc;
 
-    char tempfile[PATH_MAX];
-    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
-    const char magic[] = "DBPL";
-    uint8_t majorver = PLAYLIST_MAJOR_VER;
-    uint8_t minorver = PLAYLIST_MINOR_VER;
-    FILE *fp = fopen (tempfile, "w+b");
-    if (!fp) {
-        UNLOCK;
+    uint32_t hash_size = alloc * 2;
+    uint32_t *hash = calloc (hash_size, sizeof (uint32_t));
+    if (!hash) {
         return -1;
     }
-    if (fwrite (magic, 1, 4, fp) != 4) {
-        goto save_fail;
+    for (uint32_t i = 0; i < t->count; i++) {
+        uint32_t h = dbpl2_ptr_hash (t->values[i]) & (hash_size-1);
+        while (hash[h]) {
+            h = (h + 1) & (hash_size-1);
+        }
+        hash[h] = i + 1;
     }
-    if (fwrite (&majorver, 1, 1, fp) != 1) {
-        goto save_fail;
+    free (t->hash);
+    t->hash = hash;
+    t->hash_size = hash_size;
+    return 0;
+}
+
+// returns the string index, or -1 on failure
+static int64_t
+dbpl2_strtab_add (dbpl2_strtab_t *t, const char *value, uint32_t size) {
+    if (t->hash_size) {
+        uint32_t h = dbpl2_ptr_hash (value) & (t->hash_size-1);
+        while (t->hash[h]) {
+            if (t->values[t->hash[h]-1] == value) {
+                return t->hash[h]-1;
+            }
+            h = (h + 1) & (t->hash_size-1);
+        }
     }
-    if (fwrite (&minorver, 1, 1, fp) != 1) {
-        goto save_fail;
+    if (t->count >= t->alloc && dbpl2_strtab_grow (t) < 0) {
+        return -1;
     }
-    uint32_t cnt = plt->count[PL_MAIN];
-    if (fwrite (&cnt, 1, 4, fp) != 4) {
-        goto save_fail;
+    uint32_t h = dbpl2_ptr_hash (value) & (t->hash_size-1);
+    while (t->hash[h]) {
+        h = (h + 1) & (t->hash_size-1);
     }
+    t->hash[h] = t->count + 1;
+    t->values[t->count] = value;
+    t->sizes[t->count] = size;
+    t->data_size += 4 + ((size + 3) & ~3);
+    return t->count++;
+}
+
+static void
+dbpl2_strtab_free (dbpl2_strtab_t *t) {
+    free (t->values);
+    free (t->sizes);
+    free (t->hash);
+}
+
+static inline int
+dbpl2_meta_is_saved (pl_meta_t *m) {
+    return m->key[0] != '_' && m->key[0] != '!'; // skip reserved names
+}
+
+// must be called from inside of pl_lock
+static int
+plt_save_dbpl2 (playlist_t *plt, FILE *fp, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    dbpl2_strtab_t strtab;
+    memset (&strtab, 0, sizeof (strtab));
+    int res = -1;
+    uint32_t nmeta = 0;
+    uint32_t npltmeta = 0;
+    DB_metaInfo_t *m;
+    pl_meta_t *tm;
+
+    // collect strings
     for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        uint16_t l;
-        uint8_t ll;
-        if (cb) {
-            cb(it, user_data);
+        if (pabort && *pabort) {
+            goto out;
         }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *fname = pl_find_meta_raw (it, ":URI");
-        l = strlen (fname);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-        if (fwrite (fname, 1, l, fp) != l) {
-            goto save_fail;
+        if (cb) {
+            cb (it, user_data);
         }
-        const char *decoder_id = pl_find_meta_raw (it, ":DECODER");
-        if (decoder_id) {
-            ll = strlen (decoder_id);
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
-            }
-            if (fwrite (decoder_id, 1, ll, fp) != ll) {
-                goto save_fail;
+        for (tm = it->_meta; tm < it->_meta + it->_meta_count; tm++) {
+            if (!dbpl2_meta_is_saved (tm)) {
+                continue;
             }
-        }
-        else
-        {
-            ll = 0;
-            if (fwrite (&ll, 1, 1, fp) != 1) {
-                goto save_fail;
+            if (dbpl2_strtab_add (&strtab, tm->key, (uint32_t)strlen (tm->key) + 1) < 0
+                || dbpl2_strtab_add (&strtab, tm->value, (uint32_t)metacache_get_value_size (tm->value)) < 0) {
+                goto out;
             }
+            nmeta++;
         }
-        l = pl_find_meta_int (it, ":TRACKNUM", 0);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
-        }
-#endif
-        if (fwrite (&it->startsample32, 1, 4, fp) != 4) {
-            goto save_fail;
+    }
+    for (m = plt->meta; m; m = m->next) {
+        if (dbpl2_strtab_add (&strtab, m->key, (uint32_t)strlen (m->key) + 1) < 0
+            || dbpl2_strtab_add (&strtab, m->value, (uint32_t)strlen (m->value) + 1) < 0) {
+            goto out;
         }
-        if (fwrite (&it->endsample32, 1, 4, fp) != 4) {
-            goto save_fail;
+        npltmeta++;
+    }
+
+    dbpl2_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, "DBPL", 4);
+    hdr.majorver = PLAYLIST_MAJOR_VER;
+    hdr.minorver = PLAYLIST_MINOR_VER;
+    hdr.nstrings = strtab.count;
+    hdr.strdata_size = strtab.data_size;
+    hdr.ntracks = plt->count[PL_MAIN];
+    hdr.nmeta = nmeta;
+    hdr.npltmeta = npltmeta;
+    if (fwrite (&hdr, sizeof (hdr), 1, fp) != 1) {
+        goto out;
+    }
+
+    // string offsets
+    uint32_t offs = 0;
+    for (uint32_t i = 0; i < strtab.count; i++) {
+        if (fwrite (&offs, 4, 1, fp) != 1) {
+            goto out;
         }
-        if (fwrite (&it->_duration, 1, 4, fp) != 4) {
-            goto save_fail;
+        offs += 4 + ((strtab.sizes[i] + 3) & ~3);
+    }
+
+    // string data
+    static const char padding[4];
+    for (uint32_t i = 0; i < strtab.count; i++) {
+        uint32_t size = strtab.sizes[i];
+        if (fwrite (&size, 4, 1, fp) != 1
+            || fwrite (strtab.values[i], 1, size, fp) != size
+            || fwrite (padding, 1, ((size + 3) & ~3) - size, fp) != ((size + 3) & ~3) - size) {
+            goto out;
         }
-#if (PLAYLIST_MINOR_VER==2)
-        const char *filetype = pl_find_meta_raw (it, ":FILETYPE");
-        if (!filetype) {
-            filetype = "";
+    }
+
+    // tracks
+    uint32_t meta_first = 0;
+    uint32_t ntracks = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], ntracks++) {
+        dbpl2_track_t trk;
+        memset (&trk, 0, sizeof (trk));
+        trk.startsample = pl_item_get_startsample (it);
+        trk.endsample = pl_item_get_endsample (it);
+        trk.duration = it->_duration;
+        trk.flags = it->_flags;
+        trk.meta_first = meta_first;
+        trk.bits = (it->has_startsample64 ? DBPL2_HAS_STARTSAMPLE : 0) | (it->has_endsample64 ? DBPL2_HAS_ENDSAMPLE : 0);
+        for (tm = it->_meta; tm < it->_meta + it->_meta_count; tm++) {
+            if (dbpl2_meta_is_saved (tm)) {
+                trk.meta_count++;
+            }
         }
-        uint8_t ft = strlen (filetype);
-        if (fwrite (&ft, 1, 1, fp) != 1) {
-            goto save_fail;
+        meta_first += trk.meta_count;
+        if (fwrite (&trk, sizeof (trk), 1, fp) != 1) {
+            goto out;
         }
-        if (ft) {
-            if (fwrite (filetype, 1, ft, fp) != ft) {
-                goto save_fail;
+    }
+    if (ntracks != hdr.ntracks) {
+        goto out;
+    }
+
+    // track metadata
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        for (tm = it->_meta; tm < it->_meta + it->_meta_count; tm++) {
+            if (!dbpl2_meta_is_saved (tm)) {
+                continue;
+            }
+            dbpl2_meta_t pair;
+            pair.key = (uint32_t)dbpl2_strtab_add (&strtab, tm->key, 0);
+            pair.value = (uint32_t)dbpl2_strtab_add (&strtab, tm->value, 0);
+            if (fwrite (&pair, sizeof (pair), 1, fp) != 1) {
+                goto out;
             }
         }
-        float rg_albumgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMGAIN);
-        float rg_albumpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_ALBUMPEAK);
-        float rg_trackgain = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKGAIN);
-        float rg_trackpeak = pl_get_item_replaygain (it, DDB_REPLAYGAIN_TRACKPEAK);
-        if (fwrite (&rg_albumgain, 1, 4, fp) != 4) {
-            goto save_fail;
-        }
-        if (fwrite (&rg_albumpeak, 1, 4, fp) != 4) {
-            goto save_fail;
+    }
+
+    // playlist metadata
+    for (m = plt->meta; m; m = m->next) {
+        dbpl2_meta_t pair;
+        pair.key = (uint32_t)dbpl2_strtab_add (&strtab, m->key, 0);
+        pair.value = (uint32_t)dbpl2_strtab_add (&strtab, m->value, 0);
+        if (fwrite (&pair, sizeof (pair), 1, fp) != 1) {
+            goto out;
         }
-        if (fwrite (&rg_trackgain, 1, 4, fp) != 4) {
-            goto save_fail;
+    }
+
+    res = 0;
+out:
+    dbpl2_strtab_free (&strtab);
+    return res;
+}
+
+// takes ownership of fd; a private playlist, which is not in the playlist list yet,
+// is filled without taking pl_lock
+static playItem_t *
+plt_load_dbpl2_fd (playlist_t *plt, int fd, const char *fname, int *pabort, int private) {
+    struct stat st;
+    if (fstat (fd, &st) < 0 || st.st_size < sizeof (dbpl2_header_t)) {
+        close (fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+    int mapped = 1;
+    uint8_t *buf = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED) {
+        mapped = 0;
+        buf = malloc (size);
+        if (!buf || read (fd, buf, size) != size) {
+            free (buf);
+            close (fd);
+            return NULL;
         }
-        if (fwrite (&rg_trackpeak, 1, 4, fp) != 4) {
-            goto save_fail;
+    }
+    close (fd);
+
+    playItem_t *last_added = NULL;
+    const char **strings = NULL;
+    uint32_t *sizes = NULL;
+    uint32_t nstrings = 0;
+
+    dbpl2_header_t hdr;
+    memcpy (&hdr, buf, sizeof (hdr));
+
+    // validate section sizes
+    uint64_t offs_pos = sizeof (hdr);
+    uint64_t strdata_pos = offs_pos + (uint64_t)hdr.nstrings * 4;
+    uint64_t tracks_pos = strdata_pos + hdr.strdata_size;
+    uint64_t meta_pos = tracks_pos + (uint64_t)hdr.ntracks * sizeof (dbpl2_track_t);
+    uint64_t pltmeta_pos = meta_pos + (uint64_t)hdr.nmeta * sizeof (dbpl2_meta_t);
+    uint64_t end = pltmeta_pos + (uint64_t)hdr.npltmeta * sizeof (dbpl2_meta_t);
+    if (end > size) {
+        trace ("plt_load: %s is truncated\n", fname);
+        goto load_fail;
+    }
+
+    // intern all strings once
+    strings = calloc (hdr.nstrings ? hdr.nstrings : 1, sizeof (const char *));
+    sizes = calloc (hdr.nstrings ? hdr.nstrings : 1, sizeof (uint32_t));
+    if (!strings || !sizes) {
+        goto load_fail;
+    }
+    for (nstrings = 0; nstrings < hdr.nstrings; nstrings++) {
+        uint32_t offs;
+        memcpy (&offs, buf + offs_pos + nstrings * 4, 4);
+        if ((uint64_t)offs + 4 > hdr.strdata_size) {
+            goto load_fail;
         }
-#endif
-        if (fwrite (&it->_flags, 1, 4, fp) != 4) {
-            goto save_fail;
+        const uint8_t *p = buf + strdata_pos + offs;
+        uint32_t sz;
+        memcpy (&sz, p, 4);
+        if (sz == 0 || (uint64_t)offs + 4 + sz > hdr.strdata_size || p[4 + sz - 1] != 0) {
+            goto load_fail;
         }
+        strings[nstrings] = metacache_add_value ((const char *)p + 4, sz);
+        sizes[nstrings] = sz;
+    }
 
-        int16_t nm = 0;
-        DB_metaInfo_t *m;
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
-            nm++;
+    for (uint32_t i = 0; i < hdr.ntracks; i++) {
+        if (pabort && *pabort) {
+            break;
         }
-        if (fwrite (&nm, 1, 2, fp) != 2) {
-            goto save_fail;
+        dbpl2_track_t trk;
+        memcpy (&trk, buf + tracks_pos + i * sizeof (dbpl2_track_t), sizeof (trk));
+        if ((uint64_t)trk.meta_first + trk.meta_count > hdr.nmeta) {
+            goto load_fail;
         }
-        for (m = it->meta; m; m = m->next) {
-            if (m->key[0] == '_' || m->key[0] == '!') {
-                continue; // skip reserved names
-            }
 
-            l = strlen (m->key);
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->key, 1, l, fp) != l) {
-                    goto save_fail;
-                }
-            }
-            l = m->valuesize-1;
-            if (fwrite (&l, 1, 2, fp) != 2) {
-                goto save_fail;
-            }
-            if (l) {
-                if (fwrite (m->value, 1, l, fp) != l) {
-                    goto save_fail;
-                }
+        playItem_t *it = pl_item_alloc ();
+        if (!it) {
+            goto load_fail;
+        }
+        pl_meta_reserve (it, trk.meta_count);
+        for (uint32_t m = 0; m < trk.meta_count; m++) {
+            dbpl2_meta_t pair;
+            memcpy (&pair, buf + meta_pos + (trk.meta_first + m) * sizeof (dbpl2_meta_t), sizeof (pair));
+            if (pair.key >= nstrings || pair.value >= nstrings) {
+                pl_item_unref (it);
+                goto load_fail;
             }
+            pl_add_meta_interned (it, strings[pair.key], strings[pair.value]);
         }
-    }
+        it->startsample64 = trk.startsample;
+        it->startsample32 = trk.startsample >= 0x7fffffff ? 0x7fffffff : (int32_t)trk.startsample;
+        it->has_startsample64 = (trk.bits & DBPL2_HAS_STARTSAMPLE) ? 1 : 0;
+        it->endsample64 = trk.endsample;
+        it->endsample32 = trk.endsample >= 0x7fffffff ? 0x7fffffff : (int32_t)trk.endsample;
+        it->has_endsample64 = (trk.bits & DBPL2_HAS_ENDSAMPLE) ? 1 : 0;
+        it->_duration = trk.duration;
+        it->_flags = trk.flags;
 
-    // write playlist metadata
-    int16_t nm = 0;
-    DB_metaInfo_t *m;
-    for (m = plt->meta; m; m = m->next) {
-        nm++;
-    }
-    if (fwrite (&nm, 1, 2, fp) != 2) {
-        goto save_fail;
+        if (private) {
+            plt_insert_item_int (plt, plt->tail[PL_MAIN], it);
+        }
+        else {
+            plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        }
+        if (last_added) {
+            pl_item_unref (last_added);
+        }
+        last_added = it;
     }
 
-    for (m = plt->meta; m; m = m->next) {
-        uint16_t l;
-        l = strlen (m->key);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
+    for (uint32_t i = 0; i < hdr.npltmeta; i++) {
+        dbpl2_meta_t pair;
+        memcpy (&pair, buf + pltmeta_pos + i * sizeof (dbpl2_meta_t), sizeof (pair));
+        if (pair.key >= nstrings || pair.value >= nstrings) {
+            goto load_fail;
         }
-        if (l) {
-            if (fwrite (m->key, 1, l, fp) != l) {
-                goto save_fail;
-            }
+        if (private) {
+            plt_add_meta_int (plt, strings[pair.key], strings[pair.value]);
         }
-        l = strlen (m->value);
-        if (fwrite (&l, 1, 2, fp) != 2) {
-            goto save_fail;
+        else {
+            plt_add_meta (plt, strings[pair.key], strings[pair.value]);
         }
-        if (l) {
-            if (fwrite (m->value, 1, l, fp) != l) {
-                goto save_fail;
+    }
+
+    goto done;
+load_fail:
+    fprintf (stderr, "playlist load fail (%s)!\n", fname);
+done:
+    // release the references taken while interning
+    for (uint32_t i = 0; i < nstrings; i++) {
+        metacache_remove_value (strings[i], sizes[i]);
+    }
+    free (strings);
+    free (sizes);
+    if (mapped) {
+        munmap (buf, size);
+    }
+    else {
+        free (buf);
+    }
+    if (last_added) {
+        pl_item_unref (last_added);
+    }
+    return last_added;
+}
+
+static playItem_t *
+plt_load_dbpl2 (playlist_t *plt, const char *fname, int *pabort) {
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    return plt_load_dbpl2_fd (plt, fd, fname, pabort, 0);
+}
+
+int
+plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    LOCK;
+    const char *ext = strrchr (fname, '.');
+    if (ext) {
+        DB_playlist_t **plug = deadbeef->plug_get_playlist_list ();
+        for (int i = 0; plug[i]; i++) {
+            if (plug[i]->extensions && plug[i]->load) {
+                const char **exts = plug[i]->extensions;
+                if (exts && plug[i]->save) {
+                    for (int e = 0; exts[e]; e++) {
+                        if (!strcasecmp (exts[e], ext+1)) {
+                            int res = plug[i]->save ((ddb_playlist_t *)plt, fname, (DB_playItem_t *)playlist->head[PL_MAIN], NULL);
+                            UNLOCK;
+                            return res;
+                        }
+                    }
+                }
             }
         }
     }
 
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+    FILE *fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        UNLOCK;
+        return -1;
+    }
+    if (plt_save_dbpl2 (plt, fp, pabort, cb, user_data) < 0) {
+        goto save_fail;
+    }
     UNLOCK;
+
+    // make sure the data is on disk before replacing the old file
+    if (fflush (fp) != 0 || fsync (fileno (fp)) != 0) {
+        fclose (fp);
+        unlink (tempfile);
+        return -1;
+    }
     fclose (fp);
     if (rename (tempfile, fname) != 0) {
         fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
@@ -2284,7 +3139,10 @@ plt_save_n (int n) {
     int i;
     playlist_t *plt;
     for (i = 0, plt = playlists_head; plt && i < n; i++, plt = plt->next);
-    err = plt_save (plt, NULL, NULL, path, NULL, NULL, NULL);
+    // the file of a playlist which is still loading already has its tracks
+    if (plt && !plt->loading) {
+        err = plt_save (plt, NULL, NULL, path, NULL, NULL, NULL);
+    }
     plt_loading = 0;
     UNLOCK;
     return err;
@@ -2320,7 +3178,7 @@ pl_save_all (void) {
             err = -1;
             break;
         }
-        if (p->last_save_modification_idx == p->modification_idx) {
+        if (p->loading) {
             continue;
         }
         err = plt_save (p, NULL, NULL, path, NULL, NULL, NULL);
@@ -2379,7 +3237,11 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
     if (fread (&majorver, 1, 1, fp) != 1) {
         goto load_fail;
     }
-    if (majorver != PLAYLIST_MAJOR_VER) {
+    if (majorver == PLAYLIST_MAJOR_VER) {
+        fclose (fp);
+        return plt_load_dbpl2 (plt, fname, pabort);
+    }
+    if (majorver != 1) {
         trace ("bad majorver=%d\n", majorver);
         goto load_fail;
     }
@@ -2635,11 +3497,198 @@ plt_load (playlist_t *plt, playItem_t *after, const char *fname, int *pabort, in
     return plt_load_int (0, plt, after, fname, pabort, cb, user_data);
 }
 
+#define PL_LOAD_MAX_THREADS 8
+
+// pl_load_all publishes the current playlist as soon as it's loaded;
+// playlists which are not loaded by then are published empty, with the loading flag set,
+// and receive their tracks from the loader threads later
+typedef struct {
+    playlist_t **plts; // private playlists, owned by the loader until published
+    playlist_t **placeholders; // published playlists waiting for the tracks of plts
+    int *fds; // opened up front, so that renaming the playlist files doesn't affect loading
+    int *cursors;
+    int *scrolls;
+    uint8_t *loaded;
+    int *order; // job order, current playlist first
+    int count;
+    int next_job;
+    int ndone;
+    int curr;
+    int published;
+    playlist_t *curr_plt; // published current playlist, to be indexed after loading
+    int abort_indexing;
+    intptr_t tids[PL_LOAD_MAX_THREADS];
+    int nthreads;
+    struct timeval tm_start;
+    uintptr_t mutex;
+    uintptr_t cond;
+} pl_load_ctx_t;
+
+static pl_load_ctx_t pl_load_ctx;
+
+static int64_t
+pl_load_elapsed_ms (struct timeval *start) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return (int64_t)(tm.tv_sec - start->tv_sec) * 1000 + (tm.tv_usec - start->tv_usec) / 1000;
+}
+
+// moves the tracks and properties of a playlist loaded in background into its published placeholder,
+// in front of anything added to it in the meantime; called under pl_lock
+static void
+pl_load_splice (playlist_t *plt, playlist_t *loaded, int cursor, int scroll) {
+    plt->loading = 0;
+
+    // the playlist might have been deleted while loading
+    playlist_t *p;
+    for (p = playlists_head; p && p != plt; p = p->next);
+    if (!p) {
+        return;
+    }
+
+    int was_empty = !plt->head[PL_MAIN];
+    if (loaded->head[PL_MAIN]) {
+        loaded->tail[PL_MAIN]->next[PL_MAIN] = plt->head[PL_MAIN];
+        if (plt->head[PL_MAIN]) {
+            plt->head[PL_MAIN]->prev[PL_MAIN] = loaded->tail[PL_MAIN];
+        }
+        else {
+            plt->tail[PL_MAIN] = loaded->tail[PL_MAIN];
+        }
+        plt->head[PL_MAIN] = loaded->head[PL_MAIN];
+        plt->count[PL_MAIN] += loaded->count[PL_MAIN];
+        plt->totaltime += loaded->totaltime;
+        plt->index_count[PL_MAIN] = 0;
+        plt->main_version++;
+        plt->recalc_seltime = 1;
+
+        loaded->head[PL_MAIN] = loaded->tail[PL_MAIN] = NULL;
+        loaded->count[PL_MAIN] = 0;
+    }
+    for (DB_metaInfo_t *m = loaded->meta; m; m = m->next) {
+        plt_add_meta_int (plt, m->key, m->value);
+    }
+    if (!plt->search_index) {
+        // the tracks added meanwhile are indexed on the next search
+        plt->search_index = loaded->search_index;
+        loaded->search_index = NULL;
+    }
+    if (was_empty) {
+        plt->current_row[PL_MAIN] = cursor;
+        plt->scroll = scroll;
+        plt->last_save_modification_idx = plt->modification_idx;
+    }
+    messagepump_push (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_CONTENT, 0);
+}
+
+static void
+pl_load_finish_job (pl_load_ctx_t *lc, int job) {
+    LOCK;
+    mutex_lock (lc->mutex);
+    lc->ndone++;
+    int all = lc->ndone == lc->count;
+    playlist_t *placeholder = NULL;
+    if (lc->published) {
+        placeholder = lc->placeholders[job];
+        lc->placeholders[job] = NULL;
+    }
+    else {
+        lc->loaded[job] = 1;
+        if (job == lc->curr) {
+            cond_broadcast (lc->cond);
+        }
+    }
+    mutex_unlock (lc->mutex);
+
+    if (placeholder) {
+        pl_load_splice (placeholder, lc->plts[job], lc->cursors[job], lc->scrolls[job]);
+        plt_unref (lc->plts[job]);
+        lc->plts[job] = NULL;
+        plt_unref (placeholder);
+    }
+    UNLOCK;
+
+    if (all && placeholder) {
+        fprintf (stderr, "INFO: all %d playlists loaded in %lld ms\n", lc->count, (long long)pl_load_elapsed_ms (&lc->tm_start));
+    }
+}
+
+// loads playlists into private playlist_t objects, which are not yet visible
+// to anyone else, so the workers don't take pl_lock while parsing and indexing
+static void
+pl_load_jobs (pl_load_ctx_t *lc) {
+    for (;;) {
+        mutex_lock (lc->mutex);
+        int job = lc->next_job < lc->count ? lc->order[lc->next_job++] : -1;
+        mutex_unlock (lc->mutex);
+        if (job < 0) {
+            break;
+        }
+
+        if (lc->fds[job] >= 0) {
+            char path[1024];
+            if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, job) < sizeof (path)) {
+                fprintf (stderr, "INFO: from file %s\n", path);
+            }
+            plt_load_dbpl2_fd (lc->plts[job], lc->fds[job], path, NULL, 1);
+            lc->fds[job] = -1;
+            if (job != lc->curr) {
+                // the current playlist is published 1st, and indexed afterwards
+                pl_search_index_prebuild (lc->plts[job], 0, &lc->abort_indexing);
+            }
+        }
+        pl_load_finish_job (lc, job);
+    }
+}
+
+static void
+pl_load_worker (void *ctx) {
+    pl_load_ctx_t *lc = ctx;
+    pl_load_jobs (lc);
+
+    // the 1st worker to run out of jobs indexes the current playlist
+    mutex_lock (lc->mutex);
+    while (!lc->published) {
+        cond_wait_locked (lc->cond, lc->mutex);
+    }
+    playlist_t *curr = lc->curr_plt;
+    lc->curr_plt = NULL;
+    mutex_unlock (lc->mutex);
+    if (curr) {
+        pl_search_index_prebuild (curr, 1, &lc->abort_indexing);
+        plt_unref (curr);
+    }
+}
+
+void
+pl_load_all_wait (void) {
+    pl_load_ctx_t *lc = &pl_load_ctx;
+    // loading is finished, indexing is left to the next search
+    __atomic_store_n (&lc->abort_indexing, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < lc->nthreads; i++) {
+        thread_join (lc->tids[i]);
+    }
+    lc->nthreads = 0;
+    if (lc->mutex) {
+        mutex_free (lc->mutex);
+        lc->mutex = 0;
+    }
+    if (lc->cond) {
+        cond_free (lc->cond);
+        lc->cond = 0;
+    }
+    free (lc->plts);
+    free (lc->placeholders);
+    free (lc->fds);
+    free (lc->cursors);
+    free (lc->scrolls);
+    free (lc->loaded);
+    free (lc->order);
+    memset (lc, 0, sizeof (pl_load_ctx_t));
+}
+
 int
 pl_load_all (void) {
-    int i = 0;
-    int err = 0;
-    char path[1024];
     DB_conf_item_t *it = conf_find ("playlist.tab.", NULL);
     if (!it) {
         // legacy (0.3.3 and earlier)
@@ -2657,46 +3706,152 @@ pl_load_all (void) {
         plt_unref (plt);
         return 0;
     }
-    LOCK;
-    plt_loading = 1;
-    while (it) {
-        if (!err) {
-            if (plt_add (plt_get_count (), it->value) < 0) {
-                return -1;
-            }
-            plt_set_curr_idx (plt_get_count () - 1);
-        }
-        err = 0;
+
+    pl_load_ctx_t *lc = &pl_load_ctx;
+    memset (lc, 0, sizeof (pl_load_ctx_t));
+    gettimeofday (&lc->tm_start, NULL);
+    for (DB_conf_item_t *c = it; c; c = conf_find ("playlist.tab.", c)) {
+        lc->count++;
+    }
+    lc->plts = calloc (lc->count, sizeof (playlist_t *));
+    lc->placeholders = calloc (lc->count, sizeof (playlist_t *));
+    lc->fds = calloc (lc->count, sizeof (int));
+    lc->cursors = calloc (lc->count, sizeof (int));
+    lc->scrolls = calloc (lc->count, sizeof (int));
+    lc->loaded = calloc (lc->count, 1);
+    lc->order = calloc (lc->count, sizeof (int));
+    if (!lc->plts || !lc->placeholders || !lc->fds || !lc->cursors || !lc->scrolls || !lc->loaded || !lc->order) {
+        pl_load_all_wait ();
+        return -1;
+    }
+    int i = 0;
+    for (DB_conf_item_t *c = it; c; c = conf_find ("playlist.tab.", c), i++) {
+        lc->plts[i] = plt_alloc (c->value);
+
+        char conf[100];
+        snprintf (conf, sizeof (conf), "playlist.cursor.%d", i);
+        lc->cursors[i] = conf_get_int (conf, -1);
+        snprintf (conf, sizeof (conf), "playlist.scroll.%d", i);
+        lc->scrolls[i] = conf_get_int (conf, 0);
+
+        char path[1024];
         if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, i) > sizeof (path)) {
             fprintf (stderr, "error: failed to make path string for playlist filename\n");
-            err = -1;
+            lc->fds[i] = -1;
+            continue;
         }
-        else {
-            fprintf (stderr, "INFO: from file %s\n", path);
+        lc->fds[i] = open (path, O_RDONLY);
+        if (lc->fds[i] < 0) {
+            continue;
+        }
+        char hdr[5];
+        if (pread (lc->fds[i], hdr, 5, 0) == 5 && !strncmp (hdr, "DBPL", 4) && (uint8_t)hdr[4] == PLAYLIST_MAJOR_VER) {
+            continue;
+        }
+        // older formats are loaded here, they are converted on the next save
+        close (lc->fds[i]);
+        lc->fds[i] = -1;
+        fprintf (stderr, "INFO: from file %s\n", path);
+        plt_load (lc->plts[i], NULL, path, NULL, NULL, NULL);
+    }
 
-            playlist_t *plt = plt_get_curr ();
-            playItem_t *trk = plt_load (plt, NULL, path, NULL, NULL, NULL);
-            char conf[100];
-            snprintf (conf, sizeof (conf), "playlist.cursor.%d", i);
-            plt->current_row[PL_MAIN] = deadbeef->conf_get_int (conf, -1);
-            snprintf (conf, sizeof (conf), "playlist.scroll.%d", i);
-            plt->scroll = deadbeef->conf_get_int (conf, 0);
-            plt->last_save_modification_idx = plt->modification_idx = 0;
-            plt_unref (plt);
+    lc->curr = conf_get_int ("playlist.current", 0);
+    if (lc->curr < 0 || lc->curr >= lc->count) {
+        lc->curr = 0;
+    }
+    lc->order[0] = lc->curr;
+    for (i = 0, lc->next_job = 1; i < lc->count; i++) {
+        if (i != lc->curr) {
+            lc->order[lc->next_job++] = i;
+        }
+    }
+    lc->next_job = 0;
 
-            if (!it) {
-                fprintf (stderr, "WARNING: there were errors while loading playlist '%s' (%s)\n", it->value, path);
-            }
+    lc->mutex = mutex_create_nonrecursive ();
+    lc->cond = cond_create ();
+
+    int nthreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (nthreads > PL_LOAD_MAX_THREADS) {
+        nthreads = PL_LOAD_MAX_THREADS;
+    }
+    if (nthreads > lc->count) {
+        nthreads = lc->count;
+    }
+    for (i = 0; i < nthreads; i++) {
+        lc->tids[lc->nthreads] = thread_start (pl_load_worker, lc);
+        if (lc->tids[lc->nthreads]) {
+            lc->nthreads++;
+        }
+    }
+    if (!lc->nthreads) {
+        // no threads available, load on this thread
+        pl_load_jobs (lc);
+    }
+
+    // wait for the current playlist only
+    mutex_lock (lc->mutex);
+    while (!lc->loaded[lc->curr]) {
+        cond_wait_locked (lc->cond, lc->mutex);
+    }
+    mutex_unlock (lc->mutex);
+
+    LOCK;
+    mutex_lock (lc->mutex);
+    plt_loading = 1;
+    playlist_t *tail = playlists_head;
+    while (tail && tail->next) {
+        tail = tail->next;
+    }
+    playlist_t *curr = NULL;
+    for (i = 0; i < lc->count; i++) {
+        playlist_t *plt;
+        if (lc->loaded[i]) {
+            plt = lc->plts[i];
+            lc->plts[i] = NULL;
+            plt->current_row[PL_MAIN] = lc->cursors[i];
+            plt->scroll = lc->scrolls[i];
         }
-        it = conf_find ("playlist.tab.", it);
-        i++;
+        else {
+            plt = plt_alloc (lc->plts[i]->title);
+            plt->loading = 1;
+            plt->current_row[PL_MAIN] = -1;
+            plt_ref (plt);
+            lc->placeholders[i] = plt;
+        }
+        plt->last_save_modification_idx = plt->modification_idx = 0;
+        if (i == lc->curr) {
+            curr = plt;
+        }
+
+        if (tail) {
+            tail->next = plt;
+        }
+        else {
+            playlists_head = plt;
+        }
+        tail = plt;
+        playlists_count++;
+    }
+    if (lc->nthreads) {
+        plt_ref (curr);
+        lc->curr_plt = curr;
     }
-    plt_set_curr (0);
+    lc->published = 1;
+    cond_broadcast (lc->cond);
+    int ndone = lc->ndone;
+    mutex_unlock (lc->mutex);
+    plt_set_curr (curr);
     plt_loading = 0;
     plt_gen_conf ();
     messagepump_push (DB_EV_PLAYLISTSWITCHED, 0, 0, 0);
     UNLOCK;
-    return err;
+
+    int64_t ms = pl_load_elapsed_ms (&lc->tm_start);
+    fprintf (stderr, "INFO: current playlist ready in %lld ms, loading %d more playlists with %d threads\n", (long long)ms, lc->count - ndone, lc->nthreads);
+    if (ndone == lc->count) {
+        fprintf (stderr, "INFO: all %d playlists loaded in %lld ms\n", lc->count, (long long)ms);
+    }
+    return 0;
 }
 
 static inline void
@@ -2830,7 +3985,7 @@ pl_get_item_replaygain (playItem_t *it, int idx) {
 
 int
 pl_format_item_queue (playItem_t *it, char *s, int size) {
-    LOCK;
+    READ_LOCK;
     *s = 0;
     int initsize = size;
     const char *val = pl_find_meta_raw (it, "_playing");
@@ -2880,7 +4035,7 @@ pl_format_item_queue (playItem_t *it, char *s, int size) {
     int pq_cnt = playqueue_getcount ();
 
     if (!pq_cnt) {
-        UNLOCK;
+        READ_UNLOCK;
         return 0;
     }
 
@@ -2914,7 +4069,7 @@ pl_format_item_queue (playItem_t *it, char *s, int size) {
         s += len;
         size -= len;
     }
-    UNLOCK;
+    READ_UNLOCK;
     return initsize-size;
 }
 
@@ -3427,9 +4582,9 @@ plt_get_totaltime (playlist_t *playlist) {
 
 float
 pl_get_totaltime (void) {
-    LOCK;
+    READ_LOCK;
     float t = plt_get_totaltime (playlist);
-    UNLOCK;
+    READ_UNLOCK;
     return t;
 }
 
@@ -3489,9 +4644,9 @@ plt_get_first (playlist_t *playlist, int iter) {
 
 playItem_t *
 pl_get_first (int iter) {
-    LOCK;
+    READ_LOCK;
     playItem_t *it = plt_get_first (playlist, iter);
-    UNLOCK;
+    READ_UNLOCK;
     return it;
 }
 
@@ -3506,9 +4661,9 @@ plt_get_last (playlist_t *playlist, int iter) {
 
 playItem_t *
 pl_get_last (int iter) {
-    LOCK;
+    READ_LOCK;
     playItem_t *it = plt_get_last (playlist, iter);
-    UNLOCK;
+    READ_UNLOCK;
     return it;
 }
 
@@ -3540,9 +4695,9 @@ plt_get_cursor (playlist_t *playlist, int iter) {
 
 int
 pl_get_cursor (int iter) {
-    LOCK;
+    READ_LOCK;
     int c = plt_get_cursor (playlist, iter);
-    UNLOCK;
+    READ_UNLOCK;
     return c;
 }
 
@@ -3629,10 +4784,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
-        }
+        playItem_t *it = plt_get_item_for_idx (from, indices[i], iter);
         items[i] = it;
         if (!it) {
             trace ("plt_copy_items: warning: item %d not found in source plt_to\n", indices[i]);
@@ -3645,6 +4797,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
             pl_item_copy (new_it, items[i]);
             pl_insert_item (after, new_it);
             pl_item_unref (new_it);
+            pl_item_unref (items[i]);
             after = new_it;
         }
     }
@@ -3667,6 +4820,9 @@ plt_search_reset_int (playlist_t *playlist, int clear_selection) {
     }
     playlist->tail[PL_SEARCH] = NULL;
     playlist->count[PL_SEARCH] = 0;
+    playlist->index_count[PL_SEARCH] = 0;
+    free (playlist->search_text);
+    playlist->search_text = NULL;
     UNLOCK;
 }
 
@@ -3675,11 +4831,607 @@ plt_search_reset (playlist_t *playlist) {
     plt_search_reset_int (playlist, 1);
 }
 
-// FIXME: multivalue support
-void
-plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
+// returns the part of the metadata which is matched by the search, or NULL
+// if the field is not searched; sets *stop if none of the following fields are searched
+const char *
+plt_search_meta_value (pl_meta_t *m, int *stop) {
+    int is_uri = !strcmp (m->key, ":URI");
+    if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+        *stop = 1;
+        return NULL;
+    }
+    if (!strcasecmp (m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+        return NULL;
+    }
+    const char *value = m->value;
+    if (is_uri) {
+        value = strrchr (value, '/');
+        if (value) {
+            value++;
+        }
+        else {
+            value = m->value;
+        }
+    }
+    return value;
+}
+
+// lc must be lowercase; the results are memoized per metacache string using cmpidx
+static int
+plt_search_item_matches (playItem_t *it, const char *lc, int lc_is_valid_u8, int cmpidx) {
+    int stop = 0;
+    for (pl_meta_t *m = it->_meta; m < it->_meta + it->_meta_count && !stop; m++) {
+        const char *value = plt_search_meta_value (m, &stop);
+        if (!value) {
+            continue;
+        }
+        char cmp = *(m->value-1);
+
+        if (abs (cmp) == cmpidx) {
+            if (cmp > 0) {
+                return 1;
+            }
+        }
+        else if (lc_is_valid_u8 && u8_valid(value, strlen(value), NULL) && utfcasestr_fast (value, lc)) {
+            //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
+            *((char *)m->value-1) = cmpidx;
+            return 1;
+        }
+        else {
+            *((char *)m->value-1) = -cmpidx;
+        }
+    }
+    return 0;
+}
+
+static void
+plt_search_add_result (playlist_t *playlist, playItem_t *it, int select_results) {
+    it->next[PL_SEARCH] = NULL;
+    it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
+    if (playlist->tail[PL_SEARCH]) {
+        playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
+        playlist->tail[PL_SEARCH] = it;
+    }
+    else {
+        playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
+    }
+    if (select_results) {
+        pl_set_selected_in_playlist(playlist, it, 1);
+    }
+    playlist->count[PL_SEARCH]++;
+    plt_index_reserve (playlist, PL_SEARCH, playlist->count[PL_SEARCH]);
+}
+
+// Trigram index of the searched metadata.
+// Every indexed track gets a slot, and each trigram of its lowercased values
+// gets a posting list of the slots containing it.  A track which is changed
+// gets a new slot, so the posting lists stay sorted and are only appended to;
+// the slots of removed tracks are dropped when the index is rebuilt.
+// The index only selects the candidates, which are then matched as usual.
+#define PL_SEARCH_INDEX_MIN_TRACKS 5000
+#define PL_SEARCH_INDEX_MAX_VALUE 1024 // tracks with longer values are always matched
+// the tracks are indexed and matched in chunks, releasing the lock in between,
+// so that a long search doesn't block the UI
+#define PL_SEARCH_CHUNK 256
+
+typedef struct {
+    uint32_t key; // trigram hash, 0 for empty buckets
+    uint32_t count; // number of slots
+    uint32_t last; // last added slot
+    uint32_t size;
+    uint32_t alloc;
+    uint8_t *data; // deltas of the ascending slots, as varints
+} pl_search_posting_t;
+
+typedef struct pl_search_index_s {
+    // the items are only compared, or accessed after finding them in the playlist
+    playItem_t **items;
+    uint32_t *versions; // _meta_version of the items when indexed
+    uint32_t nslots; // slot 0 is not used
+    uint32_t slots_alloc;
+    uint32_t live; // number of slots found in the playlist by the last search
+    pl_search_posting_t *postings; // open addressing hash table
+    uint32_t npostings;
+    uint32_t postings_size;
+    uint32_t *always; // slots which can't be indexed
+    uint32_t nalways;
+    uint32_t always_alloc;
+} pl_search_index_t;
+
+static pl_search_index_t *
+pl_search_index_alloc (void) {
+    pl_search_index_t *idx = calloc (1, sizeof (pl_search_index_t));
+    idx->nslots = 1;
+    idx->postings_size = 1024;
+    idx->postings = calloc (idx->postings_size, sizeof (pl_search_posting_t));
+    return idx;
+}
+
+static void
+pl_search_index_free (pl_search_index_t *idx) {
+    for (uint32_t i = 0; i < idx->postings_size; i++) {
+        free (idx->postings[i].data);
+    }
+    free (idx->postings);
+    free (idx->items);
+    free (idx->versions);
+    free (idx->always);
+    free (idx);
+}
+
+static uint32_t
+pl_search_trigram_key (const char *s, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    }
+    return h ? h : 1;
+}
+
+static pl_search_posting_t *
+pl_search_index_find (pl_search_index_t *idx, uint32_t key) {
+    uint32_t mask = idx->postings_size - 1;
+    for (uint32_t i = key & mask; ; i = (i + 1) & mask) {
+        pl_search_posting_t *p = &idx->postings[i];
+        if (p->key == key || !p->key) {
+            return p;
+        }
+    }
+}
+
+static void
+pl_search_index_add (pl_search_index_t *idx, uint32_t key, uint32_t slot) {
+    pl_search_posting_t *p = pl_search_index_find (idx, key);
+    if (!p->key) {
+        if ((idx->npostings + 1) * 2 > idx->postings_size) {
+            pl_search_posting_t *old = idx->postings;
+            uint32_t oldsize = idx->postings_size;
+            idx->postings_size *= 2;
+            idx->postings = calloc (idx->postings_size, sizeof (pl_search_posting_t));
+            for (uint32_t i = 0; i < oldsize; i++) {
+                if (old[i].key) {
+                    *pl_search_index_find (idx, old[i].key) = old[i];
+                }
+            }
+            free (old);
+            p = pl_search_index_find (idx, key);
+        }
+        p->key = key;
+        idx->npostings++;
+    }
+    else if (p->last == slot) {
+        return;
+    }
+    if (p->size + 5 > p->alloc) {
+        p->alloc = p->alloc ? p->alloc * 2 : 8;
+        p->data = realloc (p->data, p->alloc);
+    }
+    uint32_t delta = slot - p->last;
+    while (delta >= 0x80) {
+        p->data[p->size++] = (uint8_t)(delta | 0x80);
+        delta >>= 7;
+    }
+    p->data[p->size++] = (uint8_t)delta;
+    p->last = slot;
+    p->count++;
+}
+
+// splits lowercase text into characters, returns the number of characters,
+// or -1 if text doesn't fit
+static int
+pl_search_split_chars (const char *text, int *offs, int maxchars) {
+    int n = 0;
+    int32_t i = 0;
+    while (text[i]) {
+        if (n == maxchars) {
+            return -1;
+        }
+        offs[n++] = i;
+        u8_nextchar (text, &i);
+    }
+    offs[n] = i;
+    return n;
+}
+
+// returns -1 if the value can't be indexed
+static int
+pl_search_index_value (pl_search_index_t *idx, uint32_t slot, const char *value) {
+    // lowercase the same way as utfcasestr_fast does it
+    char lw[PL_SEARCH_INDEX_MAX_VALUE * 4 + 10];
+    int offs[PL_SEARCH_INDEX_MAX_VALUE + 1];
+    int n = 0;
+    int l = 0;
+    const char *p = value;
+    while (*p) {
+        if (n == PL_SEARCH_INDEX_MAX_VALUE) {
+            return -1;
+        }
+        offs[n++] = l;
+        if ((uint8_t)*p < 0x80) {
+            lw[l++] = (*p >= 'A' && *p <= 'Z') ? *p + 0x20 : *p;
+            p++;
+            continue;
+        }
+        int32_t i = 0;
+        u8_nextchar (p, &i);
+        int ll = u8_tolower ((const signed char *)p, i, lw + l);
+        // the index is per character, which doesn't work if lowercasing produces more characters
+        int32_t c = 0;
+        u8_nextchar (lw + l, &c);
+        if (c != ll) {
+            return -1;
+        }
+        l += ll;
+        p += i;
+    }
+    offs[n] = l;
+    for (int i = 0; i + 3 <= n; i++) {
+        pl_search_index_add (idx, pl_search_trigram_key (lw + offs[i], offs[i+3] - offs[i]), slot);
+    }
+    return 0;
+}
+
+static void
+pl_search_index_item (pl_search_index_t *idx, playItem_t *it) {
+    if (idx->nslots >= idx->slots_alloc) {
+        idx->slots_alloc = idx->slots_alloc ? idx->slots_alloc * 2 : 1024;
+        idx->items = realloc (idx->items, idx->slots_alloc * sizeof (playItem_t *));
+        idx->versions = realloc (idx->versions, idx->slots_alloc * sizeof (uint32_t));
+    }
+    uint32_t slot = idx->nslots++;
+    idx->items[slot] = it;
+    idx->versions[slot] = it->_meta_version;
+    it->_search_slot = slot;
+
+    int stop = 0;
+    for (pl_meta_t *m = it->_meta; m < it->_meta + it->_meta_count && !stop; m++) {
+        const char *value = plt_search_meta_value (m, &stop);
+        // invalid utf8 never matches
+        if (!value || !u8_valid (value, strlen (value), NULL)) {
+            continue;
+        }
+        if (pl_search_index_value (idx, slot, value) < 0) {
+            if (idx->nalways == idx->always_alloc) {
+                idx->always_alloc = idx->always_alloc ? idx->always_alloc * 2 : 64;
+                idx->always = realloc (idx->always, idx->always_alloc * sizeof (uint32_t));
+            }
+            idx->always[idx->nalways++] = slot;
+            break;
+        }
+    }
+}
+
+static int
+pl_search_index_contains (pl_search_index_t *idx, playItem_t *it) {
+    uint32_t slot = it->_search_slot;
+    return slot && slot < idx->nslots && idx->items[slot] == it;
+}
+
+// once a playlist has an index, it's kept up to date with the tracks added to the playlist
+static void
+pl_search_index_insert (playlist_t *playlist, playItem_t *it) {
+    pl_search_index_t *idx = playlist->search_index;
+    if (!idx) {
+        return;
+    }
+    // tracks moved within the playlist keep their slots
+    if (!pl_search_index_contains (idx, it) || idx->versions[it->_search_slot] != it->_meta_version) {
+        pl_search_index_item (idx, it);
+    }
+    idx->live++;
+}
+
+static void
+pl_search_index_remove (playlist_t *playlist, playItem_t *it) {
+    pl_search_index_t *idx = playlist->search_index;
+    if (idx && idx->live && pl_search_index_contains (idx, it)) {
+        idx->live--;
+    }
+}
+
+static int
+plt_search_aborted (int *pabort, int i) {
+    return pabort && !(i & 0xff) && __atomic_load_n (pabort, __ATOMIC_RELAXED);
+}
+
+// indexes the tracks which were added or changed since the last search;
+// if unlock is set, the lock is released between the chunks of PL_SEARCH_CHUNK tracks;
+// returns -1 if aborted, 1 if the playlist was changed meanwhile
+static int
+pl_search_index_update (playlist_t *playlist, int unlock, int *pabort) {
+    pl_search_index_t *idx = playlist->search_index;
+    if (idx && idx->nslots - 1 > idx->live * 2 + PL_SEARCH_INDEX_MIN_TRACKS) {
+        // too many removed or changed tracks
+        pl_search_index_free (idx);
+        idx = playlist->search_index = NULL;
+    }
+    if (!idx) {
+        idx = playlist->search_index = pl_search_index_alloc ();
+    }
+    uint32_t live = 0;
+    int i = 0;
+    int indexed = 0;
+    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN], i++) {
+        if (plt_search_aborted (pabort, i)) {
+            // the tracks indexed so far stay in the index
+            return -1;
+        }
+        if (pl_search_index_contains (idx, it) && idx->versions[it->_search_slot] == it->_meta_version) {
+            live++;
+            continue;
+        }
+        pl_search_index_item (idx, it);
+        live++;
+        if (unlock && !(++indexed % PL_SEARCH_CHUNK)) {
+            uint32_t main_version = playlist->main_version;
+            UNLOCK;
+            LOCK;
+            if (playlist->main_version != main_version || playlist->search_index != idx) {
+                return 1;
+            }
+        }
+    }
+    idx->live = live;
+    return 0;
+}
+
+// builds the index of a large playlist in advance, so that the first search doesn't have to;
+// a shared playlist is indexed under pl_lock, which is released between the chunks
+static void
+pl_search_index_prebuild (playlist_t *playlist, int shared, int *pabort) {
+    if (!conf_get_int ("playlist.search_index", 1)) {
+        return;
+    }
+    if (shared) {
+        LOCK;
+    }
+    if (playlist->count[PL_MAIN] >= PL_SEARCH_INDEX_MIN_TRACKS) {
+        pl_search_index_update (playlist, shared, pabort);
+    }
+    if (shared) {
+        UNLOCK;
+    }
+}
+
+static uint32_t
+pl_search_posting_next (const uint8_t **p, uint32_t prev) {
+    uint32_t delta = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        delta |= (uint32_t)(*(*p)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    delta |= (uint32_t)*(*p)++ << shift;
+    return prev + delta;
+}
+
+static int
+pl_search_posting_cmp (const void *a, const void *b) {
+    uint32_t ca = (*(pl_search_posting_t **)a)->count;
+    uint32_t cb = (*(pl_search_posting_t **)b)->count;
+    return ca < cb ? -1 : ca > cb;
+}
+
+// marks the slots which contain all trigrams of lc, and the ones which are not indexed
+static void
+pl_search_index_mark (pl_search_index_t *idx, const char *lc, const int *offs, int nchars, uint8_t *marks) {
+    for (uint32_t i = 0; i < idx->nalways; i++) {
+        marks[idx->always[i]] = 1;
+    }
+
+    int ntrigrams = nchars - 2;
+    pl_search_posting_t **lists = malloc (ntrigrams * sizeof (pl_search_posting_t *));
+    for (int i = 0; i < ntrigrams; i++) {
+        lists[i] = pl_search_index_find (idx, pl_search_trigram_key (lc + offs[i], offs[i+3] - offs[i]));
+        if (!lists[i]->key) {
+            free (lists);
+            return;
+        }
+    }
+    qsort (lists, ntrigrams, sizeof (pl_search_posting_t *), pl_search_posting_cmp);
+
+    // intersect, starting with the shortest list
+    uint32_t *slots = malloc (lists[0]->count * sizeof (uint32_t));
+    uint32_t count = lists[0]->count;
+    const uint8_t *p = lists[0]->data;
+    uint32_t slot = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        slots[i] = slot = pl_search_posting_next (&p, slot);
+    }
+    for (int l = 1; l < ntrigrams && count > 0; l++) {
+        if (lists[l] == lists[l-1]) {
+            continue;
+        }
+        p = lists[l]->data;
+        const uint8_t *end = p + lists[l]->size;
+        slot = 0;
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            while (slot < slots[i] && p < end) {
+                slot = pl_search_posting_next (&p, slot);
+            }
+            if (slot == slots[i]) {
+                slots[n++] = slot;
+            }
+            else if (slot < slots[i]) {
+                break;
+            }
+        }
+        count = n;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        marks[slots[i]] = 1;
+    }
+    free (slots);
+    free (lists);
+}
+
+// returns 1 if the track is in the search results
+static int
+plt_search_is_result (playlist_t *playlist, playItem_t *it) {
+    return it->prev[PL_SEARCH] || it->next[PL_SEARCH] || playlist->head[PL_SEARCH] == it;
+}
+
+// matches the referenced candidates against the query, or against lc if query is NULL;
+// must be called with the lock held, which is released between the chunks if unlock is set;
+// returns -1 if aborted
+static int
+plt_search_match (playlist_t *playlist, playItem_t **items, int count, uint8_t *matched, pl_query_t *query, const char *lc, int lc_is_valid_u8, int cmpidx, int unlock, int *pabort) {
+    for (int i = 0; i < count; i++) {
+        if (!(i % PL_SEARCH_CHUNK) && i) {
+            if (unlock) {
+                UNLOCK;
+                LOCK;
+            }
+            if (pabort && __atomic_load_n (pabort, __ATOMIC_RELAXED)) {
+                return -1;
+            }
+        }
+        matched[i] = query ? pl_query_match (query, playlist, items[i]) : plt_search_item_matches (items[i], lc, lc_is_valid_u8, cmpidx);
+    }
+    return pabort && __atomic_load_n (pabort, __ATOMIC_RELAXED) ? -1 : 0;
+}
+
+// searches for the tracks matching the query, or lc if query is NULL; lc must be lowercase.
+// Structured queries are evaluated for every track, the plain text uses the index and the refinement.
+// The previous results are kept until the new ones are ready, and stay as is when aborted.
+// Returns the number of results, or -1 if aborted.
+static int
+plt_search_run (playlist_t *playlist, pl_query_t *query, const char *lc, int select_results, int *pabort) {
+    int lc_is_valid_u8 = 0;
+    int nchars = 0;
+    int offs[1001];
+    if (!query) {
+        lc_is_valid_u8 = u8_valid (lc, strlen (lc), NULL);
+        // queries shorter than a trigram are matched against every track
+        nchars = lc_is_valid_u8 ? pl_search_split_chars (lc, offs, sizeof (offs) / sizeof (int) - 1) : 0;
+    }
+
     LOCK;
-    plt_search_reset_int (playlist, select_results);
+    for (int attempt = 0; ; attempt++) {
+        static int cmpidx = 0;
+        cmpidx++;
+        if (cmpidx > 127) {
+            cmpidx = 1;
+        }
+        uint32_t meta_version = pl_get_meta_version ();
+        uint32_t main_version = playlist->main_version;
+
+        int use_index = 0;
+        int refine = 0;
+        if (!query) {
+            if (!conf_get_int ("playlist.search_index", 1)) {
+                if (playlist->search_index) {
+                    pl_search_index_free (playlist->search_index);
+                    playlist->search_index = NULL;
+                }
+            }
+            else {
+                use_index = nchars >= 3 && (playlist->search_index || playlist->count[PL_MAIN] >= PL_SEARCH_INDEX_MIN_TRACKS);
+            }
+
+            // when the text is extended, and no tracks were added, removed or moved since the last search,
+            // only the previous results and the tracks with changed metadata can match;
+            // the index is faster than checking a lot of previous results
+            refine = playlist->search_text && *playlist->search_text && lc_is_valid_u8
+                && playlist->search_main_version == playlist->main_version
+                && meta_version - playlist->search_meta_version < 0x40000000
+                && strstr (lc, playlist->search_text)
+                && (!use_index || playlist->count[PL_SEARCH] < playlist->count[PL_MAIN] / 16);
+        }
+
+        uint8_t *marks = NULL;
+        if (use_index && !refine) {
+            int res = pl_search_index_update (playlist, attempt < 2, pabort);
+            if (res < 0) {
+                UNLOCK;
+                return -1;
+            }
+            if (res > 0) {
+                continue; // the playlist was changed meanwhile
+            }
+            marks = calloc (playlist->search_index->nslots, 1);
+            pl_search_index_mark (playlist->search_index, lc, offs, nchars, marks);
+        }
+
+        // the candidates are collected in the playlist order, which gives the order of the results
+        playItem_t **items = malloc (playlist->count[PL_MAIN] * sizeof (playItem_t *) + 1);
+        uint8_t *matched = malloc (playlist->count[PL_MAIN] + 1);
+        int count = 0;
+        if (!items || !matched) {
+            free (items);
+            free (matched);
+            free (marks);
+            UNLOCK;
+            return -1;
+        }
+        if (query || *lc) {
+            for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                if (refine) {
+                    if (!plt_search_is_result (playlist, it) && (int32_t)(it->_meta_version - playlist->search_meta_version) <= 0) {
+                        continue;
+                    }
+                }
+                else if (marks && !marks[it->_search_slot]) {
+                    continue;
+                }
+                pl_item_ref (it);
+                items[count++] = it;
+            }
+        }
+        free (marks);
+
+        // after a few attempts interrupted by changes of the playlist, the lock is held for the whole search
+        int res = plt_search_match (playlist, items, count, matched, query, lc, lc_is_valid_u8, cmpidx, attempt < 2, pabort);
+
+        if (res == 0 && playlist->main_version == main_version) {
+            if (select_results) {
+                for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+                    pl_set_selected_in_playlist(playlist, it, 0);
+                }
+            }
+            plt_search_reset_int (playlist, 0);
+            for (int i = 0; i < count; i++) {
+                if (matched[i]) {
+                    plt_search_add_result (playlist, items[i], select_results);
+                }
+            }
+            res = playlist->count[PL_SEARCH];
+            if (!query) {
+                playlist->search_text = strdup (lc);
+                playlist->search_meta_version = meta_version;
+                playlist->search_main_version = playlist->main_version;
+            }
+        }
+
+        int done = res < 0 || playlist->main_version == main_version;
+        UNLOCK;
+        for (int i = 0; i < count; i++) {
+            pl_item_unref (items[i]);
+        }
+        free (items);
+        free (matched);
+        if (done) {
+            return res;
+        }
+        // tracks were added, removed or moved meanwhile, start over
+        LOCK;
+    }
+}
+
+// FIXME: multivalue support
+int
+plt_search_process3 (playlist_t *playlist, const char *text, int select_results, int *pabort) {
+    pl_query_t *query = pl_query_compile (text, 0);
+    if (query) {
+        int res = plt_search_run (playlist, query, NULL, select_results, pabort);
+        pl_query_free (query);
+        // plain text can look like a query, e.g. "LOVE IS ALL AROUND";
+        // if the query found nothing, search the text as is
+        if (res) {
+            return res < 0 ? -1 : 0;
+        }
+    }
 
     // convert text to lowercase, to save some cycles
     char lc[1000];
@@ -3702,83 +5454,12 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
     }
     *out = 0;
 
-    int lc_is_valid_u8 = u8_valid (lc, strlen (lc), NULL);
-
-    static int cmpidx = 0;
-    cmpidx++;
-    if (cmpidx > 127) {
-        cmpidx = 1;
-    }
+    return plt_search_run (playlist, NULL, lc, select_results, pabort) < 0 ? -1 : 0;
+}
 
-    for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
-        if (select_results) {
-            pl_set_selected_in_playlist(playlist, it, 0);
-        }
-        if (*text) {
-            DB_metaInfo_t *m = NULL;
-            for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
-                    break;
-                }
-                const char *value = m->value;
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
-                }
-                if (strcasecmp(m->key, "cuesheet") && strcasecmp (m->key, "log")) {
-                    char cmp = *(m->value-1);
-
-                    if (abs (cmp) == cmpidx) {
-                        if (cmp > 0) {
-                            it->next[PL_SEARCH] = NULL;
-                            it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                            if (playlist->tail[PL_SEARCH]) {
-                                playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                                playlist->tail[PL_SEARCH] = it;
-                            }
-                            else {
-                                playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                            }
-                            if (select_results) {
-                                pl_set_selected_in_playlist(playlist, it, 1);
-                            }
-                            playlist->count[PL_SEARCH]++;
-                            break;
-                        }
-                    }
-                    else if (lc_is_valid_u8 && u8_valid(value, strlen(value), NULL) && utfcasestr_fast (value, lc)) {
-                        //fprintf (stderr, "%s -> %s match (%s.%s)\n", text, value, pl_find_meta_raw (it, ":URI"), m->key);
-                        // add to list
-                        it->next[PL_SEARCH] = NULL;
-                        it->prev[PL_SEARCH] = playlist->tail[PL_SEARCH];
-                        if (playlist->tail[PL_SEARCH]) {
-                            playlist->tail[PL_SEARCH]->next[PL_SEARCH] = it;
-                            playlist->tail[PL_SEARCH] = it;
-                        }
-                        else {
-                            playlist->head[PL_SEARCH] = playlist->tail[PL_SEARCH] = it;
-                        }
-                        if (select_results) {
-                            pl_set_selected_in_playlist(playlist, it, 1);
-                        }
-                        playlist->count[PL_SEARCH]++;
-                        *((char *)m->value-1) = cmpidx;
-                        break;
-                    }
-                    else {
-                        *((char *)m->value-1) = -cmpidx;
-                    }
-                }
-            }
-        }
-    }
-    UNLOCK;
+void
+plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
+    plt_search_process3 (playlist, text, select_results, NULL);
 }
 
 void
@@ -3799,17 +5480,15 @@ send_trackinfochanged (playItem_t *track) {
 void
 pl_items_copy_junk (playItem_t *from, playItem_t *first, playItem_t *last) {
     LOCK;
-    DB_metaInfo_t *meta = from->meta;
-    while (meta) {
+    for (int m = 0; m < from->_meta_count; m++) {
         playItem_t *i;
         for (i = first; i; i = i->next[PL_MAIN]) {
             i->_flags = from->_flags;
-            pl_add_meta_copy (i, meta);
+            pl_add_meta_copy (i, &from->_meta[m]);
             if (i == last) {
                 break;
             }
         }
-        meta = meta->next;
     }
     UNLOCK;
 }
@@ -3836,18 +5515,18 @@ pl_set_item_flags (playItem_t *it, uint32_t flags) {
 
 playlist_t *
 pl_get_playlist (playItem_t *it) {
-    LOCK;
+    READ_LOCK;
     playlist_t *p = playlists_head;
     while (p) {
         int idx = plt_get_item_idx (p, it, PL_MAIN);
         if (idx != -1) {
             plt_ref (p);
-            UNLOCK;
+            READ_UNLOCK;
             return p;
         }
         p = p->next;
     }
-    UNLOCK;
+    READ_UNLOCK;
     return NULL;
 }
 
@@ -3890,6 +5569,9 @@ plt_is_fast_mode (playlist_t *plt) {
 void
 pl_ensure_lock (void) {
 #if DETECT_PL_LOCK_RC
+    if (lock_read_depth) {
+        return;
+    }
     pthread_t tid = pthread_self ();
     for (int i = 0; i < ntids; i++) {
         if (tids[i] == tid) {
@@ -4073,12 +5755,7 @@ plt_insert_file2 (int visibility, playlist_t *playlist, playItem_t *after, const
 
 playItem_t *
 plt_insert_dir2 (int visibility, playlist_t *plt, playItem_t *after, const char *dirname, int *pabort, int (*callback)(playItem_t *it, void *user_data), void *user_data) {
-    follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
-    ignore_archives = conf_get_int ("ignore_archives", 1);
-
-    playItem_t *ret = plt_insert_dir_int (visibility, plt, NULL, after, dirname, pabort, callback, user_data);
-    ignore_archives = 0;
-    return ret;
+    return plt_insert_dir_toplevel (visibility, plt, after, dirname, pabort, callback, user_data);
 }
 
 int
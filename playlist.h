@@ -40,6 +40,12 @@
 // :TRACKNUM - subsong index (sid, nsf, cue, etc)
 // :DURATION - length in seconds
 
+// a metadata field of a track, the key and value are metacache strings
+typedef struct {
+    const char *key;
+    const char *value;
+} pl_meta_t;
+
 typedef struct playItem_s {
     int32_t startsample32;
     int32_t endsample32;
@@ -53,7 +59,14 @@ typedef struct playItem_s {
     int _refc;
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
-    struct DB_metaInfo_s *meta; // linked list storing metainfo
+    pl_meta_t *_meta; // metadata fields, see plmeta.c
+    struct pl_meta_list_s *_meta_list; // linked list view of _meta for plugins, built on demand
+    uint16_t _meta_count;
+    uint16_t _meta_alloc;
+    uint64_t _meta_keys; // bloom filter of the metadata keys, see plmeta.c
+    uint32_t _meta_version; // changes whenever the metadata changes, see pl_item_meta_changed
+    uint32_t _search_slot; // slot in the search index of the owning playlist, 0 if none
+    int _index[PL_MAX_ITERATORS]; // position in the owning playlist's index, only meaningful within its valid part
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
@@ -72,13 +85,22 @@ typedef struct playlist_s {
     playItem_t *head[PL_MAX_ITERATORS]; // head of linked list
     playItem_t *tail[PL_MAX_ITERATORS]; // tail of linked list
     int current_row[PL_MAX_ITERATORS]; // current row (cursor)
+    playItem_t **index[PL_MAX_ITERATORS]; // idx->item lookup table, extended on demand
+    int index_count[PL_MAX_ITERATORS]; // number of leading items whose positions in the index are valid
+    int index_size[PL_MAX_ITERATORS]; // allocated size of the index
     int scroll;
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct pl_search_index_s *search_index; // trigram index for plt_search_process2, built on demand
+    char *search_text; // lowercase text of the last completed search, used for refining it
+    uint32_t search_meta_version; // pl_get_meta_version at the last completed search
+    uint32_t search_main_version; // main_version at the last completed search
+    uint32_t main_version; // incremented whenever tracks are added, removed or reordered
     int refc;
     int files_add_visibility;
     unsigned fast_mode : 1;
     unsigned files_adding : 1;
     unsigned recalc_seltime : 1;
+    unsigned loading : 1; // tracks are still being loaded from disk by pl_load_all
 } playlist_t;
 
 // global playlist control functions
@@ -94,6 +116,18 @@ pl_lock (void);
 void
 pl_unlock (void);
 
+// shared lock for code which only reads playlists, tracks and metadata;
+// it can be held by several threads at once, and excludes pl_lock
+void
+pl_lock_read (void);
+
+void
+pl_unlock_read (void);
+
+// fills the pl_lock contention statistics, and optionally resets the counters
+void
+pl_get_lock_stats (ddb_lock_stats_t *stats, int reset);
+
 //void
 //plt_lock (void);
 //
@@ -246,6 +280,11 @@ pl_get_for_idx_and_iter (int idx, int iter);
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter);
 
+// must be called after any change to the order or contents of the list,
+// which wasn't done via plt_insert_item / plt_remove_item
+void
+plt_index_invalidate (playlist_t *plt, int iter);
+
 int
 pl_get_idx_of (playItem_t *it);
 
@@ -267,6 +306,11 @@ pl_add_meta (playItem_t *it, const char *key, const char *value);
 void
 pl_add_meta_full (playItem_t *it, const char *key, const char *value, int valuesize);
 
+// same as pl_add_meta_full, but the key and value must be metacache strings,
+// which get referenced instead of being looked up again
+void
+pl_add_meta_interned (playItem_t *it, const char *key, const char *value);
+
 // if it already exists, append new value(s)
 // otherwise, call pl_add_meta
 void
@@ -339,9 +383,15 @@ pl_save_all (void);
 playItem_t *
 plt_load (playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
 
+// publishes the playlists, and returns as soon as the current one is loaded,
+// while the rest are loaded in background
 int
 pl_load_all (void);
 
+// waits until all playlists are loaded; must not be called under pl_lock
+void
+pl_load_all_wait (void);
+
 void
 plt_select_all (playlist_t *plt);
 
@@ -444,6 +494,15 @@ plt_search_process (playlist_t *plt, const char *text);
 void
 plt_search_process2 (playlist_t *plt, const char *text, int select_results);
 
+// same as plt_search_process2, but stops and returns -1 when *pabort becomes non-zero
+int
+plt_search_process3 (playlist_t *plt, const char *text, int select_results, int *pabort);
+
+// returns the part of the metadata which is matched by the search, or NULL
+// if the field is not searched; sets *stop if none of the following fields are searched
+const char *
+plt_search_meta_value (pl_meta_t *m, int *stop);
+
 void
 plt_sort (playlist_t *plt, int iter, int id, const char *format, int order);
 
@@ -555,14 +614,39 @@ plt_process_cue (playlist_t *plt, playItem_t *after, playItem_t *it, uint64_t to
 void
 pl_configchanged (void);
 
+// returns the node of the field in the list view of the metadata (see pl_get_metadata_head),
+// which stays valid until a field is added to the track
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key);
 
+pl_meta_t *
+pl_meta_find (playItem_t *it, const char *key);
+
+// key filter bits for pl_meta_find_with_bits, which allows to compute them once per key
+uint64_t
+pl_meta_key_filter_bits (const char *key);
+
+pl_meta_t *
+pl_meta_find_with_bits (playItem_t *it, const char *key, uint64_t bits);
+
+// preallocates space for the specified number of fields
+void
+pl_meta_reserve (playItem_t *it, int count);
+
+// assigns a new unique _meta_version to the track
+void
+pl_item_meta_changed (playItem_t *it);
+
+// returns the last assigned _meta_version, which changes whenever any metadata changes
+uint32_t
+pl_get_meta_version (void);
+
+// releases all metadata of a track, including the properties
 void
-pl_meta_free_values (DB_metaInfo_t *meta);
+pl_meta_free_all (playItem_t *it);
 
 void
-pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta);
+pl_add_meta_copy (playItem_t *it, pl_meta_t *meta);
 
 int
 register_fileadd_filter (int (*callback)(ddb_file_found_data_t *data, void *user_data), void *user_data);
@@ -122,27 +122,27 @@ playqueue_remove (playItem_t *it) {
 
 int
 playqueue_test (playItem_t *it) {
-    pl_lock ();
+    pl_lock_read ();
     for (int i = 0; i < playqueue_count; i++) {
         if (playqueue[i] == it) {
-            pl_unlock ();
+            pl_unlock_read ();
             return i;
         }
     }
-    pl_unlock ();
+    pl_unlock_read ();
     return -1;
 }
 
 playItem_t *
 playqueue_getnext (void) {
-    pl_lock ();
+    pl_lock_read ();
     if (playqueue_count > 0) {
         playItem_t *val = playqueue[0];
         pl_item_ref (val);
-        pl_unlock ();
+        pl_unlock_read ();
         return val;
     }
-    pl_unlock ();
+    pl_unlock_read ();
     return NULL;
 }
 
@@ -153,10 +153,10 @@ playqueue_getcount (void) {
 
 playItem_t *
 playqueue_get_item (int i) {
-    pl_lock ();
+    pl_lock_read ();
     playItem_t *it = playqueue[i];
     pl_item_ref (it);
-    pl_unlock ();
+    pl_unlock_read ();
     return it;
 }
 
@@ -34,72 +34,302 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+// Track metadata is stored as an array of key/value pairs of metacache strings,
+// the normal fields first, followed by the properties (':', '_' and '!' keys).
+// Plugins expect a linked list of DB_metaInfo_t (pl_get_metadata_head, pl_meta_for_key),
+// which is built on demand as a separate array of nodes. Deleting a field unlinks its node,
+// so that the list can be modified while iterating, and adding a field drops the list.
+typedef struct pl_meta_list_s {
+    DB_metaInfo_t *head;
+    DB_metaInfo_t nodes[];
+} pl_meta_list_t;
+
+#define META_MAX_COUNT 0xffff
+
+static inline int
+pl_meta_is_property (const char *key) {
+    return key[0] == ':' || key[0] == '_' || key[0] == '!';
+}
 
-DB_metaInfo_t *
-pl_meta_for_key (playItem_t *it, const char *key) {
+static inline int
+pl_meta_value_size (const pl_meta_t *m) {
+    return (int)metacache_get_value_size (m->value);
+}
+
+static int
+pl_meta_grow (playItem_t *it, int count) {
+    if (count <= it->_meta_alloc) {
+        return 0;
+    }
+    if (count > META_MAX_COUNT) {
+        return -1;
+    }
+    int alloc = it->_meta_alloc < 8 ? 8 : it->_meta_alloc + it->_meta_alloc / 2;
+    if (alloc < count) {
+        alloc = count;
+    }
+    if (alloc > META_MAX_COUNT) {
+        alloc = META_MAX_COUNT;
+    }
+    pl_meta_t *meta = realloc (it->_meta, alloc * sizeof (pl_meta_t));
+    if (!meta) {
+        return -1;
+    }
+    it->_meta = meta;
+    it->_meta_alloc = alloc;
+    return 0;
+}
+
+void
+pl_meta_reserve (playItem_t *it, int count) {
+    if (count <= it->_meta_alloc || count > META_MAX_COUNT) {
+        return;
+    }
+    pl_meta_t *meta = realloc (it->_meta, count * sizeof (pl_meta_t));
+    if (meta) {
+        it->_meta = meta;
+        it->_meta_alloc = count;
+    }
+}
+
+// may be called under the shared lock, so concurrent callers race to publish the list
+static pl_meta_list_t *
+pl_meta_get_list (playItem_t *it) {
+    pl_meta_list_t *list = __atomic_load_n (&it->_meta_list, __ATOMIC_ACQUIRE);
+    if (list || !it->_meta_count) {
+        return list;
+    }
+    int count = it->_meta_count;
+    list = malloc (sizeof (pl_meta_list_t) + count * sizeof (DB_metaInfo_t));
+    if (!list) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        DB_metaInfo_t *node = &list->nodes[i];
+        node->next = i < count - 1 ? node + 1 : NULL;
+        node->key = it->_meta[i].key;
+        node->value = it->_meta[i].value;
+        node->valuesize = pl_meta_value_size (&it->_meta[i]);
+    }
+    list->head = list->nodes;
+    pl_meta_list_t *expected = NULL;
+    if (!__atomic_compare_exchange_n (&it->_meta_list, &expected, list, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free (list);
+        list = expected;
+    }
+    return list;
+}
+
+static DB_metaInfo_t *
+pl_meta_list_find (playItem_t *it, const char *key) {
+    pl_meta_list_t *list = it->_meta_list;
+    for (DB_metaInfo_t *node = list ? list->head : NULL; node; node = node->next) {
+        if (node->key == key) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// the unlinked node keeps its next pointer, for the plugins which are iterating the list
+static void
+pl_meta_list_unlink (playItem_t *it, const char *key) {
+    pl_meta_list_t *list = it->_meta_list;
+    if (!list) {
+        return;
+    }
+    for (DB_metaInfo_t **node = &list->head; *node; node = &(*node)->next) {
+        if ((*node)->key == key) {
+            *node = (*node)->next;
+            break;
+        }
+    }
+}
+
+static void
+pl_meta_list_update (playItem_t *it, pl_meta_t *m) {
+    DB_metaInfo_t *node = pl_meta_list_find (it, m->key);
+    if (node) {
+        node->value = m->value;
+        node->valuesize = pl_meta_value_size (m);
+    }
+}
+
+static void
+pl_meta_list_free (playItem_t *it) {
+    free (it->_meta_list);
+    it->_meta_list = NULL;
+}
+
+// Each track keeps a 64-bit bloom filter of its case-folded keys,
+// which allows to skip the search for most of the missing keys.
+// Bits are only cleared by pl_meta_update_keys.
+static uint64_t
+pl_meta_key_bits (char first, const char *rest) {
+    uint32_t h = 2166136261u; // FNV-1a
+    unsigned char c = first;
+    for (;;) {
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        h = (h ^ c) * 16777619u;
+        if (!*rest) {
+            break;
+        }
+        c = *rest++;
+    }
+    return (1ULL << (h & 63)) | (1ULL << ((h >> 6) & 63));
+}
+
+static inline uint64_t
+pl_meta_key_bits_for_key (const char *key) {
+    return key[0] ? pl_meta_key_bits (key[0], key+1) : pl_meta_key_bits (0, "");
+}
+
+static inline int
+pl_meta_may_have_key (playItem_t *it, uint64_t bits) {
+    return (it->_meta_keys & bits) == bits;
+}
+
+// recalculates the key filter after metadata was removed
+static void
+pl_meta_update_keys (playItem_t *it) {
+    uint64_t keys = 0;
+    for (int i = 0; i < it->_meta_count; i++) {
+        keys |= pl_meta_key_bits_for_key (it->_meta[i].key);
+    }
+    it->_meta_keys = keys;
+    pl_item_meta_changed (it);
+}
+
+// the versions are global, so that a new track never gets the version
+// of a freed track which had the same address
+static uint32_t pl_meta_version;
+
+void
+pl_item_meta_changed (playItem_t *it) {
+    it->_meta_version = __atomic_add_fetch (&pl_meta_version, 1, __ATOMIC_RELAXED);
+}
+
+uint32_t
+pl_get_meta_version (void) {
+    return __atomic_load_n (&pl_meta_version, __ATOMIC_RELAXED);
+}
+
+uint64_t
+pl_meta_key_filter_bits (const char *key) {
+    return pl_meta_key_bits_for_key (key);
+}
+
+pl_meta_t *
+pl_meta_find (playItem_t *it, const char *key) {
+    return pl_meta_find_with_bits (it, key, pl_meta_key_bits_for_key (key));
+}
+
+pl_meta_t *
+pl_meta_find_with_bits (playItem_t *it, const char *key, uint64_t bits) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
+    if (!pl_meta_may_have_key (it, bits)) {
+        return NULL;
+    }
+    pl_meta_t *meta = it->_meta;
+    pl_meta_t *end = meta + it->_meta_count;
+    // keys are interned, so the exact match is a pointer comparison
+    for (pl_meta_t *m = meta; m < end; m++) {
+        if (m->key == key) {
+            return m;
+        }
+    }
+    for (pl_meta_t *m = meta; m < end; m++) {
         if (!strcasecmp (key, m->key)) {
             return m;
         }
-        m = m->next;
     }
     return NULL;
 }
 
+DB_metaInfo_t *
+pl_meta_for_key (playItem_t *it, const char *key) {
+    pl_meta_t *m = pl_meta_find (it, key);
+    if (!m) {
+        return NULL;
+    }
+    pl_meta_get_list (it);
+    return pl_meta_list_find (it, m->key);
+}
+
+static void
+pl_meta_release (pl_meta_t *m) {
+    metacache_remove_string (m->key);
+    if (m->value) {
+        metacache_remove_value (m->value, pl_meta_value_size (m));
+    }
+}
+
+// removes the field at index i; the caller must call pl_meta_update_keys
+static void
+pl_meta_remove (playItem_t *it, int i) {
+    pl_meta_t *m = &it->_meta[i];
+    pl_meta_list_unlink (it, m->key);
+    pl_meta_release (m);
+    memmove (m, m + 1, (it->_meta_count - i - 1) * sizeof (pl_meta_t));
+    it->_meta_count--;
+}
+
 void
-pl_meta_free_values (DB_metaInfo_t *meta) {
-    metacache_remove_value (meta->value, meta->valuesize);
-    meta->value = NULL;
-    meta->valuesize = 0;
+pl_meta_free_all (playItem_t *it) {
+    for (int i = 0; i < it->_meta_count; i++) {
+        pl_meta_release (&it->_meta[i]);
+    }
+    free (it->_meta);
+    it->_meta = NULL;
+    it->_meta_count = 0;
+    it->_meta_alloc = 0;
+    pl_meta_list_free (it);
 }
 
-DB_metaInfo_t *
-pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
+static pl_meta_t *
+_add_empty_meta (playItem_t *it, const char *key, int key_is_interned) {
     // check if it's already set
-    DB_metaInfo_t *normaltail = NULL;
-    DB_metaInfo_t *propstart = NULL;
-    DB_metaInfo_t *tail = NULL;
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
+    uint64_t bits = pl_meta_key_bits_for_key (key);
+    int maybe_dup = pl_meta_may_have_key (it, bits);
+    int is_property = pl_meta_is_property (key);
+    int pos = -1;
+    for (int i = 0; i < it->_meta_count; i++) {
+        const char *k = it->_meta[i].key;
+        if (maybe_dup && (k == key || !strcasecmp (key, k))) {
             // duplicate key
             return NULL;
         }
-        // find end of normal metadata
-        if (!normaltail && (!m->next || m->key[0] == ':' || m->key[0] == '_' || m->key[0] == '!')) {
-            normaltail = tail;
-            propstart = m;
-            if (key[0] != ':' && key[0] != '_' && key[0] != '!') {
+        // normal metadata goes before the first property
+        if (pos < 0 && !is_property && pl_meta_is_property (k)) {
+            pos = i;
+            if (!maybe_dup) {
                 break;
             }
         }
-        // find end of properties
-        tail = m;
-        m = m->next;
+    }
+    if (pos < 0) {
+        pos = it->_meta_count;
     }
     // add
-    m = calloc (1, sizeof (DB_metaInfo_t));
-    m->key = metacache_add_string (key);
-
-    if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
-        if (tail) {
-            tail->next = m;
-        }
-        else {
-            it->meta = m;
-        }
+    if (pl_meta_grow (it, it->_meta_count + 1) < 0) {
+        return NULL;
+    }
+    pl_meta_t *m = &it->_meta[pos];
+    memmove (m + 1, m, (it->_meta_count - pos) * sizeof (pl_meta_t));
+    it->_meta_count++;
+    if (key_is_interned) {
+        metacache_ref (key);
+        m->key = key;
     }
     else {
-        m->next = propstart;
-        if (normaltail) {
-            normaltail->next = m;
-        }
-        else {
-            it->meta = m;
-        }
+        m->key = metacache_add_string (key);
     }
+    m->value = NULL;
+    it->_meta_keys |= bits;
+    pl_item_meta_changed (it);
+    pl_meta_list_free (it);
 
     return m;
 }
@@ -129,24 +359,23 @@ _strip_empty (const char *value, int size, int *outsize) {
 }
 
 static void
-_meta_set_value (DB_metaInfo_t *m, const char *value, int size) {
+_meta_set_value (pl_meta_t *m, const char *value, int size) {
     size_t len = strlen (value) + 1;
     if (len != size) {
         // multivalue -- need to strip empty parts
-        char *data = _strip_empty (value, size, &m->valuesize);
+        int valuesize;
+        char *data = _strip_empty (value, size, &valuesize);
 
-        if (m->valuesize > 0) {
-            m->value = metacache_add_value (data, m->valuesize);
+        if (valuesize > 0) {
+            m->value = metacache_add_value (data, valuesize);
         }
         else {
             m->value = metacache_add_value ("", 1);
-            m->valuesize = 1;
         }
         free (data);
     }
     else {
         m->value = metacache_add_value (value, size);
-        m->valuesize = size;
     }
 }
 
@@ -156,7 +385,7 @@ pl_add_meta_full (playItem_t *it, const char *key, const char *value, int values
         return;
     }
 
-    DB_metaInfo_t *meta = pl_add_empty_meta_for_key (it, key);
+    pl_meta_t *meta = _add_empty_meta (it, key, 0);
     if (!meta) {
         return;
     }
@@ -164,6 +393,17 @@ pl_add_meta_full (playItem_t *it, const char *key, const char *value, int values
     _meta_set_value (meta, value, valuesize);
 }
 
+void
+pl_add_meta_interned (playItem_t *it, const char *key, const char *value) {
+    pl_meta_t *meta = _add_empty_meta (it, key, 1);
+    if (!meta) {
+        return;
+    }
+
+    metacache_ref (value);
+    meta->value = value;
+}
+
 void
 pl_add_meta (playItem_t *it, const char *key, const char *value) {
     if (!value || !*value) {
@@ -218,9 +458,13 @@ _combine_into_unique_multivalue (const char *value1, int size1, const char *valu
 void
 pl_append_meta_full (playItem_t *it, const char *key, const char *value, int size) {
     pl_lock ();
-    DB_metaInfo_t *m = pl_meta_for_key (it, key);
+    pl_meta_t *m = pl_meta_find (it, key);
     if (!m) {
-        m = pl_add_empty_meta_for_key(it, key);
+        m = _add_empty_meta (it, key, 0);
+        if (!m) {
+            pl_unlock ();
+            return;
+        }
     }
 
     if (!m->value) {
@@ -229,18 +473,20 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
         return;
     }
 
+    int valuesize = pl_meta_value_size (m);
     int buflen;
-    char *buf = _combine_into_unique_multivalue(m->value, m->valuesize, value, size, &buflen);
+    char *buf = _combine_into_unique_multivalue(m->value, valuesize, value, size, &buflen);
 
     if (!buf) {
         pl_unlock ();
         return;
     }
 
-    metacache_remove_value (m->value, m->valuesize);
+    metacache_remove_value (m->value, valuesize);
     m->value = metacache_add_value (buf, buflen);
-    m->valuesize = (int)buflen;
     free (buf);
+    pl_meta_list_update (it, m);
+    pl_item_meta_changed (it);
     pl_unlock ();
 }
 
@@ -253,13 +499,13 @@ void
 pl_replace_meta (playItem_t *it, const char *key, const char *value) {
     LOCK;
     // check if it's already set
-    DB_metaInfo_t *m = pl_meta_for_key (it, key);
+    pl_meta_t *m = pl_meta_find (it, key);
 
     if (m) {
-        pl_meta_free_values (m);
-        int l = (int)strlen (value) + 1;
-        m->value = metacache_add_value(value, l);
-        m->valuesize = l;
+        metacache_remove_value (m->value, pl_meta_value_size (m));
+        m->value = metacache_add_value(value, (int)strlen (value) + 1);
+        pl_meta_list_update (it, m);
+        pl_item_meta_changed (it);
         UNLOCK;
         return;
     }
@@ -293,23 +539,10 @@ pl_set_meta_float (playItem_t *it, const char *key, float value) {
 void
 pl_delete_meta (playItem_t *it, const char *key) {
     pl_lock ();
-    DB_metaInfo_t *prev = NULL;
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
-            break;
-        }
-        prev = m;
-        m = m->next;
+    pl_meta_t *m = pl_meta_find (it, key);
+    if (m) {
+        pl_meta_remove (it, (int)(m - it->_meta));
+        pl_meta_update_keys (it);
     }
     pl_unlock ();
 }
@@ -317,86 +550,76 @@ pl_delete_meta (playItem_t *it, const char *key) {
 const char *
 pl_find_meta (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
 
-    if (key && key[0] == ':') {
+    if (key && key[0] == ':' && pl_meta_may_have_key (it, pl_meta_key_bits ('!', key+1))) {
         // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
+        for (int i = 0; i < it->_meta_count; i++) {
+            const char *k = it->_meta[i].key;
+            if (k[0] == '!' && !strcasecmp (key+1, k+1)) {
+                return it->_meta[i].value;
             }
-            m = m->next;
         }
     }
 
-    m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            return m->value;
-        }
-        m = m->next;
-    }
-    return NULL;
+    pl_meta_t *m = pl_meta_find (it, key);
+    return m ? m->value : NULL;
 }
 
 const char *
 pl_find_meta_raw (playItem_t *it, const char *key) {
-    DB_metaInfo_t *m = pl_meta_for_key (it, key);
+    pl_meta_t *m = pl_meta_find (it, key);
     return m ? m->value : NULL;
 }
 
 int
 pl_find_meta_int (playItem_t *it, const char *key, int def) {
-    pl_lock ();
+    pl_lock_read ();
     const char *val = pl_find_meta (it, key);
     int res = val ? atoi (val) : def;
-    pl_unlock ();
+    pl_unlock_read ();
     return res;
 }
 
 int64_t
 pl_find_meta_int64 (playItem_t *it, const char *key, int64_t def) {
-    pl_lock ();
+    pl_lock_read ();
     const char *val = pl_find_meta (it, key);
     int64_t res = val ? atoll (val) : def;
-    pl_unlock ();
+    pl_unlock_read ();
     return res;
 }
 
 float
 pl_find_meta_float (playItem_t *it, const char *key, float def) {
-    pl_lock ();
+    pl_lock_read ();
     const char *val = pl_find_meta (it, key);
     float res = val ? atof (val) : def;
-    pl_unlock ();
+    pl_unlock_read ();
     return res;
 }
 
 DB_metaInfo_t *
 pl_get_metadata_head (playItem_t *it) {
-    return it->meta;
+    pl_meta_list_t *list = pl_meta_get_list (it);
+    return list ? list->head : NULL;
 }
 
 void
 pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
     pl_lock ();
-    DB_metaInfo_t *prev = NULL;
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (m == meta) {
-            if (prev) {
-                prev->next = m->next;
-            }
-            else {
-                it->meta = m->next;
+    pl_meta_list_t *list = it->_meta_list;
+    DB_metaInfo_t *node = list ? list->head : NULL;
+    while (node && node != meta) {
+        node = node->next;
+    }
+    if (node) {
+        for (int i = 0; i < it->_meta_count; i++) {
+            if (it->_meta[i].key == meta->key) {
+                pl_meta_remove (it, i);
+                pl_meta_update_keys (it);
+                break;
             }
-            metacache_remove_string (m->key);
-            pl_meta_free_values(m);
-            free (m);
-            break;
         }
-        prev = m;
-        m = m->next;
     }
     pl_unlock ();
 }
@@ -404,26 +627,19 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
 void
 pl_delete_all_meta (playItem_t *it) {
     LOCK;
-    DB_metaInfo_t *m = it->meta;
-    DB_metaInfo_t *prev = NULL;
-    while (m) {
-        DB_metaInfo_t *next = m->next;
-        if (m->key[0] == ':'  || m->key[0] == '_' || m->key[0] == '!') {
-            prev = m;
+    int n = 0;
+    for (int i = 0; i < it->_meta_count; i++) {
+        pl_meta_t *m = &it->_meta[i];
+        if (pl_meta_is_property (m->key)) {
+            it->_meta[n++] = *m;
         }
         else {
-            if (prev) {
-                prev->next = next;
-            }
-            else {
-                it->meta = next;
-            }
-            metacache_remove_string (m->key);
-            pl_meta_free_values (m);
-            free (m);
+            pl_meta_list_unlink (it, m->key);
+            pl_meta_release (m);
         }
-        m = next;
     }
+    it->_meta_count = n;
+    pl_meta_update_keys (it);
     uint32_t f = pl_get_item_flags (it);
     f &= ~DDB_TAG_MASK;
     pl_set_item_flags (it, f);
@@ -433,46 +649,46 @@ pl_delete_all_meta (playItem_t *it) {
 int
 pl_get_meta (playItem_t *it, const char *key, char *val, int size) {
     *val = 0;
-    pl_lock ();
+    pl_lock_read ();
     const char *v = pl_find_meta (it, key);
     if (!v) {
-        pl_unlock ();
+        pl_unlock_read ();
         return 0;
     }
     strncpy (val, v, size);
-    pl_unlock ();
+    pl_unlock_read ();
     return 1;
 }
 
 int
 pl_get_meta_raw (playItem_t *it, const char *key, char *val, int size) {
     *val = 0;
-    pl_lock ();
+    pl_lock_read ();
     const char *v = pl_find_meta_raw (it, key);
     if (!v) {
-        pl_unlock ();
+        pl_unlock_read ();
         return 0;
     }
     strncpy (val, v, size);
-    pl_unlock ();
+    pl_unlock_read ();
     return 1;
 }
 
 int
 pl_meta_exists (playItem_t *it, const char *key) {
-    pl_lock ();
+    pl_lock_read ();
     const char *v = pl_find_meta (it, key);
-    pl_unlock ();
+    pl_unlock_read ();
     return v ? 1 : 0;
 }
 
 void
-pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta) {
-    DB_metaInfo_t *m = pl_add_empty_meta_for_key(it, meta->key);
+pl_add_meta_copy (playItem_t *it, pl_meta_t *meta) {
+    pl_meta_t *m = _add_empty_meta (it, meta->key, 1);
     if (!m) {
         return; // dupe
     }
 
-    m->value = metacache_add_value (meta->value, meta->valuesize);
-    m->valuesize = meta->valuesize;
+    metacache_ref (meta->value);
+    m->value = meta->value;
 }
@@ -0,0 +1,626 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+// Search queries, in the spirit of the foobar2000 query syntax:
+//
+//   query := expr [OR expr]...
+//   expr  := term [AND term]...
+//   term  := NOT term | ( query ) | ALL | field op value | field PRESENT | field MISSING | text
+//
+// field is a metadata key, a "quoted key", or a title formatting script starting with % or $;
+// op is HAS, IS, EQUAL, GREATER, LESS, or one of =, >, <, >=, <=;
+// value is a "quoted string", or the words up to the next AND, OR or closing parenthesis.
+// HAS and IS compare text case-insensitively, EQUAL, GREATER and LESS compare the number
+// at the start of the value, = falls back to IS when the value is not a number.
+// Text without an operator is matched against all fields, the same way as the plain search.
+// Text is only taken for a query when it has at least one condition (field op value, field PRESENT
+// or field MISSING), so e.g. "NOT AFRAID" or "rock AND roll" is searched as is.
+// Keywords are case-sensitive, so that the usual search text is rarely taken for a query;
+// plt_search_process3 also searches the text as is, when it parses as a query which matches nothing.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "plquery.h"
+#include "metacache.h"
+#include "tf.h"
+#include "utf8.h"
+
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+enum {
+    PQ_ALL,
+    PQ_AND,
+    PQ_OR,
+    PQ_NOT,
+    PQ_TEXT,
+    PQ_PRESENT,
+    PQ_MISSING,
+    PQ_HAS,
+    PQ_IS,
+    PQ_EQUAL,
+    PQ_GREATER,
+    PQ_LESS,
+    PQ_GREATER_EQUAL,
+    PQ_LESS_EQUAL,
+};
+
+// evaluation costs, the operands of AND and OR are checked cheapest first
+#define PQ_COST_KEY 1 // key filter, then the metadata list
+#define PQ_COST_META 2
+#define PQ_COST_TEXT 8 // every field of the track
+#define PQ_COST_TF 16
+
+struct pl_query_s {
+    int type;
+    int cost;
+    const char *key; // metacache string, NULL if the field is a title formatting script
+    uint64_t bits; // key filter bits of the key
+    char *tf;
+    char *text; // lowercase value of HAS, IS and plain text
+    int text_valid; // text is valid utf8
+    double number;
+    int nchildren;
+    struct pl_query_s **children;
+};
+
+typedef struct {
+    const char *p;
+    int structured; // has any conditions
+} pq_parser_t;
+
+static const struct {
+    const char *name;
+    int type;
+} pq_operators[] = {
+    { "HAS", PQ_HAS },
+    { "IS", PQ_IS },
+    { "EQUAL", PQ_EQUAL },
+    { "GREATER", PQ_GREATER },
+    { "LESS", PQ_LESS },
+    { "PRESENT", PQ_PRESENT },
+    { "MISSING", PQ_MISSING },
+    { ">=", PQ_GREATER_EQUAL },
+    { "<=", PQ_LESS_EQUAL },
+    { ">", PQ_GREATER },
+    { "<", PQ_LESS },
+    { "=", PQ_EQUAL },
+    { NULL, 0 }
+};
+
+// fields which are stored under a different key, see tf_raw_fields in tf.c
+static const char *pq_key_aliases[] = {
+    "date", "year",
+    "tracknumber", "track",
+    "track number", "track",
+    "discnumber", "disc",
+    "totaldiscs", "numdiscs",
+    "totaltracks", "numtracks",
+    "samplerate", ":SAMPLERATE",
+    "bitrate", ":BITRATE",
+    "filesize", ":FILE_SIZE",
+    "_path_raw", ":URI",
+    NULL
+};
+
+// fields which are not stored in the metadata, and are evaluated as %field%
+static const char *pq_tf_fields[] = {
+    "length", "length_ex", "length_seconds", "length_seconds_fp", "length_samples",
+    "codec", "channels", "filename", "filename_ext", "directoryname", "path",
+    NULL
+};
+
+static int
+pq_is_space (char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static const char *
+pq_skip_space (const char *p) {
+    while (pq_is_space (*p)) {
+        p++;
+    }
+    return p;
+}
+
+// returns the length of the keyword at p, or 0 if there's no such keyword
+static int
+pq_keyword (const char *p, const char *kw) {
+    size_t l = strlen (kw);
+    if (strncmp (p, kw, l)) {
+        return 0;
+    }
+    char c = p[l];
+    if (c && !pq_is_space (c) && c != '(' && c != ')') {
+        return 0;
+    }
+    return (int)l;
+}
+
+// parses the number at the start of the text; if `whole` is set, nothing else is allowed
+static int
+pq_number (const char *s, double *number, int whole) {
+    s = pq_skip_space (s);
+    int neg = 0;
+    if (*s == '-' || *s == '+') {
+        neg = *s == '-';
+        s++;
+    }
+    int digits = 0;
+    double n = 0;
+    for (; *s >= '0' && *s <= '9'; s++, digits++) {
+        n = n * 10 + (*s - '0');
+    }
+    if (*s == '.') {
+        double f = 0.1;
+        for (s++; *s >= '0' && *s <= '9'; s++, digits++) {
+            n += (*s - '0') * f;
+            f /= 10;
+        }
+    }
+    if (!digits || (whole && *pq_skip_space (s))) {
+        return 0;
+    }
+    *number = neg ? -n : n;
+    return 1;
+}
+
+static pl_query_t *
+pq_node_alloc (int type) {
+    pl_query_t *node = calloc (1, sizeof (pl_query_t));
+    node->type = type;
+    return node;
+}
+
+static void
+pq_add_child (pl_query_t *node, pl_query_t *child) {
+    node->children = realloc (node->children, (node->nchildren + 1) * sizeof (pl_query_t *));
+    node->children[node->nchildren++] = child;
+}
+
+// lowercase the same way as plt_search_process does it
+static void
+pq_set_text (pl_query_t *node, const char *text) {
+    char *lc = malloc (strlen (text) * 4 + 1);
+    char *out = lc;
+    while (*text) {
+        int32_t i = 0;
+        u8_nextchar (text, &i);
+        out += u8_tolower ((const signed char *)text, i, out);
+        text += i;
+    }
+    *out = 0;
+    node->text = lc;
+    node->text_valid = u8_valid (lc, (int)(out - lc), NULL);
+}
+
+static int
+pq_set_field (pl_query_t *node, const char *name) {
+    if (!*name) {
+        return -1;
+    }
+    if (name[0] == '%' || name[0] == '$' || name[0] == '[') {
+        node->tf = tf_compile (name);
+        return node->tf ? 0 : -1;
+    }
+    int i;
+    for (i = 0; pq_tf_fields[i]; i++) {
+        if (!strcasecmp (name, pq_tf_fields[i])) {
+            char script[100];
+            snprintf (script, sizeof (script), "%%%s%%", pq_tf_fields[i]);
+            node->tf = tf_compile (script);
+            return node->tf ? 0 : -1;
+        }
+    }
+    for (i = 0; pq_key_aliases[i]; i += 2) {
+        if (!strcasecmp (name, pq_key_aliases[i])) {
+            name = pq_key_aliases[i+1];
+            break;
+        }
+    }
+    node->key = metacache_add_string (name);
+    node->bits = pl_meta_key_filter_bits (name);
+    return 0;
+}
+
+// returns the end of the field name at p
+static const char *
+pq_field_end (const char *p) {
+    if (*p == '"') {
+        const char *e = strchr (p+1, '"');
+        return e ? e+1 : p;
+    }
+    if (*p == '%' || *p == '$' || *p == '[') {
+        // spaces are allowed inside %fields% and function arguments
+        int depth = 0;
+        int field = 0;
+        for (; *p; p++) {
+            if (*p == '%') {
+                field = !field;
+            }
+            else if (field) {
+                continue;
+            }
+            else if (*p == '(' || *p == '[') {
+                depth++;
+            }
+            else if (*p == ')' || *p == ']') {
+                if (!depth) {
+                    break;
+                }
+                depth--;
+            }
+            else if (!depth && pq_is_space (*p)) {
+                break;
+            }
+        }
+        return p;
+    }
+    while (*p && !pq_is_space (*p) && *p != '(' && *p != ')' && *p != '"') {
+        p++;
+    }
+    return p;
+}
+
+// reads a "quoted string", or the words up to the next AND, OR, closing parenthesis or the end
+static char *
+pq_read_value (pq_parser_t *ps) {
+    const char *p = pq_skip_space (ps->p);
+    if (*p == '"') {
+        const char *e = strchr (p+1, '"');
+        if (!e) {
+            return NULL;
+        }
+        ps->p = e+1;
+        return strndup (p+1, e-p-1);
+    }
+    const char *start = p;
+    const char *end = p;
+    for (;;) {
+        p = pq_skip_space (p);
+        if (!*p || *p == ')' || pq_keyword (p, "AND") || pq_keyword (p, "OR")) {
+            break;
+        }
+        while (*p && *p != ')' && !pq_is_space (*p)) {
+            p++;
+        }
+        end = p;
+    }
+    if (end == start) {
+        return NULL;
+    }
+    ps->p = end;
+    return strndup (start, end-start);
+}
+
+static pl_query_t *
+pq_parse_condition (pq_parser_t *ps, const char *field, const char *field_end, const char *op, int type) {
+    pl_query_t *node = pq_node_alloc (type);
+    char *name = field[0] == '"' ? strndup (field+1, field_end-field-2) : strndup (field, field_end-field);
+    int res = pq_set_field (node, name);
+    free (name);
+    if (res < 0) {
+        goto error;
+    }
+
+    if (type == PQ_PRESENT || type == PQ_MISSING) {
+        node->cost = node->tf ? PQ_COST_TF : PQ_COST_KEY;
+    }
+    else {
+        char *value = pq_read_value (ps);
+        if (!value) {
+            goto error;
+        }
+        if (type == PQ_HAS || type == PQ_IS) {
+            pq_set_text (node, value);
+        }
+        else if (!pq_number (value, &node->number, 1)) {
+            if (op[0] != '=') {
+                trace ("query: %s expects a number, got %s\n", op, value);
+                free (value);
+                goto error;
+            }
+            node->type = PQ_IS;
+            pq_set_text (node, value);
+        }
+        free (value);
+        node->cost = node->tf ? PQ_COST_TF : PQ_COST_META;
+    }
+    ps->structured = 1;
+    return node;
+error:
+    pl_query_free (node);
+    return NULL;
+}
+
+static pl_query_t *
+pq_parse_list (pq_parser_t *ps, int type);
+
+static pl_query_t *
+pq_parse_term (pq_parser_t *ps) {
+    const char *p = pq_skip_space (ps->p);
+    int l;
+    if ((l = pq_keyword (p, "NOT"))) {
+        ps->p = p + l;
+        pl_query_t *child = pq_parse_term (ps);
+        if (!child) {
+            return NULL;
+        }
+        pl_query_t *node = pq_node_alloc (PQ_NOT);
+        pq_add_child (node, child);
+        return node;
+    }
+    if (*p == '(') {
+        ps->p = p + 1;
+        pl_query_t *node = pq_parse_list (ps, PQ_OR);
+        if (!node) {
+            return NULL;
+        }
+        p = pq_skip_space (ps->p);
+        if (*p != ')') {
+            pl_query_free (node);
+            return NULL;
+        }
+        ps->p = p + 1;
+        return node;
+    }
+    if ((l = pq_keyword (p, "ALL"))) {
+        ps->p = p + l;
+        return pq_node_alloc (PQ_ALL);
+    }
+
+    const char *field_end = pq_field_end (p);
+    if (field_end > p) {
+        const char *op = pq_skip_space (field_end);
+        for (int i = 0; pq_operators[i].name; i++) {
+            if ((l = pq_keyword (op, pq_operators[i].name))) {
+                ps->p = op + l;
+                return pq_parse_condition (ps, p, field_end, op, pq_operators[i].type);
+            }
+        }
+    }
+
+    ps->p = p;
+    char *text = pq_read_value (ps);
+    if (!text) {
+        return NULL;
+    }
+    pl_query_t *node = pq_node_alloc (PQ_TEXT);
+    pq_set_text (node, text);
+    node->cost = PQ_COST_TEXT;
+    free (text);
+    return node;
+}
+
+// parses the operands of OR, or of AND
+static pl_query_t *
+pq_parse_list (pq_parser_t *ps, int type) {
+    const char *keyword = type == PQ_OR ? "OR" : "AND";
+    pl_query_t *node = type == PQ_OR ? pq_parse_list (ps, PQ_AND) : pq_parse_term (ps);
+    if (!node) {
+        return NULL;
+    }
+    pl_query_t *list = NULL;
+    for (;;) {
+        const char *p = pq_skip_space (ps->p);
+        int l = pq_keyword (p, keyword);
+        if (!l) {
+            break;
+        }
+        ps->p = p + l;
+        pl_query_t *next = type == PQ_OR ? pq_parse_list (ps, PQ_AND) : pq_parse_term (ps);
+        if (!next) {
+            pl_query_free (list ? list : node);
+            return NULL;
+        }
+        if (!list) {
+            list = pq_node_alloc (type);
+            pq_add_child (list, node);
+        }
+        pq_add_child (list, next);
+    }
+    return list ? list : node;
+}
+
+// orders the operands of AND and OR by cost, so that the cheap ones short-circuit the expensive ones;
+// returns the cost of the node
+static int
+pq_optimize (pl_query_t *node) {
+    if (node->type == PQ_NOT) {
+        node->cost = pq_optimize (node->children[0]);
+    }
+    else if (node->type == PQ_AND || node->type == PQ_OR) {
+        node->cost = 0;
+        for (int i = 0; i < node->nchildren; i++) {
+            pl_query_t *child = node->children[i];
+            node->cost += pq_optimize (child);
+            // stable insertion sort, to keep the order of equally expensive operands
+            int j = i;
+            for (; j > 0 && node->children[j-1]->cost > child->cost; j--) {
+                node->children[j] = node->children[j-1];
+            }
+            node->children[j] = child;
+        }
+    }
+    return node->cost;
+}
+
+pl_query_t *
+pl_query_compile (const char *text, int plain_fallback) {
+    pq_parser_t ps = {
+        .p = text,
+    };
+    pl_query_t *query = pq_parse_list (&ps, PQ_OR);
+    if (query && (*pq_skip_space (ps.p) || !ps.structured)) {
+        pl_query_free (query);
+        query = NULL;
+    }
+    if (query) {
+        pq_optimize (query);
+        return query;
+    }
+    if (!plain_fallback) {
+        return NULL;
+    }
+    query = pq_node_alloc (PQ_TEXT);
+    pq_set_text (query, text);
+    query->cost = PQ_COST_TEXT;
+    return query;
+}
+
+void
+pl_query_free (pl_query_t *query) {
+    for (int i = 0; i < query->nchildren; i++) {
+        pl_query_free (query->children[i]);
+    }
+    free (query->children);
+    if (query->key) {
+        metacache_remove_string (query->key);
+    }
+    if (query->tf) {
+        tf_free (query->tf);
+    }
+    free (query->text);
+    free (query);
+}
+
+static int
+pq_match_text (pl_query_t *query, playItem_t *it) {
+    if (!query->text_valid || !*query->text) {
+        return 0;
+    }
+    int stop = 0;
+    for (pl_meta_t *m = it->_meta; m < it->_meta + it->_meta_count && !stop; m++) {
+        const char *value = plt_search_meta_value (m, &stop);
+        if (value && u8_valid (value, (int)strlen (value), NULL) && utfcasestr_fast (value, query->text)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int
+pq_match_value (pl_query_t *query, const char *value) {
+    double number;
+    switch (query->type) {
+    case PQ_HAS:
+        return query->text_valid && u8_valid (value, (int)strlen (value), NULL) && utfcasestr_fast (value, query->text);
+    case PQ_IS:
+        return query->text_valid && u8_valid (value, (int)strlen (value), NULL) && !u8_strcasecmp (value, query->text);
+    }
+    if (!pq_number (value, &number, 0)) {
+        return 0;
+    }
+    switch (query->type) {
+    case PQ_EQUAL:
+        return number == query->number;
+    case PQ_GREATER:
+        return number > query->number;
+    case PQ_LESS:
+        return number < query->number;
+    case PQ_GREATER_EQUAL:
+        return number >= query->number;
+    case PQ_LESS_EQUAL:
+        return number <= query->number;
+    }
+    return 0;
+}
+
+// returns the values of the field, separated by \0, or NULL if the field is missing;
+// size includes the terminating \0
+static const char *
+pq_field_value (pl_query_t *query, playlist_t *plt, playItem_t *it, char *buf, int bufsize, int *size) {
+    if (query->tf) {
+        ddb_tf_context_t ctx = {
+            ._size = sizeof (ddb_tf_context_t),
+            .it = (DB_playItem_t *)it,
+            .plt = (ddb_playlist_t *)plt,
+        };
+        tf_eval (&ctx, query->tf, buf, bufsize);
+        *size = (int)strlen (buf) + 1;
+        return *buf ? buf : NULL;
+    }
+    pl_meta_t *m = pl_meta_find_with_bits (it, query->key, query->bits);
+    if (!m) {
+        return NULL;
+    }
+    *size = (int)metacache_get_value_size (m->value);
+    return m->value;
+}
+
+static int
+pq_match (pl_query_t *query, playlist_t *plt, playItem_t *it) {
+    int i;
+    switch (query->type) {
+    case PQ_ALL:
+        return 1;
+    case PQ_AND:
+        for (i = 0; i < query->nchildren; i++) {
+            if (!pq_match (query->children[i], plt, it)) {
+                return 0;
+            }
+        }
+        return 1;
+    case PQ_OR:
+        for (i = 0; i < query->nchildren; i++) {
+            if (pq_match (query->children[i], plt, it)) {
+                return 1;
+            }
+        }
+        return 0;
+    case PQ_NOT:
+        return !pq_match (query->children[0], plt, it);
+    case PQ_TEXT:
+        return pq_match_text (query, it);
+    }
+
+    char buf[1000];
+    int size = 0;
+    const char *value = pq_field_value (query, plt, it, buf, sizeof (buf), &size);
+    if (query->type == PQ_PRESENT) {
+        return value != NULL;
+    }
+    if (query->type == PQ_MISSING) {
+        return value == NULL;
+    }
+    if (!value) {
+        return 0;
+    }
+    // multiple values are separated by \0
+    for (const char *v = value; v < value + size; v += strlen (v) + 1) {
+        if (pq_match_value (query, v)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+pl_query_match (pl_query_t *query, playlist_t *plt, playItem_t *it) {
+    pl_lock ();
+    int res = pq_match (query, plt, it);
+    pl_unlock ();
+    return res;
+}
@@ -0,0 +1,44 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2015 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#ifndef __deadbeef__plquery__
+#define __deadbeef__plquery__
+
+#include "playlist.h"
+
+typedef struct pl_query_s pl_query_t;
+
+// compiles a search query, e.g. `artist HAS beatles AND date GREATER 1989`;
+// returns NULL if the text is not a query, unless plain_fallback is set,
+// in which case such text is matched as a substring of any field, like plt_search_process does
+pl_query_t *
+pl_query_compile (const char *text, int plain_fallback);
+
+// returns 1 if the track matches the query; plt can be NULL
+int
+pl_query_match (pl_query_t *query, playlist_t *plt, playItem_t *it);
+
+void
+pl_query_free (pl_query_t *query);
+
+#endif /* defined(__deadbeef__plquery__) */
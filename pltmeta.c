@@ -36,24 +36,20 @@
 #define UNLOCK {pl_unlock();}
 
 void
-plt_add_meta (playlist_t *it, const char *key, const char *value) {
-    LOCK;
+plt_add_meta_int (playlist_t *it, const char *key, const char *value) {
     // check if it's already set
     DB_metaInfo_t *tail = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
         if (!strcasecmp (key, m->key)) {
             // duplicate key
-            UNLOCK;
             return;
         }
         tail = m;
         m = m->next;
     }
     // add
-    char str[256];
     if (!value || !*value) {
-        UNLOCK;
         return;
     }
     m = malloc (sizeof (DB_metaInfo_t));
@@ -67,6 +63,12 @@ plt_add_meta (playlist_t *it, const char *key, const char *value) {
     else {
         it->meta = m;
     }
+}
+
+void
+plt_add_meta (playlist_t *it, const char *key, const char *value) {
+    LOCK;
+    plt_add_meta_int (it, key, value);
     UNLOCK;
 }
 
@@ -30,6 +30,10 @@
 void
 plt_add_meta (playlist_t *it, const char *key, const char *value);
 
+// same as plt_add_meta, for playlists which are not shared yet, or under pl_lock
+void
+plt_add_meta_int (playlist_t *it, const char *key, const char *value);
+
 void
 plt_append_meta (playlist_t *it, const char *key, const char *value);
 
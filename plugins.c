@@ -58,6 +58,7 @@
 #include "tf.h"
 #include "playqueue.h"
 #include "sort.h"
+#include "plquery.h"
 #include "logger.h"
 #include "replaygain.h"
 #ifdef __APPLE__
@@ -128,6 +129,11 @@ static DB_playlist_t *g_playlist_plugins[MAX_PLAYLIST_PLUGINS+1];
 static uintptr_t background_jobs_mutex;
 static int num_background_jobs;
 
+static ddb_query_t *
+plug_query_compile (const char *text) {
+    return (ddb_query_t *)pl_query_compile (text, 1);
+}
+
 // deadbeef api
 static DB_functions_t deadbeef_api = {
     .vmajor = DB_API_VERSION_MAJOR,
@@ -492,6 +498,18 @@ static DB_functions_t deadbeef_api = {
     .pl_item_set_endsample = (void (*) (DB_playItem_t *it, int64_t sample))pl_item_set_endsample,
 
     .plt_get_selection_playback_time = (float (*) (ddb_playlist_t *plt))plt_get_selection_playback_time,
+
+    .pl_get_lock_stats = pl_get_lock_stats,
+
+    .plt_sort_v3 = (int (*) (ddb_playlist_t *plt, int iter, const ddb_sort_key_t *keys, int num_keys))plt_sort_v3,
+    .plt_search_process3 = (int (*) (ddb_playlist_t *plt, const char *text, int select_results, int *pabort))plt_search_process3,
+    .query_compile = plug_query_compile,
+    .query_match = (int (*) (ddb_query_t *query, ddb_playlist_t *plt, DB_playItem_t *it))pl_query_match,
+    .query_free = (void (*) (ddb_query_t *query))pl_query_free,
+    .streamer_get_buffer_stats = streamer_get_buffer_stats,
+    .pl_lock_read = pl_lock_read,
+    .pl_unlock_read = pl_unlock_read,
+    .metacache_get_stats = metacache_get_stats,
 };
 
 DB_functions_t *deadbeef = &deadbeef_api;
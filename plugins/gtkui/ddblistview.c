@@ -654,20 +654,20 @@ int
 ddb_listview_get_row_pos (DdbListview *listview, int row_idx) {
     int y = 0;
     int idx = 0;
-    deadbeef->pl_lock ();
+    deadbeef->pl_lock_read ();
     ddb_listview_groupcheck (listview);
     DdbListviewGroup *grp = listview->groups;
     while (grp) {
         if (idx + grp->num_items > row_idx) {
             int i = y + listview->grouptitle_height + (row_idx - idx) * listview->rowheight;
-            deadbeef->pl_unlock ();
+            deadbeef->pl_unlock_read ();
             return i;
         }
         y += grp->height;
         idx += grp->num_items;
         grp = grp->next;
     }
-    deadbeef->pl_unlock ();
+    deadbeef->pl_unlock_read ();
     return y;
 }
 
@@ -705,7 +705,7 @@ ddb_listview_list_pickpoint (DdbListview *listview, int x, int y, DdbListviewPic
         return;
     }
 
-    deadbeef->pl_lock ();
+    deadbeef->pl_lock_read ();
 
     const int is_album_art_column = ddb_listview_is_album_art_column (listview, x);
 
@@ -742,7 +742,7 @@ ddb_listview_list_pickpoint (DdbListview *listview, int x, int y, DdbListviewPic
                 pick_ctx->grp_idx = (y - grp_title_height) / rowheight;
                 pick_ctx->item_idx = idx + pick_ctx->grp_idx;
             }
-            deadbeef->pl_unlock ();
+            deadbeef->pl_unlock_read ();
             return;
         }
         grp_y += grp->height;
@@ -758,7 +758,7 @@ ddb_listview_list_pickpoint (DdbListview *listview, int x, int y, DdbListviewPic
     pick_ctx->item_idx = listview->binding->count () - 1;
     pick_ctx->grp = NULL;
 
-    deadbeef->pl_unlock ();
+    deadbeef->pl_unlock_read ();
     return;
 }
 
@@ -848,7 +848,7 @@ ddb_listview_list_render (DdbListview *listview, cairo_t *cr, GdkRectangle *clip
     if (listview->scrollpos == -1) {
         return; // too early
     }
-    deadbeef->pl_lock ();
+    deadbeef->pl_lock_read ();
     ddb_listview_groupcheck (listview);
     int scrollx = -listview->hscrollpos;
     int title_height = listview->grouptitle_height;
@@ -919,7 +919,7 @@ ddb_listview_list_render (DdbListview *listview, cairo_t *cr, GdkRectangle *clip
 //        render_treeview_background(listview, cr, FALSE, TRUE, scrollx, grp_y, total_width, clip->y+clip->height-grp_y, clip);
 //    }
 
-    deadbeef->pl_unlock ();
+    deadbeef->pl_unlock_read ();
     draw_end (&listview->listctx);
     draw_end (&listview->grpctx);
 }
@@ -3295,13 +3295,13 @@ build_groups (DdbListview *listview) {
 
 static void
 ddb_listview_build_groups (DdbListview *listview) {
-    deadbeef->pl_lock();
+    deadbeef->pl_lock_read ();
     int height = build_groups(listview);
     if (height != listview->fullheight) {
         listview->fullheight = height;
         g_idle_add_full(GTK_PRIORITY_RESIZE, ddb_listview_list_setup_vscroll, listview, NULL);
     }
-    deadbeef->pl_unlock();
+    deadbeef->pl_unlock_read ();
 }
 
 static void
@@ -3335,9 +3335,9 @@ ddb_listview_list_setup (DdbListview *listview, int scroll_to) {
     if (listview->scrollpos == -1) {
         listview->scrollpos = 0;
     }
-    deadbeef->pl_lock();
+    deadbeef->pl_lock_read ();
     listview->fullheight = build_groups(listview);
-    deadbeef->pl_unlock();
+    deadbeef->pl_unlock_read ();
     adjust_scrollbar (listview->scrollbar, listview->fullheight, listview->list_height);
     gtk_range_set_value (GTK_RANGE (listview->scrollbar), scroll_to);
     g_idle_add (unlock_columns_cb, listview);
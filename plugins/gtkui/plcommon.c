@@ -276,7 +276,7 @@ pl_common_is_album_art_column (void *user_data) {
 
 static GdkPixbuf *
 get_cover_art (DB_playItem_t *it, int width, int height, void (*callback)(void *), void *user_data) {
-    deadbeef->pl_lock();
+    deadbeef->pl_lock_read ();
     const char *uri = deadbeef->pl_find_meta(it, ":URI");
     const char *album = deadbeef->pl_find_meta(it, "album");
     const char *artist = deadbeef->pl_find_meta(it, "artist");
@@ -284,7 +284,7 @@ get_cover_art (DB_playItem_t *it, int width, int height, void (*callback)(void *
         album = deadbeef->pl_find_meta(it, "title");
     }
     GdkPixbuf *pixbuf = get_cover_art_thumb_by_size(uri, artist, album, width, height, callback, user_data);
-    deadbeef->pl_unlock();
+    deadbeef->pl_unlock_read ();
     return pixbuf;
 }
 
@@ -69,11 +69,21 @@ playlist_visible () {
     return NULL;
 }
 
+// the search runs in a background thread, so that typing doesn't block the UI;
+// starting a new search aborts the running one
+typedef struct {
+    ddb_playlist_t *plt;
+    char *text;
+    int select_results;
+    int abort;
+    int res;
+} search_job_t;
+
+static intptr_t search_tid;
+static search_job_t *search_job; // freed by search_done_cb
+
 static void
-search_process (DdbListview *listview, ddb_playlist_t *plt) {
-    GtkEntry *entry = GTK_ENTRY(lookup_widget(searchwin, "searchentry"));
-    const gchar *text = gtk_entry_get_text(entry);
-    deadbeef->plt_search_process2 (plt, text, 0);
+search_process_done (DdbListview *listview, int select_results) {
     ddb_listview_col_sort_update (listview);
     deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SEARCHRESULT, 0);
 
@@ -93,6 +103,67 @@ search_process (DdbListview *listview, ddb_playlist_t *plt) {
     deadbeef->tf_eval (&ctx, window_title_bytecode, title, sizeof (title));
     gtk_window_set_title (GTK_WINDOW (searchwin), title);
 
+    if (select_results) {
+        deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SELECTION, 0);
+        DB_playItem_t *head = deadbeef->pl_get_first (PL_SEARCH);
+        if (head) {
+            ddb_event_track_t *event = (ddb_event_track_t *)deadbeef->event_alloc(DB_EV_CURSOR_MOVED);
+            event->track = head;
+            deadbeef->event_send ((ddb_event_t *)event, PL_SEARCH, 0);
+        }
+    }
+}
+
+static gboolean
+search_done_cb (gpointer p) {
+    search_job_t *job = p;
+    if (job == search_job) {
+        deadbeef->thread_join (search_tid);
+        search_tid = 0;
+        search_job = NULL;
+        DdbListview *listview = playlist_visible ();
+        if (listview && !job->res) {
+            search_process_done (listview, job->select_results);
+        }
+    }
+    deadbeef->plt_unref (job->plt);
+    free (job->text);
+    free (job);
+    return FALSE;
+}
+
+static void
+search_thread (void *ctx) {
+    search_job_t *job = ctx;
+    job->res = deadbeef->plt_search_process3 (job->plt, job->text, job->select_results, &job->abort);
+    g_idle_add (search_done_cb, job);
+}
+
+static void
+search_cancel (void) {
+    if (search_tid) {
+        search_job->abort = 1;
+        deadbeef->thread_join (search_tid);
+        search_tid = 0;
+        search_job = NULL;
+    }
+}
+
+static void
+search_process (ddb_playlist_t *plt, int select_results) {
+    if (search_job) {
+        // keep selecting the results when replacing a search which would have done it
+        select_results |= search_job->select_results;
+    }
+    search_cancel ();
+    GtkEntry *entry = GTK_ENTRY(lookup_widget(searchwin, "searchentry"));
+    search_job_t *job = calloc (1, sizeof (search_job_t));
+    deadbeef->plt_ref (plt);
+    job->plt = plt;
+    job->text = strdup (gtk_entry_get_text (entry));
+    job->select_results = select_results;
+    search_job = job;
+    search_tid = deadbeef->thread_start (search_thread, job);
 }
 
 static gboolean
@@ -101,6 +172,7 @@ search_start_cb (gpointer p) {
     if (!playlist_visible ()) {
         DdbListview *listview = DDB_LISTVIEW (lookup_widget (searchwin, "searchlist"));
         refresh_source_id = 0;
+        search_cancel ();
         ddb_listview_clear_sort (listview);
         ddb_playlist_t *plt = deadbeef->plt_get_curr ();
         if (plt) {
@@ -128,6 +200,7 @@ search_start (void) {
 
 void
 search_destroy (void) {
+    search_cancel ();
     if (searchwin) {
         ddb_listview_size_columns_without_scrollbar (DDB_LISTVIEW (lookup_widget (searchwin, "searchlist")));
         gtk_widget_destroy (searchwin);
@@ -285,7 +358,7 @@ refresh_cb (gpointer p) {
     if (listview) {
         ddb_playlist_t *plt = deadbeef->plt_get_curr ();
         if (plt) {
-            search_process (listview, plt);
+            search_process (plt, 0);
             deadbeef->plt_unref (plt);
         }
     }
@@ -406,20 +479,10 @@ on_searchentry_changed                 (GtkEditable     *editable,
     if (listview) {
         ddb_playlist_t *plt = deadbeef->plt_get_curr ();
         if (plt) {
-            deadbeef->plt_deselect_all (plt);
-            search_process (listview, plt);
-            for (DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_SEARCH); it; it = next_playitem (it)) {
-                deadbeef->pl_set_selected (it, 1);
-            }
+            // the results are selected, and the cursor is moved to the first one, when the search is done
+            search_process (plt, 1);
             deadbeef->plt_unref (plt);
         }
-        deadbeef->sendmessage (DB_EV_PLAYLISTCHANGED, 0, DDB_PLAYLIST_CHANGE_SELECTION, 0);
-        DB_playItem_t *head = deadbeef->pl_get_first (PL_SEARCH);
-        if (head) {
-            ddb_event_track_t *event = (ddb_event_track_t *)deadbeef->event_alloc(DB_EV_CURSOR_MOVED);
-            event->track = head;
-            deadbeef->event_send ((ddb_event_t *)event, PL_SEARCH, 0);
-        }
     }
 }
 
@@ -22,11 +22,24 @@
 */
 
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
+#include <dirent.h>
+#include <unistd.h>
 #include "../../deadbeef.h"
+#include "medialib.h"
+
+#ifdef __linux__
+#define USE_INOTIFY 1
+#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#endif
 
 DB_functions_t *deadbeef;
 
@@ -34,13 +47,16 @@ static int filter_id;
 
 typedef struct ml_string_s {
     const char *text;
+    int count; // number of tracks referencing the string
     struct ml_string_s *bucket_next;
 } ml_string_t;
 
 typedef struct ml_entry_s {
+    DB_playItem_t *track;
     const char *file;
     const char *title;
     int subtrack;
+    int tracknum;
     ml_string_t *artist;
     ml_string_t *album;
     ml_string_t *genre;
@@ -54,6 +70,7 @@ typedef struct ml_entry_s {
 typedef struct {
     // plain list of all tracks in the entire collection
     ml_entry_t *tracks;
+    ml_entry_t *tracks_tail;
 
     // hash formed by filename pointer
     // this hash purpose is to quickly check whether the filename is in the library already
@@ -93,22 +110,276 @@ hash_find (ml_string_t **hash, const char *val) {
 static ml_string_t *
 hash_add (ml_string_t **hash, const char *val) {
     uint32_t h = hash_for_ptr ((void *)val) & (ML_HASH_SIZE-1);
-    if (!hash_find_for_hashkey(hash, val, h)) {
-        deadbeef->metacache_ref (val);
-        ml_string_t *s = calloc (sizeof (ml_string_t), 1);
+    ml_string_t *s = hash_find_for_hashkey(hash, val, h);
+    if (!s) {
+        s = calloc (sizeof (ml_string_t), 1);
         s->bucket_next = hash[h];
         s->text = val;
         deadbeef->metacache_ref (val);
         hash[h] = s;
-        return s;
     }
-    return NULL;
+    s->count++;
+    return s;
+}
+
+// drops a track reference, and removes the string when it's no longer used
+static void
+hash_release (ml_string_t **hash, ml_string_t *s) {
+    if (!s || --s->count > 0) {
+        return;
+    }
+    uint32_t h = hash_for_ptr ((void *)s->text) & (ML_HASH_SIZE-1);
+    ml_string_t **pp = &hash[h];
+    while (*pp && *pp != s) {
+        pp = &(*pp)->bucket_next;
+    }
+    if (*pp) {
+        *pp = s->bucket_next;
+    }
+    deadbeef->metacache_unref (s->text);
+    free (s);
 }
 
 static ddb_playlist_t *ml_playlist; // this playlist contains the actual data of the media library in plain list
 
 static ml_db_t db; // this is the index, which can be rebuilt from the playlist at any given time
 
+// Sorted browse tree: genre -> artist -> album -> track.
+// Every node keeps its children in a sorted array, which is updated together
+// with the index, so a page of any level is found without walking the library.
+typedef struct ml_tree_node_s {
+    const char *text; // metacache string, NULL for unknown
+    ml_entry_t *entry; // only set for tracks
+    struct ml_tree_node_s **children;
+    int num_children;
+    int children_size;
+    int num_tracks;
+} ml_tree_node_t;
+
+static ml_tree_node_t ml_tree_root;
+
+// protects db and the tree, which are modified by the scanner thread,
+// and read by the query functions from any thread
+static uintptr_t ml_mutex;
+
+static int
+ml_text_cmp (const char *a, const char *b) {
+    if (a == b) {
+        return 0;
+    }
+    if (!a || !b) {
+        return a ? 1 : -1;
+    }
+    int res = strcasecmp (a, b);
+    return res ? res : strcmp (a, b);
+}
+
+static int
+ml_track_cmp (ml_entry_t *a, ml_entry_t *b) {
+    if (a->tracknum != b->tracknum) {
+        return a->tracknum < b->tracknum ? -1 : 1;
+    }
+    int res = ml_text_cmp (a->title, b->title);
+    if (res) {
+        return res;
+    }
+    return a == b ? 0 : ((uintptr_t)a < (uintptr_t)b ? -1 : 1);
+}
+
+// binary search for the child with the given text, or the given track entry;
+// returns 1 if found, and the position of the child or where it should be inserted
+static int
+ml_node_find (ml_tree_node_t *node, const char *text, ml_entry_t *entry, int *pos) {
+    int l = 0;
+    int r = node->num_children;
+    while (l < r) {
+        int m = (l + r) / 2;
+        ml_tree_node_t *c = node->children[m];
+        int res = entry ? ml_track_cmp (c->entry, entry) : ml_text_cmp (c->text, text);
+        if (!res) {
+            *pos = m;
+            return 1;
+        }
+        if (res < 0) {
+            l = m + 1;
+        }
+        else {
+            r = m;
+        }
+    }
+    *pos = l;
+    return 0;
+}
+
+static ml_tree_node_t *
+ml_node_insert (ml_tree_node_t *node, int pos, const char *text, ml_entry_t *entry) {
+    if (node->num_children == node->children_size) {
+        int size = node->children_size ? node->children_size * 2 : 4;
+        ml_tree_node_t **children = realloc (node->children, size * sizeof (ml_tree_node_t *));
+        if (!children) {
+            return NULL;
+        }
+        node->children = children;
+        node->children_size = size;
+    }
+    ml_tree_node_t *c = calloc (sizeof (ml_tree_node_t), 1);
+    if (text) {
+        deadbeef->metacache_ref (text);
+    }
+    c->text = text;
+    c->entry = entry;
+    memmove (&node->children[pos+1], &node->children[pos], (node->num_children - pos) * sizeof (ml_tree_node_t *));
+    node->children[pos] = c;
+    node->num_children++;
+    return c;
+}
+
+static void
+ml_node_free (ml_tree_node_t *node) {
+    for (int i = 0; i < node->num_children; i++) {
+        ml_node_free (node->children[i]);
+        free (node->children[i]);
+    }
+    free (node->children);
+    if (node->text) {
+        deadbeef->metacache_unref (node->text);
+    }
+    memset (node, 0, sizeof (ml_tree_node_t));
+}
+
+static void
+ml_node_remove (ml_tree_node_t *node, int pos) {
+    ml_tree_node_t *c = node->children[pos];
+    ml_node_free (c);
+    free (c);
+    node->num_children--;
+    memmove (&node->children[pos], &node->children[pos+1], (node->num_children - pos) * sizeof (ml_tree_node_t *));
+}
+
+static void
+ml_tree_add (ml_entry_t *en) {
+    const char *path[DDB_MEDIALIB_LEVEL_TRACK] = {
+        en->genre ? en->genre->text : NULL,
+        en->artist ? en->artist->text : NULL,
+        en->album ? en->album->text : NULL,
+    };
+    ml_tree_node_t *node = &ml_tree_root;
+    for (int level = 0; level < DDB_MEDIALIB_LEVEL_TRACK; level++) {
+        int pos;
+        if (!ml_node_find (node, path[level], NULL, &pos)) {
+            if (!ml_node_insert (node, pos, path[level], NULL)) {
+                return;
+            }
+        }
+        node = node->children[pos];
+    }
+    int pos;
+    ml_node_find (node, NULL, en, &pos);
+    if (!ml_node_insert (node, pos, en->title, en)) {
+        return;
+    }
+    node->children[pos]->num_tracks = 1;
+
+    // count the track on the whole path
+    node = &ml_tree_root;
+    node->num_tracks++;
+    for (int level = 0; level < DDB_MEDIALIB_LEVEL_TRACK; level++) {
+        ml_node_find (node, path[level], NULL, &pos);
+        node = node->children[pos];
+        node->num_tracks++;
+    }
+}
+
+static void
+ml_tree_remove (ml_entry_t *en) {
+    const char *path[DDB_MEDIALIB_LEVEL_TRACK] = {
+        en->genre ? en->genre->text : NULL,
+        en->artist ? en->artist->text : NULL,
+        en->album ? en->album->text : NULL,
+    };
+    ml_tree_node_t *nodes[DDB_MEDIALIB_LEVEL_TRACK+1];
+    int positions[DDB_MEDIALIB_LEVEL_TRACK+1];
+    nodes[0] = &ml_tree_root;
+    for (int level = 0; level < DDB_MEDIALIB_LEVEL_TRACK; level++) {
+        if (!ml_node_find (nodes[level], path[level], NULL, &positions[level])) {
+            return;
+        }
+        nodes[level+1] = nodes[level]->children[positions[level]];
+    }
+    if (!ml_node_find (nodes[DDB_MEDIALIB_LEVEL_TRACK], NULL, en, &positions[DDB_MEDIALIB_LEVEL_TRACK])) {
+        return;
+    }
+
+    // remove the track, and the groups which became empty
+    for (int level = DDB_MEDIALIB_LEVEL_TRACK; level >= 0; level--) {
+        nodes[level]->num_tracks--;
+        if (level == DDB_MEDIALIB_LEVEL_TRACK || !nodes[level+1]->num_children) {
+            ml_node_remove (nodes[level], positions[level]);
+        }
+    }
+}
+
+static ml_tree_node_t *
+ml_tree_get (const char **path, int depth) {
+    if (depth < 0 || depth > DDB_MEDIALIB_LEVEL_TRACK) {
+        return NULL;
+    }
+    ml_tree_node_t *node = &ml_tree_root;
+    for (int level = 0; level < depth; level++) {
+        int pos;
+        if (!ml_node_find (node, path[level], NULL, &pos)) {
+            return NULL;
+        }
+        node = node->children[pos];
+    }
+    return node;
+}
+
+static int
+ml_count (const char **path, int depth) {
+    deadbeef->mutex_lock (ml_mutex);
+    ml_tree_node_t *node = ml_tree_get (path, depth);
+    int res = node ? node->num_children : -1;
+    deadbeef->mutex_unlock (ml_mutex);
+    return res;
+}
+
+static int
+ml_query (const char **path, int depth, int offset, int count, ddb_medialib_node_t *nodes) {
+    int n = 0;
+    deadbeef->mutex_lock (ml_mutex);
+    ml_tree_node_t *node = ml_tree_get (path, depth);
+    if (node && offset >= 0) {
+        for (int i = offset; i < node->num_children && n < count; i++, n++) {
+            ml_tree_node_t *c = node->children[i];
+            nodes[n].text = c->text;
+            if (c->text) {
+                deadbeef->metacache_ref (c->text);
+            }
+            nodes[n].num_children = c->num_children;
+            nodes[n].num_tracks = c->num_tracks;
+            nodes[n].track = c->entry ? c->entry->track : NULL;
+            if (nodes[n].track) {
+                deadbeef->pl_item_ref (nodes[n].track);
+            }
+        }
+    }
+    deadbeef->mutex_unlock (ml_mutex);
+    return n;
+}
+
+static void
+ml_free_nodes (ddb_medialib_node_t *nodes, int count) {
+    for (int i = 0; i < count; i++) {
+        if (nodes[i].text) {
+            deadbeef->metacache_unref (nodes[i].text);
+        }
+        if (nodes[i].track) {
+            deadbeef->pl_item_unref (nodes[i].track);
+        }
+    }
+}
+
 #define REG_COL_DEF(col)\
 ml_string_t *\
 ml_reg_##col (ml_db_t *db, const char *c) {\
@@ -123,11 +394,503 @@ REG_COL_DEF(artist);
 REG_COL_DEF(genre);
 REG_COL_DEF(folder);
 
-DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
-
 uintptr_t tid;
 int scanner_terminate;
 
+// Scan state of each directory in the library, persisted in medialib.idx.
+// On startup, only the directories with a changed mtime are rescanned,
+// and in these, only the files with a changed mtime or size are re-added.
+// NOTE: files modified in place, without touching their directory, are not
+// picked up until something else changes in the same directory.
+typedef struct ml_file_s {
+    char *name;
+    int64_t mtime;
+    int64_t size;
+    struct ml_file_s *next;
+} ml_file_t;
+
+typedef struct ml_dir_s {
+    const char *path; // metacache string
+    int64_t mtime;
+    int removed;
+    int wd; // inotify watch descriptor, 0 if not watched
+    int dirty; // got filesystem events since the last check
+    ml_file_t *files; // sorted by name, same as scandir output
+    struct ml_dir_s *next;
+    struct ml_dir_s *bucket_next;
+} ml_dir_t;
+
+static ml_dir_t *ml_dirs;
+static ml_dir_t *ml_dir_hash[ML_HASH_SIZE];
+
+// changes found by the scanner, applied to the library in one go
+typedef struct ml_path_s {
+    char *path;
+    int is_dir;
+    struct ml_path_s *next;
+} ml_path_t;
+
+typedef struct {
+    ml_string_t *removed[ML_HASH_SIZE]; // uris of the files to remove from the library
+    int nremoved;
+    ml_path_t *added; // files and new directories to add to the library
+    ml_path_t *added_tail;
+    int changed;
+} ml_scan_t;
+
+#define ML_INDEX_VERSION 1
+
+static int follow_symlinks;
+
+static ml_dir_t *
+ml_dir_find (const char *path) {
+    const char *s = deadbeef->metacache_get_string (path);
+    if (!s) {
+        return NULL;
+    }
+    ml_dir_t *d = ml_dir_hash[hash_for_ptr ((void *)s)];
+    while (d && (d->path != s || d->removed)) {
+        d = d->bucket_next;
+    }
+    deadbeef->metacache_unref (s);
+    return d;
+}
+
+static ml_dir_t *
+ml_dir_add (const char *path, int64_t mtime) {
+    ml_dir_t *d = calloc (sizeof (ml_dir_t), 1);
+    d->path = deadbeef->metacache_add_string (path);
+    d->mtime = mtime;
+    d->next = ml_dirs;
+    ml_dirs = d;
+    uint32_t h = hash_for_ptr ((void *)d->path);
+    d->bucket_next = ml_dir_hash[h];
+    ml_dir_hash[h] = d;
+    return d;
+}
+
+static void
+ml_dir_free_files (ml_dir_t *d) {
+    while (d->files) {
+        ml_file_t *next = d->files->next;
+        free (d->files->name);
+        free (d->files);
+        d->files = next;
+    }
+}
+
+#if USE_INOTIFY
+static int ml_inotify_fd = -1;
+static int ml_wakeup_fds[2] = { -1, -1 }; // wakes up the watcher on ml_stop
+static ml_dir_t **ml_watch_dirs; // indexed by watch descriptor
+static int ml_watch_dirs_size;
+static int ml_watch_warned;
+
+#define ML_WATCH_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+static void
+ml_watch_dir (ml_dir_t *d) {
+    if (ml_inotify_fd < 0 || d->wd > 0 || d->removed) {
+        return;
+    }
+    int wd = inotify_add_watch (ml_inotify_fd, d->path, ML_WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC && !ml_watch_warned) {
+            fprintf (stderr, "medialib: out of inotify watches, some folders will not be watched (see /proc/sys/fs/inotify/max_user_watches)\n");
+            ml_watch_warned = 1;
+        }
+        return;
+    }
+    if (wd >= ml_watch_dirs_size) {
+        int size = ml_watch_dirs_size ? ml_watch_dirs_size * 2 : 1024;
+        while (size <= wd) {
+            size *= 2;
+        }
+        ml_dir_t **dirs = realloc (ml_watch_dirs, size * sizeof (ml_dir_t *));
+        if (!dirs) {
+            inotify_rm_watch (ml_inotify_fd, wd);
+            return;
+        }
+        memset (dirs + ml_watch_dirs_size, 0, (size - ml_watch_dirs_size) * sizeof (ml_dir_t *));
+        ml_watch_dirs = dirs;
+        ml_watch_dirs_size = size;
+    }
+    ml_watch_dirs[wd] = d;
+    d->wd = wd;
+}
+
+static void
+ml_unwatch_dir (ml_dir_t *d) {
+    if (d->wd > 0) {
+        inotify_rm_watch (ml_inotify_fd, d->wd);
+        ml_watch_dirs[d->wd] = NULL;
+        d->wd = 0;
+    }
+}
+#else
+static void
+ml_watch_dir (ml_dir_t *d) {
+}
+
+static void
+ml_unwatch_dir (ml_dir_t *d) {
+}
+#endif
+
+// frees the entries of the folders which are gone, once nothing refers to them anymore
+static void
+ml_dirs_free_removed (void) {
+    ml_dir_t **pd = &ml_dirs;
+    while (*pd) {
+        ml_dir_t *d = *pd;
+        if (!d->removed) {
+            pd = &d->next;
+            continue;
+        }
+        *pd = d->next;
+        ml_dir_t **pb = &ml_dir_hash[hash_for_ptr ((void *)d->path)];
+        while (*pb != d) {
+            pb = &(*pb)->bucket_next;
+        }
+        *pb = d->bucket_next;
+        ml_dir_free_files (d);
+        deadbeef->metacache_unref (d->path);
+        free (d);
+    }
+}
+
+static void
+ml_dirs_free (void) {
+    while (ml_dirs) {
+        ml_dir_t *next = ml_dirs->next;
+        ml_dir_free_files (ml_dirs);
+        deadbeef->metacache_unref (ml_dirs->path);
+        free (ml_dirs);
+        ml_dirs = next;
+    }
+    memset (ml_dir_hash, 0, sizeof (ml_dir_hash));
+}
+
+// returns 0 if the index was loaded, and belongs to the same music directory
+static int
+ml_dirs_load (const char *fname, const char *root) {
+    FILE *fp = fopen (fname, "rt");
+    if (!fp) {
+        return -1;
+    }
+    char line[PATH_MAX+100];
+    int version = 0;
+    int n = 0;
+    if (!fgets (line, sizeof (line), fp) || sscanf (line, "MLIDX %d", &version) != 1 || version != ML_INDEX_VERSION
+        || !fgets (line, sizeof (line), fp) || strncmp (line, "R ", 2)) {
+        fclose (fp);
+        return -1;
+    }
+    line[strcspn (line, "\n")] = 0;
+    if (strcmp (line+2, root)) {
+        fclose (fp);
+        return -1;
+    }
+
+    ml_dir_t *d = NULL;
+    ml_file_t *tail = NULL;
+    while (fgets (line, sizeof (line), fp)) {
+        line[strcspn (line, "\n")] = 0;
+        long long mtime, size;
+        if (line[0] == 'D' && sscanf (line, "D %lld %n", &mtime, &n) == 1) {
+            d = ml_dir_add (line+n, mtime);
+            tail = NULL;
+        }
+        else if (line[0] == 'F' && d && sscanf (line, "F %lld %lld %n", &mtime, &size, &n) == 2) {
+            ml_file_t *f = calloc (sizeof (ml_file_t), 1);
+            f->name = strdup (line+n);
+            f->mtime = mtime;
+            f->size = size;
+            if (tail) {
+                tail->next = f;
+            }
+            else {
+                d->files = f;
+            }
+            tail = f;
+        }
+        else {
+            fprintf (stderr, "medialib: bad line in %s: %s\n", fname, line);
+            ml_dirs_free ();
+            fclose (fp);
+            return -1;
+        }
+    }
+    fclose (fp);
+    return 0;
+}
+
+static int
+ml_dirs_save (const char *fname, const char *root) {
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+    FILE *fp = fopen (tempfile, "w+t");
+    if (!fp) {
+        return -1;
+    }
+    fprintf (fp, "MLIDX %d\nR %s\n", ML_INDEX_VERSION, root);
+    for (ml_dir_t *d = ml_dirs; d; d = d->next) {
+        if (d->removed) {
+            continue;
+        }
+        fprintf (fp, "D %lld %s\n", (long long)d->mtime, d->path);
+        for (ml_file_t *f = d->files; f; f = f->next) {
+            fprintf (fp, "F %lld %lld %s\n", (long long)f->mtime, (long long)f->size, f->name);
+        }
+    }
+    if (fclose (fp)) {
+        unlink (tempfile);
+        return -1;
+    }
+    return rename (tempfile, fname);
+}
+
+static int
+ml_dirent_alphasort (const struct dirent **a, const struct dirent **b) {
+    return strcmp ((*a)->d_name, (*b)->d_name);
+}
+
+// same rules as plt_insert_dir: symlinked dirs are skipped, unless enabled in config
+static int
+ml_stat (const char *path, struct stat *st) {
+    if (lstat (path, st) < 0) {
+        return -1;
+    }
+    if (S_ISLNK (st->st_mode)) {
+        if (stat (path, st) < 0 || (S_ISDIR (st->st_mode) && !follow_symlinks)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+ml_scan_remove (ml_scan_t *scan, const char *dir, const char *name) {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/%s", dir, name);
+    const char *s = deadbeef->metacache_get_string (path);
+    if (!s) {
+        // no such track in the library
+        return;
+    }
+    uint32_t h = hash_for_ptr ((void *)s);
+    if (hash_find_for_hashkey (scan->removed, s, h)) {
+        deadbeef->metacache_unref (s);
+        return;
+    }
+    ml_string_t *str = calloc (sizeof (ml_string_t), 1);
+    str->text = s;
+    str->bucket_next = scan->removed[h];
+    scan->removed[h] = str;
+    scan->nremoved++;
+    scan->changed = 1;
+}
+
+static void
+ml_scan_add (ml_scan_t *scan, const char *path, int is_dir) {
+    ml_path_t *p = calloc (sizeof (ml_path_t), 1);
+    p->path = strdup (path);
+    p->is_dir = is_dir;
+    if (scan->added_tail) {
+        scan->added_tail->next = p;
+    }
+    else {
+        scan->added = p;
+    }
+    scan->added_tail = p;
+    scan->changed = 1;
+}
+
+static int
+ml_is_indexed (const char *path) {
+    const char *s = deadbeef->metacache_get_string (path);
+    if (!s) {
+        return 0;
+    }
+    ml_entry_t *en = db.filename_hash[hash_for_ptr ((void *)s)];
+    while (en && en->file != s) {
+        en = en->bucket_next;
+    }
+    deadbeef->metacache_unref (s);
+    return en != NULL;
+}
+
+static void
+ml_scan_new_dir (ml_scan_t *scan, const char *path, int64_t mtime);
+
+// compares directory contents to the saved state, and updates it;
+// in new directories, files are only recorded, since the whole directory is
+// going to be added with plt_insert_dir
+static void
+ml_scan_dir_entries (ml_scan_t *scan, ml_dir_t *d, int is_new) {
+    struct dirent **namelist = NULL;
+    int n = scandir (d->path, &namelist, NULL, ml_dirent_alphasort);
+    if (n < 0) {
+        if (namelist) {
+            free (namelist);
+        }
+        return;
+    }
+
+    ml_file_t *old = d->files;
+    ml_file_t *tail = NULL;
+    d->files = NULL;
+    for (int i = 0; i < n; i++) {
+        const char *name = namelist[i]->d_name;
+        struct stat st;
+        char fullname[PATH_MAX];
+        snprintf (fullname, sizeof (fullname), "%s/%s", d->path, name);
+        if (name[0] == '.' || scanner_terminate || ml_stat (fullname, &st) < 0) {
+            free (namelist[i]);
+            continue;
+        }
+
+        if (S_ISDIR (st.st_mode)) {
+            // known subdirectories are checked on their own
+            if (!ml_dir_find (fullname)) {
+                if (!is_new) {
+                    ml_scan_add (scan, fullname, 1);
+                }
+                ml_scan_new_dir (scan, fullname, st.st_mtime);
+            }
+        }
+        else if (S_ISREG (st.st_mode)) {
+            // files which sort before this one are gone
+            while (old && strcmp (old->name, name) < 0) {
+                ml_file_t *next = old->next;
+                ml_scan_remove (scan, d->path, old->name);
+                free (old->name);
+                free (old);
+                old = next;
+            }
+
+            ml_file_t *f;
+            if (old && !strcmp (old->name, name)) {
+                f = old;
+                old = old->next;
+                if (f->mtime != st.st_mtime || f->size != st.st_size) {
+                    ml_scan_remove (scan, d->path, name);
+                    ml_scan_add (scan, fullname, 0);
+                }
+            }
+            else {
+                f = calloc (sizeof (ml_file_t), 1);
+                f->name = strdup (name);
+                if (!is_new && !ml_is_indexed (fullname)) {
+                    ml_scan_add (scan, fullname, 0);
+                }
+            }
+            f->mtime = st.st_mtime;
+            f->size = st.st_size;
+            f->next = NULL;
+            if (tail) {
+                tail->next = f;
+            }
+            else {
+                d->files = f;
+            }
+            tail = f;
+        }
+        free (namelist[i]);
+    }
+    free (namelist);
+
+    while (old) {
+        ml_file_t *next = old->next;
+        ml_scan_remove (scan, d->path, old->name);
+        free (old->name);
+        free (old);
+        old = next;
+    }
+}
+
+static void
+ml_scan_new_dir (ml_scan_t *scan, const char *path, int64_t mtime) {
+    ml_dir_t *d = ml_dir_add (path, mtime);
+    // start watching before reading the contents, to not miss anything added meanwhile
+    ml_watch_dir (d);
+    ml_scan_dir_entries (scan, d, 1);
+}
+
+static void
+ml_dir_remove (ml_scan_t *scan, ml_dir_t *d) {
+    for (ml_file_t *f = d->files; f; f = f->next) {
+        ml_scan_remove (scan, d->path, f->name);
+    }
+    ml_dir_free_files (d);
+    ml_unwatch_dir (d);
+    d->removed = 1;
+    scan->changed = 1;
+}
+
+// rescans the directory if it was modified, or unconditionally if force is set
+static void
+ml_dir_check (ml_scan_t *scan, ml_dir_t *d, int force) {
+    struct stat st;
+    if (ml_stat (d->path, &st) < 0 || !S_ISDIR (st.st_mode)) {
+        ml_dir_remove (scan, d);
+        // subfolders are gone too, e.g. when the folder was moved away
+        size_t l = strlen (d->path);
+        for (ml_dir_t *sub = ml_dirs; sub; sub = sub->next) {
+            if (!sub->removed && !strncmp (sub->path, d->path, l) && sub->path[l] == '/') {
+                ml_dir_remove (scan, sub);
+            }
+        }
+    }
+    else if (force || st.st_mtime != d->mtime) {
+        d->mtime = st.st_mtime;
+        ml_scan_dir_entries (scan, d, 0);
+        scan->changed = 1;
+    }
+}
+
+static void
+ml_scan_changes (ml_scan_t *scan, const char *root) {
+    if (!ml_dirs) {
+        struct stat st;
+        if (ml_stat (root, &st) < 0 || !S_ISDIR (st.st_mode)) {
+            return;
+        }
+        ml_scan_add (scan, root, 1);
+        ml_scan_new_dir (scan, root, st.st_mtime);
+        return;
+    }
+
+    // new directories get prepended to the list, and are already scanned
+    ml_dir_t *dirs = ml_dirs;
+    for (ml_dir_t *d = dirs; d && !scanner_terminate; d = d->next) {
+        if (!d->removed) {
+            ml_dir_check (scan, d, 0);
+        }
+    }
+}
+
+static void
+ml_scan_free (ml_scan_t *scan) {
+    for (int i = 0; i < ML_HASH_SIZE; i++) {
+        ml_string_t *s = scan->removed[i];
+        while (s) {
+            ml_string_t *next = s->bucket_next;
+            deadbeef->metacache_unref (s->text);
+            free (s);
+            s = next;
+        }
+    }
+    while (scan->added) {
+        ml_path_t *next = scan->added->next;
+        free (scan->added->path);
+        free (scan->added);
+        scan->added = next;
+    }
+}
+
+DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
+
 static int
 add_file_info_cb (DB_playItem_t *it, void *data) {
 //    fprintf (stderr, "added %s                                 \r", deadbeef->pl_find_meta (it, ":URI"));
@@ -152,6 +915,9 @@ static void
 ml_free_db (void) {
     fprintf (stderr, "clearing index...\n");
 
+    deadbeef->mutex_lock (ml_mutex);
+    ml_node_free (&ml_tree_root);
+
     FREE_COL(album);
     FREE_COL(artist);
     FREE_COL(genre);
@@ -165,90 +931,184 @@ ml_free_db (void) {
         if (db.tracks->file) {
             deadbeef->metacache_unref (db.tracks->file);
         }
+        deadbeef->pl_item_unref (db.tracks->track);
         free (db.tracks);
         db.tracks = next;
     }
 
     memset (&db, 0, sizeof (db));
+    deadbeef->mutex_unlock (ml_mutex);
 }
 
-// This should be called only on pre-existing ml playlist.
-// Subsequent indexing should be done on the fly, using fileadd listener.
 static void
-ml_index (void) {
-    ml_free_db();
+ml_free_entry (ml_entry_t *en) {
+    hash_release (db.hash_album, en->album);
+    hash_release (db.hash_artist, en->artist);
+    hash_release (db.hash_genre, en->genre);
+    hash_release (db.hash_folder, en->folder);
+    if (en->title) {
+        deadbeef->metacache_unref (en->title);
+    }
+    if (en->file) {
+        deadbeef->metacache_unref (en->file);
+    }
+    deadbeef->pl_item_unref (en->track);
+    free (en);
+}
 
-    fprintf (stderr, "building index...\n");
+static void
+ml_index_track (DB_playItem_t *it) {
+    char folder[PATH_MAX];
+    ml_entry_t *en = calloc (sizeof (ml_entry_t), 1);
+
+    deadbeef->mutex_lock (ml_mutex);
+
+    const char *uri = deadbeef->pl_find_meta (it, ":URI");
+    const char *title = deadbeef->pl_find_meta (it, "title");
+    const char *artist = deadbeef->pl_find_meta (it, "artist");
+
+    // FIXME: album needs to be a combination of album + artist for indexing / library
+    const char *album = deadbeef->pl_find_meta (it, "album");
+    const char *genre = deadbeef->pl_find_meta (it, "genre");
+    ml_string_t *alb = ml_reg_album (&db, album);
+    ml_string_t *art = ml_reg_artist (&db, artist);
+    ml_string_t *gnr = ml_reg_genre (&db, genre);
+
+    char *fn = strrchr (uri, '/');
+    ml_string_t *fld = NULL;
+    if (fn) {
+        memcpy (folder, uri, fn-uri);
+        folder[fn-uri] = 0;
+        const char *s = deadbeef->metacache_add_string (folder);
+        fld = ml_reg_folder (&db, s);
+        deadbeef->metacache_unref (s);
+    }
 
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
+    // uri and title are not indexed, only a part of track list,
+    // that's why they have an extra ref for each entry
+    deadbeef->metacache_ref (uri);
+    en->file = uri;
+    if (title) {
+        deadbeef->metacache_ref (title);
+    }
+    if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
+        en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
+    }
+    else {
+        en->subtrack = -1;
+    }
+    en->title = title;
+    en->tracknum = deadbeef->pl_find_meta_int (it, "track", -1);
+    deadbeef->pl_item_ref (it);
+    en->track = it;
+    en->artist = art;
+    en->album = alb;
+    en->genre = gnr;
+    en->folder = fld;
+
+    if (db.tracks_tail) {
+        db.tracks_tail->next = en;
+    }
+    else {
+        db.tracks = en;
+    }
+    db.tracks_tail = en;
 
-    ml_entry_t *tail = NULL;
+    // add to the hash table
+    uint32_t hash = hash_for_ptr ((void *)en->file);
+    en->bucket_next = db.filename_hash[hash];
+    db.filename_hash[hash] = en;
 
-    char folder[PATH_MAX];
+    ml_tree_add (en);
+    deadbeef->mutex_unlock (ml_mutex);
+}
 
-    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+// indexes the tracks starting from `it`, which are appended to the library
+static void
+ml_index_from (DB_playItem_t *it) {
     while (it) {
-        ml_entry_t *en = calloc (sizeof (ml_entry_t), 1);
-
-        const char *uri = deadbeef->pl_find_meta (it, ":URI");
-        const char *title = deadbeef->pl_find_meta (it, "title");
-        const char *artist = deadbeef->pl_find_meta (it, "artist");
-
-        // FIXME: album needs to be a combination of album + artist for indexing / library
-        const char *album = deadbeef->pl_find_meta (it, "album");
-        const char *genre = deadbeef->pl_find_meta (it, "genre");
-        ml_string_t *alb = ml_reg_album (&db, album);
-        ml_string_t *art = ml_reg_artist (&db, artist);
-        ml_string_t *gnr = ml_reg_genre (&db, genre);
-
-        char *fn = strrchr (uri, '/');
-        ml_string_t *fld = NULL;
-        if (fn) {
-            memcpy (folder, uri, fn-uri);
-            folder[fn-uri] = 0;
-            const char *s = deadbeef->metacache_add_string (folder);
-            fld = ml_reg_folder (&db, s);
-            deadbeef->metacache_unref (s);
-        }
-
-        // uri and title are not indexed, only a part of track list,
-        // that's why they have an extra ref for each entry
-        deadbeef->metacache_ref (uri);
-        en->file = uri;
-        if (title) {
-            deadbeef->metacache_ref (title);
-        }
-        if (deadbeef->pl_get_item_flags (it) & DDB_IS_SUBTRACK) {
-            en->subtrack = deadbeef->pl_find_meta_int (it, ":TRACKNUM", -1);
-        }
-        else {
-            en->subtrack = -1;
+        ml_index_track (it);
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+}
+
+// removes all entries of the given files from the index
+static void
+ml_unindex_files (ml_string_t **files) {
+    deadbeef->mutex_lock (ml_mutex);
+    ml_entry_t *prev = NULL;
+    ml_entry_t *en = db.tracks;
+    while (en) {
+        ml_entry_t *next = en->next;
+        if (!hash_find (files, en->file)) {
+            prev = en;
+            en = next;
+            continue;
         }
-        en->title = title;
-        en->artist = art;
-        en->album = alb;
-        en->genre = gnr;
-        en->folder = fld;
 
-        if (tail) {
-            tail->next = en;
-            tail = en;
+        if (prev) {
+            prev->next = next;
         }
         else {
-            tail = db.tracks = en;
+            db.tracks = next;
+        }
+        if (db.tracks_tail == en) {
+            db.tracks_tail = prev;
         }
 
-        // add to the hash table
-        // at this point, we only have unique pointers, and don't need a duplicate check
-        uint32_t hash = hash_for_ptr ((void *)en->file);
-        en->bucket_next = db.filename_hash[hash];
-        db.filename_hash[hash] = en;
+        ml_entry_t **pp = &db.filename_hash[hash_for_ptr ((void *)en->file)];
+        while (*pp && *pp != en) {
+            pp = &(*pp)->bucket_next;
+        }
+        if (*pp) {
+            *pp = en->bucket_next;
+        }
+        ml_tree_remove (en);
+        ml_free_entry (en);
+        en = next;
+    }
+    deadbeef->mutex_unlock (ml_mutex);
+}
 
-        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
-        deadbeef->pl_item_unref (it);
-        it = next;
+static int
+ml_search (const char *text, DB_playItem_t **tracks, int count) {
+    ddb_query_t *query = deadbeef->query_compile (text);
+    int n = 0;
+    deadbeef->pl_lock ();
+    if (ml_playlist) {
+        DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+        while (it) {
+            if (deadbeef->query_match (query, ml_playlist, it)) {
+                if (n < count) {
+                    deadbeef->pl_item_ref (it);
+                    tracks[n] = it;
+                }
+                n++;
+            }
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
     }
+    deadbeef->pl_unlock ();
+    deadbeef->query_free (query);
+    return n;
+}
+
+// This should be called only on pre-existing ml playlist.
+// Subsequent indexing is done incrementally, see ml_scan_apply.
+static void
+ml_index (void) {
+    ml_free_db();
+
+    fprintf (stderr, "building index...\n");
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    ml_index_from (deadbeef->plt_get_first (ml_playlist, PL_MAIN));
 
     int nalb = 0;
     int nart = 0;
@@ -267,13 +1127,195 @@ ml_index (void) {
     fprintf (stderr, "index build time: %f seconds (%d albums, %d artists, %d genres, %d folders)\n", ms / 1000.f, nalb, nart, ngnr, nfld);
 }
 
+static void
+ml_scan_apply (ml_scan_t *scan) {
+    if (scan->nremoved) {
+        DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+        while (it) {
+            DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+            const char *uri = deadbeef->pl_find_meta (it, ":URI");
+            if (uri && hash_find (scan->removed, uri)) {
+                deadbeef->plt_remove_item (ml_playlist, it);
+            }
+            deadbeef->pl_item_unref (it);
+            it = next;
+        }
+        // changed files must be dropped from the index, otherwise the filter skips them
+        ml_unindex_files (scan->removed);
+    }
+
+    for (ml_path_t *p = scan->added; p && !scanner_terminate; p = p->next) {
+        DB_playItem_t *tail = deadbeef->plt_get_last (ml_playlist, PL_MAIN);
+        if (p->is_dir) {
+            plt_insert_dir (ml_playlist, tail, p->path, &scanner_terminate, add_file_info_cb, NULL);
+        }
+        else {
+            deadbeef->plt_insert_file2 (0, ml_playlist, tail, p->path, &scanner_terminate, add_file_info_cb, NULL);
+        }
+
+        // new tracks are appended after the old tail
+        ml_index_from (tail ? deadbeef->pl_get_next (tail, PL_MAIN) : deadbeef->plt_get_first (ml_playlist, PL_MAIN));
+        if (tail) {
+            deadbeef->pl_item_unref (tail);
+        }
+    }
+}
+
+static void
+ml_save (const char *plpath, const char *idxpath, const char *root) {
+    deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL);
+    if (ml_dirs_save (idxpath, root) < 0) {
+        fprintf (stderr, "medialib: failed to save %s\n", idxpath);
+    }
+}
+
+#if USE_INOTIFY
+// bursts of events are applied as one update, after the folders got quiet,
+// but not later than the max delay after the first event
+#define ML_WATCH_QUIET_MS 1000
+#define ML_WATCH_MAX_DELAY_MS 10000
+
+static int64_t
+ml_time_ms (void) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return (int64_t)tm.tv_sec * 1000 + tm.tv_usec / 1000;
+}
+
+static void
+ml_watch_flush (const char *plpath, const char *idxpath, const char *root) {
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    ml_scan_t scan;
+    memset (&scan, 0, sizeof (scan));
+    int ndirs = 0;
+    for (ml_dir_t *d = ml_dirs; d && !scanner_terminate; d = d->next) {
+        if (d->dirty && !d->removed) {
+            d->dirty = 0;
+            ml_dir_check (&scan, d, 1);
+            ndirs++;
+        }
+    }
+    if (scan.changed && !scanner_terminate) {
+        ml_scan_apply (&scan);
+        if (!scanner_terminate) {
+            ml_save (plpath, idxpath, root);
+        }
+    }
+    ml_scan_free (&scan);
+    ml_dirs_free_removed ();
+
+    gettimeofday (&tm2, NULL);
+    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+    fprintf (stderr, "ml watch update time: %f seconds (%d folders, %d tracks)\n", ms / 1000.f, ndirs, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+}
+
+static void
+ml_watch (const char *plpath, const char *idxpath, const char *root) {
+    ml_inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (ml_inotify_fd < 0) {
+        fprintf (stderr, "medialib: inotify_init1 failed: %s\n", strerror (errno));
+        return;
+    }
+    for (ml_dir_t *d = ml_dirs; d; d = d->next) {
+        ml_watch_dir (d);
+    }
+
+    int pending = 0;
+    int64_t first_event = 0;
+    int64_t last_event = 0;
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    while (!scanner_terminate) {
+        // sleep until the next event, or until the pending changes are due
+        int timeout = -1;
+        if (pending) {
+            int64_t due = last_event + ML_WATCH_QUIET_MS;
+            if (due > first_event + ML_WATCH_MAX_DELAY_MS) {
+                due = first_event + ML_WATCH_MAX_DELAY_MS;
+            }
+            int64_t now = ml_time_ms ();
+            timeout = due > now ? (int)(due - now) : 0;
+        }
+        struct pollfd pfd[2] = {
+            { .fd = ml_inotify_fd, .events = POLLIN },
+            { .fd = ml_wakeup_fds[0], .events = POLLIN },
+        };
+        int res = poll (pfd, ml_wakeup_fds[0] >= 0 ? 2 : 1, timeout);
+        int64_t now = ml_time_ms ();
+        if (res > 0 && (pfd[0].revents & POLLIN)) {
+            ssize_t len;
+            while ((len = read (ml_inotify_fd, buf, sizeof (buf))) > 0) {
+                const struct inotify_event *ev;
+                for (char *ptr = buf; ptr < buf + len; ptr += sizeof (struct inotify_event) + ev->len) {
+                    ev = (const struct inotify_event *)ptr;
+                    if (ev->mask & IN_Q_OVERFLOW) {
+                        // events were lost, check everything
+                        for (ml_dir_t *d = ml_dirs; d; d = d->next) {
+                            d->dirty = 1;
+                        }
+                    }
+                    else if (ev->wd > 0 && ev->wd < ml_watch_dirs_size && ml_watch_dirs[ev->wd]) {
+                        ml_dir_t *d = ml_watch_dirs[ev->wd];
+                        d->dirty = 1;
+                        if (ev->mask & IN_IGNORED) {
+                            // the watch was removed by the kernel
+                            ml_watch_dirs[ev->wd] = NULL;
+                            d->wd = 0;
+                        }
+                    }
+                    else {
+                        continue;
+                    }
+                    if (!pending) {
+                        first_event = now;
+                    }
+                    pending = 1;
+                    last_event = now;
+                }
+            }
+        }
+        if (pending && (now - last_event >= ML_WATCH_QUIET_MS || now - first_event >= ML_WATCH_MAX_DELAY_MS)) {
+            pending = 0;
+            ml_watch_flush (plpath, idxpath, root);
+            // watch the new folders
+            for (ml_dir_t *d = ml_dirs; d; d = d->next) {
+                ml_watch_dir (d);
+            }
+        }
+    }
+
+    close (ml_inotify_fd);
+    ml_inotify_fd = -1;
+    for (ml_dir_t *d = ml_dirs; d; d = d->next) {
+        d->wd = 0;
+    }
+    free (ml_watch_dirs);
+    ml_watch_dirs = NULL;
+    ml_watch_dirs_size = 0;
+}
+#endif
+
 static void
 scanner_thread (void *none) {
     char plpath[PATH_MAX];
     snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    char idxpath[PATH_MAX];
+    snprintf (idxpath, sizeof (idxpath), "%s/medialib.idx", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
 
     struct timeval tm1, tm2;
 
+    char musicdir[PATH_MAX];
+    deadbeef->conf_get_str ("medialib.path", "", musicdir, sizeof (musicdir));
+    if (!musicdir[0]) {
+        return;
+    }
+    const char *root = musicdir;
+    if (!strncmp (root, "file://", 7)) {
+        root += 7;
+    }
+    follow_symlinks = deadbeef->conf_get_int ("add_folders_follow_symlinks", 0);
+
     if (!ml_playlist) {
         ml_playlist = deadbeef->plt_alloc ("medialib");
 
@@ -284,28 +1326,45 @@ scanner_thread (void *none) {
         long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
         fprintf (stderr, "ml playlist load time: %f seconds\n", ms / 1000.f);
 
-        if (plt_head) {
-//            for (int i = 0; i < 100; i++) {
-                ml_index ();
-//            }
+        // the scan state is only valid together with the library it describes
+        if (!plt_head || ml_dirs_load (idxpath, root) < 0) {
+            deadbeef->plt_clear (ml_playlist);
+        }
+        else {
+            ml_index ();
         }
     }
 
     gettimeofday (&tm1, NULL);
 
-    const char *musicdir = deadbeef->conf_get_str_fast ("medialib.path", NULL);
-    if (!musicdir) {
-        return;
-    }
-
-    printf ("adding dir: %s\n", musicdir);
-    plt_insert_dir (ml_playlist, NULL, musicdir, &scanner_terminate, add_file_info_cb, NULL);
+    ml_scan_t scan;
+    memset (&scan, 0, sizeof (scan));
+    ml_scan_changes (&scan, root);
 
     gettimeofday (&tm2, NULL);
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+    fprintf (stderr, "ml change check time: %f seconds (%s)\n", ms / 1000.f, scan.changed ? "changed" : "unchanged");
 
-    deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL);
+    if (scan.changed && !scanner_terminate) {
+        printf ("updating library: %s\n", musicdir);
+        ml_scan_apply (&scan);
+
+        gettimeofday (&tm2, NULL);
+        ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
+        fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
+
+        if (!scanner_terminate) {
+            ml_save (plpath, idxpath, root);
+        }
+    }
+    ml_scan_free (&scan);
+    ml_dirs_free_removed ();
+
+#if USE_INOTIFY
+    if (!scanner_terminate && deadbeef->conf_get_int ("medialib.watch", 1)) {
+        ml_watch (plpath, idxpath, root);
+    }
+#endif
 }
 
 //#define FILTER_PERF
@@ -365,23 +1424,24 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
 
 static int
 ml_connect (void) {
-#if 0
-    //tid = deadbeef->thread_start_low_priority (scanner_thread, NULL);
-
-    struct timeval tm1, tm2;
-    gettimeofday (&tm1, NULL);
-    scanner_thread(NULL);
-    gettimeofday (&tm2, NULL);
-    long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
-    fprintf (stderr, "whole ml init time: %f seconds\n", ms / 1000.f);
-    exit (0);
-#endif
+    tid = deadbeef->thread_start_low_priority (scanner_thread, NULL);
     return 0;
 }
 
 static int
 ml_start (void) {
+    ml_mutex = deadbeef->mutex_create ();
     filter_id = deadbeef->register_fileadd_filter (ml_fileadd_filter, NULL);
+#if USE_INOTIFY
+    if (!pipe (ml_wakeup_fds)) {
+        fcntl (ml_wakeup_fds[0], F_SETFL, O_NONBLOCK);
+        fcntl (ml_wakeup_fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl (ml_wakeup_fds[1], F_SETFD, FD_CLOEXEC);
+    }
+    else {
+        ml_wakeup_fds[0] = ml_wakeup_fds[1] = -1;
+    }
+#endif
     return 0;
 }
 
@@ -389,9 +1449,25 @@ static int
 ml_stop (void) {
     if (tid) {
         scanner_terminate = 1;
+#if USE_INOTIFY
+        if (ml_wakeup_fds[1] >= 0) {
+            char c = 0;
+            if (write (ml_wakeup_fds[1], &c, 1) < 0) {
+                fprintf (stderr, "medialib: failed to wake up the watcher\n");
+            }
+        }
+#endif
         deadbeef->thread_join (tid);
         tid = 0;
     }
+#if USE_INOTIFY
+    for (int i = 0; i < 2; i++) {
+        if (ml_wakeup_fds[i] >= 0) {
+            close (ml_wakeup_fds[i]);
+            ml_wakeup_fds[i] = -1;
+        }
+    }
+#endif
     if (filter_id) {
         deadbeef->unregister_fileadd_filter (filter_id);
         filter_id = 0;
@@ -399,6 +1475,13 @@ ml_stop (void) {
 
     if (ml_playlist) {
         deadbeef->plt_free (ml_playlist);
+        ml_playlist = NULL;
+    }
+    ml_free_db ();
+    ml_dirs_free ();
+    if (ml_mutex) {
+        deadbeef->mutex_free (ml_mutex);
+        ml_mutex = 0;
     }
 
     return 0;
@@ -409,16 +1492,12 @@ ml_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
     return 0;
 }
 
-typedef struct ddb_medialib_plugin_s {
-    DB_misc_t plugin;
-} ddb_medialib_plugin_t;
-
 // define plugin interface
 static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.api_vmajor = 1,
     .plugin.plugin.api_vminor = 0,
     .plugin.plugin.version_major = 0,
-    .plugin.plugin.version_minor = 1,
+    .plugin.plugin.version_minor = 3,
     .plugin.plugin.type = DB_PLUGIN_MISC,
     .plugin.plugin.id = "medialib",
     .plugin.plugin.name = "Media Library",
@@ -451,6 +1530,10 @@ static ddb_medialib_plugin_t plugin = {
     .plugin.plugin.stop = ml_stop,
 //    .plugin.plugin.configdialog = settings_dlg,
     .plugin.plugin.message = ml_message,
+    .count = ml_count,
+    .query = ml_query,
+    .free_nodes = ml_free_nodes,
+    .search = ml_search,
 };
 
 DB_plugin_t *
@@ -0,0 +1,73 @@
+/*
+    Media Library plugin for DeaDBeeF Player
+    Copyright (C) 2009-2016 Alexey Yakovenko
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+#ifndef __MEDIALIB_H
+#define __MEDIALIB_H
+
+#include "../../deadbeef.h"
+
+// changes in 0.2:
+//   added the browse tree query API: count, query, free_nodes
+// changes in 0.3:
+//   added search
+
+// levels of the browse tree; `depth` in the query functions is the number
+// of names in the path, e.g. depth 2 with {genre, artist} selects the albums
+enum {
+    DDB_MEDIALIB_LEVEL_GENRE = 0,
+    DDB_MEDIALIB_LEVEL_ARTIST = 1,
+    DDB_MEDIALIB_LEVEL_ALBUM = 2,
+    DDB_MEDIALIB_LEVEL_TRACK = 3,
+};
+
+typedef struct {
+    // genre, artist or album name, or the track title; NULL if unknown
+    // this is a metacache string, referenced until free_nodes is called
+    const char *text;
+    // number of child nodes, 0 for tracks
+    int num_children;
+    // number of tracks below the node, 1 for tracks
+    int num_tracks;
+    // the track, only set at the track level; referenced until free_nodes is called
+    DB_playItem_t *track;
+} ddb_medialib_node_t;
+
+typedef struct ddb_medialib_plugin_s {
+    DB_misc_t plugin;
+
+    // returns the number of children of the node at `path`, or -1 if there's no such node
+    // path elements are matched exactly, NULL matches the "unknown" node
+    int (*count) (const char **path, int depth);
+
+    // fills `nodes` with up to `count` children of the node at `path`, starting at `offset`
+    // children are sorted case-insensitively by name; tracks by track number, then title
+    // returns the number of nodes filled in, which must be released with free_nodes
+    int (*query) (const char **path, int depth, int offset, int count, ddb_medialib_node_t *nodes);
+
+    void (*free_nodes) (ddb_medialib_node_t *nodes, int count);
+
+    // returns the number of tracks matching the text, which can be a query, see query_compile;
+    // fills `tracks` with up to `count` of them, which must be released with pl_item_unref
+    int (*search) (const char *text, DB_playItem_t **tracks, int count);
+} ddb_medialib_plugin_t;
+
+#endif
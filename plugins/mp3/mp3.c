@@ -28,6 +28,9 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
 #include "../../deadbeef.h"
 #include "mp3.h"
 #ifdef USE_LIBMAD
@@ -431,9 +434,27 @@ retry_sync:
     return offs + mpeg_frame->packetlength;
 }
 
+static void
+_seektable_add (buffer_t *buffer, int64_t offs, int64_t sample) {
+    if (buffer->seektable_count == buffer->seektable_alloc) {
+        int alloc = buffer->seektable_alloc ? buffer->seektable_alloc * 2 : 1024;
+        mp3_seekpoint_t *seektable = realloc (buffer->seektable, alloc * sizeof (mp3_seekpoint_t));
+        if (!seektable) {
+            return;
+        }
+        buffer->seektable = seektable;
+        buffer->seektable_alloc = alloc;
+    }
+    buffer->seektable[buffer->seektable_count].offs = offs;
+    buffer->seektable[buffer->seektable_count].sample = sample;
+    buffer->seektable_count++;
+}
+
 // sample=-1: scan entire stream, calculate precise duration
 // sample=0: read headers/tags, calculate approximate duration
 // sample>0: seek to the frame with the sample, update skipsamples
+// with sample!=0, the seek table is filled in while scanning,
+// and seeking starts from the closest table entry, instead of the start of the stream
 // return value: -1 on error
 static int
 cmp3_scan_stream (buffer_t *buffer, int sample) {
@@ -465,6 +486,33 @@ cmp3_scan_stream (buffer_t *buffer, int sample) {
         frame_positions[i] = buffer->startoffset;
     }
 
+    if (sample > 0 && buffer->seektable_count > 1) {
+        // start from the last seek table entry which leaves enough lead-in frames before the sample
+        int64_t limit = sample - (MAX_LEAD_IN_FRAMES + 1) * 1152;
+        int l = 0;
+        int r = buffer->seektable_count - 1;
+        while (l < r) {
+            int m = (l + r + 1) / 2;
+            if (buffer->seektable[m].sample <= limit) {
+                l = m;
+            }
+            else {
+                r = m - 1;
+            }
+        }
+        if (l > 0) {
+            offs = buffer->seektable[l].offs;
+            nframe = l * MP3_SEEKTABLE_INTERVAL;
+            scansamples = (int)buffer->seektable[l].sample;
+            lead_in_frame_pos = offs;
+            lead_in_frame_no = nframe;
+            for (int i = 0; i < MAX_LEAD_IN_FRAMES; i++) {
+                frame_positions[i] = offs;
+            }
+            trace ("cmp3_scan_stream: starting from frame %d (offs: %lld)\n", nframe, offs);
+        }
+    }
+
     for (;;) {
         if (offs <= 0) {
             offs = deadbeef->ftell (buffer->file);
@@ -554,6 +602,10 @@ cmp3_scan_stream (buffer_t *buffer, int sample) {
         }
 // }}}
 
+        if (sample != 0 && nframe % MP3_SEEKTABLE_INTERVAL == 0 && nframe / MP3_SEEKTABLE_INTERVAL == buffer->seektable_count) {
+            _seektable_add (buffer, framepos, scansamples);
+        }
+
         if (sample == 0) {
 // {{{ update averages, interrupt scan on frame #100
             // calculating apx duration based on 1st 100 frames
@@ -762,6 +814,307 @@ cmp3_set_extra_properties (buffer_t *buffer, int fake) {
     deadbeef->pl_replace_meta (buffer->it, fake ? "!FILETYPE" : ":FILETYPE", "MP3");
 }
 
+// {{{ seek cache
+// The results of the full scan are cached in <cache dir>/mp3seek/<md5 of uri>,
+// so that long files without Xing header don't need to be rescanned on every playback.
+// Loading a cache file updates its mtime, and the least recently used files are deleted
+// when there are more than MP3_SEEKCACHE_MAX_FILES.
+// With mp3.disable_gapless, the file is not fully scanned, and the cache is not used.
+#define MP3_SEEKCACHE_MIN_DURATION 600 // seconds, shorter files are fast enough to scan
+#define MP3_SEEKCACHE_MAX_FILES 1000
+#define MP3_SEEKCACHE_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint32_t cache_version;
+    int64_t fsize;
+    int64_t mtime;
+    int64_t startoffset;
+    int64_t totalsamples;
+    float duration;
+    int32_t version;
+    int32_t layer;
+    int32_t bitrate;
+    int32_t samplerate;
+    int32_t packetlength;
+    int32_t channels;
+    int32_t delay;
+    int32_t padding;
+    int32_t vbr;
+    int32_t lamepreset;
+    int32_t have_xing_header;
+    int32_t seektable_interval;
+    int32_t seektable_count;
+} mp3_seekcache_header_t;
+
+// returns -1 if the file can't be cached, e.g. not a local file
+static int
+cmp3_seekcache_init (buffer_t *buffer, char *path, size_t size, mp3_seekcache_header_t *hdr) {
+    if (!deadbeef->conf_get_int ("mp3.seek_cache", 1)) {
+        return -1;
+    }
+    const char *cachedir = deadbeef->get_system_dir (DDB_SYS_DIR_CACHE);
+    if (!cachedir || !*cachedir) {
+        return -1;
+    }
+
+    char uri[PATH_MAX];
+    deadbeef->pl_get_meta (buffer->it, ":URI", uri, sizeof (uri));
+    const char *fname = uri;
+    if (!strncasecmp (fname, "file://", 7)) {
+        fname += 7;
+    }
+    struct stat st;
+    if (stat (fname, &st) || !S_ISREG (st.st_mode)) {
+        return -1;
+    }
+
+    uint8_t sig[16];
+    char sigstr[33];
+    deadbeef->md5 (sig, uri, (int)strlen (uri));
+    deadbeef->md5_to_str (sigstr, sig);
+    if (snprintf (path, size, "%s%smp3seek/%s", cachedir, cachedir[strlen (cachedir)-1] == '/' ? "" : "/", sigstr) >= size) {
+        return -1;
+    }
+
+    memset (hdr, 0, sizeof (mp3_seekcache_header_t));
+    memcpy (hdr->magic, "MP3S", 4);
+    hdr->cache_version = MP3_SEEKCACHE_VERSION;
+    hdr->fsize = deadbeef->fgetlength (buffer->file);
+    hdr->mtime = st.st_mtime;
+    hdr->seektable_interval = MP3_SEEKTABLE_INTERVAL;
+    return 0;
+}
+
+// checks the cached stream parameters, which are used without rescanning the file
+static int
+cmp3_seekcache_header_valid (const mp3_seekcache_header_t *hdr) {
+    static const int srtable[3][3] = {
+        {44100, 48000, 32000},
+        {22050, 24000, 16000},
+        {11025, 12000, 8000},
+    };
+    if (hdr->version < 1 || hdr->version > 3
+        || hdr->layer < 1 || hdr->layer > 3
+        || hdr->channels < 1 || hdr->channels > 2
+        || hdr->startoffset < 0 || hdr->startoffset >= hdr->fsize
+        || hdr->delay < 0 || hdr->padding < 0
+        // no mpeg frame has more than a few samples per byte
+        || hdr->totalsamples <= 0 || hdr->totalsamples > hdr->fsize * 16) {
+        return 0;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (hdr->samplerate == srtable[hdr->version-1][i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// returns 0 if the stream parameters and the seek table were loaded from the cache
+static int
+cmp3_seekcache_load (buffer_t *buffer) {
+    char path[PATH_MAX];
+    mp3_seekcache_header_t hdr, cached;
+    if (cmp3_seekcache_init (buffer, path, sizeof (path), &hdr) < 0) {
+        return -1;
+    }
+
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    if (fread (&cached, sizeof (cached), 1, fp) != 1
+        || memcmp (cached.magic, hdr.magic, 4)
+        || cached.cache_version != hdr.cache_version
+        || cached.fsize != hdr.fsize
+        || cached.mtime != hdr.mtime
+        || cached.seektable_interval != hdr.seektable_interval
+        || cached.seektable_count <= 0
+        || !cmp3_seekcache_header_valid (&cached)) {
+        trace ("mp3: seek cache %s is invalid or out of date\n", path);
+        fclose (fp);
+        return -1;
+    }
+
+    mp3_seekpoint_t *seektable = malloc (cached.seektable_count * sizeof (mp3_seekpoint_t));
+    if (!seektable || fread (seektable, sizeof (mp3_seekpoint_t), cached.seektable_count, fp) != cached.seektable_count) {
+        free (seektable);
+        fclose (fp);
+        return -1;
+    }
+    fclose (fp);
+
+    // the seek points must be within the file, and in order
+    for (int i = 0; i < cached.seektable_count; i++) {
+        if (seektable[i].offs < cached.startoffset || seektable[i].offs >= cached.fsize
+            || seektable[i].sample < 0 || seektable[i].sample > cached.totalsamples + cached.delay + cached.padding
+            || (i > 0 && (seektable[i].offs <= seektable[i-1].offs || seektable[i].sample <= seektable[i-1].sample))) {
+            trace ("mp3: seek cache %s has invalid seek points\n", path);
+            free (seektable);
+            return -1;
+        }
+    }
+
+    // keep the recently used files when evicting
+    utime (path, NULL);
+
+    buffer->startoffset = cached.startoffset;
+    buffer->totalsamples = cached.totalsamples;
+    buffer->duration = cached.duration;
+    buffer->version = cached.version;
+    buffer->layer = cached.layer;
+    buffer->bitrate = cached.bitrate;
+    buffer->samplerate = cached.samplerate;
+    buffer->packetlength = cached.packetlength;
+    buffer->channels = cached.channels;
+    buffer->delay = cached.delay;
+    buffer->padding = cached.padding;
+    buffer->vbr = cached.vbr;
+    buffer->lamepreset = cached.lamepreset;
+    buffer->have_xing_header = cached.have_xing_header;
+
+    free (buffer->seektable);
+    buffer->seektable = seektable;
+    buffer->seektable_count = buffer->seektable_alloc = cached.seektable_count;
+    trace ("mp3: loaded %d seek points from %s\n", cached.seektable_count, path);
+    return 0;
+}
+
+typedef struct {
+    char *name;
+    time_t mtime;
+} mp3_seekcache_file_t;
+
+static int
+cmp3_seekcache_file_cmp (const void *a, const void *b) {
+    time_t ta = ((const mp3_seekcache_file_t *)a)->mtime;
+    time_t tb = ((const mp3_seekcache_file_t *)b)->mtime;
+    return ta < tb ? -1 : ta > tb;
+}
+
+// deletes the least recently used files, when there are too many
+static void
+cmp3_seekcache_evict (const char *dir) {
+    DIR *d = opendir (dir);
+    if (!d) {
+        return;
+    }
+    mp3_seekcache_file_t *files = NULL;
+    int count = 0;
+    int alloc = 0;
+    struct dirent *de;
+    while ((de = readdir (d))) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat st;
+        if (snprintf (path, sizeof (path), "%s/%s", dir, de->d_name) >= sizeof (path)
+            || stat (path, &st) || !S_ISREG (st.st_mode)) {
+            continue;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 256;
+            mp3_seekcache_file_t *f = realloc (files, alloc * sizeof (mp3_seekcache_file_t));
+            if (!f) {
+                break;
+            }
+            files = f;
+        }
+        files[count].name = strdup (de->d_name);
+        files[count].mtime = st.st_mtime;
+        if (files[count].name) {
+            count++;
+        }
+    }
+    closedir (d);
+
+    if (count > MP3_SEEKCACHE_MAX_FILES) {
+        qsort (files, count, sizeof (mp3_seekcache_file_t), cmp3_seekcache_file_cmp);
+        for (int i = 0; i < count - MP3_SEEKCACHE_MAX_FILES; i++) {
+            char path[PATH_MAX];
+            if (snprintf (path, sizeof (path), "%s/%s", dir, files[i].name) < sizeof (path)) {
+                trace ("mp3: evicting seek cache %s\n", path);
+                unlink (path);
+            }
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free (files[i].name);
+    }
+    free (files);
+}
+
+static void
+cmp3_seekcache_save (buffer_t *buffer) {
+    if (buffer->seektable_count <= 0 || buffer->duration < MP3_SEEKCACHE_MIN_DURATION) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    mp3_seekcache_header_t hdr;
+    if (cmp3_seekcache_init (buffer, path, sizeof (path), &hdr) < 0) {
+        return;
+    }
+
+    hdr.startoffset = buffer->startoffset;
+    hdr.totalsamples = buffer->totalsamples;
+    hdr.duration = buffer->duration;
+    hdr.version = buffer->version;
+    hdr.layer = buffer->layer;
+    hdr.bitrate = buffer->bitrate;
+    hdr.samplerate = buffer->samplerate;
+    hdr.packetlength = buffer->packetlength;
+    hdr.channels = buffer->channels;
+    hdr.delay = buffer->delay;
+    hdr.padding = buffer->padding;
+    hdr.vbr = buffer->vbr;
+    hdr.lamepreset = buffer->lamepreset;
+    hdr.have_xing_header = buffer->have_xing_header;
+    hdr.seektable_count = buffer->seektable_count;
+
+    // make folders, the cache dir itself may not exist yet
+    char dir[PATH_MAX];
+    strcpy (dir, path);
+    for (char *p = strchr (dir + 1, '/'); p; p = strchr (p + 1, '/')) {
+        *p = 0;
+        mkdir (dir, 0755);
+        *p = '/';
+    }
+
+    // write to a temp file, and rename, so that a partially written cache is never loaded
+    // the temp name is unique, in case several threads save the same file
+    char temp[PATH_MAX];
+    if (snprintf (temp, sizeof (temp), "%s.part.XXXXXX", path) >= sizeof (temp)) {
+        return;
+    }
+    int fd = mkstemp (temp);
+    if (fd < 0) {
+        trace ("mp3: failed to create seek cache temp file for %s\n", path);
+        return;
+    }
+    FILE *fp = fdopen (fd, "wb");
+    if (!fp) {
+        trace ("mp3: failed to write seek cache %s\n", temp);
+        close (fd);
+        unlink (temp);
+        return;
+    }
+    int err = fwrite (&hdr, sizeof (hdr), 1, fp) != 1
+        || fwrite (buffer->seektable, sizeof (mp3_seekpoint_t), buffer->seektable_count, fp) != buffer->seektable_count;
+    if (fclose (fp) || err || rename (temp, path)) {
+        trace ("mp3: failed to write seek cache %s\n", path);
+        unlink (temp);
+        return;
+    }
+    trace ("mp3: saved %d seek points to %s\n", buffer->seektable_count, path);
+
+    *strrchr (dir, '/') = 0;
+    cmp3_seekcache_evict (dir);
+}
+// }}}
+
 static int
 cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
     mp3_info_t *info = (mp3_info_t *)_info;
@@ -805,10 +1158,21 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
             trace ("mp3: skipping %d(%xH) bytes of junk\n", skip, skip);
             deadbeef->fseek (info->buffer.file, skip, SEEK_SET);
         }
-        int res = cmp3_scan_stream (&info->buffer, deadbeef->conf_get_int ("mp3.disable_gapless", 0) ? 0 : -1);
-        if (res < 0) {
-            trace ("mp3: cmp3_init: initial cmp3_scan_stream failed\n");
-            return -1;
+        if (deadbeef->conf_get_int ("mp3.disable_gapless", 0)) {
+            // quick scan, which doesn't need the seek cache
+            int res = cmp3_scan_stream (&info->buffer, 0);
+            if (res < 0) {
+                trace ("mp3: cmp3_init: initial cmp3_scan_stream failed\n");
+                return -1;
+            }
+        }
+        else if (cmp3_seekcache_load (&info->buffer) < 0) {
+            int res = cmp3_scan_stream (&info->buffer, -1);
+            if (res < 0) {
+                trace ("mp3: cmp3_init: initial cmp3_scan_stream failed\n");
+                return -1;
+            }
+            cmp3_seekcache_save (&info->buffer);
         }
         info->buffer.delay += 529;
         if (info->buffer.padding >= 529) {
@@ -989,6 +1353,7 @@ cmp3_free (DB_fileinfo_t *_info) {
         info->info.file = NULL;
         info->dec->free (info);
     }
+    free (info->buffer.seektable);
     free (info);
 }
 
@@ -1289,6 +1654,7 @@ static const char *exts[] = {
 static const char settings_dlg[] =
     "property \"Force 16 bit output\" checkbox mp3.force16bit 0;\n"
     "property \"Disable gapless playback (faster scanning)\" checkbox mp3.disable_gapless 0;\n"
+    "property \"Cache seek tables of long files\" checkbox mp3.seek_cache 1;\n"
 #if defined(USE_LIBMAD) && defined(USE_LIBMPG123)
     "property \"Backend\" select[2] mp3.backend 0 mpg123 mad;\n"
 #endif
@@ -53,6 +53,14 @@ extern DB_functions_t *deadbeef;
 #define TOC_FLAG        0x0004
 #define VBR_SCALE_FLAG  0x0008
 
+// seek table: one entry per MP3_SEEKTABLE_INTERVAL mpeg frames
+#define MP3_SEEKTABLE_INTERVAL 64
+
+typedef struct {
+    int64_t offs; // file offset of the frame header
+    int64_t sample; // number of samples before the frame
+} mp3_seekpoint_t;
+
 struct mp3_decoder_api_s;
 
 typedef struct {
@@ -103,6 +111,12 @@ typedef struct {
     uint16_t lamepreset;
     int have_xing_header;
     int lead_in_frames;
+
+    // filled by cmp3_scan_stream with sample!=0, and loaded from the seek cache;
+    // entry N is the frame N*MP3_SEEKTABLE_INTERVAL
+    mp3_seekpoint_t *seektable;
+    int seektable_count;
+    int seektable_alloc;
 } buffer_t;
 
 typedef struct {
@@ -32,6 +32,14 @@
 #include "premix.h"
 #include "fastftoi.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PREMIX_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define PREMIX_NEON 1
+#include <arm_neon.h>
+#endif
+
 #define trace(...) { fprintf(stderr, __VA_ARGS__); }
 //#define trace(fmt,...)
 
@@ -376,14 +384,18 @@ static inline void
 pcm_write_samples_float_to_32 (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int nsamples, int * restrict channelmap, int outputsamplesize) {
     for (int s = 0; s < nsamples; s++) {
         for (int c = 0; c < outputfmt->channels; c++) {
-            float fsample = (*((float*)(input + channelmap[c] * 4)));
-            if (fsample > (float)0x7fffffff/0x80000000) {
-                fsample = (float)0x7fffffff/0x80000000;
+            float fsample = (*((float*)(input + channelmap[c] * 4))) * (float)0x80000000;
+            int32_t sample;
+            // 0x7fffffff is not representable as float, and 1.0 would overflow
+            if (fsample >= (float)0x80000000) {
+                sample = 0x7fffffff;
+            }
+            else if (fsample < -(float)0x80000000) {
+                sample = INT32_MIN;
             }
-            else if (fsample < -1.f) {
-                fsample = -1.f;
+            else {
+                sample = (int32_t)fsample;
             }
-            int32_t sample = fsample * (float)0x80000000;
             *((int32_t *)(output + 4 * c)) = sample;
         }
         input += 4 * inputfmt->channels;
@@ -453,6 +465,738 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+// Kernels for the identity channel map, converting n samples of all channels at once.
+// The results are identical to the pcm_write_samples_* functions above.
+typedef void (*pcm_kernel_fn_t) (const char * restrict input, char * restrict output, int n);
+
+typedef struct {
+    pcm_kernel_fn_t s16_to_float;
+    pcm_kernel_fn_t s24_to_float;
+    pcm_kernel_fn_t s32_to_float;
+    pcm_kernel_fn_t float_to_s16;
+    pcm_kernel_fn_t float_to_s24;
+    pcm_kernel_fn_t float_to_s32;
+    // gain stage, multiplying n samples in place
+    void (*gain_s16) (char *bytes, int n, int32_t gain); // fixed point gain, see pcm_gain_to_fixed
+    void (*gain_float) (char *bytes, int n, float gain);
+} pcm_kernels_t;
+
+static inline float
+pcm_s24_to_float (const char *in) {
+    int32_t sample = ((unsigned char)in[0]) | ((unsigned char)in[1]<<8) | (in[2]<<16);
+    return sample / (float)0x800000;
+}
+
+static inline int16_t
+pcm_float_to_s16 (float sample) {
+    int isample = ftoi (sample*0x8000);
+    if (isample > 0x7fff) {
+        isample = 0x7fff;
+    }
+    else if (isample < -0x8000) {
+        isample = -0x8000;
+    }
+    return (int16_t)isample;
+}
+
+static inline void
+pcm_float_to_s24 (float sample, char *out) {
+    int32_t outsample = (int32_t)ftoi (sample * 0x800000);
+    if (outsample >= 0x7fffff) {
+        outsample = 0x7fffff;
+    }
+    else if (outsample < -0x800000) {
+        outsample = -0x800000;
+    }
+    out[0] = (outsample&0x0000ff);
+    out[1] = (outsample&0x00ff00)>>8;
+    out[2] = (outsample&0xff0000)>>16;
+}
+
+static inline int32_t
+pcm_float_to_s32 (float sample) {
+    float fsample = sample * (float)0x80000000;
+    if (fsample >= (float)0x80000000) {
+        return 0x7fffffff;
+    }
+    else if (fsample < -(float)0x80000000) {
+        return INT32_MIN;
+    }
+    return (int32_t)fsample;
+}
+
+// the scalar kernels also finish the tails of the SIMD kernels
+static void
+pcm_kernel_s16_to_float (const char * restrict input, char * restrict output, int n) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+static void
+pcm_kernel_s24_to_float (const char * restrict input, char * restrict output, int n) {
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = pcm_s24_to_float (input + i * 3);
+    }
+}
+
+static void
+pcm_kernel_s32_to_float (const char * restrict input, char * restrict output, int n) {
+    const int32_t *in = (const int32_t *)input;
+    float *out = (float *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] / (float)0x80000000;
+    }
+}
+
+static void
+pcm_kernel_float_to_s16 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        out[i] = pcm_float_to_s16 (in[i]);
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_kernel_float_to_s24 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    fpu_control ctl;
+    fpu_setround (&ctl);
+    for (int i = 0; i < n; i++) {
+        pcm_float_to_s24 (in[i], output + i * 3);
+    }
+    fpu_restore (ctl);
+}
+
+static void
+pcm_kernel_float_to_s32 (const char * restrict input, char * restrict output, int n) {
+    const float *in = (const float *)input;
+    int32_t *out = (int32_t *)output;
+    for (int i = 0; i < n; i++) {
+        out[i] = pcm_float_to_s32 (in[i]);
+    }
+}
+
+// Integer samples are multiplied by fixed point gains, with rounding and clipping:
+// 8 and 16 bit samples by 4.12 gains, fitting int16, which limits the gains to +18dB;
+// 24 and 32 bit samples by 8.24 gains, in 64 bit.
+#define PCM_GAIN_BITS_16 12
+#define PCM_GAIN_BITS_32 24
+#define PCM_GAIN_MAX (32767.f / (1 << PCM_GAIN_BITS_16))
+
+static inline int32_t
+pcm_gain_to_fixed (float gain, int bits) {
+    if (gain <= 0) {
+        return 0;
+    }
+    if (gain > PCM_GAIN_MAX) {
+        gain = PCM_GAIN_MAX;
+    }
+    return (int32_t)(gain * (1 << bits) + .5f);
+}
+
+static inline int16_t
+pcm_gain_s16 (int16_t sample, int32_t gain) {
+    int32_t v = (sample * gain + (1 << (PCM_GAIN_BITS_16-1))) >> PCM_GAIN_BITS_16;
+    if (v > 0x7fff) {
+        v = 0x7fff;
+    }
+    else if (v < -0x8000) {
+        v = -0x8000;
+    }
+    return (int16_t)v;
+}
+
+static void
+pcm_gain_kernel_s8 (char *bytes, int n, int32_t gain) {
+    int8_t *s = (int8_t *)bytes;
+    for (int i = 0; i < n; i++) {
+        int32_t v = (s[i] * gain + (1 << (PCM_GAIN_BITS_16-1))) >> PCM_GAIN_BITS_16;
+        if (v > 0x7f) {
+            v = 0x7f;
+        }
+        else if (v < -0x80) {
+            v = -0x80;
+        }
+        s[i] = (int8_t)v;
+    }
+}
+
+static void
+pcm_gain_kernel_s16 (char *bytes, int n, int32_t gain) {
+    int16_t *s = (int16_t *)bytes;
+    for (int i = 0; i < n; i++) {
+        s[i] = pcm_gain_s16 (s[i], gain);
+    }
+}
+
+static void
+pcm_gain_kernel_s24 (char *bytes, int n, int32_t gain) {
+    for (int i = 0; i < n; i++, bytes += 3) {
+        int32_t sample = ((unsigned char)bytes[0]) | ((unsigned char)bytes[1]<<8) | (bytes[2]<<16);
+        int64_t v = ((int64_t)sample * gain + (1 << (PCM_GAIN_BITS_32-1))) >> PCM_GAIN_BITS_32;
+        if (v > 0x7fffff) {
+            v = 0x7fffff;
+        }
+        else if (v < -0x800000) {
+            v = -0x800000;
+        }
+        bytes[0] = (v&0x0000ff);
+        bytes[1] = (v&0x00ff00)>>8;
+        bytes[2] = (v&0xff0000)>>16;
+    }
+}
+
+static void
+pcm_gain_kernel_s32 (char *bytes, int n, int32_t gain) {
+    int32_t *s = (int32_t *)bytes;
+    for (int i = 0; i < n; i++) {
+        int64_t v = ((int64_t)s[i] * gain + (1 << (PCM_GAIN_BITS_32-1))) >> PCM_GAIN_BITS_32;
+        if (v > INT32_MAX) {
+            v = INT32_MAX;
+        }
+        else if (v < INT32_MIN) {
+            v = INT32_MIN;
+        }
+        s[i] = (int32_t)v;
+    }
+}
+
+static void
+pcm_gain_kernel_float (char *bytes, int n, float gain) {
+    float *s = (float *)bytes;
+    for (int i = 0; i < n; i++) {
+        s[i] *= gain;
+    }
+}
+
+static const pcm_kernels_t pcm_kernels_scalar = {
+    pcm_kernel_s16_to_float,
+    pcm_kernel_s24_to_float,
+    pcm_kernel_s32_to_float,
+    pcm_kernel_float_to_s16,
+    pcm_kernel_float_to_s24,
+    pcm_kernel_float_to_s32,
+    pcm_gain_kernel_s16,
+    pcm_gain_kernel_float,
+};
+
+#if PREMIX_X86
+// SSE2 and AVX2 kernels are compiled for their targets regardless of the compiler flags,
+// and are only used if the CPU supports them.
+// The float to int conversions round to nearest, like ftoi, and give 0x80000000 on overflow.
+
+#define PCM_SSE2 __attribute__ ((target ("sse2")))
+#define PCM_AVX2 __attribute__ ((target ("avx2")))
+
+static void PCM_SSE2
+pcm_kernel_s16_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(input + i * 2));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+        _mm_storeu_ps ((float *)output + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps ((float *)output + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    pcm_kernel_s16_to_float (input + i * 2, output + i * 4, n - i);
+}
+
+static void PCM_SSE2
+pcm_kernel_s24_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // no byte shuffles in SSE2: place the samples in the upper 24 bits, and scale by 2^-31
+        const unsigned char *in = (const unsigned char *)input + i * 3;
+        __m128i v = _mm_set_epi32 ((int32_t)((in[9]<<8)|(in[10]<<16)|((uint32_t)in[11]<<24)),
+                                   (int32_t)((in[6]<<8)|(in[7]<<16)|((uint32_t)in[8]<<24)),
+                                   (int32_t)((in[3]<<8)|(in[4]<<16)|((uint32_t)in[5]<<24)),
+                                   (int32_t)((in[0]<<8)|(in[1]<<16)|((uint32_t)in[2]<<24)));
+        _mm_storeu_ps ((float *)output + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+    pcm_kernel_s24_to_float (input + i * 3, output + i * 4, n - i);
+}
+
+static void PCM_SSE2
+pcm_kernel_s32_to_float_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(input + i * 4));
+        _mm_storeu_ps ((float *)output + i, _mm_mul_ps (_mm_cvtepi32_ps (v), scale));
+    }
+    pcm_kernel_s32_to_float (input + i * 4, output + i * 4, n - i);
+}
+
+static void PCM_SSE2
+pcm_kernel_float_to_s16_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)input + i), scale));
+        __m128i hi = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)input + i + 4), scale));
+        // saturation is the same as clipping
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), _mm_packs_epi32 (lo, hi));
+    }
+    pcm_kernel_float_to_s16 (input + i * 4, output + i * 2, n - i);
+}
+
+// packs the low 24 bits of the 4 lanes into 12 bytes
+static inline void PCM_SSE2
+pcm_store_s24x4_sse2 (__m128i v, char *out) {
+    // pack pairs of samples within 64-bit lanes, then the lanes
+    __m128i u = _mm_or_si128 (_mm_and_si128 (v, _mm_set1_epi64x (0xffffff)),
+                              _mm_and_si128 (_mm_srli_epi64 (v, 8), _mm_set1_epi64x (0xffffff000000)));
+    const __m128i low6 = _mm_set_epi32 (0, 0, 0xffff, -1);
+    u = _mm_or_si128 (_mm_and_si128 (u, low6), _mm_andnot_si128 (low6, _mm_srli_si128 (u, 2)));
+    _mm_storel_epi64 ((__m128i *)out, u);
+    int32_t w = _mm_cvtsi128_si32 (_mm_srli_si128 (u, 8));
+    memcpy (out + 8, &w, 4);
+}
+
+static inline __m128i PCM_SSE2
+pcm_clip_s24_sse2 (__m128i v) {
+    const __m128i max = _mm_set1_epi32 (0x7fffff);
+    const __m128i min = _mm_set1_epi32 (-0x800000);
+    __m128i gt = _mm_cmpgt_epi32 (v, max);
+    v = _mm_or_si128 (_mm_and_si128 (gt, max), _mm_andnot_si128 (gt, v));
+    __m128i lt = _mm_cmplt_epi32 (v, min);
+    return _mm_or_si128 (_mm_and_si128 (lt, min), _mm_andnot_si128 (lt, v));
+}
+
+static void PCM_SSE2
+pcm_kernel_float_to_s24_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps (0x800000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps ((const float *)input + i), scale));
+        pcm_store_s24x4_sse2 (pcm_clip_s24_sse2 (v), output + i * 3);
+    }
+    pcm_kernel_float_to_s24 (input + i * 4, output + i * 3, n - i);
+}
+
+// truncates like the scalar code, positive overflow is saturated by flipping 0x80000000
+static void PCM_SSE2
+pcm_kernel_float_to_s32_sse2 (const char * restrict input, char * restrict output, int n) {
+    const __m128 scale = _mm_set1_ps ((float)0x80000000);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 f = _mm_mul_ps (_mm_loadu_ps ((const float *)input + i), scale);
+        __m128i over = _mm_castps_si128 (_mm_cmpge_ps (f, scale));
+        _mm_storeu_si128 ((__m128i *)(output + i * 4), _mm_xor_si128 (_mm_cvttps_epi32 (f), over));
+    }
+    pcm_kernel_float_to_s32 (input + i * 4, output + i * 4, n - i);
+}
+
+static void PCM_SSE2
+pcm_gain_kernel_s16_sse2 (char *bytes, int n, int32_t gain) {
+    const __m128i g = _mm_set1_epi16 ((int16_t)gain);
+    const __m128i round = _mm_set1_epi32 (1 << (PCM_GAIN_BITS_16-1));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)(bytes + i * 2));
+        // 32 bit products from the low and high halves
+        __m128i lo = _mm_mullo_epi16 (v, g);
+        __m128i hi = _mm_mulhi_epi16 (v, g);
+        __m128i p0 = _mm_srai_epi32 (_mm_add_epi32 (_mm_unpacklo_epi16 (lo, hi), round), PCM_GAIN_BITS_16);
+        __m128i p1 = _mm_srai_epi32 (_mm_add_epi32 (_mm_unpackhi_epi16 (lo, hi), round), PCM_GAIN_BITS_16);
+        _mm_storeu_si128 ((__m128i *)(bytes + i * 2), _mm_packs_epi32 (p0, p1));
+    }
+    pcm_gain_kernel_s16 (bytes + i * 2, n - i, gain);
+}
+
+static void PCM_SSE2
+pcm_gain_kernel_float_sse2 (char *bytes, int n, float gain) {
+    const __m128 g = _mm_set1_ps (gain);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps ((float *)bytes + i, _mm_mul_ps (_mm_loadu_ps ((const float *)bytes + i), g));
+    }
+    pcm_gain_kernel_float (bytes + i * 4, n - i, gain);
+}
+
+static const pcm_kernels_t pcm_kernels_sse2 = {
+    pcm_kernel_s16_to_float_sse2,
+    pcm_kernel_s24_to_float_sse2,
+    pcm_kernel_s32_to_float_sse2,
+    pcm_kernel_float_to_s16_sse2,
+    pcm_kernel_float_to_s24_sse2,
+    pcm_kernel_float_to_s32_sse2,
+    pcm_gain_kernel_s16_sse2,
+    pcm_gain_kernel_float_sse2,
+};
+
+static void PCM_AVX2
+pcm_kernel_s16_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(input + i * 2)));
+        _mm256_storeu_ps ((float *)output + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    pcm_kernel_s16_to_float (input + i * 2, output + i * 4, n - i);
+}
+
+static void PCM_AVX2
+pcm_kernel_s24_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (1.f / 0x80000000);
+    // moves the 4 samples in the low 12 bytes of each lane to the upper 24 bits of int32s
+    const __m256i shuf = _mm256_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                           -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    int i = 0;
+    // each iteration reads 28 bytes
+    for (; i + 10 <= n; i += 8) {
+        const __m128i *in = (const __m128i *)(input + i * 3);
+        __m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 (in)),
+                                             _mm_loadu_si128 ((const __m128i *)(input + i * 3 + 12)), 1);
+        v = _mm256_shuffle_epi8 (v, shuf);
+        _mm256_storeu_ps ((float *)output + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    pcm_kernel_s24_to_float (input + i * 3, output + i * 4, n - i);
+}
+
+static void PCM_AVX2
+pcm_kernel_s32_to_float_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (1.f / 0x80000000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *)(input + i * 4));
+        _mm256_storeu_ps ((float *)output + i, _mm256_mul_ps (_mm256_cvtepi32_ps (v), scale));
+    }
+    pcm_kernel_s32_to_float (input + i * 4, output + i * 4, n - i);
+}
+
+static void PCM_AVX2
+pcm_kernel_float_to_s16_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps ((const float *)input + i), scale));
+        __m128i s = _mm_packs_epi32 (_mm256_castsi256_si128 (v), _mm256_extracti128_si256 (v, 1));
+        _mm_storeu_si128 ((__m128i *)(output + i * 2), s);
+    }
+    pcm_kernel_float_to_s16 (input + i * 4, output + i * 2, n - i);
+}
+
+static void PCM_AVX2
+pcm_kernel_float_to_s24_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps (0x800000);
+    const __m256i max = _mm256_set1_epi32 (0x7fffff);
+    const __m256i min = _mm256_set1_epi32 (-0x800000);
+    // packs the low 3 bytes of each int32 into the low 12 bytes of each lane
+    const __m256i shuf = _mm256_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps ((const float *)input + i), scale));
+        v = _mm256_shuffle_epi8 (_mm256_max_epi32 (_mm256_min_epi32 (v, max), min), shuf);
+        char *out = output + i * 3;
+        __m128i lo = _mm256_castsi256_si128 (v);
+        __m128i hi = _mm256_extracti128_si256 (v, 1);
+        _mm_storel_epi64 ((__m128i *)out, lo);
+        int32_t w = _mm_cvtsi128_si32 (_mm_srli_si128 (lo, 8));
+        memcpy (out + 8, &w, 4);
+        _mm_storel_epi64 ((__m128i *)(out + 12), hi);
+        w = _mm_cvtsi128_si32 (_mm_srli_si128 (hi, 8));
+        memcpy (out + 20, &w, 4);
+    }
+    pcm_kernel_float_to_s24 (input + i * 4, output + i * 3, n - i);
+}
+
+static void PCM_AVX2
+pcm_kernel_float_to_s32_avx2 (const char * restrict input, char * restrict output, int n) {
+    const __m256 scale = _mm256_set1_ps ((float)0x80000000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 f = _mm256_mul_ps (_mm256_loadu_ps ((const float *)input + i), scale);
+        __m256i over = _mm256_castps_si256 (_mm256_cmp_ps (f, scale, _CMP_GE_OQ));
+        _mm256_storeu_si256 ((__m256i *)(output + i * 4), _mm256_xor_si256 (_mm256_cvttps_epi32 (f), over));
+    }
+    pcm_kernel_float_to_s32 (input + i * 4, output + i * 4, n - i);
+}
+
+static void PCM_AVX2
+pcm_gain_kernel_s16_avx2 (char *bytes, int n, int32_t gain) {
+    const __m256i g = _mm256_set1_epi16 ((int16_t)gain);
+    const __m256i round = _mm256_set1_epi32 (1 << (PCM_GAIN_BITS_16-1));
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *)(bytes + i * 2));
+        // unpack and pack work within 128 bit lanes, which keeps the order
+        __m256i lo = _mm256_mullo_epi16 (v, g);
+        __m256i hi = _mm256_mulhi_epi16 (v, g);
+        __m256i p0 = _mm256_srai_epi32 (_mm256_add_epi32 (_mm256_unpacklo_epi16 (lo, hi), round), PCM_GAIN_BITS_16);
+        __m256i p1 = _mm256_srai_epi32 (_mm256_add_epi32 (_mm256_unpackhi_epi16 (lo, hi), round), PCM_GAIN_BITS_16);
+        _mm256_storeu_si256 ((__m256i *)(bytes + i * 2), _mm256_packs_epi32 (p0, p1));
+    }
+    pcm_gain_kernel_s16 (bytes + i * 2, n - i, gain);
+}
+
+static void PCM_AVX2
+pcm_gain_kernel_float_avx2 (char *bytes, int n, float gain) {
+    const __m256 g = _mm256_set1_ps (gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps ((float *)bytes + i, _mm256_mul_ps (_mm256_loadu_ps ((const float *)bytes + i), g));
+    }
+    pcm_gain_kernel_float (bytes + i * 4, n - i, gain);
+}
+
+static const pcm_kernels_t pcm_kernels_avx2 = {
+    pcm_kernel_s16_to_float_avx2,
+    pcm_kernel_s24_to_float_avx2,
+    pcm_kernel_s32_to_float_avx2,
+    pcm_kernel_float_to_s16_avx2,
+    pcm_kernel_float_to_s24_avx2,
+    pcm_kernel_float_to_s32_avx2,
+    pcm_gain_kernel_s16_avx2,
+    pcm_gain_kernel_float_avx2,
+};
+#endif // PREMIX_X86
+
+#if PREMIX_NEON
+// ftoi is floor(f+.5) on ARM, the conversions to int saturate
+
+static void
+pcm_kernel_s16_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16 ((const int16_t *)input + i);
+        vst1q_f32 ((float *)output + i, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (v))), 1.f / 0x8000));
+        vst1q_f32 ((float *)output + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (v))), 1.f / 0x8000));
+    }
+    pcm_kernel_s16_to_float (input + i * 2, output + i * 4, n - i);
+}
+
+static void
+pcm_kernel_s24_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x3_t b = vld3_u8 ((const uint8_t *)input + i * 3);
+        // the samples in the upper 24 bits of int32s
+        uint16x8_t mid = vorrq_u16 (vshll_n_u8 (b.val[1], 8), vmovl_u8 (b.val[0]));
+        uint16x8_t top = vshll_n_u8 (b.val[2], 8);
+        uint32x4_t lo = vorrq_u32 (vshll_n_u16 (vget_low_u16 (top), 16), vshll_n_u16 (vget_low_u16 (mid), 8));
+        uint32x4_t hi = vorrq_u32 (vshll_n_u16 (vget_high_u16 (top), 16), vshll_n_u16 (vget_high_u16 (mid), 8));
+        vst1q_f32 ((float *)output + i, vmulq_n_f32 (vcvtq_f32_s32 (vreinterpretq_s32_u32 (lo)), 1.f / 0x80000000));
+        vst1q_f32 ((float *)output + i + 4, vmulq_n_f32 (vcvtq_f32_s32 (vreinterpretq_s32_u32 (hi)), 1.f / 0x80000000));
+    }
+    pcm_kernel_s24_to_float (input + i * 3, output + i * 4, n - i);
+}
+
+static void
+pcm_kernel_s32_to_float_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t v = vld1q_s32 ((const int32_t *)input + i);
+        vst1q_f32 ((float *)output + i, vmulq_n_f32 (vcvtq_f32_s32 (v), 1.f / 0x80000000));
+    }
+    pcm_kernel_s32_to_float (input + i * 4, output + i * 4, n - i);
+}
+
+static inline int32x4_t
+pcm_ftoi_neon (float32x4_t f) {
+    return vcvtmq_s32_f32 (vaddq_f32 (f, vdupq_n_f32 (.5f)));
+}
+
+static void
+pcm_kernel_float_to_s16_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)input + i), 0x8000));
+        int32x4_t hi = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)input + i + 4), 0x8000));
+        vst1q_s16 ((int16_t *)output + i, vcombine_s16 (vqmovn_s32 (lo), vqmovn_s32 (hi)));
+    }
+    pcm_kernel_float_to_s16 (input + i * 4, output + i * 2, n - i);
+}
+
+static void
+pcm_kernel_float_to_s24_neon (const char * restrict input, char * restrict output, int n) {
+    const int32x4_t max = vdupq_n_s32 (0x7fffff);
+    const int32x4_t min = vdupq_n_s32 (-0x800000);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int32x4_t lo = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)input + i), 0x800000));
+        int32x4_t hi = pcm_ftoi_neon (vmulq_n_f32 (vld1q_f32 ((const float *)input + i + 4), 0x800000));
+        uint32x4_t ulo = vreinterpretq_u32_s32 (vmaxq_s32 (vminq_s32 (lo, max), min));
+        uint32x4_t uhi = vreinterpretq_u32_s32 (vmaxq_s32 (vminq_s32 (hi, max), min));
+        uint8x8x3_t b;
+        b.val[0] = vmovn_u16 (vcombine_u16 (vmovn_u32 (ulo), vmovn_u32 (uhi)));
+        b.val[1] = vmovn_u16 (vcombine_u16 (vmovn_u32 (vshrq_n_u32 (ulo, 8)), vmovn_u32 (vshrq_n_u32 (uhi, 8))));
+        b.val[2] = vmovn_u16 (vcombine_u16 (vmovn_u32 (vshrq_n_u32 (ulo, 16)), vmovn_u32 (vshrq_n_u32 (uhi, 16))));
+        vst3_u8 ((uint8_t *)output + i * 3, b);
+    }
+    pcm_kernel_float_to_s24 (input + i * 4, output + i * 3, n - i);
+}
+
+static void
+pcm_kernel_float_to_s32_neon (const char * restrict input, char * restrict output, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t f = vmulq_n_f32 (vld1q_f32 ((const float *)input + i), (float)0x80000000);
+        vst1q_s32 ((int32_t *)output + i, vcvtq_s32_f32 (f));
+    }
+    pcm_kernel_float_to_s32 (input + i * 4, output + i * 4, n - i);
+}
+
+static void
+pcm_gain_kernel_s16_neon (char *bytes, int n, int32_t gain) {
+    const int16x4_t g = vdup_n_s16 ((int16_t)gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16 ((const int16_t *)bytes + i);
+        int32x4_t lo = vrshrq_n_s32 (vmull_s16 (vget_low_s16 (v), g), PCM_GAIN_BITS_16);
+        int32x4_t hi = vrshrq_n_s32 (vmull_s16 (vget_high_s16 (v), g), PCM_GAIN_BITS_16);
+        vst1q_s16 ((int16_t *)bytes + i, vcombine_s16 (vqmovn_s32 (lo), vqmovn_s32 (hi)));
+    }
+    pcm_gain_kernel_s16 (bytes + i * 2, n - i, gain);
+}
+
+static void
+pcm_gain_kernel_float_neon (char *bytes, int n, float gain) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32 ((float *)bytes + i, vmulq_n_f32 (vld1q_f32 ((const float *)bytes + i), gain));
+    }
+    pcm_gain_kernel_float (bytes + i * 4, n - i, gain);
+}
+
+static const pcm_kernels_t pcm_kernels_neon = {
+    pcm_kernel_s16_to_float_neon,
+    pcm_kernel_s24_to_float_neon,
+    pcm_kernel_s32_to_float_neon,
+    pcm_kernel_float_to_s16_neon,
+    pcm_kernel_float_to_s24_neon,
+    pcm_kernel_float_to_s32_neon,
+    pcm_gain_kernel_s16_neon,
+    pcm_gain_kernel_float_neon,
+};
+#endif // PREMIX_NEON
+
+static int pcm_convert_impl = -1;
+
+static const pcm_kernels_t *
+pcm_get_kernels (int impl) {
+    switch (impl) {
+    case PCM_CONVERT_SCALAR:
+        return &pcm_kernels_scalar;
+#if PREMIX_X86
+    case PCM_CONVERT_SSE2:
+        return &pcm_kernels_sse2;
+    case PCM_CONVERT_AVX2:
+        return &pcm_kernels_avx2;
+#endif
+#if PREMIX_NEON
+    case PCM_CONVERT_NEON:
+        return &pcm_kernels_neon;
+#endif
+    }
+    return NULL;
+}
+
+static int
+pcm_convert_is_supported (int impl) {
+    switch (impl) {
+    case PCM_CONVERT_GENERIC:
+    case PCM_CONVERT_SCALAR:
+        return 1;
+#if PREMIX_X86
+    case PCM_CONVERT_SSE2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("sse2");
+    case PCM_CONVERT_AVX2:
+        __builtin_cpu_init ();
+        return __builtin_cpu_supports ("avx2");
+#endif
+#if PREMIX_NEON
+    case PCM_CONVERT_NEON:
+        return 1;
+#endif
+    }
+    return 0;
+}
+
+int
+pcm_convert_get_impl (void) {
+    int impl = __atomic_load_n (&pcm_convert_impl, __ATOMIC_RELAXED);
+    if (impl < 0) {
+        // the best one supported by the CPU
+        impl = PCM_CONVERT_NEON;
+        while (!pcm_convert_is_supported (impl)) {
+            impl--;
+        }
+        __atomic_store_n (&pcm_convert_impl, impl, __ATOMIC_RELAXED);
+    }
+    return impl;
+}
+
+int
+pcm_convert_set_impl (int impl) {
+    if (impl < 0 || impl > PCM_CONVERT_NEON || !pcm_convert_is_supported (impl)) {
+        return -1;
+    }
+    __atomic_store_n (&pcm_convert_impl, impl, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// converts with the identity channel map, returns 0 if there's no kernel for the formats
+static int
+pcm_convert_flat (int inidx, int outidx, const char * restrict input, char * restrict output, int n) {
+    int impl = pcm_convert_get_impl ();
+    if (impl == PCM_CONVERT_GENERIC) {
+        return 0;
+    }
+    if (inidx == outidx) {
+        memcpy (output, input, n * (((inidx & 3) + 1)));
+        return 1;
+    }
+    const pcm_kernels_t *k = pcm_get_kernels (impl);
+    if (!k) {
+        return 0;
+    }
+    pcm_kernel_fn_t fn = NULL;
+    if (outidx == 7) {
+        switch (inidx) {
+        case 1:
+            fn = k->s16_to_float;
+            break;
+        case 2:
+            fn = k->s24_to_float;
+            break;
+        case 3:
+            fn = k->s32_to_float;
+            break;
+        }
+    }
+    else if (inidx == 7) {
+        switch (outidx) {
+        case 1:
+            fn = k->float_to_s16;
+            break;
+        case 2:
+            fn = k->float_to_s24;
+            break;
+        case 3:
+            fn = k->float_to_s32;
+            break;
+        }
+    }
+    if (!fn) {
+        return 0;
+    }
+    fn (input, output, n);
+    return 1;
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -500,7 +1244,16 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
 
         int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
         int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
-        if (remappers[inidx][outidx]) {
+
+        int identity = inputfmt->channels == outputfmt->channels && outchannels == outputfmt->channelmask;
+        for (int i = 0; identity && i < inputfmt->channels; i++) {
+            identity = channelmap[i] == i;
+        }
+
+        if (identity && pcm_convert_flat (inidx, outidx, input, output, nsamples * inputfmt->channels)) {
+            // done
+        }
+        else if (remappers[inidx][outidx]) {
             remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
         }
         else {
@@ -510,3 +1263,66 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
     return nsamples * outputsamplesize;
 }
 
+// multiplies n samples by a constant gain
+static void
+pcm_apply_gain_flat (int idx, char *bytes, int n, float gain) {
+    const pcm_kernels_t *k = pcm_get_kernels (pcm_convert_get_impl ());
+    if (!k) {
+        k = &pcm_kernels_scalar;
+    }
+    switch (idx) {
+    case 0:
+        pcm_gain_kernel_s8 (bytes, n, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_16));
+        break;
+    case 1:
+        k->gain_s16 (bytes, n, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_16));
+        break;
+    case 2:
+        pcm_gain_kernel_s24 (bytes, n, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_32));
+        break;
+    case 3:
+        pcm_gain_kernel_s32 (bytes, n, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_32));
+        break;
+    case 7:
+        k->gain_float (bytes, n, gain);
+        break;
+    }
+}
+
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float gain_from, float gain_to, int ramp_frames) {
+    int idx = ((fmt->bps >> 3) - 1) | (fmt->is_float << 2);
+    int samplesize = fmt->bps >> 3;
+    int framesize = samplesize * fmt->channels;
+    int nframes = size / framesize;
+    if (ramp_frames > nframes) {
+        ramp_frames = nframes;
+    }
+
+    // the ramp changes the gain once per frame, so that all channels get the same one
+    for (int i = 0; i < ramp_frames; i++, bytes += framesize) {
+        float gain = gain_from + (gain_to - gain_from) * (i + 1) / ramp_frames;
+        switch (idx) {
+        case 0:
+            pcm_gain_kernel_s8 (bytes, fmt->channels, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_16));
+            break;
+        case 1:
+            pcm_gain_kernel_s16 (bytes, fmt->channels, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_16));
+            break;
+        case 2:
+            pcm_gain_kernel_s24 (bytes, fmt->channels, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_32));
+            break;
+        case 3:
+            pcm_gain_kernel_s32 (bytes, fmt->channels, pcm_gain_to_fixed (gain, PCM_GAIN_BITS_32));
+            break;
+        case 7:
+            pcm_gain_kernel_float (bytes, fmt->channels, gain);
+            break;
+        }
+    }
+
+    nframes -= ramp_frames;
+    if (nframes > 0 && gain_to != 1) {
+        pcm_apply_gain_flat (idx, bytes, nframes * fmt->channels, gain_to);
+    }
+}
@@ -32,4 +32,29 @@
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
 
+// pcm_convert implementations, the SIMD ones are only used with the identity channel map
+enum {
+    PCM_CONVERT_GENERIC, // per-sample channel mapping for all formats
+    PCM_CONVERT_SCALAR,
+    PCM_CONVERT_SSE2,
+    PCM_CONVERT_AVX2,
+    PCM_CONVERT_NEON,
+};
+
+// returns the implementation used by pcm_convert,
+// the best one supported by the CPU, unless set by pcm_convert_set_impl
+int
+pcm_convert_get_impl (void);
+
+// e.g. for benchmarks; returns -1 if the implementation is not supported
+int
+pcm_convert_set_impl (int impl);
+
+// Multiplies the samples in place by a gain, which changes linearly from gain_from to gain_to
+// over the first ramp_frames frames (at most all of them), and stays at gain_to after that.
+// Float samples are not clipped; integer samples are clipped, and processed in fixed point,
+// with the gains limited to +18dB.
+void
+pcm_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float gain_from, float gain_to, int ramp_frames);
+
 #endif
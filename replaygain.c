@@ -229,8 +229,8 @@ apply_replay_gain_int32 (ddb_replaygain_settings_t *settings, char *bytes, int s
     }
 }
 
-void
-apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
+static float
+get_float_volume (ddb_replaygain_settings_t *settings) {
     float vol = 1.f;
     int mode = _get_source_mode (settings->source_mode);
     switch (mode) {
@@ -261,6 +261,20 @@ apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int
     default:
         break;
     }
+    return vol;
+}
+
+float
+replaygain_get_scale (ddb_replaygain_settings_t *settings) {
+    if (!settings->processing_flags) {
+        return 1.f;
+    }
+    return get_float_volume (settings);
+}
+
+void
+apply_replay_gain_float32 (ddb_replaygain_settings_t *settings, char *bytes, int size) {
+    float vol = get_float_volume (settings);
     float *s = (float*)bytes;
     for (int j = 0; j < size/4; j++) {
         float sample = ((float)*s) * vol;
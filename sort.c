@@ -25,9 +25,12 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
 #include "utf8.h"
 #include "sort.h"
 #include "tf.h"
+#include "threading.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -46,94 +49,376 @@ plt_sort (playlist_t *playlist, int iter, int id, const char *format, int order)
     plt_sort_internal (playlist, iter, id, format, order, 0);
 }
 
-static int pl_sort_is_duration;
-static int pl_sort_is_track;
-static int pl_sort_ascending;
-static int pl_sort_id;
-static int pl_sort_version; // 0: use pl_sort_format, 1: use pl_sort_tf_bytecode
-static const char *pl_sort_format;
-static char *pl_sort_tf_bytecode;
+// a single sort key, as used while a sort is in progress
+typedef struct {
+    int version; // 0: use format, 1: use bytecode
+    const char *format;
+    char *bytecode;
+    int id;
+    int ascending;
+    int numeric; // compare the formatted values as numbers
+    int is_duration;
+    int is_track;
+} pl_sort_column_t;
+
+static pl_sort_column_t *pl_sort_columns;
+static int pl_sort_num_columns;
 static ddb_tf_context_t pl_sort_tf_ctx;
 
+#define PL_SORT_MAX_THREADS 8
+// don't start a sorting thread for less than this number of tracks
+#define PL_SORT_MIN_TRACKS_PER_THREAD 10000
+#define PL_SORT_CHUNK_SIZE 65536
+
+// value of one sort column for a single track, computed once before sorting
+typedef struct {
+    const char *text; // lowercase formatted value, NULL for numeric columns
+    const char *text_rest; // text after the leading number
+    int64_t num; // leading number of the text, or the numeric value
+    int has_num;
+} pl_sort_value_t;
+
+typedef struct {
+    playItem_t *it;
+    pl_sort_value_t *values; // one per sort column
+    int idx; // original position, used to keep the sort stable
+} pl_sort_key_t;
+
+// storage for the key strings
+typedef struct pl_sort_chunk_s {
+    struct pl_sort_chunk_s *next;
+    size_t used;
+    char data[PL_SORT_CHUNK_SIZE];
+} pl_sort_chunk_t;
+
+typedef struct {
+    pl_sort_key_t *src;
+    pl_sort_key_t *dst;
+    int start;
+    int mid;
+    int end;
+} pl_sort_job_t;
+
+// same ordering as u8_strcasecmp, for strings which are already lowercase
 static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
+pl_sort_strcmp_lc (const char *p1, const char *p2) {
+    while (*p1 && *p2) {
+        if (!(*p1 & 0x80) && !(*p2 & 0x80)) {
+            if (*p1 != *p2) {
+                return (unsigned char)*p1 - (unsigned char)*p2;
+            }
+            p1++;
+            p2++;
+            continue;
         }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
+        int32_t i1 = 0;
+        int32_t i2 = 0;
+        u8_nextchar (p1, &i1);
+        u8_nextchar (p2, &i2);
+        if (i1 != i2) {
+            return i1 - i2;
         }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+        int res = memcmp (p1, p2, i1);
+        if (res) {
+            return res;
         }
-        return anum - bnum;
+        p1 += i1;
+        p2 += i2;
     }
-    return u8_strcasecmp (a,b);
+
+    if (*p1) {
+        return 1;
+    }
+    else if (*p2) {
+        return -1;
+    }
+    return 0;
 }
 
 static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
-    if (pl_sort_is_duration) {
-        float dur_a = a->_duration * 100000;
-        float dur_b = b->_duration * 100000;
-        return !pl_sort_ascending ? dur_b - dur_a : dur_a - dur_b;
-    }
-    else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
-        if (t && !isdigit (*t)) {
-            t1 = 999999;
+pl_sort_value_cmp (const pl_sort_value_t *a, const pl_sort_value_t *b) {
+    if (!a->text) {
+        if (a->has_num != b->has_num) {
+            return a->has_num - b->has_num;
         }
-        else {
-            t1 = t ? atoi (t) : -1;
+        return (a->num > b->num) - (a->num < b->num);
+    }
+    // numbers at the start of the text are compared by value, the rest
+    // case-insensitively
+    if (a->has_num && b->has_num) {
+        int res = (a->num > b->num) - (a->num < b->num);
+        if (res) {
+            return res;
         }
-        t = pl_find_meta_raw (b, "track");
+        return pl_sort_strcmp_lc (a->text_rest, b->text_rest);
+    }
+    return pl_sort_strcmp_lc (a->text, b->text);
+}
+
+static int
+pl_sort_key_cmp (const void *a, const void *b) {
+    const pl_sort_key_t *ka = a;
+    const pl_sort_key_t *kb = b;
+    for (int i = 0; i < pl_sort_num_columns; i++) {
+        int res = pl_sort_value_cmp (&ka->values[i], &kb->values[i]);
+        if (res) {
+            return pl_sort_columns[i].ascending ? res : -res;
+        }
+    }
+    return ka->idx - kb->idx;
+}
+
+// returns NULL if out of memory
+static const char *
+pl_sort_store_key (pl_sort_chunk_t **chunks, const char *value) {
+    // lowercase the value, so that comparisons don't need to do it
+    char lc[3072];
+    int len = 0;
+    const char *p = value;
+    while (*p && len < sizeof (lc) - 10) {
+        int32_t i = 0;
+        u8_nextchar (p, &i);
+        len += u8_tolower ((const signed char *)p, i, lc + len);
+        p += i;
+    }
+    lc[len++] = 0;
+
+    pl_sort_chunk_t *c = *chunks;
+    if (!c || c->used + len > PL_SORT_CHUNK_SIZE) {
+        c = malloc (sizeof (pl_sort_chunk_t));
+        if (!c) {
+            return NULL;
+        }
+        c->next = *chunks;
+        c->used = 0;
+        *chunks = c;
+    }
+    char *key = c->data + c->used;
+    memcpy (key, lc, len);
+    c->used += len;
+    return key;
+}
+
+static void
+pl_sort_init_value (pl_sort_value_t *v, pl_sort_column_t *c, playItem_t *it, pl_sort_chunk_t **chunks) {
+    v->text = NULL;
+    v->text_rest = NULL;
+    v->num = 0;
+    v->has_num = 1;
+
+    if (c->is_duration) {
+        v->num = (int64_t)(it->_duration * 100000);
+        return;
+    }
+    else if (c->is_track) {
+        const char *t = pl_find_meta_raw (it, "track");
         if (t && !isdigit (*t)) {
-            t2 = 999999;
+            v->num = 999999;
         }
         else {
-            t2 = t ? atoi (t) : -1;
+            v->num = t ? atoi (t) : -1;
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
+        return;
+    }
+
+    char tmp[1024];
+    if (c->version == 0) {
+        pl_format_title (it, -1, tmp, sizeof (tmp), c->id, c->format);
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
-        if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+        pl_sort_tf_ctx.id = c->id;
+        pl_sort_tf_ctx.it = (ddb_playItem_t *)it;
+        tf_eval (&pl_sort_tf_ctx, c->bytecode, tmp, sizeof (tmp));
+    }
+
+    if (c->numeric) {
+        // values which are not numbers are less than any number
+        char *end;
+        v->num = strtoll (tmp, &end, 10);
+        v->has_num = end != tmp;
+        return;
+    }
+
+    v->text = pl_sort_store_key (chunks, tmp);
+    v->has_num = 0;
+    if (!v->text) {
+        // out of memory: the track sorts as if the value was empty
+        v->text = v->text_rest = "";
+        return;
+    }
+    const char *p = v->text;
+    if (isdigit (*p)) {
+        v->has_num = 1;
+        while (isdigit (*p)) {
+            if (v->num < INT64_MAX / 10 - 10) {
+                v->num = v->num * 10 + *p - '0';
+            }
+            p++;
+        }
+    }
+    v->text_rest = p;
+}
+
+static void
+pl_sort_chunk_worker (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    qsort (job->src + job->start, job->end - job->start, sizeof (pl_sort_key_t), pl_sort_key_cmp);
+}
+
+static void
+pl_sort_merge_worker (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    int a = job->start;
+    int b = job->mid;
+    int o = job->start;
+    while (a < job->mid && b < job->end) {
+        if (pl_sort_key_cmp (&job->src[b], &job->src[a]) < 0) {
+            job->dst[o++] = job->src[b++];
         }
         else {
-            pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
+            job->dst[o++] = job->src[a++];
+        }
+    }
+    memcpy (job->dst + o, job->src + a, (job->mid - a) * sizeof (pl_sort_key_t));
+    o += job->mid - a;
+    memcpy (job->dst + o, job->src + b, (job->end - b) * sizeof (pl_sort_key_t));
+}
+
+// runs all jobs, on separate threads where possible
+static void
+pl_sort_run_jobs (pl_sort_job_t *jobs, int njobs, void (*fn)(void *ctx)) {
+    intptr_t tids[PL_SORT_MAX_THREADS];
+    for (int i = 0; i < njobs; i++) {
+        tids[i] = 0;
+        if (i != njobs - 1) {
+            tids[i] = thread_start (fn, &jobs[i]);
+        }
+        if (!tids[i]) {
+            fn (&jobs[i]);
         }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+    }
+    for (int i = 0; i < njobs; i++) {
+        if (tids[i]) {
+            thread_join (tids[i]);
         }
-        return res;
     }
 }
 
-static int
-qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+// sorts the keys in place: each thread sorts a slice, then the slices get merged
+static void
+pl_sort_keys (pl_sort_key_t *keys, int count) {
+    int nthreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (nthreads > PL_SORT_MAX_THREADS) {
+        nthreads = PL_SORT_MAX_THREADS;
+    }
+    if (nthreads > count / PL_SORT_MIN_TRACKS_PER_THREAD) {
+        nthreads = count / PL_SORT_MIN_TRACKS_PER_THREAD;
+    }
+    pl_sort_key_t *tmp = NULL;
+    if (nthreads > 1) {
+        tmp = malloc (count * sizeof (pl_sort_key_t));
+    }
+    if (!tmp) {
+        qsort (keys, count, sizeof (pl_sort_key_t), pl_sort_key_cmp);
+        return;
+    }
+
+    int bounds[PL_SORT_MAX_THREADS+1];
+    pl_sort_job_t jobs[PL_SORT_MAX_THREADS];
+    for (int i = 0; i <= nthreads; i++) {
+        bounds[i] = (int)((int64_t)count * i / nthreads);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i].src = keys;
+        jobs[i].start = bounds[i];
+        jobs[i].end = bounds[i+1];
+    }
+    pl_sort_run_jobs (jobs, nthreads, pl_sort_chunk_worker);
+
+    pl_sort_key_t *src = keys;
+    pl_sort_key_t *dst = tmp;
+    int nruns = nthreads;
+    while (nruns > 1) {
+        int njobs = 0;
+        int i;
+        for (i = 0; i + 1 < nruns; i += 2) {
+            jobs[njobs].src = src;
+            jobs[njobs].dst = dst;
+            jobs[njobs].start = bounds[i];
+            jobs[njobs].mid = bounds[i+1];
+            jobs[njobs].end = bounds[i+2];
+            njobs++;
+        }
+        if (i < nruns) {
+            // odd run out, carry over as is
+            memcpy (dst + bounds[i], src + bounds[i], (bounds[i+1] - bounds[i]) * sizeof (pl_sort_key_t));
+        }
+        pl_sort_run_jobs (jobs, njobs, pl_sort_merge_worker);
+
+        for (i = 0; i < nruns; i += 2) {
+            bounds[i/2] = bounds[i];
+        }
+        nruns = (nruns + 1) / 2;
+        bounds[nruns] = count;
+
+        pl_sort_key_t *t = src;
+        src = dst;
+        dst = t;
+    }
+
+    if (src != keys) {
+        memcpy (keys, src, count * sizeof (pl_sort_key_t));
+    }
+    free (tmp);
+}
+
+// evaluates the sort values of every track once, then sorts the tracks by them;
+// must be called with pl_lock held
+static void
+pl_sort_tracks (playlist_t *playlist, playItem_t **tracks, int count, pl_sort_column_t *columns, int num_columns) {
+    pl_sort_key_t *keys = malloc (count * sizeof (pl_sort_key_t));
+    pl_sort_value_t *values = malloc (count * num_columns * sizeof (pl_sort_value_t));
+    if (!keys || !values) {
+        free (keys);
+        free (values);
+        return;
+    }
+
+    pl_sort_columns = columns;
+    pl_sort_num_columns = num_columns;
+    pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
+    pl_sort_tf_ctx.it = NULL;
+    pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
+    pl_sort_tf_ctx.idx = -1;
+    pl_sort_tf_ctx.id = -1;
+
+    pl_sort_chunk_t *chunks = NULL;
+    for (int i = 0; i < count; i++) {
+        keys[i].it = tracks[i];
+        keys[i].values = values + i * num_columns;
+        keys[i].idx = i;
+        for (int c = 0; c < num_columns; c++) {
+            pl_sort_init_value (&keys[i].values[c], &columns[c], tracks[i], &chunks);
+        }
+    }
+
+    pl_sort_keys (keys, count);
+
+    for (int i = 0; i < count; i++) {
+        tracks[i] = keys[i].it;
+    }
+
+    while (chunks) {
+        pl_sort_chunk_t *next = chunks->next;
+        free (chunks);
+        chunks = next;
+    }
+    free (values);
+    free (keys);
+
+    pl_sort_columns = NULL;
+    pl_sort_num_columns = 0;
+    memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
 }
 
 void
@@ -178,6 +463,7 @@ plt_sort_random (playlist_t *playlist, int iter) {
         prev = it;
     }
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter);
 
     free (array);
 
@@ -186,59 +472,12 @@ plt_sort_random (playlist_t *playlist, int iter) {
     pl_unlock ();
 }
 
-// version 0: title formatting v1
-// version 1: title formatting v2
-void
-plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, int order, int version) {
-    if (order == DDB_SORT_RANDOM) {
-        plt_sort_random (playlist, iter);
-        return;
-    }
-    int ascending = order == DDB_SORT_DESCENDING ? 0 : 1;
-
-    if (format == NULL || id == DB_COLUMN_FILENUMBER || !playlist->head[iter] || !playlist->head[iter]->next[iter]) {
-        return;
-    }
-    pl_lock ();
+// sorts the tracks of the playlist and relinks them, keeping the cursor on the same track;
+// must be called with pl_lock held
+static void
+plt_sort_columns (playlist_t *playlist, int iter, pl_sort_column_t *columns, int num_columns) {
     struct timeval tm1;
     gettimeofday (&tm1, NULL);
-    pl_sort_ascending = ascending;
-    trace ("ascending: %d\n", ascending);
-    pl_sort_id = id;
-
-    pl_sort_version = version;
-    if (version == 0) {
-        pl_sort_format = format;
-        pl_sort_tf_bytecode = NULL;
-    }
-    else {
-        pl_sort_format = NULL;
-        pl_sort_tf_bytecode = tf_compile (format);
-        pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-        pl_sort_tf_ctx.it = NULL;
-        pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-        pl_sort_tf_ctx.idx = -1;
-        pl_sort_tf_ctx.id = id;
-    }
-
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%l"))
-            || (version == 1 && !strcmp (format, "%length%")))
-        ) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%n"))
-            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
-        ) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
 
     int cursor = plt_get_cursor (playlist, PL_MAIN);
     playItem_t *track_under_cursor = NULL;
@@ -251,11 +490,8 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         array[idx] = it;
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    pl_sort_tracks (playlist, array, playlist->count[iter], columns, num_columns);
+
     playItem_t *prev = NULL;
     playlist->head[iter] = 0;
     for (idx = 0; idx < playlist->count[iter]; idx++) {
@@ -272,6 +508,7 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     }
 
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter);
 
     free (array);
 
@@ -287,20 +524,105 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     trace ("sort time: %f seconds\n", ms / 1000.f);
 
     plt_modified (playlist);
+}
+
+// version 0: title formatting v1
+// version 1: title formatting v2
+void
+plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, int order, int version) {
+    if (order == DDB_SORT_RANDOM) {
+        plt_sort_random (playlist, iter);
+        return;
+    }
+    int ascending = order == DDB_SORT_DESCENDING ? 0 : 1;
 
+    if (format == NULL || id == DB_COLUMN_FILENUMBER || !playlist->head[iter] || !playlist->head[iter]->next[iter]) {
+        return;
+    }
+    pl_lock ();
+    trace ("ascending: %d\n", ascending);
+
+    pl_sort_column_t column;
+    memset (&column, 0, sizeof (column));
+    column.version = version;
+    column.id = id;
+    column.ascending = ascending;
     if (version == 0) {
-        pl_sort_format = NULL;
+        column.format = format;
+    }
+    else {
+        column.bytecode = tf_compile (format);
+    }
+
+    if (format && id == -1
+        && ((version == 0 && !strcmp (format, "%l"))
+            || (version == 1 && !strcmp (format, "%length%")))
+        ) {
+        column.is_duration = 1;
     }
+    if (format && id == -1
+        && ((version == 0 && !strcmp (format, "%n"))
+            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
+        ) {
+        column.is_track = 1;
+    }
+
+    plt_sort_columns (playlist, iter, &column, 1);
 
-    if (version == 1) {
-        tf_free (pl_sort_tf_bytecode);
-        pl_sort_tf_bytecode = NULL;
-        memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
+    if (column.bytecode) {
+        tf_free (column.bytecode);
     }
 
     pl_unlock ();
 }
 
+int
+plt_sort_v3 (playlist_t *plt, int iter, const ddb_sort_key_t *keys, int num_keys) {
+    if (num_keys <= 0 || !keys) {
+        return -1;
+    }
+    if (keys[0].order == DDB_SORT_RANDOM) {
+        plt_sort_random (plt, iter);
+        return 0;
+    }
+
+    // compile all keys before sorting, so that a bad key doesn't leave the playlist sorted by the other ones
+    pl_sort_column_t *columns = calloc (num_keys, sizeof (pl_sort_column_t));
+    if (!columns) {
+        return -1;
+    }
+    int res = 0;
+    int num_columns = 0;
+    for (int i = 0; i < num_keys; i++) {
+        pl_sort_column_t *c = &columns[num_columns];
+        c->bytecode = keys[i].format ? tf_compile (keys[i].format) : NULL;
+        if (!c->bytecode) {
+            trace ("plt_sort_v3: invalid format in sort key %d: %s\n", i, keys[i].format ? keys[i].format : "(null)");
+            res = -1;
+            break;
+        }
+        c->version = 1;
+        c->id = -1;
+        c->ascending = keys[i].order == DDB_SORT_DESCENDING ? 0 : 1;
+        c->numeric = keys[i].numeric;
+        num_columns++;
+    }
+
+    if (!res) {
+        pl_lock ();
+        if (plt->head[iter] && plt->head[iter]->next[iter]) {
+            plt_sort_columns (plt, iter, columns, num_columns);
+        }
+        pl_unlock ();
+    }
+
+    for (int i = 0; i < num_columns; i++) {
+        tf_free (columns[i].bytecode);
+    }
+    free (columns);
+    return res;
+}
+
 void
 sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, const char *format, int order) {
     if (order != DDB_SORT_DESCENDING && order != DDB_SORT_ASCENDING) {
@@ -314,43 +636,26 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
     }
 
     pl_lock ();
-    pl_sort_ascending = ascending;
-    pl_sort_id = -1;
 
-    pl_sort_version = 1;
-    pl_sort_format = NULL;
-    pl_sort_tf_bytecode = tf_compile (format);
-    pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-    pl_sort_tf_ctx.it = NULL;
-    pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-    pl_sort_tf_ctx.idx = -1;
-    pl_sort_tf_ctx.id = -1;
+    pl_sort_column_t column;
+    memset (&column, 0, sizeof (column));
+    column.version = 1;
+    column.id = -1;
+    column.ascending = ascending;
+    column.bytecode = tf_compile (format);
 
     if (format
         && !strcmp (format, "%length%")) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
+        column.is_duration = 1;
     }
     if (format
         && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
+        column.is_track = 1;
     }
 
-#if HAVE_MERGESORT
-    mergesort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    pl_sort_tracks (playlist, tracks, num_tracks, &column, 1);
 
-    tf_free (pl_sort_tf_bytecode);
-    pl_sort_tf_bytecode = NULL;
-    memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
+    tf_free (column.bytecode);
 
     pl_unlock ();
 }
-
@@ -29,6 +29,9 @@
 void
 plt_sort_v2 (playlist_t *plt, int iter, int id, const char *format, int order);
 
+int
+plt_sort_v3 (playlist_t *plt, int iter, const ddb_sort_key_t *keys, int num_keys);
+
 void
 sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, const char *format, int order);
 
@@ -29,11 +29,13 @@
 #include <stdio.h>
 #include <assert.h>
 #include <unistd.h>
+#include <fcntl.h>
 #ifdef __linux__
 #include <sys/prctl.h>
 #endif
 #include <sys/time.h>
 #include <errno.h>
+#include <math.h>
 #include "threading.h"
 #include "playlist.h"
 #include "common.h"
@@ -52,6 +54,7 @@
 #include "playqueue.h"
 #include "streamreader.h"
 #include "dsp.h"
+#include "replaygain.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #undef trace
@@ -80,6 +83,29 @@ static int stop_after_album = 0;
 
 static int conf_streamer_nosleep = 0;
 
+// read-ahead duration, for local files and for network streams
+static int conf_readahead_ms = 5000;
+static int conf_readahead_ms_remote = 20000;
+
+// the read-ahead is doubled after underruns, up to READAHEAD_MAX_SCALE times,
+// and halved again after READAHEAD_DECAY_MS without underruns
+#define READAHEAD_MAX_SCALE 8
+#define READAHEAD_DECAY_MS 60000
+
+static int readahead_scale = 1;
+static int64_t readahead_scale_time;
+static uint64_t readahead_underruns; // underrun_count at the last adjustment
+static int readahead_target_ms;
+static int readahead_bytes_per_sec;
+static uint64_t underrun_count; // incremented by the output thread
+static int output_flowing; // the output got data since the last reset or underrun
+static int streaming_track_is_remote;
+
+// the next track is pre-opened when the streaming track has less than conf_preopen_ms left to decode,
+// and conf_preroll_ms of it are pre-read
+static int conf_preopen_ms = 10000;
+static int conf_preroll_ms = 1000;
+
 static int streaming_terminate;
 
 // buffer up to 3 seconds at 44100Hz stereo
@@ -179,6 +205,9 @@ stream_track (playItem_t *track);
 static void
 _handle_playback_stopped (void);
 
+static void
+prefetch_abort_files (void);
+
 static void
 streamer_abort_files (void) {
     DB_FILE *file = fileinfo_file;
@@ -196,7 +225,7 @@ streamer_abort_files (void) {
     if (strfile) {
         deadbeef->fabort (strfile);
     }
-
+    prefetch_abort_files ();
 }
 
 static void
@@ -209,20 +238,21 @@ send_songstarted (playItem_t *trk) {
     messagepump_push_event ((ddb_event_t*)pev, 0, 0);
 }
 
+// track_playtime is the total playtime of the finished track
 static void
-send_songfinished (playItem_t *trk) {
+send_songfinished (playItem_t *trk, float track_playtime) {
     ddb_event_track_t *pev = (ddb_event_track_t *)messagepump_event_alloc (DB_EV_SONGFINISHED);
     pev->track = DB_PLAYITEM (trk);
     pl_item_ref (trk);
-    pev->playtime = playtime;
+    pev->playtime = track_playtime;
     pev->started_timestamp = started_timestamp;
     messagepump_push_event ((ddb_event_t*)pev, 0, 0);
 }
 
 static void
-send_trackchanged (playItem_t *from, playItem_t *to) {
+send_trackchanged (playItem_t *from, playItem_t *to, float from_playtime) {
     ddb_event_trackchange_t *event = (ddb_event_trackchange_t *)messagepump_event_alloc (DB_EV_SONGCHANGED);
-    event->playtime = playtime;
+    event->playtime = from_playtime;
     event->started_timestamp = started_timestamp;
     if (from) {
         pl_item_ref (from);
@@ -246,8 +276,9 @@ set_last_played (playItem_t *track) {
     }
 }
 
+// from_playtime is the total playtime of the previous track
 static void
-streamer_start_playback (playItem_t *from, playItem_t *it) {
+streamer_start_playback (playItem_t *from, playItem_t *it, float from_playtime) {
     if (from) {
         pl_item_ref (from);
     }
@@ -264,7 +295,7 @@ streamer_start_playback (playItem_t *from, playItem_t *it) {
         playqueue_remove (playing_track);
 
         trace ("from=%p (%s), to=%p (%s) [2]\n", from, from ? pl_find_meta (from, ":URI") : "null", it, it ? pl_find_meta (it, ":URI") : "null");
-        send_trackchanged (from, it);
+        send_trackchanged (from, it, from_playtime);
         started_timestamp = time (NULL);
     }
     if (from) {
@@ -301,16 +332,7 @@ str_get_idx_of (playItem_t *it) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *c = streamer_playlist->head[PL_MAIN];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[PL_MAIN];
-        idx++;
-    }
-    if (!c) {
-        pl_unlock ();
-        return -1;
-    }
+    int idx = plt_get_item_idx (streamer_playlist, it, PL_MAIN);
     pl_unlock ();
     return idx;
 }
@@ -323,17 +345,7 @@ str_get_for_idx (int idx) {
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
     }
-    playItem_t *it = streamer_playlist->head[PL_MAIN];
-    while (idx--) {
-        if (!it) {
-            pl_unlock ();
-            return NULL;
-        }
-        it = it->next[PL_MAIN];
-    }
-    if (it) {
-        pl_item_ref (it);
-    }
+    playItem_t *it = plt_get_item_for_idx (streamer_playlist, idx, PL_MAIN);
     pl_unlock ();
     return it;
 }
@@ -422,10 +434,16 @@ get_random_track (void) {
     return plt_get_item_for_idx (plt, r, PL_MAIN);
 }
 
+// with peek set, only predicts the next track: returns NULL instead of reshuffling,
+// and doesn't change the streamer playlist or the shuffle state
 static playItem_t *
-get_next_track (playItem_t *curr) {
+get_next_track (playItem_t *curr, int peek) {
     pl_lock ();
     if (!streamer_playlist) {
+        if (peek) {
+            pl_unlock ();
+            return NULL;
+        }
         playlist_t *plt = plt_get_curr ();
         streamer_set_streamer_playlist (plt);
         plt_unref (plt);
@@ -468,7 +486,8 @@ get_next_track (playItem_t *curr) {
             // find minimal notplayed
             playItem_t *pmin = NULL; // notplayed minimum
             for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i->played) {
+                // curr is marked as played only once it reaches the output
+                if (i->played || i == curr) {
                     continue;
                 }
                 if (!pmin || i->shufflerating < pmin->shufflerating) {
@@ -476,7 +495,7 @@ get_next_track (playItem_t *curr) {
                 }
             }
             playItem_t *it = pmin;
-            if (!it) {
+            if (!it && !peek) {
                 // all songs played, reshuffle and try again
                 if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
                     plt_reshuffle (streamer_playlist, &it, NULL);
@@ -498,7 +517,7 @@ get_next_track (playItem_t *curr) {
             int rating = curr->shufflerating;
             playItem_t *pmin = NULL; // notplayed minimum
             for (playItem_t *i = plt->head[PL_MAIN]; i; i = i->next[PL_MAIN]) {
-                if (i->played || i->shufflerating < rating) {
+                if (i->played || i == curr || i->shufflerating < rating) {
                     continue;
                 }
                 if (!pmin || i->shufflerating < pmin->shufflerating) {
@@ -506,7 +525,7 @@ get_next_track (playItem_t *curr) {
                 }
             }
             playItem_t *it = pmin;
-            if (!it) {
+            if (!it && !peek) {
                 // all songs played, reshuffle and try again
                 if (pl_loop_mode == PLAYBACK_MODE_LOOP_ALL) { // loop
                     trace ("all songs played! reshuffle\n");
@@ -514,8 +533,10 @@ get_next_track (playItem_t *curr) {
                 }
             }
             if (!it) {
-                playItem_t *temp;
-                plt_reshuffle (streamer_playlist, &temp, NULL);
+                if (!peek) {
+                    playItem_t *temp;
+                    plt_reshuffle (streamer_playlist, &temp, NULL);
+                }
                 pl_unlock ();
                 return NULL;
             }
@@ -830,6 +851,286 @@ streamer_play_failed (playItem_t *failed_track) {
     streamer_unlock();
 }
 
+// Pre-opening of the next track: when the streaming track is about to end, a worker thread
+// opens the predicted next track, and reads its first blocks, so that the track change
+// doesn't wait for the decoder, e.g. on network storage.
+// The prefetch is only accessed by the streamer thread, except the results of the worker,
+// which are published by the thread join.
+// A worker which is discarded while running is stopped, and joined later, see prefetch_reap.
+#define PREFETCH_MAX_BLOCKS 64
+
+typedef struct prefetch_s {
+    playItem_t *track;
+    char decoder_id[100];
+    intptr_t tid;
+    int abandoned; // discarded while running, stops the worker
+    int finished; // set by the worker when it's done
+    DB_FILE *file; // the file of the opened track, guarded by prefetch_mutex
+    struct prefetch_s *next; // in prefetch_abandoned
+    int preroll_ms;
+
+    DB_fileinfo_t *fileinfo; // NULL if the track failed to open
+    int adopted; // the fileinfo is owned by the streamer, which plays the pre-read blocks
+    streamblock_t *blocks;
+    int blocks_alloc;
+    int num_blocks; // read by the worker
+    int next_block; // the next one to be queued by the streamer
+
+    // the state in which the prediction was made
+    playlist_t *plt;
+    int plt_modification_idx;
+    int order;
+    int loop_mode;
+    int queue_count;
+} prefetch_t;
+
+static prefetch_t *prefetch;
+static prefetch_t *prefetch_abandoned; // the workers to join, guarded by prefetch_mutex
+static uintptr_t prefetch_mutex;
+static int prefetch_checked; // the streaming track was checked for prefetching
+static int prefetch_drop; // set by stream_track (NULL), which can also be called from the DSP thread
+
+static void
+prefetch_free (prefetch_t *p) {
+    for (int i = 0; i < p->blocks_alloc; i++) {
+        if (p->blocks[i].track) {
+            pl_item_unref (p->blocks[i].track);
+        }
+        free (p->blocks[i].buf);
+    }
+    free (p->blocks);
+    if (p->fileinfo && !p->adopted) {
+        p->fileinfo->plugin->free (p->fileinfo);
+    }
+    pl_item_unref (p->track);
+    free (p);
+}
+
+static void
+prefetch_thread (void *ctx) {
+    prefetch_t *p = ctx;
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-prefetch", 0, 0, 0, 0);
+#endif
+
+    DB_decoder_t *dec = plug_get_decoder_for_id (p->decoder_id);
+    DB_fileinfo_t *fi = dec ? dec_open (dec, STREAMER_HINTS, p->track) : NULL;
+    if (fi && dec->init (fi, DB_PLAYITEM (p->track)) != 0) {
+        dec->free (fi);
+        fi = NULL;
+    }
+
+    if (fi) {
+        p->fileinfo = fi;
+        mutex_lock (prefetch_mutex);
+        p->file = fi->file;
+        if (p->file && __atomic_load_n (&p->abandoned, __ATOMIC_ACQUIRE)) {
+            vfs_fabort (p->file);
+        }
+        mutex_unlock (prefetch_mutex);
+        int bytes_per_sec = fi->fmt.samplerate * fi->fmt.channels * (fi->fmt.bps >> 3);
+        int n = (int)((int64_t)p->preroll_ms * bytes_per_sec / 1000 / STREAMREADER_BLOCK_SIZE) + 1;
+        if (n > PREFETCH_MAX_BLOCKS) {
+            n = PREFETCH_MAX_BLOCKS;
+        }
+        p->blocks = calloc (n, sizeof (streamblock_t));
+        p->blocks_alloc = n;
+        for (int i = 0; i < n && !__atomic_load_n (&p->abandoned, __ATOMIC_ACQUIRE); i++) {
+            p->blocks[i].buf = malloc (STREAMREADER_BLOCK_SIZE);
+            if (streamreader_read_block (&p->blocks[i], p->track, fi) < 0) {
+                // the streamer gets the same error when reading the track
+                break;
+            }
+            p->num_blocks++;
+            if (p->blocks[i].last) {
+                break;
+            }
+        }
+    }
+
+    __atomic_store_n (&p->finished, 1, __ATOMIC_RELEASE);
+}
+
+// joins and frees the abandoned workers which are finished, or all of them if wait is set
+static void
+prefetch_reap (int wait) {
+    prefetch_t *done = NULL;
+    mutex_lock (prefetch_mutex);
+    prefetch_t **pp = &prefetch_abandoned;
+    while (*pp) {
+        prefetch_t *p = *pp;
+        if (wait || __atomic_load_n (&p->finished, __ATOMIC_ACQUIRE)) {
+            *pp = p->next;
+            p->next = done;
+            done = p;
+        }
+        else {
+            pp = &p->next;
+        }
+    }
+    mutex_unlock (prefetch_mutex);
+    while (done) {
+        prefetch_t *next = done->next;
+        thread_join (done->tid);
+        prefetch_free (done);
+        done = next;
+    }
+}
+
+// aborts the files of the discarded workers; the pre-opened next track is kept
+static void
+prefetch_abort_files (void) {
+    if (!prefetch_mutex) {
+        return;
+    }
+    mutex_lock (prefetch_mutex);
+    for (prefetch_t *p = prefetch_abandoned; p; p = p->next) {
+        if (p->file) {
+            vfs_fabort (p->file);
+        }
+    }
+    mutex_unlock (prefetch_mutex);
+}
+
+static void
+prefetch_discard (void) {
+    prefetch_t *p = prefetch;
+    if (!p) {
+        return;
+    }
+    prefetch = NULL;
+    if (p->tid && !__atomic_load_n (&p->finished, __ATOMIC_ACQUIRE)) {
+        // don't wait for a slow open: stop the worker, and join it later
+        mutex_lock (prefetch_mutex);
+        __atomic_store_n (&p->abandoned, 1, __ATOMIC_RELEASE);
+        if (p->file) {
+            vfs_fabort (p->file);
+        }
+        p->next = prefetch_abandoned;
+        prefetch_abandoned = p;
+        mutex_unlock (prefetch_mutex);
+        return;
+    }
+    if (p->tid) {
+        thread_join (p->tid);
+    }
+    prefetch_free (p);
+}
+
+// starts pre-opening the next track, when the streaming track is about to end
+static void
+prefetch_check (void) {
+    if (prefetch_abandoned) {
+        prefetch_reap (0);
+    }
+    if (prefetch || prefetch_checked || !streaming_track || !fileinfo || conf_preopen_ms <= 0) {
+        return;
+    }
+    float dur = pl_get_item_duration (streaming_track);
+    if (dur <= 0 || (dur - fileinfo->readpos) * 1000 > conf_preopen_ms) {
+        return;
+    }
+    prefetch_checked = 1;
+
+    playItem_t *next = get_next_track (streaming_track, 1);
+    if (!next) {
+        return;
+    }
+
+    prefetch_t *p = calloc (1, sizeof (prefetch_t));
+    p->track = next;
+    p->preroll_ms = conf_preroll_ms;
+    pl_lock ();
+    const char *dec = pl_find_meta (next, ":DECODER");
+    if (dec) {
+        strncpy (p->decoder_id, dec, sizeof (p->decoder_id) - 1);
+    }
+    p->plt = streamer_playlist;
+    p->queue_count = playqueue_getcount ();
+    pl_unlock ();
+    p->plt_modification_idx = p->plt ? plt_get_modification_idx (p->plt) : 0;
+    p->order = pl_get_order ();
+    p->loop_mode = conf_get_int ("playback.loop", 0);
+
+    // tracks without a decoder need content type detection, which is left to stream_track
+    if (p->decoder_id[0]) {
+        p->tid = thread_start (prefetch_thread, p);
+    }
+    if (!p->tid) {
+        prefetch_free (p);
+        return;
+    }
+    prefetch = p;
+}
+
+// returns the predicted next track, if the playlist, order, or queue didn't change since the prediction
+static playItem_t *
+prefetch_get_predicted (void) {
+    prefetch_t *p = prefetch;
+    if (!p || p->adopted) {
+        return NULL;
+    }
+    if (p->plt != streamer_playlist
+        || (p->plt && p->plt_modification_idx != plt_get_modification_idx (p->plt))
+        || p->order != pl_get_order ()
+        || p->loop_mode != conf_get_int ("playback.loop", 0)
+        || p->queue_count != playqueue_getcount ()) {
+        return NULL;
+    }
+    pl_item_ref (p->track);
+    return p->track;
+}
+
+// takes over the pre-opened decoder of the track, if there's one, otherwise discards the prefetch
+static DB_fileinfo_t *
+prefetch_take (playItem_t *it) {
+    prefetch_t *p = prefetch;
+    if (!p || p->adopted || p->track != it) {
+        prefetch_discard ();
+        return NULL;
+    }
+
+    // waiting for the worker is not slower than opening the track here
+    thread_join (p->tid);
+    p->tid = 0;
+    DB_fileinfo_t *fi = p->fileinfo;
+    if (fi) {
+        p->adopted = 1;
+    }
+    if (!fi || !p->num_blocks) {
+        // on failure, the track is opened again by stream_track, which handles the errors
+        prefetch_discard ();
+    }
+    return fi;
+}
+
+// reads the next block of the streaming track, taking the pre-read blocks first
+static int
+streamer_read_block (streamblock_t *block) {
+    prefetch_t *p = prefetch;
+    int res;
+    if (p && p->adopted && p->next_block < p->num_blocks) {
+        streamreader_swap_block (block, &p->blocks[p->next_block++]);
+        res = 1;
+    }
+    else {
+        if (p && p->adopted) {
+            prefetch_discard ();
+        }
+        res = streamreader_read_block (block, streaming_track, fileinfo);
+    }
+
+    // the settings of the streaming track are current for replaygain_apply,
+    // which is only updated here, on the streamer thread
+    if (res > 0 && !(fileinfo->plugin->plugin.flags & DDB_PLUGIN_FLAG_REPLAYGAIN)) {
+        ddb_replaygain_settings_t rg_settings;
+        rg_settings._size = sizeof (rg_settings);
+        replaygain_init_settings (&rg_settings, block->track);
+        replaygain_set_current (&rg_settings);
+    }
+    return res;
+}
+
 static int
 stream_track (playItem_t *it) {
     if (fileinfo) {
@@ -837,6 +1138,11 @@ stream_track (playItem_t *it) {
         fileinfo = NULL;
         fileinfo_file = NULL;
     }
+    prefetch_checked = 0;
+    if (!it) {
+        // discarded by the streamer thread
+        __atomic_store_n (&prefetch_drop, 1, __ATOMIC_RELEASE);
+    }
     trace ("stream_track %s\n", playing_track ? pl_find_meta (playing_track, ":URI") : "null");
     int err = 0;
     playItem_t *from = NULL;
@@ -878,6 +1184,17 @@ stream_track (playItem_t *it) {
         goto success;
     }
 
+    __atomic_store_n (&prefetch_drop, 0, __ATOMIC_RELEASE);
+    DB_fileinfo_t *prefetched = prefetch_take (it);
+    if (prefetched) {
+        new_fileinfo = prefetched;
+        new_fileinfo_file = prefetched->file;
+        streaming_track = it;
+        pl_item_ref (streaming_track);
+        streaming_track_is_remote = is_remote_stream (it);
+        goto success;
+    }
+
     char decoder_id[100] = "";
     char filetype[100] = "";
     pl_lock ();
@@ -1164,6 +1481,7 @@ m3u_error:
             if (streaming_track) {
                 pl_item_ref (streaming_track);
             }
+            streaming_track_is_remote = is_remote_stream (it);
 
             trace ("bps=%d, channels=%d, samplerate=%d\n", new_fileinfo->fmt.bps, new_fileinfo->fmt.channels, new_fileinfo->fmt.samplerate);
             break;
@@ -1188,13 +1506,16 @@ error:
     return err;
 }
 
+static float
+dspbuffer_get_playpos (void);
+
 float
 streamer_get_playpos (void) {
     float seek = last_seekpos;
     if (seek >= 0) {
         return seek;
     }
-    return playpos;
+    return dspbuffer_get_playpos ();
 }
 
 int
@@ -1229,7 +1550,11 @@ update_stop_after_current (void) {
 
 static void
 streamer_next (void) {
-    playItem_t *next = get_next_track (streaming_track);
+    // reuse the prediction, which can be random
+    playItem_t *next = prefetch_get_predicted ();
+    if (!next) {
+        next = get_next_track (streaming_track, 0);
+    }
     stream_track (next);
     if (next) {
         pl_item_unref (next);
@@ -1267,6 +1592,10 @@ streamer_seek_real (float seekpos) {
             if (fileinfo->plugin->seek (fileinfo, playpos) >= 0) {
                 streamer_reset (1);
             }
+            if (prefetch && prefetch->adopted) {
+                // the pre-read blocks are before the seek position
+                prefetch_discard ();
+            }
             playpos = fileinfo->readpos;
             avg_bitrate = -1;
             streamer_unlock();
@@ -1282,6 +1611,45 @@ streamer_seek_real (float seekpos) {
     last_seekpos = -1;
 }
 
+static int64_t
+streamer_time_ms (void) {
+    struct timeval tm;
+    gettimeofday (&tm, NULL);
+    return (int64_t)tm.tv_sec * 1000 + tm.tv_usec / 1000;
+}
+
+// sizes the read-ahead buffer for the format of the streaming track,
+// must be called with streamer_lock held, before getting the next block
+static void
+streamer_update_readahead (void) {
+    int64_t now = streamer_time_ms ();
+    uint64_t underruns = __atomic_load_n (&underrun_count, __ATOMIC_RELAXED);
+    // the counter can be reset by streamer_get_buffer_stats
+    if (underruns > readahead_underruns) {
+        if (readahead_scale < READAHEAD_MAX_SCALE) {
+            readahead_scale *= 2;
+            trace ("streamer: underrun, read-ahead scale %d\n", readahead_scale);
+        }
+        readahead_scale_time = now;
+    }
+    else if (readahead_scale > 1 && now - readahead_scale_time > READAHEAD_DECAY_MS) {
+        readahead_scale /= 2;
+        readahead_scale_time = now;
+    }
+    readahead_underruns = underruns;
+
+    int ms = (streaming_track_is_remote ? conf_readahead_ms_remote : conf_readahead_ms) * readahead_scale;
+    int bytes_per_sec = fileinfo->fmt.samplerate * fileinfo->fmt.channels * (fileinfo->fmt.bps >> 3);
+    readahead_target_ms = ms;
+    readahead_bytes_per_sec = bytes_per_sec;
+    streamreader_set_block_count ((int)((int64_t)ms * bytes_per_sec / 1000 / STREAMREADER_BLOCK_SIZE) + 1);
+}
+
+static void
+streamer_dsp_wake (void);
+
+// Sleeps in handler_wait while there's nothing to do: it's woken by commands,
+// and by the DSP thread, when it frees a block, or runs out of them.
 void
 streamer_thread (void *ctx) {
 #ifdef __linux__
@@ -1341,10 +1709,20 @@ streamer_thread (void *ctx) {
                 streamer_notify_order_changed_real(p1, p2);
                 break;
             }
+            streamer_dsp_wake ();
+            continue;
+        }
+
+        if (__atomic_exchange_n (&prefetch_drop, 0, __ATOMIC_ACQ_REL)) {
+            prefetch_discard ();
         }
 
         if (output->state () == OUTPUT_STATE_STOPPED) {
-            usleep (50000);
+            // release the read-ahead memory while idle
+            streamer_lock ();
+            streamreader_set_block_count (0);
+            streamer_unlock ();
+            handler_wait (handler);
             continue;
         }
 
@@ -1368,36 +1746,43 @@ streamer_thread (void *ctx) {
         streamer_lock ();
         if (!fileinfo) {
             streamer_unlock ();
+            handler_wait (handler);
             continue;
         }
 
+        streamer_update_readahead ();
         streamblock_t *block = streamreader_get_next_block ();
         streamer_unlock ();
 
         if (!block) {
-            usleep (50000);
+            // all blocks are full
+            handler_wait (handler);
             continue;
         }
 
-        int res = streamreader_read_block (block, streaming_track, fileinfo);
+        int res = streamer_read_block (block);
 
         if (res < 0) {
             // error
             streamer_next ();
         }
         else  {
-            streamer_lock ();
-            streamreader_enqueue_block (block);
             int last = block->last;
-            streamer_unlock ();
+            streamreader_enqueue_block (block);
 
             if (last) {
                 // end of file, next track
                 streamer_next ();
             }
+            else {
+                prefetch_check ();
+            }
         }
+        streamer_dsp_wake ();
     }
 
+    prefetch_discard ();
+
     // stop streaming song
     if (fileinfo) {
         fileinfo->plugin->free (fileinfo);
@@ -1416,6 +1801,255 @@ streamer_thread (void *ctx) {
     streamer_unlock ();
 }
 
+// We always decode the entire block, 16384 bytes of input PCM
+// after DSP that can become really big.
+// Think converting from 8KHz/8 bit to 192KHz/32 bit, thats 96x size increase,
+// which gives us the need of 1.5MB buffer.
+//
+// The outbuffer is the DSP thread's staging area, a single processed block
+// is copied from it into the dspbuffer.
+//
+// FIXME: this BSS allocation is temporary, needs to be on heap, and allocated on demand.
+static char outbuffer[512*1024];
+
+// The dspbuffer is a ring of output PCM, processed ahead by the DSP thread
+// and consumed by streamer_read.
+// It's guaranteed that dspbuffer contains only samples with the same output format.
+//
+// The positions are absolute byte offsets: dspbuffer_wpos and dspbuffer_discard
+// are only written by the DSP thread, dspbuffer_rpos only by the output thread.
+// streamer_reset flushes the ring by starting a new streamreader generation,
+// streamer_dsp_flush flushes only the ring, keeping the decoded blocks;
+// the DSP thread then moves dspbuffer_discard to the write position.
+#define DSPBUFFER_SIZE (2*1024*1024) // power of 2, must be larger than 2 outbuffers
+#define DSPBUFFER_AHEAD_MS 100 // minimum amount of data to process ahead
+
+static char *dspbuffer;
+static uint64_t dspbuffer_wpos;
+static uint64_t dspbuffer_rpos;
+static uint64_t dspbuffer_discard;
+static unsigned dspbuffer_gen; // generation of the data in dspbuffer
+static unsigned dspbuffer_flushes;
+static int dspbuffer_request; // size of the last streamer_read
+static int drain_pending; // the next block needs to wait until dspbuffer is played, e.g. to change the output format
+static float dspbuffer_ratio = 1; // dsp speed ratio of the last processed block, for converting buffered bytes to track time
+
+// Track changes are found by the DSP thread ahead of the output,
+// and are queued with their position in dspbuffer.
+// The songfinished/songstarted events, and the other playback state changes,
+// are done by the DSP thread once streamer_read has passed the position,
+// which is when the new track starts playing.
+// playpos and playtime are the position of the processed data,
+// streamer_get_playpos subtracts the duration of the buffered data.
+#define DSPBUFFER_MAX_TRACK_CHANGES 16
+
+typedef struct {
+    uint64_t pos; // dspbuffer position of the first byte of the new track
+    playItem_t *track;
+    float prev_playpos; // position and playtime of the previous track at its end
+    float prev_playtime;
+} dspbuffer_track_change_t;
+
+static dspbuffer_track_change_t dspbuffer_track_changes[DSPBUFFER_MAX_TRACK_CHANGES];
+static int dspbuffer_num_track_changes;
+static uint64_t dspbuffer_next_change_pos = UINT64_MAX; // pos of the first queued track change, read by streamer_read
+static float dspbuffer_next_change_playpos; // prev_playpos of the first queued track change
+
+static intptr_t dsp_tid;
+
+// The DSP thread sleeps until the output consumes data, a block is queued, or a reset.
+// The output thread must not block, so the wakeup doesn't take any locks:
+// the first streamer_dsp_wake after the DSP thread went to sleep writes a byte into dsp_wakeup_fds,
+// and the DSP thread sleeps in read.
+// dsp_wakeup stays set until the DSP thread wakes up, so that no wakeup is lost.
+static int dsp_wakeup_fds[2] = { -1, -1 };
+static int dsp_wakeup;
+
+// can be called from any thread, including the output
+static void
+streamer_dsp_wake (void) {
+    if (__atomic_exchange_n (&dsp_wakeup, 1, __ATOMIC_SEQ_CST)) {
+        return; // already pending
+    }
+    if (dsp_wakeup_fds[1] >= 0) {
+        char c = 0;
+        if (write (dsp_wakeup_fds[1], &c, 1) < 0) {
+            // the pipe can't be full, at most one byte is pending
+        }
+    }
+}
+
+static void
+streamer_dsp_wait (void) {
+    if (dsp_wakeup_fds[0] < 0) {
+        // no pipe, poll
+        while (!__atomic_load_n (&dsp_wakeup, __ATOMIC_SEQ_CST)) {
+            usleep (1000);
+        }
+    }
+    else {
+        char c;
+        while (read (dsp_wakeup_fds[0], &c, 1) < 0 && errno == EINTR);
+    }
+    __atomic_store_n (&dsp_wakeup, 0, __ATOMIC_SEQ_CST);
+}
+
+// changes with every streamer_reset and streamer_dsp_flush
+static unsigned
+dspbuffer_get_generation (void) {
+    return streamreader_get_generation () + __atomic_load_n (&dspbuffer_flushes, __ATOMIC_ACQUIRE);
+}
+
+// amount of data in dspbuffer, as seen by the DSP thread
+static int
+dspbuffer_get_fill (void) {
+    uint64_t rpos = __atomic_load_n (&dspbuffer_rpos, __ATOMIC_ACQUIRE);
+    if (rpos < dspbuffer_discard) {
+        rpos = dspbuffer_discard;
+    }
+    return (int)(dspbuffer_wpos - rpos);
+}
+
+static void
+dspbuffer_publish_track_changes (void) {
+    if (dspbuffer_num_track_changes) {
+        __atomic_store (&dspbuffer_next_change_playpos, &dspbuffer_track_changes[0].prev_playpos, __ATOMIC_RELAXED);
+        __atomic_store_n (&dspbuffer_next_change_pos, dspbuffer_track_changes[0].pos, __ATOMIC_RELEASE);
+    }
+    else {
+        __atomic_store_n (&dspbuffer_next_change_pos, UINT64_MAX, __ATOMIC_RELEASE);
+    }
+}
+
+// the track whose data was processed last
+static playItem_t *
+dspbuffer_get_track (void) {
+    if (dspbuffer_num_track_changes) {
+        return dspbuffer_track_changes[dspbuffer_num_track_changes-1].track;
+    }
+    return playing_track;
+}
+
+static void
+dspbuffer_queue_track_change (playItem_t *track) {
+    dspbuffer_track_change_t *tc = &dspbuffer_track_changes[dspbuffer_num_track_changes++];
+    tc->pos = dspbuffer_wpos;
+    tc->track = track;
+    pl_item_ref (track);
+    tc->prev_playpos = playpos;
+    tc->prev_playtime = playtime;
+    dspbuffer_publish_track_changes ();
+
+    // the following data belongs to the new track
+    playpos = 0;
+    playtime = 0;
+    avg_bitrate = -1;
+    last_seekpos = -1;
+}
+
+// does the track changes which streamer_read has reached, called from the DSP thread
+static void
+dspbuffer_play_track_changes (void) {
+    uint64_t rpos = __atomic_load_n (&dspbuffer_rpos, __ATOMIC_ACQUIRE);
+    if (rpos < dspbuffer_discard) {
+        rpos = dspbuffer_discard;
+    }
+    while (dspbuffer_num_track_changes && dspbuffer_track_changes[0].pos <= rpos) {
+        dspbuffer_track_change_t tc = dspbuffer_track_changes[0];
+        dspbuffer_num_track_changes--;
+        memmove (&dspbuffer_track_changes[0], &dspbuffer_track_changes[1], dspbuffer_num_track_changes * sizeof (dspbuffer_track_change_t));
+        dspbuffer_publish_track_changes ();
+
+        update_stop_after_current ();
+        if (playing_track) {
+            send_songfinished (playing_track, tc.prev_playtime);
+        }
+        streamer_start_playback (playing_track, tc.track, tc.prev_playtime);
+        send_songstarted (playing_track);
+        pl_item_unref (tc.track);
+    }
+}
+
+static void
+dspbuffer_clear_track_changes (void) {
+    for (int i = 0; i < dspbuffer_num_track_changes; i++) {
+        pl_item_unref (dspbuffer_track_changes[i].track);
+    }
+    dspbuffer_num_track_changes = 0;
+    dspbuffer_publish_track_changes ();
+}
+
+// drops the processed data after streamer_reset, called from the DSP thread
+static void
+dspbuffer_check_reset (void) {
+    unsigned gen = dspbuffer_get_generation ();
+    if (dspbuffer_gen != gen) {
+        __atomic_store_n (&dspbuffer_discard, dspbuffer_wpos, __ATOMIC_RELEASE);
+        __atomic_store_n (&dspbuffer_gen, gen, __ATOMIC_RELEASE);
+        drain_pending = 0;
+        // the new tracks were not played
+        dspbuffer_clear_track_changes ();
+    }
+}
+
+// play position of the track which is being played, rather than processed
+static float
+dspbuffer_get_playpos (void) {
+    DB_output_t *output = plug_get_output ();
+    if (!output) {
+        return playpos;
+    }
+    int bytes_per_sec = output->fmt.samplerate * output->fmt.channels * (output->fmt.bps >> 3);
+    if (bytes_per_sec <= 0 || __atomic_load_n (&dspbuffer_gen, __ATOMIC_ACQUIRE) != dspbuffer_get_generation ()) {
+        return playpos;
+    }
+    uint64_t rpos = __atomic_load_n (&dspbuffer_rpos, __ATOMIC_ACQUIRE);
+    uint64_t discard = __atomic_load_n (&dspbuffer_discard, __ATOMIC_ACQUIRE);
+    if (rpos < discard) {
+        rpos = discard;
+    }
+    uint64_t change_pos = __atomic_load_n (&dspbuffer_next_change_pos, __ATOMIC_ACQUIRE);
+    float pos;
+    uint64_t end;
+    if (change_pos != UINT64_MAX && change_pos > rpos) {
+        // the previous track is still playing
+        __atomic_load (&dspbuffer_next_change_playpos, &pos, __ATOMIC_RELAXED);
+        end = change_pos;
+    }
+    else {
+        pos = playpos;
+        end = __atomic_load_n (&dspbuffer_wpos, __ATOMIC_ACQUIRE);
+    }
+    if (end > rpos) {
+        float ratio;
+        __atomic_load (&dspbuffer_ratio, &ratio, __ATOMIC_RELAXED);
+        pos -= (float)(end - rpos) / bytes_per_sec * ratio;
+    }
+    return pos > 0 ? pos : 0;
+}
+
+static void
+dspbuffer_write (const char *bytes, int size) {
+    int pos = (int)(dspbuffer_wpos & (DSPBUFFER_SIZE-1));
+    int n = min (size, DSPBUFFER_SIZE - pos);
+    memcpy (dspbuffer + pos, bytes, n);
+    memcpy (dspbuffer, bytes + n, size - n);
+    __atomic_store_n (&dspbuffer_wpos, dspbuffer_wpos + size, __ATOMIC_RELEASE);
+}
+
+// target fill of dspbuffer in bytes: enough for 2 output reads, and at least DSPBUFFER_AHEAD_MS
+static int
+dspbuffer_get_target (void) {
+    DB_output_t *output = plug_get_output ();
+    int bytes_per_sec = output->fmt.samplerate * output->fmt.channels * (output->fmt.bps >> 3);
+    int target = max (bytes_per_sec / 1000 * DSPBUFFER_AHEAD_MS, __atomic_load_n (&dspbuffer_request, __ATOMIC_RELAXED) * 2);
+    target = max (target, STREAMREADER_BLOCK_SIZE);
+    return min (target, DSPBUFFER_SIZE - (int)sizeof (outbuffer));
+}
+
+static void
+streamer_dsp_thread (void *ctx);
+
 void
 streamer_dsp_refresh (void) {
     handler_push (handler, STR_EV_DSP_RELOAD, 0, 0, 0);
@@ -1440,7 +2074,18 @@ streamer_init (void) {
     deadbeef->conf_get_str ("network.ctmapping", DDB_DEFAULT_CTMAPPING, conf_network_ctmapping, sizeof (conf_network_ctmapping));
     ctmap_init ();
 
+    dspbuffer = malloc (DSPBUFFER_SIZE);
+    if (!pipe (dsp_wakeup_fds)) {
+        fcntl (dsp_wakeup_fds[1], F_SETFL, O_NONBLOCK);
+        fcntl (dsp_wakeup_fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl (dsp_wakeup_fds[1], F_SETFD, FD_CLOEXEC);
+    }
+    else {
+        dsp_wakeup_fds[0] = dsp_wakeup_fds[1] = -1;
+    }
+    prefetch_mutex = mutex_create_nonrecursive ();
     streamer_tid = thread_start (streamer_thread, NULL);
+    dsp_tid = thread_start (streamer_dsp_thread, NULL);
     return 0;
 }
 
@@ -1451,13 +2096,29 @@ streamer_free (void) {
 #endif
 
     if (playing_track) {
-        send_trackchanged (playing_track, NULL);
+        send_trackchanged (playing_track, NULL, playtime);
     }
     streamer_abort_files ();
     streaming_terminate = 1;
+    streamer_dsp_wake ();
+    handler_notify (handler);
+    thread_join (dsp_tid);
     thread_join (streamer_tid);
+    dspbuffer_clear_track_changes ();
+    // the decoders of the discarded prefetches must be freed before the plugins are unloaded
+    prefetch_reap (1);
+    mutex_free (prefetch_mutex);
+    prefetch_mutex = 0;
+    for (int i = 0; i < 2; i++) {
+        if (dsp_wakeup_fds[i] >= 0) {
+            close (dsp_wakeup_fds[i]);
+            dsp_wakeup_fds[i] = -1;
+        }
+    }
 
     streamreader_free ();
+    free (dspbuffer);
+    dspbuffer = NULL;
 
     if (first_failed_track) {
         pl_item_unref (first_failed_track);
@@ -1499,18 +2160,6 @@ streamer_free (void) {
     }
 }
 
-// We always decode the entire block, 16384 bytes of input PCM
-// after DSP that can become really big.
-// Think converting from 8KHz/8 bit to 192KHz/32 bit, thats 96x size increase,
-// which gives us the need of 1.5MB buffer.
-//
-// It's guaranteed that outbuffer contains only samples from the files with same wave format.
-//
-// FIXME: this BSS allocation is temporary, needs to be on heap, and allocated on demand.
-// FIXME: streamer_reset should flush this.
-static char outbuffer[512*1024];
-static int outbuffer_remaining;
-
 void
 streamer_reset (int full) { // must be called when current song changes by external reasons
     if (!mutex) {
@@ -1521,11 +2170,22 @@ streamer_reset (int full) { // must be called when current song changes by exter
     streamer_lock();
     streamreader_reset ();
     dsp_reset ();
-    outbuffer_remaining = 0;
     streamer_unlock();
+
+    // the DSP thread drops the processed data, the streamer refills the blocks
+    streamer_dsp_wake ();
+    handler_notify (handler);
+}
+
+void
+streamer_dsp_flush (void) {
+    streamer_lock ();
+    __atomic_add_fetch (&dspbuffer_flushes, 1, __ATOMIC_RELEASE);
+    streamer_unlock ();
+    streamer_dsp_wake ();
 }
 
-// NOTE: this is supposed to be only called from streamer_read
+// NOTE: this is supposed to be only called from the DSP thread
 static void
 get_desired_output_format (ddb_waveformat_t *in_fmt, ddb_waveformat_t *out_fmt) {
     memcpy (out_fmt, in_fmt, sizeof (ddb_waveformat_t));
@@ -1553,7 +2213,45 @@ streamer_set_output_format (ddb_waveformat_t *fmt) {
     }
 }
 
-// when firstblock is true -- means it's allowed to change output format
+// The gain stage applies ReplayGain, preamp, volume and mute in one pass, in the DSP thread.
+// Gain changes are ramped over GAIN_RAMP_MS, to avoid clicks.
+#define GAIN_RAMP_MS 20
+
+static float gain_current = -1; // -1 until the first block
+static float gain_target;
+static float gain_step; // per frame, while ramping to gain_target
+
+static void
+streamer_apply_gain (const ddb_waveformat_t *fmt, char *bytes, int size, float gain) {
+    if (gain_current < 0) {
+        gain_current = gain_target = gain;
+    }
+    if (gain != gain_target) {
+        gain_target = gain;
+        gain_step = (gain_target - gain_current) / (fmt->samplerate * GAIN_RAMP_MS / 1000);
+    }
+
+    float from = gain_current;
+    int ramp = 0;
+    if (gain_current != gain_target) {
+        int nframes = size / ((fmt->bps >> 3) * fmt->channels);
+        ramp = (int)ceilf ((gain_target - gain_current) / gain_step);
+        if (ramp > nframes) {
+            ramp = nframes;
+            gain_current += gain_step * ramp;
+        }
+        else {
+            gain_current = gain_target;
+        }
+    }
+    else if (gain_current == 1) {
+        return;
+    }
+    pcm_apply_gain (fmt, bytes, size, from, gain_current, ramp);
+}
+
+// when firstblock is true -- means it's allowed to change output format,
+// otherwise a format change or a stop sets drain_pending, and waits for the next firstblock
 static int
 process_output_block (char *bytes, int firstblock) {
     streamblock_t *block = streamreader_get_curr_block();
@@ -1564,11 +2262,18 @@ process_output_block (char *bytes, int firstblock) {
         streamreader_next_block ();
         return 0;
     }
+    if (!firstblock && memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+        drain_pending = 1;
+        return 0;
+    }
 
     DB_output_t *output = plug_get_output ();
     int sz = block->size - block->pos;
     assert (sz);
 
+    // the track of the data before this block, which can be still in dspbuffer
+    playItem_t *prev_track = dspbuffer_get_track ();
+
     // handle stop after current
     int stop = 0;
     if (block->last) {
@@ -1576,18 +2281,23 @@ process_output_block (char *bytes, int firstblock) {
             stop = 1;
         }
         else {
-            if (stop_after_album_check (playing_track, block->track)) {
+            if (stop_after_album_check (prev_track, block->track)) {
                 stop = 1;
             }
         }
+        if (stop && !firstblock) {
+            // let the output play the rest of the track first
+            drain_pending = 1;
+            return 0;
+        }
     }
 
     // handle change of track, or start of a new track
-    if (block->last || block->track != playing_track || (playing_track && last_played != playing_track)) {
-        // next track started
-        update_stop_after_current ();
-
+    if (block->last || block->track != prev_track
+        || (!dspbuffer_num_track_changes && playing_track && last_played != playing_track)) {
         if (stop) {
+            // dspbuffer is empty, so the previous track has finished playing
+            update_stop_after_current ();
             output->stop ();
             streamer_lock();
             streamer_reset (1);
@@ -1597,19 +2307,15 @@ process_output_block (char *bytes, int firstblock) {
             return 0;
         }
 
-        if (playing_track) {
-            send_songfinished (playing_track);
+        if (dspbuffer_num_track_changes == DSPBUFFER_MAX_TRACK_CHANGES) {
+            // wait for the queued track changes to be played
+            return 0;
         }
 
-        streamer_start_playback (playing_track, block->track);
-
-        // only reset playpos/bitrate if track changing to another,
-        // otherwise the track is the first one, and playpos is pre-set
-        playpos = 0;
-        playtime = 0;
-        avg_bitrate = -1;
-        last_seekpos = -1;
-        send_songstarted (playing_track);
+        // next track starts at the current end of dspbuffer,
+        // the events are sent once it's played
+        dspbuffer_queue_track_change (block->track);
+        dspbuffer_play_track_changes ();
     }
 
     if (firstblock) {
@@ -1622,6 +2328,11 @@ process_output_block (char *bytes, int firstblock) {
         }
     }
 
+    float gain = block->replaygain;
+    if (!output->has_volume) {
+        gain *= audio_is_mute () ? 0 : volume_get_amp ();
+    }
+
     ddb_waveformat_t datafmt; // comes either from dsp, or from input plugin
     memcpy (&datafmt, &block->fmt, sizeof (ddb_waveformat_t));
 
@@ -1644,6 +2355,19 @@ process_output_block (char *bytes, int firstblock) {
     // DSP plugins may change output format at any time.
     if (firstblock) {
         streamer_set_output_format (&datafmt);
+        drain_pending = 0;
+    }
+    else {
+        ddb_waveformat_t outfmt;
+        get_desired_output_format (&datafmt, &outfmt);
+        if (memcmp (&prev_output_format, &outfmt, sizeof (ddb_waveformat_t))) {
+            drain_pending = 1;
+        }
+    }
+
+    // the gain is applied in float to the DSP output, otherwise in the output format
+    if (dsp_res) {
+        streamer_apply_gain (&datafmt, dspbytes, sz, gain);
     }
 
     if (memcmp (&output->fmt, &datafmt, sizeof (ddb_waveformat_t))) {
@@ -1653,8 +2377,13 @@ process_output_block (char *bytes, int firstblock) {
         memcpy (bytes, dspbytes, sz);
     }
 
+    if (!dsp_res) {
+        streamer_apply_gain (&output->fmt, bytes, sz, gain);
+    }
+
     playpos += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
     playtime += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
+    __atomic_store (&dspbuffer_ratio, &dspratio, __ATOMIC_RELAXED);
 
     if (block->pos >= block->size) {
         streamreader_next_block ();
@@ -1663,6 +2392,90 @@ process_output_block (char *bytes, int firstblock) {
     return sz;
 }
 
+static void
+update_avg_bitrate (int bitrate) {
+    if (bitrate == -1) {
+        return;
+    }
+    if (avg_bitrate == -1) {
+        avg_bitrate = bitrate;
+    }
+    else {
+        if (avg_bitrate < bitrate) {
+            avg_bitrate += 5;
+            if (avg_bitrate > bitrate) {
+                avg_bitrate = bitrate;
+            }
+        }
+        else if (avg_bitrate > bitrate) {
+            avg_bitrate -= 5;
+            if (avg_bitrate < bitrate) {
+                avg_bitrate = bitrate;
+            }
+        }
+    }
+//    printf ("apx bitrate: %d (last %d)\n", avg_bitrate, last_bitrate);
+}
+
+// Runs the DSP chain ahead of the output, into dspbuffer,
+// so that streamer_read only needs to copy the ready data.
+// Sleeps in streamer_dsp_wait while the buffer is full, or there are no blocks.
+static void
+streamer_dsp_thread (void *ctx) {
+#ifdef __linux__
+    prctl (PR_SET_NAME, "deadbeef-dsp", 0, 0, 0, 0);
+#endif
+
+    while (!streaming_terminate) {
+        streamer_lock ();
+        dspbuffer_check_reset ();
+        dspbuffer_play_track_changes ();
+
+        int fill = dspbuffer_get_fill ();
+        if (fill >= dspbuffer_get_target () || (drain_pending && fill)
+            || dspbuffer_num_track_changes == DSPBUFFER_MAX_TRACK_CHANGES) {
+            streamer_unlock ();
+            streamer_dsp_wait ();
+            continue;
+        }
+
+        streamblock_t *block = streamreader_get_curr_block ();
+        if (!block) {
+            // NULL streaming_track means playback stopped,
+            // and the output has played all the remaining data
+            if (!streaming_track && !fill && playing_track) {
+                update_stop_after_current ();
+                _handle_playback_stopped ();
+                playpos = 0;
+                playtime = 0;
+                avg_bitrate = -1;
+                last_seekpos = -1;
+            }
+            streamer_unlock ();
+            // starving, let the streamer know
+            handler_notify (handler);
+            streamer_dsp_wait ();
+            continue;
+        }
+
+        int bitrate = block->bitrate;
+        unsigned gen = dspbuffer_gen;
+        int rb = process_output_block (outbuffer, !fill);
+        if (rb > 0) {
+            update_avg_bitrate (bitrate);
+        }
+        streamer_unlock ();
+
+        // a reset after unlocking makes this data stale, it's flushed on the next iteration
+        if (rb > 0 && gen == dspbuffer_get_generation ()) {
+            dspbuffer_write (outbuffer, rb);
+        }
+
+        // a block may have been freed
+        handler_notify (handler);
+    }
+}
+
 int
 streamer_read (char *bytes, int size) {
 #if 0
@@ -1671,64 +2484,47 @@ streamer_read (char *bytes, int size) {
 #endif
     DB_output_t *output = plug_get_output ();
 
-    streamer_lock ();
-    streamblock_t *block = streamreader_get_curr_block();
-    if (!block) {
-        // NULL streaming_track means playback stopped,
-        // otherwise just a buffer starvation (e.g. after seeking)
-        if (!streaming_track) {
-            update_stop_after_current ();
-            _handle_playback_stopped();
-            playpos = 0;
-            playtime = 0;
-            avg_bitrate = -1;
-            last_seekpos = -1;
-        }
-        streamer_unlock();
-
-        return streaming_track ? 0 : -1;
+    // The DSP thread processes the data ahead, so the output never waits for the streamer lock,
+    // and doesn't run the DSP chain.
+    __atomic_store_n (&dspbuffer_request, size, __ATOMIC_RELAXED);
+    unsigned gen = __atomic_load_n (&dspbuffer_gen, __ATOMIC_ACQUIRE);
+    if (gen != dspbuffer_get_generation ()) {
+        // reset, waiting for the DSP thread to flush the stale data
+        output_flowing = 0;
+        streamer_dsp_wake ();
+        return 0;
     }
 
-    // decode enough blocks to fill the output buffer
-    int firstblock = 1;
-    while (outbuffer_remaining < size) {
-        int rb = process_output_block (outbuffer + outbuffer_remaining, firstblock);
-        if (rb <= 0) {
-            break;
-        }
-        outbuffer_remaining += rb;
-        firstblock = 0;
+    uint64_t rpos = dspbuffer_rpos;
+    uint64_t discard = __atomic_load_n (&dspbuffer_discard, __ATOMIC_ACQUIRE);
+    if (rpos < discard) {
+        rpos = discard;
     }
-    streamer_unlock ();
-
-    // consume decoded data
-    int sz = min (size, outbuffer_remaining);
-    memcpy (bytes, outbuffer, sz);
-    if (sz < outbuffer_remaining) {
-        memmove (outbuffer, outbuffer + sz, outbuffer_remaining - sz);
+    int avail = (int)(__atomic_load_n (&dspbuffer_wpos, __ATOMIC_ACQUIRE) - rpos);
+    if (!avail) {
+        // NULL streaming_track means playback stopped,
+        // otherwise just a buffer starvation (e.g. after seeking)
+        if (streaming_track && output_flowing && !__atomic_load_n (&drain_pending, __ATOMIC_RELAXED)) {
+            // ran out of data during playback, not after a reset or a format change
+            __atomic_add_fetch (&underrun_count, 1, __ATOMIC_RELAXED);
+        }
+        output_flowing = 0;
+        streamer_dsp_wake ();
+        return (streaming_track || streamreader_num_blocks_ready ()) ? 0 : -1;
     }
-    outbuffer_remaining -= sz;
 
-    // approximate bitrate
-    if (block->bitrate != -1) {
-        if (avg_bitrate == -1) {
-            avg_bitrate = block->bitrate;
-        }
-        else {
-            if (avg_bitrate < block->bitrate) {
-                avg_bitrate += 5;
-                if (avg_bitrate > block->bitrate) {
-                    avg_bitrate = block->bitrate;
-                }
-            }
-            else if (avg_bitrate > block->bitrate) {
-                avg_bitrate -= 5;
-                if (avg_bitrate < block->bitrate) {
-                    avg_bitrate = block->bitrate;
-                }
-            }
-        }
-//        printf ("apx bitrate: %d (last %d)\n", avg_bitrate, last_bitrate);
+    // consume processed data
+    int sz = min (size, avail);
+    output_flowing = 1;
+    int pos = (int)(rpos & (DSPBUFFER_SIZE-1));
+    int n = min (sz, DSPBUFFER_SIZE - pos);
+    memcpy (bytes, dspbuffer + pos, n);
+    memcpy (bytes + n, dspbuffer, sz - n);
+    __atomic_store_n (&dspbuffer_rpos, rpos + sz, __ATOMIC_RELEASE);
+    if (avail - sz < dspbuffer_get_target ()
+        || rpos + sz >= __atomic_load_n (&dspbuffer_next_change_pos, __ATOMIC_ACQUIRE)) {
+        // more data is needed, or the next track starts playing
+        streamer_dsp_wake ();
     }
 
 #if 0
@@ -1800,70 +2596,6 @@ streamer_read (char *bytes, int size) {
         }
     }
 
-    if (!output->has_volume) {
-        int mult = 1-audio_is_mute ();
-        char *stream = bytes;
-        int bytesread = sz;
-        if (output->fmt.bps == 16) {
-            mult *= 1000;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 1000) {
-                int half = bytesread/2;
-                for (int i = 0; i < half; i++) {
-                    int16_t sample = *((int16_t*)stream);
-                    *((int16_t*)stream) = (int16_t)(((int32_t)sample) * ivolume / 1000);
-                    stream += 2;
-                }
-            }
-        }
-        else if (output->fmt.bps == 8) {
-            mult *= 255;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 255) {
-                for (int i = 0; i < bytesread; i++) {
-                    *stream = (int8_t)(((int32_t)(*stream)) * ivolume / 1000);
-                    stream++;
-                }
-            }
-        }
-        else if (output->fmt.bps == 24) {
-            mult *= 1000;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 1000) {
-                int third = bytesread/3;
-                for (int i = 0; i < third; i++) {
-                    int32_t sample = ((unsigned char)stream[0]) | ((unsigned char)stream[1]<<8) | (stream[2]<<16);
-                    int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                    stream[0] = (newsample&0x0000ff);
-                    stream[1] = (newsample&0x00ff00)>>8;
-                    stream[2] = (newsample&0xff0000)>>16;
-                    stream += 3;
-                }
-            }
-        }
-        else if (output->fmt.bps == 32 && !output->fmt.is_float) {
-            mult *= 1000;
-            int16_t ivolume = volume_get_amp () * mult;
-            if (ivolume != 1000) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    int32_t sample = *((int32_t*)stream);
-                    int32_t newsample = (int32_t)((int64_t)sample * ivolume / 1000);
-                    *((int32_t*)stream) = newsample;
-                    stream += 4;
-                }
-            }
-        }
-        else if (output->fmt.bps == 32 && output->fmt.is_float) {
-            float fvolume = volume_get_amp () * (1-audio_is_mute ());
-            if (fvolume != 1.f) {
-                for (int i = 0; i < bytesread/4; i++) {
-                    *((float*)stream) = (*((float*)stream)) * fvolume;
-                    stream += 4;
-                }
-            }
-        }
-    }
-
     return sz;
 }
 
@@ -1903,6 +2635,30 @@ streamer_configchanged (void) {
     }
 
     conf_streamer_nosleep = conf_get_int ("streamer.nosleep", 0);
+    conf_readahead_ms = conf_get_int ("streamer.readahead_ms", 5000);
+    conf_readahead_ms_remote = conf_get_int ("streamer.readahead_ms_remote", 20000);
+    conf_preopen_ms = conf_get_int ("streamer.preopen_ms", 10000);
+    conf_preroll_ms = conf_get_int ("streamer.preroll_ms", 1000);
+}
+
+void
+streamer_get_buffer_stats (ddb_buffer_stats_t *stats, int reset) {
+    if (stats && stats->_size > (int)sizeof (stats->_size)) {
+        // only fill the fields known to the caller
+        int bytes_per_sec = readahead_bytes_per_sec;
+        ddb_buffer_stats_t st = {
+            ._size = stats->_size,
+            .fill_bytes = streamreader_get_fill_bytes (),
+            .capacity_bytes = streamreader_get_block_count () * STREAMREADER_BLOCK_SIZE,
+            .target_ms = readahead_target_ms,
+            .underrun_count = __atomic_load_n (&underrun_count, __ATOMIC_RELAXED),
+        };
+        st.fill_ms = bytes_per_sec > 0 ? (int)((int64_t)st.fill_bytes * 1000 / bytes_per_sec) : 0;
+        memcpy (stats, &st, min (stats->_size, (int)sizeof (st)));
+    }
+    if (reset) {
+        __atomic_store_n (&underrun_count, 0, __ATOMIC_RELAXED);
+    }
 }
 
 static void
@@ -1910,9 +2666,9 @@ _handle_playback_stopped (void) {
     if (playing_track) {
         playItem_t *trk = playing_track;
         pl_item_ref (trk);
-        send_songfinished (trk);
-        streamer_start_playback (playing_track, NULL);
-        send_trackchanged (trk, NULL);
+        send_songfinished (trk, playtime);
+        streamer_start_playback (playing_track, NULL, playtime);
+        send_trackchanged (trk, NULL, playtime);
         pl_item_unref (trk);
     }
 }
@@ -2030,7 +2786,7 @@ static void
 play_next (void) {
     DB_output_t *output = plug_get_output ();
     streamer_reset(1);
-    playItem_t *next = get_next_track(last_played);
+    playItem_t *next = get_next_track(last_played, 0);
     streamer_is_buffering = 1;
 
     if (!next) {
@@ -2117,6 +2873,11 @@ streamer_set_dsp_chain (ddb_dsp_context_t *chain) {
 
 static void
 streamer_notify_order_changed_real (int prev_order, int new_order) {
+    if (prefetch && !prefetch->adopted) {
+        // predicted in the previous order
+        prefetch_discard ();
+        prefetch_checked = 0;
+    }
     if (prev_order != PLAYBACK_ORDER_SHUFFLE_ALBUMS && new_order == PLAYBACK_ORDER_SHUFFLE_ALBUMS) {
         streamer_lock ();
         playItem_t *curr = playing_track;
@@ -56,6 +56,10 @@ streamer_read (char *bytes, int size);
 void
 streamer_reset (int full);
 
+// drops the data processed by the DSP chain, and not played yet
+void
+streamer_dsp_flush (void);
+
 void
 streamer_lock (void);
 
@@ -87,6 +91,9 @@ streamer_get_playing_track (void);
 void
 streamer_configchanged (void);
 
+void
+streamer_get_buffer_stats (ddb_buffer_stats_t *stats, int reset);
+
 // if paused -- resume
 // else, if have cursor track -- stop current, play cursor
 // else, play next
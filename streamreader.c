@@ -27,51 +27,116 @@
 #include "streamreader.h"
 #include "replaygain.h"
 
-// read ahead about 5 sec at 44100/16/2
-#define BLOCK_SIZE 16384
-#define BLOCK_COUNT 48
+#define BLOCK_SIZE STREAMREADER_BLOCK_SIZE
 
-static streamblock_t *blocks; // list of all blocks
+// the number of blocks is adjusted by the streamer to the read-ahead duration, see streamreader_set_block_count
+#define DEFAULT_BLOCK_COUNT 48 // about 5 sec at 44100/16/2
+#define MIN_BLOCK_COUNT 8
+#define MAX_BLOCK_COUNT 4096 // 64MB
 
-static streamblock_t *block_data; // first available block with data (can be NULL)
+// The blocks form a single-producer, single-consumer ring: the streamer thread
+// fills the block at `tail`, the output thread plays the block at `head`.
+// The indexes only grow, and wrap around the ring using modulo block_count.
+// A block is published by advancing `tail`, and freed by advancing `head`,
+// so neither side needs a lock to access the queue.
+static streamblock_t *blocks;
 
-static streamblock_t *block_next; // next block available
+static int block_count;
 
-static int numblocks_ready;
+static unsigned head;
 
-static int curr_block_bitrate;
+static unsigned tail;
+
+// incremented by every reset; blocks which were being filled during the reset
+// carry the previous generation, and are dropped by the consumer
+static unsigned generation;
+
+// bytes of data in the published blocks, which were not consumed yet
+static int fill_bytes;
+
+// thread-local, since the next track can be pre-read by another thread, see streamer.c
+static __thread int curr_block_bitrate;
 
 void
 streamreader_init (void) {
-    for (int i = 0; i < BLOCK_COUNT; i++) {
-        streamblock_t *b = calloc (1, sizeof (streamblock_t));
-        b->pos = -1;
-        b->buf = malloc (BLOCK_SIZE);
-        b->next = blocks;
-        blocks = b;
+    block_count = DEFAULT_BLOCK_COUNT;
+    blocks = calloc (block_count, sizeof (streamblock_t));
+    for (int i = 0; i < block_count; i++) {
+        blocks[i].pos = -1;
+        blocks[i].buf = malloc (BLOCK_SIZE);
     }
-    block_next = blocks;
-    numblocks_ready = 0;
+    head = tail = 0;
+    fill_bytes = 0;
 }
 
 void
 streamreader_free (void) {
-    while (blocks) {
-        streamblock_t *next = blocks->next;
-        free (blocks->buf);
-        free (blocks);
-        blocks = next;
+    for (int i = 0; i < block_count; i++) {
+        free (blocks[i].buf);
+    }
+    free (blocks);
+    blocks = NULL;
+    block_count = 0;
+    head = tail = 0;
+    fill_bytes = 0;
+}
+
+void
+streamreader_set_block_count (int count) {
+    if (count < MIN_BLOCK_COUNT) {
+        count = MIN_BLOCK_COUNT;
+    }
+    else if (count > MAX_BLOCK_COUNT) {
+        count = MAX_BLOCK_COUNT;
+    }
+    // shrink only when the difference is large, to avoid reallocating on every small change
+    if (count == block_count || (count < block_count && count > block_count / 2)) {
+        return;
+    }
+
+    // the consumer is excluded by streamer_lock, and the producer is the caller,
+    // so the queued blocks can be moved to the start of the new ring
+    unsigned h = __atomic_load_n (&head, __ATOMIC_ACQUIRE);
+    int queued = (int)(__atomic_load_n (&tail, __ATOMIC_ACQUIRE) - h);
+    if (count < queued) {
+        count = queued;
+    }
+    streamblock_t *newblocks = calloc (count, sizeof (streamblock_t));
+    int n = 0;
+    for (int i = 0; i < block_count; i++) {
+        streamblock_t *b = &blocks[(h + i) % block_count];
+        if (n < count) {
+            newblocks[n++] = *b;
+        }
+        else {
+            free (b->buf);
+        }
+    }
+    for (; n < count; n++) {
+        newblocks[n].pos = -1;
+        newblocks[n].buf = malloc (BLOCK_SIZE);
     }
-    block_next = block_data = NULL;
-    numblocks_ready = 0;
+    free (blocks);
+    blocks = newblocks;
+    block_count = count;
+    __atomic_store_n (&head, 0, __ATOMIC_RELEASE);
+    __atomic_store_n (&tail, queued, __ATOMIC_RELEASE);
+}
+
+int
+streamreader_get_block_count (void) {
+    return block_count;
 }
 
 streamblock_t *
 streamreader_get_next_block (void) {
-    if (block_next->pos >= 0) {
+    unsigned t = __atomic_load_n (&tail, __ATOMIC_RELAXED);
+    if (t - __atomic_load_n (&head, __ATOMIC_ACQUIRE) >= (unsigned)block_count) {
         return NULL; // all buffers full
     }
-    return block_next;
+    streamblock_t *block = &blocks[t % block_count];
+    block->gen = __atomic_load_n (&generation, __ATOMIC_ACQUIRE);
+    return block;
 }
 
 int
@@ -104,13 +169,15 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     pl_item_ref (track);
     block->track = track;
 
+    // the gain is applied later, together with the volume;
+    // the settings are local, since this can run on the prefetch thread
+    block->replaygain = 1;
     int input_does_rg = fileinfo->plugin->plugin.flags & DDB_PLUGIN_FLAG_REPLAYGAIN;
     if (!input_does_rg) {
         ddb_replaygain_settings_t rg_settings;
         rg_settings._size = sizeof (rg_settings);
         replaygain_init_settings (&rg_settings, track);
-        replaygain_set_current (&rg_settings);
-        replaygain_apply (&fileinfo->fmt, block->buf, block->size);
+        block->replaygain = replaygain_get_scale (&rg_settings);
     }
 
 
@@ -119,20 +186,24 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     return 1;
 }
 
+void
+streamreader_swap_block (streamblock_t *block, streamblock_t *from) {
+    char *buf = block->buf;
+    unsigned gen = block->gen;
+    *block = *from;
+    block->gen = gen;
+    from->buf = buf;
+    from->size = 0;
+    from->track = NULL;
+}
+
 void
 streamreader_enqueue_block (streamblock_t *block) {
     // block is passed just for sanity checking
-    assert (block == block_next);
-    if (!block_data) {
-        block_data = block_next;
-    }
-
-    block_next = block_next->next;
-    if (!block_next) {
-        block_next = blocks;
-    }
-
-    numblocks_ready++;
+    unsigned t = __atomic_load_n (&tail, __ATOMIC_RELAXED);
+    assert (block == &blocks[t % block_count]);
+    __atomic_add_fetch (&fill_bytes, block->size, __ATOMIC_RELAXED);
+    __atomic_store_n (&tail, t + 1, __ATOMIC_RELEASE);
 }
 
 void
@@ -140,50 +211,63 @@ streamer_set_bitrate (int bitrate) {
     curr_block_bitrate = bitrate;
 }
 
+static void
+streamreader_release_block (streamblock_t *block) {
+    __atomic_sub_fetch (&fill_bytes, block->size, __ATOMIC_RELAXED);
+    block->pos = -1;
+    pl_item_unref (block->track);
+    block->track = NULL;
+}
+
 streamblock_t *
 streamreader_get_curr_block (void) {
-    return block_data;
+    unsigned h = __atomic_load_n (&head, __ATOMIC_RELAXED);
+    unsigned gen = __atomic_load_n (&generation, __ATOMIC_ACQUIRE);
+    while (h != __atomic_load_n (&tail, __ATOMIC_ACQUIRE)) {
+        streamblock_t *block = &blocks[h % block_count];
+        if (block->gen == gen) {
+            return block;
+        }
+        // filled before the last reset
+        streamreader_release_block (block);
+        __atomic_store_n (&head, ++h, __ATOMIC_RELEASE);
+    }
+    return NULL;
 }
 
 void
 streamreader_next_block (void) {
-    if (block_data) {
-        block_data->pos = -1;
-        pl_item_unref (block_data->track);
-        block_data->track = NULL;
-
-        block_data = block_data->next;
-        if (!block_data) {
-            block_data = blocks;
-        }
-
-        numblocks_ready--;
-        if (numblocks_ready < 0) {
-            numblocks_ready = 0;
-        }
-    }
-
-    if (block_data && block_data->pos < 0) {
-        block_data = NULL; // no available blocks with data
+    unsigned h = __atomic_load_n (&head, __ATOMIC_RELAXED);
+    if (h != __atomic_load_n (&tail, __ATOMIC_ACQUIRE)) {
+        streamreader_release_block (&blocks[h % block_count]);
+        __atomic_store_n (&head, h + 1, __ATOMIC_RELEASE);
     }
 }
 
 void
 streamreader_reset (void) {
-    streamblock_t *b = blocks;
-    while (b) {
-        if (b->pos >= 0) {
-            b->pos = -1;
-            pl_item_unref (b->track);
-        }
-        b = b->next;
+    // the blocks are only consumed under streamer_lock, which is held by the caller,
+    // so the published blocks can be freed right away
+    __atomic_add_fetch (&generation, 1, __ATOMIC_RELEASE);
+    unsigned h = __atomic_load_n (&head, __ATOMIC_RELAXED);
+    unsigned t = __atomic_load_n (&tail, __ATOMIC_ACQUIRE);
+    for (; h != t; h++) {
+        streamreader_release_block (&blocks[h % block_count]);
     }
-    block_next = blocks;
-    block_data = NULL;
-    numblocks_ready = 0;
+    __atomic_store_n (&head, h, __ATOMIC_RELEASE);
 }
 
 int
 streamreader_num_blocks_ready (void) {
-    return numblocks_ready;
+    return (int)(__atomic_load_n (&tail, __ATOMIC_ACQUIRE) - __atomic_load_n (&head, __ATOMIC_ACQUIRE));
+}
+
+int
+streamreader_get_fill_bytes (void) {
+    return __atomic_load_n (&fill_bytes, __ATOMIC_RELAXED);
+}
+
+unsigned
+streamreader_get_generation (void) {
+    return __atomic_load_n (&generation, __ATOMIC_ACQUIRE);
 }
@@ -28,7 +28,6 @@
 #include "playlist.h"
 
 typedef struct streamblock_s {
-    struct streamblock_s *next;
     char *buf;
     int size; // how much bytes total in the buffer, up to BLOCK_SIZE, but can be less
     int pos; // read position in the buffer
@@ -37,6 +36,8 @@ typedef struct streamblock_s {
 
     playItem_t *track;
     ddb_waveformat_t fmt;
+    unsigned gen; // streamreader generation at the time the block was filled
+    float replaygain; // ReplayGain and preamp scale, applied by the streamer's gain stage
 } streamblock_t;
 
 void
@@ -45,21 +46,43 @@ streamreader_init (void);
 void
 streamreader_free (void);
 
+// The producer functions (get_next_block, read_block, enqueue_block) are called
+// from the streamer thread, and don't need any locking.
+// The consumer functions (get_curr_block, next_block) and reset must be called with streamer_lock held.
+
+// Changes the number of blocks, which is clamped to a sane range,
+// and is not reduced below the number of queued blocks.
+// Must be called from the streamer thread, with streamer_lock held, while no block is being filled.
+void
+streamreader_set_block_count (int count);
+
+int
+streamreader_get_block_count (void);
+
 // returns next available (free) block, or NULL.
 streamblock_t *
 streamreader_get_next_block (void);
 
-// Reads data from stream to the specified block.
+// Size of the data in each block
+#define STREAMREADER_BLOCK_SIZE 16384
+
+// Reads data from stream to the specified block, which can also be a block outside of the queue,
+// e.g. when pre-reading the next track from another thread.
 // Returns negative value on error.
 int
 streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo);
 
+// Moves the data of a block, which was read outside of the queue, into the block returned by
+// `streamreader_get_next_block`, by swapping their buffers; `from` is left empty, with a free buffer.
+void
+streamreader_swap_block (streamblock_t *block, streamblock_t *from);
+
 // Appends (enqueues) the block to the list of blocks containing data.
 // The passed block pointer must be the same as returned by `streamreader_get_next_block`.
 void
 streamreader_enqueue_block (streamblock_t *block);
 
-// Get the first (current) block with data from the queue.
+// Get the first (current) block with data from the queue, skipping the blocks filled before the last reset.
 // Can return NULL.
 streamblock_t *
 streamreader_get_curr_block (void);
@@ -68,7 +91,7 @@ streamreader_get_curr_block (void);
 void
 streamreader_next_block (void);
 
-// Resets the queue
+// Resets the queue, and starts a new generation
 void
 streamreader_reset (void);
 
@@ -76,4 +99,12 @@ streamreader_reset (void);
 int
 streamreader_num_blocks_ready (void);
 
+// Bytes of data in the queue, can be called from any thread
+int
+streamreader_get_fill_bytes (void);
+
+// Incremented by every reset, can be called from any thread
+unsigned
+streamreader_get_generation (void);
+
 #endif /* streamreader_h */
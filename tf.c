@@ -61,6 +61,8 @@
 #include "gettext.h"
 #include "plugins.h"
 #include "junklib.h"
+#include "metacache.h"
+#include "threading.h"
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
@@ -85,17 +87,82 @@ typedef struct {
     tf_func_ptr_t func;
 } tf_func_def;
 
+// Scripts which consist only of text, fields, [...], $if2 and $num are
+// additionally specialized into a flat array of ops with the metadata keys
+// interned upfront, which avoids the field name lookups and argument copying
+// of the interpreter. Everything else is evaluated by tf_eval_int.
+
+enum {
+    TF_OP_TEXT, // literal text
+    TF_OP_META, // first present key, with multiple values joined
+    TF_OP_META_RAW, // raw value of a key
+    TF_OP_TITLE, // %title%, falls back to the file name
+    TF_OP_TRACKNUMBER, // %tracknumber%, or %track number% when len is 1
+    TF_OP_LENGTH, // %length%
+    TF_OP_IFDEF, // [...], followed by its contents
+    TF_OP_IF2, // $if2(a,b), followed by 2 args
+    TF_OP_NUM, // $num(n,len), followed by 2 args
+    TF_OP_ARG, // function argument, followed by its contents
+};
+
+#define TF_OP_MAX_KEYS 6
+
+typedef struct {
+    uint8_t type;
+    uint8_t nkeys;
+    int32_t size; // number of ops including the nested ones
+    int32_t len;
+    const char *text;
+    const char *keys[TF_OP_MAX_KEYS]; // interned with metacache
+    uint64_t bits[TF_OP_MAX_KEYS]; // see pl_meta_find_with_bits
+} tf_op_t;
+
+typedef struct {
+    int count;
+    tf_op_t ops[];
+} tf_program_t;
+
+#define TF_CACHE_BITS 10
+
+typedef struct {
+    playItem_t *it; // not referenced, see pl_item_meta_changed
+    uint32_t version; // it->_meta_version at the time of evaluation
+    uint32_t flags;
+    int id;
+    int outlen;
+    int len; // return value of tf_eval
+    int dimmed;
+    int textsize;
+    char *text;
+} tf_cache_entry_t;
+
+// stored after the bytecode, see tf_compile
+typedef struct {
+    tf_program_t *prg; // NULL if the script can't be specialized
+    int cacheable; // the output depends only on the track and its metadata
+    tf_cache_entry_t *cache; // direct mapped by track
+    uintptr_t cache_mutex; // the scripts are evaluated under the shared pl_lock, see pl_lock_read
+} tf_script_t;
+
 static int
 tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int outlen, int *bool_out, int fail_on_undef);
 
 static const char *
 _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free);
 
+static const char *
+_tf_combine_meta_value (pl_meta_t *meta, int *needs_free);
+
 
 #define TF_EVAL_CHECK(res, ctx, arg, arg_len, out, outlen, fail_on_undef)\
 res = tf_eval_int (ctx, arg, arg_len, out, outlen, &bool_out, fail_on_undef);\
 if (res < 0) { *out = 0; return -1; }
 
+// fallbacks of %album artist%, %artist% and %album%
+static const char *tf_album_artist_fields[] = { "album artist", "albumartist", "band", "artist", "composer", "performer", NULL };
+static const char *tf_artist_fields[] = { "artist", "album artist", "albumartist", "composer", "performer", NULL };
+static const char *tf_album_fields[] = { "album", "venue", NULL };
+
 // empty track is used when ctx.it is null
 static playItem_t empty_track;
 // empty playlist is used when ctx.plt is null
@@ -103,8 +170,33 @@ static playlist_t empty_playlist;
 // empty code is used when "code" argumen is null
 static char empty_code[4] = {0};
 
+static int
+tf_eval_impl (ddb_tf_context_t *ctx, const char *code, char *out, int outlen, int interpreted);
+
 int
 tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
+    return tf_eval_impl (ctx, code, out, outlen, 0);
+}
+
+int
+tf_eval_interpreted (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
+    return tf_eval_impl (ctx, code, out, outlen, 1);
+}
+
+static tf_script_t *
+tf_get_script (const char *code);
+
+static tf_cache_entry_t *
+tf_cache_entry (tf_script_t *script, playItem_t *it);
+
+static void
+tf_cache_store (tf_cache_entry_t *entry, ddb_tf_context_t *ctx, uint32_t version, int id, int outlen, int len, const char *text);
+
+static int
+tf_eval_ops (ddb_tf_context_t *ctx, const tf_op_t *ops, int count, char *out, int outlen, int *bool_out, int fail_on_undef);
+
+static int
+tf_eval_impl (ddb_tf_context_t *ctx, const char *code, char *out, int outlen, int interpreted) {
     if (
         // 0.7.2
         ctx->_size != (char *)&ctx->dimmed - (char *)ctx
@@ -119,6 +211,9 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         code = empty_code;
     }
 
+    tf_script_t *script = interpreted ? NULL : tf_get_script (code);
+    tf_program_t *prg = script ? script->prg : NULL;
+
     int null_it = 0;
     if (!ctx->it) {
         null_it = 1;
@@ -142,6 +237,28 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         id = ctx->id;
     }
 
+    tf_cache_entry_t *entry = NULL;
+    uint32_t version = 0;
+    int update = ctx->update;
+    if (script && script->cacheable && !null_it && id != DB_COLUMN_FILENUMBER && id != DB_COLUMN_PLAYING) {
+        playItem_t *it = (playItem_t *)ctx->it;
+        pl_lock_read ();
+        version = it->_meta_version;
+        mutex_lock (script->cache_mutex);
+        entry = tf_cache_entry (script, it);
+        if (entry->it == it && entry->version == version && entry->flags == ctx->flags && entry->id == id && entry->outlen == outlen) {
+            strcpy (out, entry->text);
+            if (HAS_DIMMED (ctx)) {
+                ctx->dimmed = entry->dimmed;
+            }
+            l = entry->len;
+            mutex_unlock (script->cache_mutex);
+            pl_unlock_read ();
+            goto done;
+        }
+        mutex_unlock (script->cache_mutex);
+    }
+
     if (HAS_DIMMED (ctx)) {
         ctx->dimmed = 0;
     }
@@ -161,22 +278,40 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         break;
     default:
         // tf_eval_int expects outlen to not include the terminating zero
-        l = tf_eval_int (ctx, code, codelen, out, outlen-1, &bool_out, 0);
+        if (prg) {
+            pl_lock_read ();
+            l = tf_eval_ops (ctx, prg->ops, prg->count, out, outlen-1, &bool_out, 0);
+            pl_unlock_read ();
+        }
+        else {
+            l = tf_eval_int (ctx, code, codelen, out, outlen-1, &bool_out, 0);
+        }
         break;
     }
 
     if (!(ctx->flags & DDB_TF_CONTEXT_MULTILINE)) {
         // replace any unprintable char with '_'
-        for (; *out; out++) {
-            if ((uint8_t)(*out) < ' ') {
-                if (*out == '\033' && (ctx->flags & DDB_TF_CONTEXT_TEXT_DIM)) {
+        for (char *c = out; *c; c++) {
+            if ((uint8_t)(*c) < ' ') {
+                if (*c == '\033' && (ctx->flags & DDB_TF_CONTEXT_TEXT_DIM)) {
                     continue;
                 }
-                *out = '_';
+                *c = '_';
             }
         }
     }
 
+    if (entry) {
+        // don't cache the scripts which asked to be updated periodically
+        if (ctx->update == update) {
+            mutex_lock (script->cache_mutex);
+            tf_cache_store (entry, ctx, version, id, outlen, l, out);
+            mutex_unlock (script->cache_mutex);
+        }
+        pl_unlock_read ();
+    }
+
+done:
     if (null_it) {
         ctx->it = NULL;
     }
@@ -292,6 +427,9 @@ tf_func_lower (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const c
     return (int)(pout - out);
 }
 
+static int
+tf_format_num (int n, int n_len, char *out);
+
 // $num(n,len) Formats the integer number n in decimal notation with len characters. Pads with zeros
 // from the left if necessary. len includes the dash when the number is negative. If n is not numeric, it is treated as zero.
 int
@@ -316,6 +454,12 @@ tf_func_num (ddb_tf_context_t *ctx, int argc, const uint16_t *arglens, const cha
         return -1;
     }
 
+    return tf_format_num (n, n_len, out);
+}
+
+// writes n padded with zeros to n_len characters, returns the number of written bytes
+static int
+tf_format_num (int n, int n_len, char *out) {
     if (n_len < 0) {
         n_len = 0;
     }
@@ -1758,22 +1902,29 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
 
 static const char *
 _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
-    DB_metaInfo_t *meta = pl_meta_for_key (it, key);
+    pl_meta_t *meta = pl_meta_find (it, key);
 
     if (!meta) {
         *needs_free = 0;
         return NULL;
     }
 
+    return _tf_combine_meta_value (meta, needs_free);
+}
+
+// returns the value of meta, with multiple values joined by ", "
+static const char *
+_tf_combine_meta_value (pl_meta_t *meta, int *needs_free) {
     size_t len = 0;
+    size_t valuesize = metacache_get_value_size (meta->value);
 
     const char *value = meta->value;
-    const char *end = meta->value +meta->valuesize;
+    const char *end = meta->value + valuesize;
     while (value < end) {
         size_t l = strlen (value);
 
         // TEST
-        if (l+1 == meta->valuesize) {
+        if (l+1 == valuesize) {
             *needs_free = 0;
             return meta->value;
         }
@@ -1788,7 +1939,7 @@ _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
     char *p = out;
 
     value = meta->value;
-    end = meta->value +meta->valuesize;
+    end = meta->value + valuesize;
     while (value < end) {
         len = strlen (value);
         memcpy (p, value, value + len + 1 != end ? len : len + 1);
@@ -1896,12 +2047,14 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 // special cases
                 // most if not all of this stuff is to make tf scripts
                 // compatible with fb2k syntax
-                pl_lock ();
+                // NOTE: new special fields need to be added to tf_dynamic_fields,
+                // or handled in tf_spec_field
+                pl_lock_read ();
                 const char *val = NULL;
                 int needs_free = 0;
-                const char *aa_fields[] = { "album artist", "albumartist", "band", "artist", "composer", "performer", NULL };
-                const char *a_fields[] = { "artist", "album artist", "albumartist", "composer", "performer", NULL };
-                const char *alb_fields[] = { "album", "venue", NULL };
+                const char **aa_fields = tf_album_artist_fields;
+                const char **a_fields = tf_artist_fields;
+                const char **alb_fields = tf_album_fields;
 
                 // set to 1 if special case handler successfully wrote the output
                 int skip_out = 0;
@@ -2382,7 +2535,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     out += l;
                     outlen -= l;
                 }
-                pl_unlock ();
+                pl_unlock_read ();
                 if (!skip_out && !val && fail_on_undef) {
                     return -1;
                 }
@@ -2501,6 +2654,496 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
     return (int)(out-init_out);
 }
 
+typedef struct {
+    tf_op_t *ops;
+    int count;
+    int alloc;
+} tf_specializer_t;
+
+// special fields of tf_eval_int which are not specialized
+static const char *tf_dynamic_fields[] = {
+    "track artist", "playback_bitrate", "filesize_natural", "channels", "codec",
+    "playback_time", "playback_time_seconds", "playback_time_remaining", "playback_time_remaining_seconds",
+    "length_ex", "length_seconds", "length_seconds_fp", "length_samples", "isplaying", "ispaused",
+    "filename", "filename_ext", "directoryname", "path", "list_index", "list_total",
+    "queue_index", "queue_indexes", "queue_total", "_deadbeef_version", "_playlist_name",
+    "selection_playback_time", NULL
+};
+
+// fields which are plain aliases of metadata keys
+static const char *tf_raw_fields[] = {
+    "discnumber", "disc",
+    "totaldiscs", "numdiscs",
+    "date", "year",
+    "samplerate", ":SAMPLERATE",
+    "bitrate", ":BITRATE",
+    "filesize", ":FILE_SIZE",
+    "replaygain_album_gain", ":REPLAYGAIN_ALBUMGAIN",
+    "replaygain_album_peak", ":REPLAYGAIN_ALBUMPEAK",
+    "replaygain_track_gain", ":REPLAYGAIN_TRACKGAIN",
+    "replaygain_track_peak", ":REPLAYGAIN_TRACKPEAK",
+    "_path_raw", ":URI",
+    NULL
+};
+
+static int
+tf_spec_add (tf_specializer_t *s, int type) {
+    if (s->count == s->alloc) {
+        s->alloc = s->alloc ? s->alloc * 2 : 16;
+        s->ops = realloc (s->ops, s->alloc * sizeof (tf_op_t));
+    }
+    tf_op_t *op = &s->ops[s->count];
+    memset (op, 0, sizeof (tf_op_t));
+    op->type = type;
+    op->size = 1;
+    return s->count++;
+}
+
+static void
+tf_op_add_key (tf_op_t *op, const char *key) {
+    op->keys[op->nkeys] = metacache_add_string (key);
+    op->bits[op->nkeys] = pl_meta_key_filter_bits (key);
+    op->nkeys++;
+}
+
+static int
+tf_spec_field (tf_specializer_t *s, const char *name) {
+    int i;
+    for (i = 0; tf_dynamic_fields[i]; i++) {
+        if (!strcmp (name, tf_dynamic_fields[i])) {
+            return -1;
+        }
+    }
+
+    const char **chain = NULL;
+    if (!strcmp (name, "album artist")) {
+        chain = tf_album_artist_fields;
+    }
+    else if (!strcmp (name, "artist")) {
+        chain = tf_artist_fields;
+    }
+    else if (!strcmp (name, "album")) {
+        chain = tf_album_fields;
+    }
+    if (chain) {
+        int o = tf_spec_add (s, TF_OP_META);
+        for (i = 0; chain[i]; i++) {
+            tf_op_add_key (&s->ops[o], chain[i]);
+        }
+        return 0;
+    }
+
+    if (!strcmp (name, "title")) {
+        int o = tf_spec_add (s, TF_OP_TITLE);
+        tf_op_add_key (&s->ops[o], "title");
+        tf_op_add_key (&s->ops[o], ":URI");
+        return 0;
+    }
+    if (!strcmp (name, "tracknumber") || !strcmp (name, "track number")) {
+        int o = tf_spec_add (s, TF_OP_TRACKNUMBER);
+        s->ops[o].len = name[5] == ' ';
+        tf_op_add_key (&s->ops[o], "track");
+        return 0;
+    }
+    if (!strcmp (name, "length")) {
+        tf_spec_add (s, TF_OP_LENGTH);
+        return 0;
+    }
+    for (i = 0; tf_raw_fields[i]; i += 2) {
+        if (!strcmp (name, tf_raw_fields[i])) {
+            int o = tf_spec_add (s, TF_OP_META_RAW);
+            tf_op_add_key (&s->ops[o], tf_raw_fields[i+1]);
+            return 0;
+        }
+    }
+
+    int o = tf_spec_add (s, TF_OP_META);
+    tf_op_add_key (&s->ops[o], name);
+    return 0;
+}
+
+static int
+tf_spec_seq (tf_specializer_t *s, const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            int len = 0;
+            while (len < size && code[len]) {
+                len++;
+            }
+            int o = tf_spec_add (s, TF_OP_TEXT);
+            s->ops[o].text = code;
+            s->ops[o].len = len;
+            code += len;
+            size -= len;
+            continue;
+        }
+
+        int blocksize;
+        if (code[1] == 1) {
+            tf_func_ptr_t func = tf_funcs[(uint8_t)code[2]].func;
+            int argc = (uint8_t)code[3];
+            if ((func != tf_func_if2 && func != tf_func_num) || argc != 2) {
+                return -1;
+            }
+            uint16_t arglens[2];
+            memcpy (arglens, code + 4, sizeof (arglens));
+            const char *arg = code + 4 + sizeof (arglens);
+
+            int f = tf_spec_add (s, func == tf_func_if2 ? TF_OP_IF2 : TF_OP_NUM);
+            for (int i = 0; i < argc; i++) {
+                int a = tf_spec_add (s, TF_OP_ARG);
+                if (tf_spec_seq (s, arg, arglens[i])) {
+                    return -1;
+                }
+                s->ops[a].size = s->count - a;
+                arg += arglens[i];
+            }
+            s->ops[f].size = s->count - f;
+            blocksize = (int)(arg - code);
+        }
+        else if (code[1] == 2) {
+            int len = (uint8_t)code[2];
+            char name[len+1];
+            memcpy (name, code + 3, len);
+            name[len] = 0;
+            if (tf_spec_field (s, name)) {
+                return -1;
+            }
+            blocksize = 3 + len;
+        }
+        else if (code[1] == 3) {
+            int32_t len;
+            memcpy (&len, code + 2, 4);
+            int i = tf_spec_add (s, TF_OP_IFDEF);
+            if (tf_spec_seq (s, code + 6, len)) {
+                return -1;
+            }
+            s->ops[i].size = s->count - i;
+            blocksize = 6 + len;
+        }
+        else {
+            // text dimming, preformatted text
+            return -1;
+        }
+        code += blocksize;
+        size -= blocksize;
+    }
+    return 0;
+}
+
+static void
+tf_spec_free_ops (tf_op_t *ops, int count) {
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < ops[i].nkeys; k++) {
+            metacache_remove_string (ops[i].keys[k]);
+        }
+    }
+}
+
+// returns NULL if the script can't be specialized
+static tf_program_t *
+tf_specialize (const char *code, int size) {
+    tf_specializer_t s;
+    memset (&s, 0, sizeof (s));
+    if (tf_spec_seq (&s, code, size)) {
+        tf_spec_free_ops (s.ops, s.count);
+        free (s.ops);
+        return NULL;
+    }
+    tf_program_t *prg = malloc (sizeof (tf_program_t) + s.count * sizeof (tf_op_t));
+    prg->count = s.count;
+    if (s.count) {
+        memcpy (prg->ops, s.ops, s.count * sizeof (tf_op_t));
+    }
+    free (s.ops);
+    return prg;
+}
+
+static void
+tf_program_free (tf_program_t *prg) {
+    tf_spec_free_ops (prg->ops, prg->count);
+    free (prg);
+}
+
+// fields which depend on the playback state or on the playlist
+static const char *tf_uncacheable_fields[] = {
+    "playback_bitrate", "playback_time", "playback_time_seconds", "playback_time_remaining",
+    "playback_time_remaining_seconds", "isplaying", "ispaused", "list_index", "list_total",
+    "queue_index", "queue_indexes", "queue_total", "_playlist_name", "selection_playback_time", NULL
+};
+
+// returns 1 if the output of the bytecode depends only on the track and its metadata
+static int
+tf_is_cacheable (const char *code, int size) {
+    while (size > 0) {
+        if (*code) {
+            code++;
+            size--;
+            continue;
+        }
+
+        int32_t len;
+        int blocksize;
+        if (code[1] == 1) {
+            if (tf_funcs[(uint8_t)code[2]].func == tf_func_rand) {
+                return 0;
+            }
+            int argc = (uint8_t)code[3];
+            const char *arg = code + 4 + argc * sizeof (uint16_t);
+            for (int i = 0; i < argc; i++) {
+                uint16_t arglen;
+                memcpy (&arglen, code + 4 + i * sizeof (uint16_t), sizeof (arglen));
+                if (!tf_is_cacheable (arg, arglen)) {
+                    return 0;
+                }
+                arg += arglen;
+            }
+            blocksize = (int)(arg - code);
+        }
+        else if (code[1] == 2) {
+            len = (uint8_t)code[2];
+            for (int i = 0; tf_uncacheable_fields[i]; i++) {
+                if (!strncmp (code + 3, tf_uncacheable_fields[i], len) && !tf_uncacheable_fields[i][len]) {
+                    return 0;
+                }
+            }
+            blocksize = 3 + len;
+        }
+        else if (code[1] == 3) {
+            memcpy (&len, code + 2, 4);
+            if (!tf_is_cacheable (code + 6, len)) {
+                return 0;
+            }
+            blocksize = 6 + len;
+        }
+        else if (code[1] == 4) {
+            memcpy (&len, code + 2, 4);
+            blocksize = 6 + len;
+        }
+        else if (code[1] == 5) {
+            memcpy (&len, code + 3, 4);
+            if (!tf_is_cacheable (code + 7, len)) {
+                return 0;
+            }
+            blocksize = 7 + len;
+        }
+        else {
+            return 0;
+        }
+        code += blocksize;
+        size -= blocksize;
+    }
+    return 1;
+}
+
+// must be called with script->cache_mutex held
+static tf_cache_entry_t *
+tf_cache_entry (tf_script_t *script, playItem_t *it) {
+    if (!script->cache) {
+        script->cache = calloc (1 << TF_CACHE_BITS, sizeof (tf_cache_entry_t));
+    }
+    uint32_t h = (uint32_t)((uintptr_t)it >> 4) * 2654435761u;
+    return &script->cache[h >> (32 - TF_CACHE_BITS)];
+}
+
+static void
+tf_cache_store (tf_cache_entry_t *entry, ddb_tf_context_t *ctx, uint32_t version, int id, int outlen, int len, const char *text) {
+    int size = (int)strlen (text) + 1;
+    if (size > entry->textsize) {
+        free (entry->text);
+        entry->text = malloc (size);
+        entry->textsize = size;
+    }
+    memcpy (entry->text, text, size);
+    entry->it = (playItem_t *)ctx->it;
+    entry->version = version;
+    entry->flags = ctx->flags;
+    entry->id = id;
+    entry->outlen = outlen;
+    entry->len = len;
+    entry->dimmed = HAS_DIMMED (ctx) ? ctx->dimmed : 0;
+}
+
+// same as tf_eval_int, for specialized ops; must be called with pl_lock or pl_lock_read held
+static int
+tf_eval_ops (ddb_tf_context_t *ctx, const tf_op_t *ops, int count, char *out, int outlen, int *bool_out, int fail_on_undef) {
+    playItem_t *it = (playItem_t *)ctx->it;
+    char *init_out = out;
+    *bool_out = 0;
+
+    int count_true_conditionals = 0;
+    int count_false_conditionals = 0;
+
+    for (int i = 0; i < count; i += ops[i].size) {
+        const tf_op_t *op = &ops[i];
+        const char *val = NULL;
+        int needs_free = 0;
+        int skip_out = 0;
+        pl_meta_t *meta;
+
+        switch (op->type) {
+        case TF_OP_TEXT:
+            if (op->len <= outlen) {
+                memcpy (out, op->text, op->len);
+                out += op->len;
+                outlen -= op->len;
+                continue;
+            }
+            // the rest of the output doesn't fit
+            out += u8_strnbcpy (out, op->text, outlen);
+            goto end;
+        case TF_OP_IFDEF: {
+            int ifdef_bool = 0;
+            int res = tf_eval_ops (ctx, op + 1, op->size - 1, out, outlen, &ifdef_bool, 1);
+            if (res >= 0) {
+                out += res;
+                outlen -= res;
+                count_true_conditionals++;
+            }
+            else {
+                count_false_conditionals++;
+            }
+            continue;
+        }
+        case TF_OP_IF2:
+        case TF_OP_NUM: {
+            const tf_op_t *a = op + 1;
+            const tf_op_t *b = a + a->size;
+            int arg_bool = 0;
+            int res = tf_eval_ops (ctx, a + 1, a->size - 1, out, outlen, &arg_bool, fail_on_undef);
+            if (res < 0) {
+                *out = 0;
+                return -1;
+            }
+            if (op->type == TF_OP_IF2) {
+                if (!arg_bool) {
+                    res = tf_eval_ops (ctx, b + 1, b->size - 1, out, outlen, &arg_bool, fail_on_undef);
+                    if (res < 0) {
+                        *out = 0;
+                        return -1;
+                    }
+                }
+            }
+            else {
+                int n = atoi (out);
+                res = tf_eval_ops (ctx, b + 1, b->size - 1, out, outlen, &arg_bool, fail_on_undef);
+                if (res < 0) {
+                    *out = 0;
+                    return -1;
+                }
+                int n_len = atoi (out);
+                if (outlen < 1 || outlen < n_len) {
+                    *out = 0;
+                    return -1;
+                }
+                res = tf_format_num (n, n_len, out);
+            }
+            if (res > 0) {
+                *bool_out = 1;
+                if (*out == 0) {
+                    res = 0;
+                }
+            }
+            out += res;
+            outlen -= res;
+            continue;
+        }
+        case TF_OP_META:
+            for (int k = 0; k < op->nkeys; k++) {
+                meta = pl_meta_find_with_bits (it, op->keys[k], op->bits[k]);
+                if (meta) {
+                    val = _tf_combine_meta_value (meta, &needs_free);
+                    break;
+                }
+            }
+            break;
+        case TF_OP_META_RAW:
+            meta = pl_meta_find_with_bits (it, op->keys[0], op->bits[0]);
+            val = meta ? meta->value : NULL;
+            break;
+        case TF_OP_TITLE:
+            meta = pl_meta_find_with_bits (it, op->keys[0], op->bits[0]);
+            if (meta) {
+                val = _tf_combine_meta_value (meta, &needs_free);
+            }
+            else if ((meta = pl_meta_find_with_bits (it, op->keys[1], op->bits[1]))) {
+                const char *v = meta->value;
+                const char *start = strrchr (v, '/');
+                if (start) {
+                    start++;
+                }
+                else {
+                    start = v;
+                }
+                const char *startcol = strrchr (v, ':');
+                if (startcol > start) {
+                    start = startcol+1;
+                }
+                const char *end = strrchr (start, '.');
+                if (end) {
+                    int n = min ((int)(end-start), outlen);
+                    n = u8_strnbcpy (out, start, n);
+                    outlen -= n;
+                    out += n;
+                }
+            }
+            break;
+        case TF_OP_TRACKNUMBER:
+            meta = pl_meta_find_with_bits (it, op->keys[0], op->bits[0]);
+            if (meta && isdigit (meta->value[0])) {
+                int len = snprintf (out, outlen, op->len ? "%d" : "%02d", atoi (meta->value));
+                out += len;
+                outlen -= len;
+                skip_out = 1;
+            }
+            break;
+        case TF_OP_LENGTH: {
+            float t = roundf (pl_get_item_duration (it));
+            if (t >= 0) {
+                int hr = t/3600;
+                int mn = (t-hr*3600)/60;
+                int sc = t-hr*3600-mn*60;
+                int len;
+                if (hr) {
+                    len = snprintf (out, outlen, "%d:%02d:%02d", hr, mn, sc);
+                }
+                else {
+                    len = snprintf (out, outlen, "%d:%02d", mn, sc);
+                }
+                out += len;
+                outlen -= len;
+                skip_out = 1;
+            }
+            break;
+        }
+        }
+
+        // fields
+        if (val || (!val && out > init_out)) {
+            *bool_out = 1;
+        }
+        if (!skip_out && val) {
+            int32_t l = u8_strnbcpy (out, val, outlen);
+            out += l;
+            outlen -= l;
+        }
+        if (!skip_out && !val && fail_on_undef) {
+            return -1;
+        }
+        if (val && needs_free) {
+            free ((char *)val);
+        }
+    }
+end:
+    *out = 0;
+
+    if (fail_on_undef && count_false_conditionals > 0 && count_true_conditionals == 0) {
+        return -1;
+    }
+
+    return (int)(out-init_out);
+}
+
 int
 tf_compile_plain (tf_compiler_t *c);
 
@@ -2818,15 +3461,44 @@ tf_compile (const char *script) {
     }
 
     size_t size = c.o - code;
-    char *out = malloc (size + 8);
+    // the tf_script_t pointer is stored after the padding
+    char *out = malloc (size + 8 + sizeof (tf_script_t *));
     memcpy (out + 4, code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
     *((int32_t *)out) = (int32_t)(size);
+    tf_script_t *s = calloc (1, sizeof (tf_script_t));
+    s->prg = tf_specialize (out + 4, (int)size);
+    s->cacheable = tf_is_cacheable (out + 4, (int)size);
+    s->cache_mutex = mutex_create_nonrecursive ();
+    memcpy (out + 8 + size, &s, sizeof (s));
     return out;
 }
 
+static tf_script_t *
+tf_get_script (const char *code) {
+    tf_script_t *script = NULL;
+    if (code && code != empty_code) {
+        memcpy (&script, code + 8 + *((int32_t *)code), sizeof (script));
+    }
+    return script;
+}
+
 void
 tf_free (char *code) {
+    tf_script_t *script = tf_get_script (code);
+    if (script) {
+        if (script->prg) {
+            tf_program_free (script->prg);
+        }
+        if (script->cache) {
+            for (int i = 0; i < 1 << TF_CACHE_BITS; i++) {
+                free (script->cache[i].text);
+            }
+            free (script->cache);
+        }
+        mutex_free (script->cache_mutex);
+        free (script);
+    }
     free (code);
 }
 
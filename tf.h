@@ -42,6 +42,11 @@ tf_free (char *code);
 int
 tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen);
 
+// same as tf_eval, but never uses the specialized code of simple scripts,
+// for testing and benchmarking the bytecode interpreter
+int
+tf_eval_interpreted (ddb_tf_context_t *ctx, const char *code, char *out, int outlen);
+
 // convert legacy title formatting to the new format, usable with tf_compile
 void
 tf_import_legacy (const char *fmt, char *out, int outsize);
@@ -56,6 +56,10 @@ mutex_free (uintptr_t mtx);
 int
 mutex_lock (uintptr_t mtx);
 
+// returns 0 if the lock was acquired, non-zero if it's held by another thread
+int
+mutex_trylock (uintptr_t mtx);
+
 int
 mutex_unlock (uintptr_t mtx);
 
@@ -68,6 +72,11 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// same as cond_wait, but expects the mutex to be already locked by the caller,
+// which allows to check the wait condition without missing a signal
+int
+cond_wait_locked (uintptr_t cond, uintptr_t mutex);
+
 int
 cond_signal (uintptr_t cond);
 
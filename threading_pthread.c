@@ -176,6 +176,16 @@ mutex_lock (uintptr_t _mtx) {
     return err;
 }
 
+int
+mutex_trylock (uintptr_t _mtx) {
+    pthread_mutex_t *mtx = (pthread_mutex_t *)_mtx;
+    int err = pthread_mutex_trylock (mtx);
+    if (err != 0 && err != EBUSY) {
+        fprintf (stderr, "pthread_mutex_trylock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 mutex_unlock (uintptr_t _mtx) {
     pthread_mutex_t *mtx = (pthread_mutex_t *)_mtx;
@@ -221,6 +231,17 @@ cond_wait (uintptr_t c, uintptr_t m) {
     return err;
 }
 
+int
+cond_wait_locked (uintptr_t c, uintptr_t m) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    int err = pthread_cond_wait (cond, mutex);
+    if (err != 0) {
+        fprintf (stderr, "pthread_cond_wait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 cond_signal (uintptr_t c) {
     pthread_cond_t *cond = (pthread_cond_t *)c;
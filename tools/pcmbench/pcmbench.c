@@ -0,0 +1,159 @@
+/*
+    DeaDBeeF - The Ultimate Music Player
+    Copyright (C) 2009-2017 Alexey Yakovenko <waker@users.sourceforge.net>
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License
+    as published by the Free Software Foundation; either version 2
+    of the License, or (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+// pcm_convert benchmark: reports input MB/s of every implementation supported by the CPU,
+// and checks that their output is identical to the generic one.
+// usage: pcmbench [seconds per conversion]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "../../deadbeef.h"
+#include "../../premix.h"
+
+#define NSAMPLES 16384 // stereo frames per call, about the size of a streamer block after DSP
+#define CHANNELS 2
+
+static const char *impl_names[] = { "generic", "scalar", "sse2", "avx2", "neon" };
+
+typedef struct {
+    const char *name;
+    int inbps, infloat;
+    int outbps, outfloat;
+} conversion_t;
+
+static const conversion_t conversions[] = {
+    { "16 -> float", 16, 0, 32, 1 },
+    { "24 -> float", 24, 0, 32, 1 },
+    { "32 -> float", 32, 0, 32, 1 },
+    { "float -> 16", 32, 1, 16, 0 },
+    { "float -> 24", 32, 1, 24, 0 },
+    { "float -> 32", 32, 1, 32, 0 },
+};
+
+static double
+now (void) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void
+fill_input (const conversion_t *conv, char *input, int size) {
+    if (conv->infloat) {
+        // include clipping, and the values around full scale
+        float *f = (float *)input;
+        for (int i = 0; i < size / 4; i++) {
+            f[i] = sinf (i * 0.001f) * 1.2f;
+        }
+        f[0] = 1.f;
+        f[1] = -1.f;
+        f[2] = 0.99999994f;
+        f[3] = 1e10f;
+        f[4] = -1e10f;
+    }
+    else {
+        for (int i = 0; i < size; i++) {
+            input[i] = (char)(rand () & 0xff);
+        }
+    }
+}
+
+int
+main (int argc, char *argv[]) {
+    double seconds = argc > 1 ? atof (argv[1]) : 0.5;
+    int inbuf_size = NSAMPLES * CHANNELS * 4;
+    int outbuf_size = NSAMPLES * CHANNELS * 4;
+    char *input = malloc (inbuf_size);
+    char *expected = malloc (outbuf_size);
+    char *output = malloc (outbuf_size);
+    int errors = 0;
+
+    printf ("%d frames, %d channels; detected implementation: %s\n\n", NSAMPLES, CHANNELS, impl_names[pcm_convert_get_impl ()]);
+    printf ("%-14s", "");
+    for (int impl = PCM_CONVERT_GENERIC; impl <= PCM_CONVERT_NEON; impl++) {
+        if (!pcm_convert_set_impl (impl)) {
+            printf ("%12s", impl_names[impl]);
+        }
+    }
+    printf ("  (input MB/s)\n");
+
+    for (int c = 0; c < sizeof (conversions) / sizeof (conversions[0]); c++) {
+        const conversion_t *conv = &conversions[c];
+        ddb_waveformat_t infmt = { .bps = conv->inbps, .channels = CHANNELS, .samplerate = 44100, .channelmask = DDB_SPEAKER_FRONT_LEFT | DDB_SPEAKER_FRONT_RIGHT, .is_float = conv->infloat };
+        ddb_waveformat_t outfmt = infmt;
+        outfmt.bps = conv->outbps;
+        outfmt.is_float = conv->outfloat;
+
+        int insize = NSAMPLES * CHANNELS * (conv->inbps / 8);
+        fill_input (conv, input, insize);
+
+        pcm_convert_set_impl (PCM_CONVERT_GENERIC);
+        int outsize = pcm_convert (&infmt, input, &outfmt, expected, insize);
+
+        printf ("%-14s", conv->name);
+        for (int impl = PCM_CONVERT_GENERIC; impl <= PCM_CONVERT_NEON; impl++) {
+            if (pcm_convert_set_impl (impl)) {
+                continue;
+            }
+            // check all the tails
+            for (int n = 1; n <= 33; n++) {
+                memset (output, 0x55, outbuf_size);
+                pcm_convert (&infmt, input, &outfmt, output, n * CHANNELS * (conv->inbps / 8));
+                int sz = n * CHANNELS * (conv->outbps / 8);
+                if (memcmp (output, expected, sz) || output[sz] != 0x55) {
+                    printf ("\n%s: %s: mismatch with %d frames\n", conv->name, impl_names[impl], n);
+                    errors++;
+                    break;
+                }
+            }
+            memset (output, 0, outbuf_size);
+            pcm_convert (&infmt, input, &outfmt, output, insize);
+            if (memcmp (output, expected, outsize)) {
+                printf ("\n%s: %s: mismatch\n", conv->name, impl_names[impl]);
+                errors++;
+            }
+
+            int iterations = 0;
+            double start = now ();
+            double elapsed;
+            do {
+                for (int i = 0; i < 16; i++) {
+                    pcm_convert (&infmt, input, &outfmt, output, insize);
+                }
+                iterations += 16;
+                elapsed = now () - start;
+            } while (elapsed < seconds);
+            printf ("%12.0f", (double)insize * iterations / elapsed / (1024 * 1024));
+        }
+        printf ("\n");
+    }
+
+    free (input);
+    free (expected);
+    free (output);
+
+    if (errors) {
+        printf ("%d errors\n", errors);
+        return 1;
+    }
+    return 0;
+}